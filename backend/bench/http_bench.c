@@ -0,0 +1,559 @@
+// In-process micro-benchmark for the HTTP API.
+//
+// Feeds pre-built, properly signed requests straight into
+// handle_server_event on a detached connection, so the numbers cover the
+// handlers and SQLite but not the network stack:
+//
+//   identity_post    POST /api/identity with --prekeys PQ and curve OPKs
+//   identity_patch   PATCH /api/identity topping up --prekeys of each
+//   bundle           GET /api/keys/<handle>/bundle
+//   bundle_dry_run   GET /api/keys/<handle>/bundle?dryRun=1
+//
+// Per endpoint it prints ops/sec and latency percentiles of the whole
+// request, plus the mean time spent in protobuf unpacking, XEdDSA
+// verification and SQLite. SQLite time comes from SQLITE_TRACE_PROFILE on
+// every connection during the request. Unpacking and verification are only
+// estimates (the approx_* columns): that work is repeated outside the
+// handler on the same inputs, after the timed run, with warm caches.
+
+#include <crypto.h>
+#include <inttypes.h>
+#include <math.h>
+#include <mongoose.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "log.h"
+#include "messages.pb-c.h"
+#include "server.h"
+
+#define NS_PER_S 1000000000ULL
+#define NS_PER_US 1000.0
+
+#define PQKEM_PUBLIC_KEY_LENGTH 1568  // ML-KEM-1024, as sent by the frontend
+
+enum endpoint {
+  EP_IDENTITY_POST,
+  EP_IDENTITY_PATCH,
+  EP_BUNDLE,
+  EP_BUNDLE_DRY_RUN,
+  EP_COUNT,
+};
+
+static const char *s_endpoint_names[EP_COUNT] = {
+    [EP_IDENTITY_POST] = "identity_post",
+    [EP_IDENTITY_PATCH] = "identity_patch",
+    [EP_BUNDLE] = "bundle",
+    [EP_BUNDLE_DRY_RUN] = "bundle_dry_run",
+};
+
+static const int s_expected_status[EP_COUNT] = {
+    [EP_IDENTITY_POST] = 201,
+    [EP_IDENTITY_PATCH] = 200,
+    [EP_BUNDLE] = 200,
+    [EP_BUNDLE_DRY_RUN] = 200,
+};
+
+// a raw request and where it was parsed into
+struct request {
+  char *buf;
+  size_t len;
+  struct mg_http_message hm;
+};
+
+struct result {
+  double *latency_ns;
+  size_t ops, failed;
+  uint64_t wall_ns, unpack_ns, verify_ns, sql_ns;
+};
+
+static const char *s_db_path = "./http_bench.sqlite";
+static size_t s_ops = 200;
+static size_t s_prekeys = 100;
+static int s_shards = 1;
+
+// one key set shared by every identity; the server only checks signatures
+static uint8_t s_sk[CURVE25519_PRIVATE_KEY_LENGTH];
+static uint8_t s_pk[CURVE25519_PUBLIC_KEY_LENGTH];
+static Messages__SignedPrekey s_spk = MESSAGES__SIGNED_PREKEY__INIT;
+static Messages__SignedPrekey s_pqspk = MESSAGES__SIGNED_PREKEY__INIT;
+static Messages__SignedPrekey *s_pqopks;
+static Messages__SignedPrekey **s_pqopk_ptrs;
+static Messages__Prekey *s_opks;
+static Messages__Prekey **s_opk_ptrs;
+
+static uint64_t s_sql_ns;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+static int sql_profile(unsigned type, void *ctx, void *p, void *x) {
+  (void)ctx;
+  (void)p;
+  if (type == SQLITE_TRACE_PROFILE) s_sql_ns += *(sqlite3_int64 *)x;
+  return 0;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double pct(const struct result *r, double p) {
+  if (!r->ops) return 0;
+  size_t rank = (size_t)ceil(p / 100.0 * r->ops);
+  return r->latency_ns[rank ? rank - 1 : 0];
+}
+
+static void remove_db_files(void) {
+  const char *suffixes[] = {"", "-wal", "-shm"};
+  char path[4096], base[4096];
+  for (int i = -1; i < s_shards; ++i) {
+    if (i < 0) {
+      snprintf(base, sizeof base, "%s", s_db_path);
+    } else {
+      db_shard_path(base, sizeof base, s_db_path, i);
+    }
+    for (size_t j = 0; j < sizeof suffixes / sizeof *suffixes; ++j) {
+      snprintf(path, sizeof path, "%s%s", base, suffixes[j]);
+      unlink(path);
+    }
+  }
+}
+
+static bool sign_prekey(Messages__SignedPrekey *pb, uint8_t *key,
+                        size_t key_len, int64_t key_id) {
+  pb->key.data = key;
+  pb->key.len = key_len;
+  pb->id = key_id;
+  pb->sig.data = xeddsa_sign(s_sk, key, key_len);
+  pb->sig.len = XEDDSA_SIGNATURE_LENGTH;
+  return pb->sig.data != NULL;
+}
+
+static bool gen_keys(void) {
+  EVP_PKEY *pkey = NULL;
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+  size_t sk_len = sizeof s_sk, pk_len = sizeof s_pk;
+  bool ok = ctx && EVP_PKEY_keygen_init(ctx) == 1 &&
+            EVP_PKEY_keygen(ctx, &pkey) == 1 &&
+            EVP_PKEY_get_raw_private_key(pkey, s_sk, &sk_len) == 1 &&
+            EVP_PKEY_get_raw_public_key(pkey, s_pk, &pk_len) == 1;
+  EVP_PKEY_free(pkey);
+  EVP_PKEY_CTX_free(ctx);
+  if (!ok) return false;
+
+  size_t n = s_prekeys ? s_prekeys : 1;
+  uint8_t *keys = malloc(CURVE25519_PUBLIC_KEY_LENGTH * (2 + n) +
+                         PQKEM_PUBLIC_KEY_LENGTH * (1 + n));
+  s_pqopks = calloc(n, sizeof *s_pqopks);
+  s_pqopk_ptrs = calloc(n, sizeof *s_pqopk_ptrs);
+  s_opks = calloc(n, sizeof *s_opks);
+  s_opk_ptrs = calloc(n, sizeof *s_opk_ptrs);
+  if (!keys || !s_pqopks || !s_pqopk_ptrs || !s_opks || !s_opk_ptrs)
+    return false;
+
+  uint8_t *p = keys;
+  size_t keys_len = CURVE25519_PUBLIC_KEY_LENGTH * (2 + n) +
+                    PQKEM_PUBLIC_KEY_LENGTH * (1 + n);
+  if (RAND_bytes(keys, keys_len) != 1) return false;
+
+  if (!sign_prekey(&s_spk, p, CURVE25519_PUBLIC_KEY_LENGTH, 1)) return false;
+  p += CURVE25519_PUBLIC_KEY_LENGTH;
+  if (!sign_prekey(&s_pqspk, p, PQKEM_PUBLIC_KEY_LENGTH, 1)) return false;
+  p += PQKEM_PUBLIC_KEY_LENGTH;
+
+  for (size_t i = 0; i < s_prekeys; ++i) {
+    Messages__SignedPrekey init = MESSAGES__SIGNED_PREKEY__INIT;
+    s_pqopks[i] = init;
+    if (!sign_prekey(&s_pqopks[i], p, PQKEM_PUBLIC_KEY_LENGTH, i + 1))
+      return false;
+    s_pqopk_ptrs[i] = &s_pqopks[i];
+    p += PQKEM_PUBLIC_KEY_LENGTH;
+
+    Messages__Prekey opk = MESSAGES__PREKEY__INIT;
+    opk.key.data = p;
+    opk.key.len = CURVE25519_PUBLIC_KEY_LENGTH;
+    opk.id = i + 1;
+    s_opks[i] = opk;
+    s_opk_ptrs[i] = &s_opks[i];
+    p += CURVE25519_PUBLIC_KEY_LENGTH;
+  }
+
+  return true;
+}
+
+static void *pack_identity(size_t i, size_t *len) {
+  char handle[33];
+  snprintf(handle, sizeof handle, "bench_%zu", i);
+
+  Messages__Identity pb = MESSAGES__IDENTITY__INIT;
+  pb.handle = handle;
+  pb.id_key.data = s_pk;
+  pb.id_key.len = sizeof s_pk;
+  pb.prekey = &s_spk;
+  pb.pqkem_prekey = &s_pqspk;
+  pb.n_one_time_pqkem_prekeys = s_prekeys;
+  pb.one_time_pqkem_prekeys = s_pqopk_ptrs;
+  pb.n_one_time_prekeys = s_prekeys;
+  pb.one_time_prekeys = s_opk_ptrs;
+
+  *len = messages__identity__get_packed_size(&pb);
+  void *buf = malloc(*len);
+  if (buf) messages__identity__pack(&pb, buf);
+  return buf;
+}
+
+static void *pack_identity_patch(size_t *len) {
+  Messages__IdentityPatch pb = MESSAGES__IDENTITY_PATCH__INIT;
+  pb.n_one_time_pqkem_prekeys = s_prekeys;
+  pb.one_time_pqkem_prekeys = s_pqopk_ptrs;
+  pb.n_one_time_prekeys = s_prekeys;
+  pb.one_time_prekeys = s_opk_ptrs;
+
+  *len = messages__identity_patch__get_packed_size(&pb);
+  void *buf = malloc(*len);
+  if (buf) messages__identity_patch__pack(&pb, buf);
+  return buf;
+}
+
+/**
+ * Builds a raw request, signed as handle over method + uri + query + body
+ * unless handle is NULL, and parses it the way mongoose would.
+ */
+static bool build_request(struct request *req, const char *method,
+                          const char *uri, const char *query,
+                          const char *handle, const void *body,
+                          size_t body_len) {
+  char auth[256] = "";
+
+  if (handle) {
+    size_t method_len = strlen(method), uri_len = strlen(uri),
+           query_len = strlen(query);
+    size_t msg_len = method_len + uri_len + query_len + body_len;
+    uint8_t *msg = malloc(msg_len ? msg_len : 1);
+    if (!msg) return false;
+    memcpy(msg, method, method_len);
+    memcpy(msg + method_len, uri, uri_len);
+    memcpy(msg + method_len + uri_len, query, query_len);
+    if (body_len)
+      memcpy(msg + method_len + uri_len + query_len, body, body_len);
+
+    uint8_t *sig = xeddsa_sign(s_sk, msg, msg_len);
+    free(msg);
+    if (!sig) return false;
+
+    char sig_b64[EVP_ENCODE_LENGTH(XEDDSA_SIGNATURE_LENGTH)];
+    EVP_EncodeBlock((unsigned char *)sig_b64, sig, XEDDSA_SIGNATURE_LENGTH);
+    free(sig);
+    snprintf(auth, sizeof auth, "X-Identity: %s\r\nX-Signature: %s\r\n", handle,
+             sig_b64);
+  }
+
+  char head[1024];
+  int head_len = snprintf(head, sizeof head,
+                          "%s %s%s%s HTTP/1.1\r\n"
+                          "Host: localhost\r\n"
+                          "%s"
+                          "Content-Type: application/protobuf\r\n"
+                          "Content-Length: %zu\r\n"
+                          "\r\n",
+                          method, uri, *query ? "?" : "", query, auth,
+                          body_len);
+  if (head_len < 0 || (size_t)head_len >= sizeof head) return false;
+
+  req->len = head_len + body_len;
+  if (!(req->buf = malloc(req->len))) return false;
+  memcpy(req->buf, head, head_len);
+  if (body_len) memcpy(req->buf + head_len, body, body_len);
+
+  return mg_http_parse(req->buf, req->len, &req->hm) > 0;
+}
+
+/**
+ * Repeats the unpacking and signature checks the handler does for req,
+ * outside of it, so they can be timed on their own. This is an estimate
+ * of the handler's share, not a measurement of it.
+ */
+static void time_breakdown(enum endpoint ep, struct request *req,
+                           uint64_t *unpack_ns, uint64_t *verify_ns) {
+  struct mg_http_message *hm = &req->hm;
+  Messages__SignedPrekey **signed_prekeys = NULL;
+  size_t n_signed_prekeys = 0;
+  void *pb = NULL;
+
+  uint64_t t0 = now_ns();
+  if (ep == EP_IDENTITY_POST) {
+    Messages__Identity *id = messages__identity__unpack(
+        NULL, hm->body.len, (uint8_t *)hm->body.buf);
+    pb = id;
+    if (id) {
+      signed_prekeys = id->one_time_pqkem_prekeys;
+      n_signed_prekeys = id->n_one_time_pqkem_prekeys;
+    }
+  } else if (ep == EP_IDENTITY_PATCH) {
+    Messages__IdentityPatch *patch = messages__identity_patch__unpack(
+        NULL, hm->body.len, (uint8_t *)hm->body.buf);
+    pb = patch;
+    if (patch) {
+      signed_prekeys = patch->one_time_pqkem_prekeys;
+      n_signed_prekeys = patch->n_one_time_pqkem_prekeys;
+    }
+  }
+  uint64_t t1 = now_ns();
+
+  if (ep == EP_IDENTITY_POST) {
+    // signed prekey and last-resort pqkem prekey
+    xeddsa_verify(s_pk, s_spk.key.data, s_spk.key.len, s_spk.sig.data);
+    xeddsa_verify(s_pk, s_pqspk.key.data, s_pqspk.key.len, s_pqspk.sig.data);
+  } else {
+    // the request signature, see verify_request
+    struct mg_str *sig = mg_http_get_header(hm, "X-Signature");
+    size_t msg_len =
+        hm->method.len + hm->uri.len + hm->query.len + hm->body.len;
+    uint8_t *msg = malloc(msg_len);
+    uint8_t raw_sig[XEDDSA_SIGNATURE_LENGTH + 2];
+    if (msg && sig &&
+        EVP_DecodeBlock(raw_sig, (const unsigned char *)sig->buf,
+                        (int)sig->len) >= XEDDSA_SIGNATURE_LENGTH) {
+      uint8_t *p = msg;
+      memcpy(p, hm->method.buf, hm->method.len);
+      p += hm->method.len;
+      memcpy(p, hm->uri.buf, hm->uri.len);
+      p += hm->uri.len;
+      memcpy(p, hm->query.buf, hm->query.len);
+      p += hm->query.len;
+      memcpy(p, hm->body.buf, hm->body.len);
+      xeddsa_verify(s_pk, msg, msg_len, raw_sig);
+    }
+    free(msg);
+  }
+  for (size_t i = 0; i < n_signed_prekeys; ++i)
+    xeddsa_verify(s_pk, signed_prekeys[i]->key.data,
+                  signed_prekeys[i]->key.len, signed_prekeys[i]->sig.data);
+  uint64_t t2 = now_ns();
+
+  if (ep == EP_IDENTITY_POST && pb)
+    messages__identity__free_unpacked(pb, NULL);
+  if (ep == EP_IDENTITY_PATCH && pb)
+    messages__identity_patch__free_unpacked(pb, NULL);
+
+  *unpack_ns += t1 - t0;
+  *verify_ns += t2 - t1;
+}
+
+static bool make_request(enum endpoint ep, size_t i, struct request *req) {
+  char handle[33], uri[64];
+  snprintf(handle, sizeof handle, "bench_%zu", i);
+  bool ok = false;
+  size_t len = 0;
+  void *body = NULL;
+
+  switch (ep) {
+    case EP_IDENTITY_POST:
+      if ((body = pack_identity(i, &len)))
+        ok = build_request(req, "POST", "/api/identity", "", NULL, body, len);
+      break;
+    case EP_IDENTITY_PATCH:
+      if ((body = pack_identity_patch(&len)))
+        ok = build_request(req, "PATCH", "/api/identity", "", handle, body,
+                           len);
+      break;
+    case EP_BUNDLE:
+    case EP_BUNDLE_DRY_RUN:
+      // fetch someone else's bundle, signed as this identity
+      snprintf(uri, sizeof uri, "/api/keys/bench_%zu/bundle",
+               (i + 1) % s_ops);
+      ok = build_request(req, "GET", uri,
+                         ep == EP_BUNDLE_DRY_RUN ? "dryRun=1" : "", handle,
+                         NULL, 0);
+      break;
+    default:
+      break;
+  }
+
+  free(body);
+  return ok;
+}
+
+static bool run_endpoint(struct mg_connection *c, enum endpoint ep,
+                         struct result *r) {
+  struct request *reqs = calloc(s_ops, sizeof *reqs);
+  if (!(r->latency_ns = calloc(s_ops, sizeof *r->latency_ns)) || !reqs) {
+    free(r->latency_ns);
+    r->latency_ns = NULL;
+    free(reqs);
+    return false;
+  }
+
+  // signing and packing stay out of the measurement
+  for (size_t i = 0; i < s_ops; ++i) {
+    if (!make_request(ep, i, &reqs[i])) {
+      fprintf(stderr, "[%s:%d] building %s request failed\n", __func__,
+              __LINE__, s_endpoint_names[ep]);
+      goto err;
+    }
+  }
+
+  uint64_t started_at = now_ns();
+  for (size_t i = 0; i < s_ops; ++i) {
+    c->send.len = 0;
+    s_sql_ns = 0;
+
+    uint64_t t0 = now_ns();
+    handle_server_event(c, MG_EV_HTTP_MSG, &reqs[i].hm);
+    uint64_t t1 = now_ns();
+
+    r->latency_ns[r->ops++] = t1 - t0;
+    r->sql_ns += s_sql_ns;
+
+    int status = c->send.len > 12 ? atoi((char *)c->send.buf + 9) : 0;
+    if (status != s_expected_status[ep]) {
+      if (!r->failed)
+        fprintf(stderr, "[%s:%d] %s: unexpected status %d\n", __func__,
+                __LINE__, s_endpoint_names[ep], status);
+      ++r->failed;
+    }
+  }
+  r->wall_ns = now_ns() - started_at;
+
+  for (size_t i = 0; i < s_ops; ++i)
+    time_breakdown(ep, &reqs[i], &r->unpack_ns, &r->verify_ns);
+
+  qsort(r->latency_ns, r->ops, sizeof *r->latency_ns, cmp_double);
+
+  for (size_t i = 0; i < s_ops; ++i) free(reqs[i].buf);
+  free(reqs);
+  return true;
+
+err:
+  for (size_t i = 0; i < s_ops; ++i) free(reqs[i].buf);
+  free(reqs);
+  free(r->latency_ns);
+  r->latency_ns = NULL;
+  return false;
+}
+
+static void report(FILE *f, enum endpoint ep, const struct result *r) {
+  double n = r->ops ? r->ops : 1;
+  double total_us = 0;
+  for (size_t i = 0; i < r->ops; ++i) total_us += r->latency_ns[i] / NS_PER_US;
+
+  double unpack_us = r->unpack_ns / NS_PER_US / n;
+  double verify_us = r->verify_ns / NS_PER_US / n;
+  double sql_us = r->sql_ns / NS_PER_US / n;
+  double mean_us = total_us / n;
+  double other_us = mean_us - unpack_us - verify_us - sql_us;
+
+  fprintf(f,
+          "%s,%zu,%zu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+          s_endpoint_names[ep], r->ops, r->failed,
+          r->wall_ns ? r->ops / (r->wall_ns / (double)NS_PER_S) : 0, mean_us,
+          pct(r, 50) / NS_PER_US, pct(r, 99) / NS_PER_US,
+          pct(r, 99.9) / NS_PER_US, pct(r, 100) / NS_PER_US, unpack_us,
+          verify_us, sql_us, other_us > 0 ? other_us : 0);
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      fprintf(stdout,
+              "Usage: %s [OPTIONS]\n"
+              "\n"
+              "Options:\n"
+              "  -n, --ops N        Requests per endpoint (default: %zu)\n"
+              "  -p, --prekeys N    One-time prekeys of each kind per "
+              "POST/PATCH (default: %zu)\n"
+              "  -d, --db PATH      Scratch database, deleted before and "
+              "after (default: %s)\n"
+              "  --shards K         Shard count for the scratch database "
+              "(default: %d)\n"
+              "  -h, --help         Show this help message and exit\n",
+              argv[0], s_ops, s_prekeys, s_db_path, s_shards);
+      return EXIT_SUCCESS;
+    }
+  }
+
+  for (int i = 1; i < argc; ++i) {
+    char *arg = argv[i];
+    if (i + 1 >= argc) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return EXIT_FAILURE;
+    }
+    if (strcmp(arg, "-n") == 0 || strcmp(arg, "--ops") == 0) {
+      s_ops = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "-p") == 0 || strcmp(arg, "--prekeys") == 0) {
+      s_prekeys = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--db") == 0) {
+      s_db_path = argv[++i];
+    } else if (strcmp(arg, "--shards") == 0) {
+      s_shards = atoi(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "illegal option: %s\ntry `%s --help` for more information.\n",
+              arg, argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (s_ops < 2) {
+    fprintf(stderr, "need at least 2 ops\n");
+    return EXIT_FAILURE;
+  }
+
+  // keep the per-request access log out of the results
+  log_level = LOG_LEVEL_WARN;
+  FILE *out = stdout;
+
+  if (!gen_keys()) {
+    fprintf(stderr, "[%s:%d] key generation failed\n", __func__, __LINE__);
+    return EXIT_FAILURE;
+  }
+
+  remove_db_files();
+  if (db_init(&db, s_db_path, s_shards) != SQLITE_OK) return EXIT_FAILURE;
+  db_trace(SQLITE_TRACE_PROFILE, sql_profile, NULL);
+
+  struct mg_mgr mgr;
+  mg_mgr_init(&mgr);
+
+  // never attached to a socket, replies just pile up in c->send
+  struct mg_connection *c = calloc(1, sizeof *c);
+  if (!c) return EXIT_FAILURE;
+  c->mgr = &mgr;
+
+  fprintf(out,
+          "endpoint,ops,failed,ops_per_s,mean_us,p50_us,p99_us,p999_us,"
+          "max_us,approx_unpack_us,approx_verify_us,sqlite_us,other_us\n");
+
+  int ret = EXIT_SUCCESS;
+  for (enum endpoint ep = 0; ep < EP_COUNT; ++ep) {
+    struct result r = {0};
+    if (!run_endpoint(c, ep, &r)) {
+      ret = EXIT_FAILURE;
+      free(r.latency_ns);
+      break;
+    }
+    report(out, ep, &r);
+    fflush(out);
+    free(r.latency_ns);
+  }
+
+  free(c->send.buf);
+  free(c);
+  mg_mgr_free(&mgr);
+  db_close(db);
+  remove_db_files();
+
+  return ret;
+}
@@ -0,0 +1,871 @@
+// End-to-end load generator for the chat server.
+//
+// Registers N throwaway identities through /api/identity, connects them to
+// /api/ws, answers the challenge and then exchanges Forward messages between
+// them at a fixed aggregate rate. A fraction of the identities stays offline
+// during the traffic phase and connects afterwards, so their queues get
+// drained. Latencies are measured inside this process on a monotonic clock:
+//
+//   register  POST /api/identity sent -> response
+//   auth      WS connect started -> Ack for the challenge response
+//   ack       Forward sent -> Ack
+//   forward   Forward sent -> delivered to the (online) recipient
+//   drain     Ack for the challenge response -> last queued message received
+//
+// Results go out as one CSV row per run (header only when the file is empty,
+// so runs can be appended) or as JSON.
+
+#include <crypto.h>
+#include <inttypes.h>
+#include <math.h>
+#include <mongoose.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "messages.pb-c.h"
+#include "websocket.pb-c.h"
+
+#define NS_PER_S 1000000000ULL
+#define NS_PER_MS 1000000.0
+
+#define PQKEM_PUBLIC_KEY_LENGTH 1568  // ML-KEM-1024, as sent by the frontend
+#define MIN_PAYLOAD_SIZE 16           // room for the send timestamp
+#define MAX_SEND_BACKLOG (1 << 20)    // skip a sender with this much unsent
+#define SETTLE_TIMEOUT_NS (5 * NS_PER_S)
+#define DRAIN_TIMEOUT_NS (30 * NS_PER_S)
+
+enum model { MODEL_UNIFORM, MODEL_PAIRS, MODEL_HOTSPOT };
+static const char *s_model_names[] = {"uniform", "pairs", "hotspot"};
+
+enum phase {
+  PHASE_REGISTER,
+  PHASE_CONNECT,
+  PHASE_TRAFFIC,
+  PHASE_SETTLE,
+  PHASE_DRAIN,
+  PHASE_CLEANUP,
+  PHASE_DONE,
+};
+
+enum ident_state {
+  IDENT_NEW,
+  IDENT_REGISTERING,
+  IDENT_REGISTERED,
+  IDENT_CONNECTING,
+  IDENT_AUTHED,
+  IDENT_DELETING,
+  IDENT_DONE,
+  IDENT_FAILED,
+};
+
+struct ident {
+  char handle[33];
+  uint8_t sk[CURVE25519_PRIVATE_KEY_LENGTH];
+  uint8_t pk[CURVE25519_PUBLIC_KEY_LENGTH];
+  enum ident_state state;
+  bool offline;  // kept disconnected during the traffic phase
+  struct mg_connection *ws;
+  void *body;  // pending HTTP request body
+  size_t body_len;
+  uint64_t started_at, authed_at;
+  uint64_t expected, received;  // queued while offline, and drained since
+  uint32_t message_number;
+};
+
+struct sent {
+  uint64_t at;
+  uint32_t to;
+};
+
+struct samples {
+  double *v;
+  size_t len, cap;
+};
+
+static const char *s_url = "http://127.0.0.1:8000";
+static char s_ws_url[256];
+static size_t s_n_idents = 1000;
+static double s_rate = 1000;
+static double s_duration = 10;
+static size_t s_payload_size = 256;
+static double s_offline = 0.1;
+static size_t s_concurrency = 64;
+static enum model s_model = MODEL_UNIFORM;
+static const char *s_format = "csv";
+static const char *s_out_path = NULL;
+static bool s_cleanup = true;
+static uint64_t s_seed = 0;
+
+static struct ident *s_idents;
+static size_t *s_online;  // indices of identities sending during traffic
+static size_t s_n_online;
+static enum phase s_phase = PHASE_REGISTER;
+static uint64_t s_phase_started_at;
+static size_t s_next, s_inflight, s_finished;
+static uint64_t s_traffic_ns;
+
+static struct sent *s_sent;
+static size_t s_n_sent, s_cap_sent;
+static uint64_t s_acked, s_ack_errors[8], s_delivered, s_skipped;
+static uint64_t s_drained_idents, s_drain_waiting;
+static uint64_t s_register_failed, s_auth_failed;
+
+static struct samples s_lat_register, s_lat_auth, s_lat_ack, s_lat_forward,
+    s_lat_drain;
+
+static uint64_t s_rng;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+static uint64_t rng_next(void) {
+  // xorshift64*
+  s_rng ^= s_rng >> 12;
+  s_rng ^= s_rng << 25;
+  s_rng ^= s_rng >> 27;
+  return s_rng * 0x2545f4914f6cdd1dULL;
+}
+
+static size_t rng_below(size_t n) { return rng_next() % n; }
+
+static void samples_add(struct samples *s, double v) {
+  if (s->len == s->cap) {
+    size_t cap = s->cap ? s->cap * 2 : 1024;
+    double *p = realloc(s->v, cap * sizeof *p);
+    if (!p) return;
+    s->v = p;
+    s->cap = cap;
+  }
+  s->v[s->len++] = v;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// nearest-rank percentile; samples must be sorted
+static double samples_pct(const struct samples *s, double p) {
+  if (!s->len) return 0;
+  size_t rank = (size_t)ceil(p / 100.0 * s->len);
+  return s->v[rank ? rank - 1 : 0];
+}
+
+static double samples_mean(const struct samples *s) {
+  double sum = 0;
+  for (size_t i = 0; i < s->len; ++i) sum += s->v[i];
+  return s->len ? sum / s->len : 0;
+}
+
+static void set_phase(enum phase phase) {
+  s_phase = phase;
+  s_phase_started_at = now_ns();
+  s_next = s_finished = 0;
+}
+
+static bool gen_keypair(struct ident *id) {
+  EVP_PKEY *pkey = NULL;
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+  size_t sk_len = sizeof id->sk, pk_len = sizeof id->pk;
+  bool ok = ctx && EVP_PKEY_keygen_init(ctx) == 1 &&
+            EVP_PKEY_keygen(ctx, &pkey) == 1 &&
+            EVP_PKEY_get_raw_private_key(pkey, id->sk, &sk_len) == 1 &&
+            EVP_PKEY_get_raw_public_key(pkey, id->pk, &pk_len) == 1;
+  EVP_PKEY_free(pkey);
+  EVP_PKEY_CTX_free(ctx);
+  return ok;
+}
+
+static bool sign_prekey(Messages__SignedPrekey *pb, const uint8_t *sk,
+                        uint8_t *key, size_t key_len, int64_t key_id) {
+  pb->key.data = key;
+  pb->key.len = key_len;
+  pb->id = key_id;
+  pb->sig.data = xeddsa_sign(sk, key, key_len);
+  pb->sig.len = XEDDSA_SIGNATURE_LENGTH;
+  return pb->sig.data != NULL;
+}
+
+static bool build_identity(struct ident *id) {
+  uint8_t spk[CURVE25519_PUBLIC_KEY_LENGTH], pqspk[PQKEM_PUBLIC_KEY_LENGTH];
+  Messages__Identity pb = MESSAGES__IDENTITY__INIT;
+  Messages__SignedPrekey pb_spk = MESSAGES__SIGNED_PREKEY__INIT;
+  Messages__SignedPrekey pb_pqspk = MESSAGES__SIGNED_PREKEY__INIT;
+  bool ok = false;
+
+  // the server only checks sizes and signatures, random prekeys will do
+  if (RAND_bytes(spk, sizeof spk) != 1 ||
+      RAND_bytes(pqspk, sizeof pqspk) != 1)
+    goto err;
+
+  if (!sign_prekey(&pb_spk, id->sk, spk, sizeof spk, 1) ||
+      !sign_prekey(&pb_pqspk, id->sk, pqspk, sizeof pqspk, 1))
+    goto err;
+
+  pb.handle = id->handle;
+  pb.id_key.data = id->pk;
+  pb.id_key.len = sizeof id->pk;
+  pb.prekey = &pb_spk;
+  pb.pqkem_prekey = &pb_pqspk;
+
+  id->body_len = messages__identity__get_packed_size(&pb);
+  if (!(id->body = malloc(id->body_len))) goto err;
+  messages__identity__pack(&pb, id->body);
+  ok = true;
+
+err:
+  free(pb_spk.sig.data);
+  free(pb_pqspk.sig.data);
+  return ok;
+}
+
+static void http_fn(struct mg_connection *c, int ev, void *ev_data) {
+  struct ident *id = c->fn_data;
+
+  if (ev == MG_EV_CONNECT) {
+    struct mg_str host = mg_url_host(s_url);
+    bool is_delete = id->state == IDENT_DELETING;
+    char auth[256] = "";
+
+    if (is_delete) {
+      // signed over method + uri + query + body, see verify_request
+      const char msg[] = "DELETE/api/identity";
+      char sig_b64[EVP_ENCODE_LENGTH(XEDDSA_SIGNATURE_LENGTH)];
+      uint8_t *sig = xeddsa_sign(id->sk, (const uint8_t *)msg, sizeof msg - 1);
+      if (!sig) {
+        c->is_closing = 1;
+        return;
+      }
+      EVP_EncodeBlock((unsigned char *)sig_b64, sig, XEDDSA_SIGNATURE_LENGTH);
+      free(sig);
+      snprintf(auth, sizeof auth, "X-Identity: %s\r\nX-Signature: %s\r\n",
+               id->handle, sig_b64);
+    }
+
+    mg_printf(c,
+              "%s /api/identity HTTP/1.1\r\n"
+              "Host: %.*s\r\n"
+              "%s"
+              "Content-Type: application/protobuf\r\n"
+              "Content-Length: %d\r\n"
+              "\r\n",
+              is_delete ? "DELETE" : "POST", (int)host.len, host.buf, auth,
+              (int)id->body_len);
+    if (id->body_len) mg_send(c, id->body, id->body_len);
+  } else if (ev == MG_EV_HTTP_MSG) {
+    struct mg_http_message *hm = ev_data;
+    int status = mg_http_status(hm);
+
+    if (id->state == IDENT_REGISTERING) {
+      if (status == 201) {
+        samples_add(&s_lat_register,
+                    (now_ns() - id->started_at) / NS_PER_MS);
+        id->state = IDENT_REGISTERED;
+      } else {
+        fprintf(stderr, "[%s:%d] registering %s failed: %d\n", __func__,
+                __LINE__, id->handle, status);
+      }
+    } else if (id->state == IDENT_DELETING && status != 200) {
+      fprintf(stderr, "[%s:%d] deleting %s failed: %d\n", __func__, __LINE__,
+              id->handle, status);
+    }
+    c->is_draining = 1;
+  } else if (ev == MG_EV_CLOSE) {
+    if (id->state == IDENT_REGISTERING) {
+      id->state = IDENT_FAILED;
+      ++s_register_failed;
+    } else if (id->state == IDENT_DELETING) {
+      id->state = IDENT_DONE;
+    }
+    free(id->body);
+    id->body = NULL;
+    id->body_len = 0;
+    --s_inflight;
+    ++s_finished;
+  }
+}
+
+static void ws_send_pb(struct mg_connection *c,
+                       const Websocket__ServerboundMessage *env) {
+  uint8_t stack_buf[1024];
+  size_t n = websocket__serverbound_message__get_packed_size(env);
+  uint8_t *buf = n <= sizeof stack_buf ? stack_buf : malloc(n);
+  if (!buf) return;
+  websocket__serverbound_message__pack(env, buf);
+  mg_ws_send(c, buf, n, WEBSOCKET_OP_BINARY);
+  if (buf != stack_buf) free(buf);
+}
+
+static void handle_challenge(struct mg_connection *c, struct ident *id,
+                             const Websocket__Challenge *ch) {
+  uint8_t *sig = xeddsa_sign(id->sk, ch->nonce.data, ch->nonce.len);
+  if (!sig) {
+    c->is_closing = 1;
+    return;
+  }
+
+  Websocket__ChallengeResponse res = WEBSOCKET__CHALLENGE_RESPONSE__INIT;
+  res.handle = id->handle;
+  res.signature.data = sig;
+  res.signature.len = XEDDSA_SIGNATURE_LENGTH;
+
+  // id 0 is reserved for the challenge response, forwards count from 1
+  Websocket__ServerboundMessage env = WEBSOCKET__SERVERBOUND_MESSAGE__INIT;
+  env.id = 0;
+  env.payload_case = WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD_CHALLENGE_RESPONSE;
+  env.challenge_response = &res;
+  ws_send_pb(c, &env);
+  free(sig);
+}
+
+static void drain_done(struct ident *id, uint64_t now) {
+  samples_add(&s_lat_drain, (now - id->authed_at) / NS_PER_MS);
+  ++s_drained_idents;
+  --s_drain_waiting;
+}
+
+static void handle_ack(struct mg_connection *c, struct ident *id,
+                       const Websocket__Ack *ack) {
+  uint64_t now = now_ns();
+
+  if (ack->message_id == 0) {
+    if (ack->has_error) {
+      // counted as failed once the connection closes
+      fprintf(stderr, "[%s:%d] auth for %s failed: %d\n", __func__, __LINE__,
+              id->handle, ack->error);
+      c->is_closing = 1;
+      return;
+    }
+    id->state = IDENT_AUTHED;
+    id->authed_at = now;
+    samples_add(&s_lat_auth, (now - id->started_at) / NS_PER_MS);
+    ++s_finished;
+    if (id->offline && id->expected) ++s_drain_waiting;
+    return;
+  }
+
+  if (ack->message_id < 1 || (size_t)ack->message_id > s_n_sent) return;
+  struct sent *sent = &s_sent[ack->message_id - 1];
+  samples_add(&s_lat_ack, (now - sent->at) / NS_PER_MS);
+
+  if (ack->has_error) {
+    ++s_ack_errors[(size_t)ack->error < 8 ? ack->error : 7];
+  } else {
+    ++s_acked;
+    if (s_idents[sent->to].offline) ++s_idents[sent->to].expected;
+  }
+}
+
+static void handle_forward(struct ident *id, const Websocket__Forward *fwd) {
+  uint64_t now = now_ns();
+
+  if (fwd->payload_case != WEBSOCKET__FORWARD__PAYLOAD_MESSAGE ||
+      fwd->message->ciphertext.len < sizeof(uint64_t))
+    return;
+
+  if (id->offline) {
+    if (++id->received == id->expected) drain_done(id, now);
+    return;
+  }
+
+  uint64_t sent_at;
+  memcpy(&sent_at, fwd->message->ciphertext.data, sizeof sent_at);
+  samples_add(&s_lat_forward, (now - sent_at) / NS_PER_MS);
+  ++s_delivered;
+}
+
+static void ws_fn(struct mg_connection *c, int ev, void *ev_data) {
+  struct ident *id = c->fn_data;
+
+  if (ev == MG_EV_WS_MSG) {
+    struct mg_ws_message *wm = ev_data;
+    Websocket__ClientboundMessage *env = websocket__clientbound_message__unpack(
+        NULL, wm->data.len, (uint8_t *)wm->data.buf);
+    if (!env) {
+      fprintf(stderr, "[%s:%d] invalid message\n", __func__, __LINE__);
+      return;
+    }
+
+    switch (env->payload_case) {
+      case WEBSOCKET__CLIENTBOUND_MESSAGE__PAYLOAD_CHALLENGE:
+        handle_challenge(c, id, env->challenge);
+        break;
+      case WEBSOCKET__CLIENTBOUND_MESSAGE__PAYLOAD_ACK:
+        handle_ack(c, id, env->ack);
+        break;
+      case WEBSOCKET__CLIENTBOUND_MESSAGE__PAYLOAD_FORWARD:
+        handle_forward(id, env->forward);
+        break;
+      default:
+        break;
+    }
+
+    websocket__clientbound_message__free_unpacked(env, NULL);
+  } else if (ev == MG_EV_ERROR) {
+    fprintf(stderr, "[%s:%d] %s: %s\n", __func__, __LINE__, id->handle,
+            (char *)ev_data);
+  } else if (ev == MG_EV_CLOSE) {
+    if (id->state == IDENT_CONNECTING) {
+      ++s_auth_failed;
+      ++s_finished;
+    }
+    if (id->state != IDENT_DELETING && id->state != IDENT_DONE)
+      id->state = id->state == IDENT_CONNECTING ? IDENT_FAILED
+                                                : IDENT_REGISTERED;
+    id->ws = NULL;
+  }
+}
+
+static void start_register(struct mg_mgr *mgr, struct ident *id) {
+  if (!build_identity(id)) {
+    id->state = IDENT_FAILED;
+    ++s_register_failed;
+    ++s_finished;
+    return;
+  }
+
+  id->state = IDENT_REGISTERING;
+  id->started_at = now_ns();
+  if (!mg_http_connect(mgr, s_url, http_fn, id)) {
+    id->state = IDENT_FAILED;
+    ++s_register_failed;
+    ++s_finished;
+    free(id->body);
+    id->body = NULL;
+    return;
+  }
+  ++s_inflight;
+}
+
+static void start_connect(struct mg_mgr *mgr, struct ident *id) {
+  id->state = IDENT_CONNECTING;
+  id->started_at = now_ns();
+  if (!(id->ws = mg_ws_connect(mgr, s_ws_url, ws_fn, id, NULL))) {
+    id->state = IDENT_FAILED;
+    ++s_auth_failed;
+    ++s_finished;
+  }
+}
+
+static void start_delete(struct mg_mgr *mgr, struct ident *id) {
+  id->state = IDENT_DELETING;
+  if (!mg_http_connect(mgr, s_url, http_fn, id)) {
+    id->state = IDENT_DONE;
+    ++s_finished;
+    return;
+  }
+  ++s_inflight;
+}
+
+static size_t pick_recipient(size_t from) {
+  switch (s_model) {
+    case MODEL_PAIRS: {
+      size_t to = from ^ 1;
+      return to < s_n_idents ? to : (from + s_n_idents - 1) % s_n_idents;
+    }
+    case MODEL_HOTSPOT: {
+      // 90% of the traffic goes to 1% of the identities
+      size_t hot = s_n_idents / 100 ? s_n_idents / 100 : 1;
+      if (rng_below(10) != 0) return rng_below(hot);
+      return rng_below(s_n_idents);
+    }
+    case MODEL_UNIFORM:
+    default:
+      return rng_below(s_n_idents);
+  }
+}
+
+static void send_forward(void) {
+  if (!s_n_online) return;
+  struct ident *from = &s_idents[s_online[rng_below(s_n_online)]];
+  if (from->state != IDENT_AUTHED || !from->ws) return;
+  if (from->ws->send.len > MAX_SEND_BACKLOG) {
+    ++s_skipped;
+    return;
+  }
+
+  size_t to = pick_recipient(from - s_idents);
+  if (to == (size_t)(from - s_idents)) to = (to + 1) % s_n_idents;
+  if (s_idents[to].state == IDENT_FAILED) return;
+
+  if (s_n_sent == s_cap_sent) {
+    size_t cap = s_cap_sent ? s_cap_sent * 2 : 65536;
+    struct sent *p = realloc(s_sent, cap * sizeof *p);
+    if (!p) return;
+    s_sent = p;
+    s_cap_sent = cap;
+  }
+
+  uint8_t payload_buf[4096];
+  uint8_t *payload =
+      s_payload_size <= sizeof payload_buf ? payload_buf : malloc(s_payload_size);
+  if (!payload) return;
+  uint8_t dh[CURVE25519_PUBLIC_KEY_LENGTH] = {0}, nonce[12] = {0};
+
+  Websocket__MessageHeader hdr = WEBSOCKET__MESSAGE_HEADER__INIT;
+  hdr.dh_public_key.data = dh;
+  hdr.dh_public_key.len = sizeof dh;
+  hdr.message_number = from->message_number++;
+
+  Websocket__EncryptedMessage msg = WEBSOCKET__ENCRYPTED_MESSAGE__INIT;
+  msg.header = &hdr;
+  msg.ciphertext.data = payload;
+  msg.ciphertext.len = s_payload_size;
+  msg.nonce.data = nonce;
+  msg.nonce.len = sizeof nonce;
+
+  Websocket__Forward fwd = WEBSOCKET__FORWARD__INIT;
+  fwd.handle = s_idents[to].handle;
+  fwd.payload_case = WEBSOCKET__FORWARD__PAYLOAD_MESSAGE;
+  fwd.message = &msg;
+
+  Websocket__ServerboundMessage env = WEBSOCKET__SERVERBOUND_MESSAGE__INIT;
+  env.id = (int64_t)s_n_sent + 1;
+  env.payload_case = WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD_FORWARD;
+  env.forward = &fwd;
+
+  memset(payload, 0xa5, s_payload_size);
+  uint64_t at = now_ns();
+  memcpy(payload, &at, sizeof at);
+  s_sent[s_n_sent++] = (struct sent){.at = at, .to = (uint32_t)to};
+  ws_send_pb(from->ws, &env);
+
+  if (payload != payload_buf) free(payload);
+}
+
+static uint64_t ack_errors(void) {
+  uint64_t n = 0;
+  for (size_t i = 0; i < sizeof s_ack_errors / sizeof *s_ack_errors; ++i)
+    n += s_ack_errors[i];
+  return n;
+}
+
+static void tick(struct mg_mgr *mgr) {
+  uint64_t now = now_ns();
+
+  switch (s_phase) {
+    case PHASE_REGISTER: {
+      while (s_inflight < s_concurrency && s_next < s_n_idents)
+        start_register(mgr, &s_idents[s_next++]);
+      if (s_finished == s_n_idents) {
+        fprintf(stderr, "registered %zu identities (%" PRIu64 " failed)\n",
+                s_n_idents - (size_t)s_register_failed, s_register_failed);
+        set_phase(PHASE_CONNECT);
+      }
+      break;
+    }
+    case PHASE_CONNECT: {
+      size_t pending = s_next - s_finished;
+      while (pending < s_concurrency && s_next < s_n_online) {
+        struct ident *id = &s_idents[s_online[s_next++]];
+        if (id->state == IDENT_REGISTERED) {
+          start_connect(mgr, id);
+          ++pending;
+        } else {
+          ++s_finished;
+        }
+      }
+      if (s_finished == s_n_online) {
+        fprintf(stderr, "connected %zu identities, sending for %.0f s\n",
+                s_n_online - (size_t)s_auth_failed, s_duration);
+        set_phase(PHASE_TRAFFIC);
+      }
+      break;
+    }
+    case PHASE_TRAFFIC: {
+      uint64_t elapsed = now - s_phase_started_at;
+      uint64_t due = (uint64_t)(elapsed / (double)NS_PER_S * s_rate);
+      // catch up in bounded bursts so a stall doesn't turn into a flood
+      for (size_t i = 0; s_n_sent < due && i < 10000; ++i) send_forward();
+      if (elapsed >= s_duration * NS_PER_S) {
+        s_traffic_ns = elapsed;
+        set_phase(PHASE_SETTLE);
+      }
+      break;
+    }
+    case PHASE_SETTLE: {
+      if (s_acked + ack_errors() >= s_n_sent ||
+          now - s_phase_started_at > SETTLE_TIMEOUT_NS) {
+        fprintf(stderr, "connecting offline identities to drain queues\n");
+        set_phase(PHASE_DRAIN);
+      }
+      break;
+    }
+    case PHASE_DRAIN: {
+      size_t connecting = 0;
+      for (size_t i = 0; i < s_next; ++i)
+        connecting += s_idents[i].state == IDENT_CONNECTING;
+      for (; s_next < s_n_idents && connecting < s_concurrency; ++s_next) {
+        struct ident *id = &s_idents[s_next];
+        if (!id->offline || id->state != IDENT_REGISTERED) continue;
+        start_connect(mgr, id);
+        ++connecting;
+      }
+      if ((s_next == s_n_idents && !connecting && !s_drain_waiting) ||
+          now - s_phase_started_at > DRAIN_TIMEOUT_NS) {
+        if (s_drain_waiting)
+          fprintf(stderr, "%" PRIu64 " queues not drained in time\n",
+                  s_drain_waiting);
+        for (size_t i = 0; i < s_n_idents; ++i)
+          if (s_idents[i].ws) s_idents[i].ws->is_draining = 1;
+        set_phase(s_cleanup ? PHASE_CLEANUP : PHASE_DONE);
+      }
+      break;
+    }
+    case PHASE_CLEANUP: {
+      while (s_inflight < s_concurrency && s_next < s_n_idents) {
+        struct ident *id = &s_idents[s_next++];
+        if (id->state == IDENT_FAILED || id->state == IDENT_NEW) {
+          ++s_finished;
+          continue;
+        }
+        if (id->ws) {
+          // still closing from the drain phase, come back to it
+          --s_next;
+          break;
+        }
+        start_delete(mgr, id);
+      }
+      if (s_finished == s_n_idents) set_phase(PHASE_DONE);
+      break;
+    }
+    case PHASE_DONE:
+      break;
+  }
+}
+
+static void report_csv(FILE *f) {
+  struct {
+    const char *name;
+    struct samples *s;
+  } lat[] = {{"register", &s_lat_register}, {"auth", &s_lat_auth},
+             {"ack", &s_lat_ack},           {"forward", &s_lat_forward},
+             {"drain", &s_lat_drain}};
+  size_t n_lat = sizeof lat / sizeof *lat;
+
+  fseek(f, 0, SEEK_END);
+  if (ftell(f) <= 0) {
+    fprintf(f,
+            "identities,online,model,rate,payload_bytes,duration_s,sent,"
+            "acked,errors,queue_full,skipped,delivered,throughput_msgs_s,"
+            "drained_idents");
+    for (size_t i = 0; i < n_lat; ++i)
+      fprintf(f, ",%s_count,%s_mean_ms,%s_p50_ms,%s_p99_ms,%s_p999_ms,%s_max_ms",
+              lat[i].name, lat[i].name, lat[i].name, lat[i].name, lat[i].name,
+              lat[i].name);
+    fputc('\n', f);
+  }
+
+  double secs = s_traffic_ns / (double)NS_PER_S;
+  fprintf(f,
+          "%zu,%zu,%s,%.0f,%zu,%.3f,%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64
+          ",%" PRIu64 ",%" PRIu64 ",%.1f,%" PRIu64,
+          s_n_idents, s_n_online, s_model_names[s_model], s_rate,
+          s_payload_size, secs, s_n_sent, s_acked, ack_errors(),
+          s_ack_errors[WEBSOCKET__ACK__ERROR__RECIPIENT_QUEUE_FULL], s_skipped,
+          s_delivered, secs > 0 ? s_delivered / secs : 0, s_drained_idents);
+  for (size_t i = 0; i < n_lat; ++i) {
+    struct samples *s = lat[i].s;
+    fprintf(f, ",%zu,%.3f,%.3f,%.3f,%.3f,%.3f", s->len, samples_mean(s),
+            samples_pct(s, 50), samples_pct(s, 99), samples_pct(s, 99.9),
+            samples_pct(s, 100));
+  }
+  fputc('\n', f);
+}
+
+static void report_json_latency(FILE *f, const char *name,
+                                const struct samples *s, bool last) {
+  fprintf(f,
+          "    \"%s\": {\"count\": %zu, \"mean_ms\": %.3f, \"p50_ms\": %.3f, "
+          "\"p99_ms\": %.3f, \"p999_ms\": %.3f, \"max_ms\": %.3f}%s\n",
+          name, s->len, samples_mean(s), samples_pct(s, 50),
+          samples_pct(s, 99), samples_pct(s, 99.9), samples_pct(s, 100),
+          last ? "" : ",");
+}
+
+static void report_json(FILE *f) {
+  double secs = s_traffic_ns / (double)NS_PER_S;
+  fprintf(f,
+          "{\n"
+          "  \"config\": {\"identities\": %zu, \"online\": %zu, "
+          "\"model\": \"%s\", \"rate\": %.0f, \"payload_bytes\": %zu, "
+          "\"duration_s\": %.3f},\n"
+          "  \"forwards\": {\"sent\": %zu, \"acked\": %" PRIu64
+          ", \"errors\": %" PRIu64 ", \"queue_full\": %" PRIu64
+          ", \"skipped\": %" PRIu64 ", \"delivered\": %" PRIu64
+          ", \"throughput_msgs_s\": %.1f, \"drained_idents\": %" PRIu64
+          "},\n"
+          "  \"latency\": {\n",
+          s_n_idents, s_n_online, s_model_names[s_model], s_rate,
+          s_payload_size, secs, s_n_sent, s_acked, ack_errors(),
+          s_ack_errors[WEBSOCKET__ACK__ERROR__RECIPIENT_QUEUE_FULL], s_skipped,
+          s_delivered, secs > 0 ? s_delivered / secs : 0, s_drained_idents);
+  report_json_latency(f, "register", &s_lat_register, false);
+  report_json_latency(f, "auth", &s_lat_auth, false);
+  report_json_latency(f, "ack", &s_lat_ack, false);
+  report_json_latency(f, "forward", &s_lat_forward, false);
+  report_json_latency(f, "drain", &s_lat_drain, true);
+  fprintf(f, "  }\n}\n");
+}
+
+static bool setup(void) {
+  if (!(s_idents = calloc(s_n_idents, sizeof *s_idents)) ||
+      !(s_online = calloc(s_n_idents, sizeof *s_online))) {
+    fprintf(stderr, "[%s:%d] out of memory\n", __func__, __LINE__);
+    return false;
+  }
+
+  // handles must start with a letter and stay within 32 characters
+  uint32_t run = (uint32_t)rng_next();
+  size_t n_offline = (size_t)(s_n_idents * s_offline);
+  for (size_t i = 0; i < s_n_idents; ++i) {
+    struct ident *id = &s_idents[i];
+    snprintf(id->handle, sizeof id->handle, "lg%08" PRIx32 "_%zu", run, i);
+    if (!gen_keypair(id)) {
+      fprintf(stderr, "[%s:%d] key generation failed\n", __func__, __LINE__);
+      return false;
+    }
+    // spread the offline identities evenly, so pairs get mixed too
+    id->offline = n_offline && (i * n_offline / s_n_idents) !=
+                                   ((i + 1) * n_offline / s_n_idents);
+    if (!id->offline) s_online[s_n_online++] = i;
+  }
+
+  const char *scheme_end = strstr(s_url, "://");
+  const char *rest = scheme_end ? scheme_end + 3 : s_url;
+  bool tls = strncmp(s_url, "https://", 8) == 0;
+  snprintf(s_ws_url, sizeof s_ws_url, "%s://%s/api/ws", tls ? "wss" : "ws",
+           rest);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      fprintf(stdout,
+              "Usage: %s [OPTIONS]\n"
+              "\n"
+              "Options:\n"
+              "  -u, --url URL          Server base URL (default: %s)\n"
+              "  -n, --identities N     Identities to simulate (default: %zu)\n"
+              "  -r, --rate R           Forwards per second, total "
+              "(default: %.0f)\n"
+              "  -d, --duration S       Traffic phase length in seconds "
+              "(default: %.0f)\n"
+              "  -s, --size B           Ciphertext bytes per message "
+              "(default: %zu)\n"
+              "  -m, --model M          uniform, pairs or hotspot "
+              "(default: %s)\n"
+              "  --offline F            Fraction kept offline until the drain "
+              "phase (default: %.2f)\n"
+              "  -c, --concurrency N    Parallel registrations/handshakes "
+              "(default: %zu)\n"
+              "  -f, --format FMT       csv or json (default: %s)\n"
+              "  -o, --out PATH         Append results to PATH "
+              "(default: stdout)\n"
+              "  --seed N               Seed for recipient selection\n"
+              "  --no-cleanup           Keep the identities afterwards\n"
+              "  -h, --help             Show this help message and exit\n",
+              argv[0], s_url, s_n_idents, s_rate, s_duration, s_payload_size,
+              s_model_names[s_model], s_offline, s_concurrency, s_format);
+      return EXIT_SUCCESS;
+    }
+  }
+
+  for (int i = 1; i < argc; ++i) {
+    char *arg = argv[i];
+    if (i + 1 >= argc && strcmp(arg, "--no-cleanup") != 0) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return EXIT_FAILURE;
+    }
+    if (strcmp(arg, "-u") == 0 || strcmp(arg, "--url") == 0) {
+      s_url = argv[++i];
+    } else if (strcmp(arg, "-n") == 0 || strcmp(arg, "--identities") == 0) {
+      s_n_idents = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "-r") == 0 || strcmp(arg, "--rate") == 0) {
+      s_rate = strtod(argv[++i], NULL);
+    } else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--duration") == 0) {
+      s_duration = strtod(argv[++i], NULL);
+    } else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--size") == 0) {
+      s_payload_size = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "-m") == 0 || strcmp(arg, "--model") == 0) {
+      const char *name = argv[++i];
+      size_t m = 0, n = sizeof s_model_names / sizeof *s_model_names;
+      while (m < n && strcmp(name, s_model_names[m]) != 0) ++m;
+      if (m == n) {
+        fprintf(stderr, "unknown traffic model: %s\n", name);
+        return EXIT_FAILURE;
+      }
+      s_model = (enum model)m;
+    } else if (strcmp(arg, "--offline") == 0) {
+      s_offline = strtod(argv[++i], NULL);
+    } else if (strcmp(arg, "-c") == 0 || strcmp(arg, "--concurrency") == 0) {
+      s_concurrency = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "-f") == 0 || strcmp(arg, "--format") == 0) {
+      s_format = argv[++i];
+    } else if (strcmp(arg, "-o") == 0 || strcmp(arg, "--out") == 0) {
+      s_out_path = argv[++i];
+    } else if (strcmp(arg, "--seed") == 0) {
+      s_seed = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--no-cleanup") == 0) {
+      s_cleanup = false;
+    } else {
+      fprintf(stderr,
+              "illegal option: %s\ntry `%s --help` for more information.\n",
+              arg, argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (s_n_idents < 2 || s_concurrency < 1 || s_rate <= 0 ||
+      s_offline < 0 || s_offline >= 1 || s_payload_size < MIN_PAYLOAD_SIZE ||
+      (strcmp(s_format, "csv") != 0 && strcmp(s_format, "json") != 0)) {
+    fprintf(stderr, "invalid options, try `%s --help`\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  s_rng = s_seed ? s_seed : now_ns() | 1;
+  if (!setup()) return EXIT_FAILURE;
+
+  struct mg_mgr mgr;
+  mg_mgr_init(&mgr);
+  set_phase(PHASE_REGISTER);
+
+  while (s_phase != PHASE_DONE) {
+    mg_mgr_poll(&mgr, 1);
+    tick(&mgr);
+  }
+
+  mg_mgr_free(&mgr);
+
+  struct samples *all[] = {&s_lat_register, &s_lat_auth, &s_lat_ack,
+                           &s_lat_forward, &s_lat_drain};
+  for (size_t i = 0; i < sizeof all / sizeof *all; ++i)
+    qsort(all[i]->v, all[i]->len, sizeof *all[i]->v, cmp_double);
+
+  FILE *out = s_out_path ? fopen(s_out_path, "a+") : stdout;
+  if (!out) {
+    perror(s_out_path);
+    return EXIT_FAILURE;
+  }
+  if (strcmp(s_format, "json") == 0) {
+    report_json(out);
+  } else {
+    report_csv(out);
+  }
+  if (out != stdout) fclose(out);
+
+  for (size_t i = 0; i < sizeof all / sizeof *all; ++i) free(all[i]->v);
+  free(s_sent);
+  free(s_online);
+  free(s_idents);
+
+  return EXIT_SUCCESS;
+}
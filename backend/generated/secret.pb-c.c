@@ -7,6 +7,51 @@
 #endif
 
 #include "secret.pb-c.h"
+void   secret__blob_ref__init
+                     (Secret__BlobRef         *message)
+{
+  static const Secret__BlobRef init_value = SECRET__BLOB_REF__INIT;
+  *message = init_value;
+}
+size_t secret__blob_ref__get_packed_size
+                     (const Secret__BlobRef *message)
+{
+  assert(message->base.descriptor == &secret__blob_ref__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t secret__blob_ref__pack
+                     (const Secret__BlobRef *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &secret__blob_ref__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t secret__blob_ref__pack_to_buffer
+                     (const Secret__BlobRef *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &secret__blob_ref__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+Secret__BlobRef *
+       secret__blob_ref__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (Secret__BlobRef *)
+     protobuf_c_message_unpack (&secret__blob_ref__descriptor,
+                                allocator, len, data);
+}
+void   secret__blob_ref__free_unpacked
+                     (Secret__BlobRef *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &secret__blob_ref__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
 void   secret__attachment__init
                      (Secret__Attachment         *message)
 {
@@ -277,7 +322,84 @@ void   secret__payload__free_unpacked
   assert(message->base.descriptor == &secret__payload__descriptor);
   protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
 }
-static const ProtobufCFieldDescriptor secret__attachment__field_descriptors[3] =
+static const ProtobufCFieldDescriptor secret__blob_ref__field_descriptors[4] =
+{
+  {
+    "hash",
+    1,
+    PROTOBUF_C_LABEL_REQUIRED,
+    PROTOBUF_C_TYPE_BYTES,
+    0,   /* quantifier_offset */
+    offsetof(Secret__BlobRef, hash),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "key",
+    2,
+    PROTOBUF_C_LABEL_REQUIRED,
+    PROTOBUF_C_TYPE_BYTES,
+    0,   /* quantifier_offset */
+    offsetof(Secret__BlobRef, key),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "size",
+    3,
+    PROTOBUF_C_LABEL_REQUIRED,
+    PROTOBUF_C_TYPE_INT64,
+    0,   /* quantifier_offset */
+    offsetof(Secret__BlobRef, size),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "chunk_size",
+    4,
+    PROTOBUF_C_LABEL_REQUIRED,
+    PROTOBUF_C_TYPE_INT32,
+    0,   /* quantifier_offset */
+    offsetof(Secret__BlobRef, chunk_size),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned secret__blob_ref__field_indices_by_name[] = {
+  3,   /* field[3] = chunk_size */
+  0,   /* field[0] = hash */
+  1,   /* field[1] = key */
+  2,   /* field[2] = size */
+};
+static const ProtobufCIntRange secret__blob_ref__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 4 }
+};
+const ProtobufCMessageDescriptor secret__blob_ref__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "secret.BlobRef",
+  "BlobRef",
+  "Secret__BlobRef",
+  "secret",
+  sizeof(Secret__BlobRef),
+  4,
+  secret__blob_ref__field_descriptors,
+  secret__blob_ref__field_indices_by_name,
+  1,  secret__blob_ref__number_ranges,
+  (ProtobufCMessageInit) secret__blob_ref__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
+static const ProtobufCFieldDescriptor secret__attachment__field_descriptors[4] =
 {
   {
     "id",
@@ -306,17 +428,30 @@ static const ProtobufCFieldDescriptor secret__attachment__field_descriptors[3] =
   {
     "data",
     3,
-    PROTOBUF_C_LABEL_REQUIRED,
+    PROTOBUF_C_LABEL_OPTIONAL,
     PROTOBUF_C_TYPE_BYTES,
-    0,   /* quantifier_offset */
+    offsetof(Secret__Attachment, has_data),
     offsetof(Secret__Attachment, data),
     NULL,
     NULL,
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "blob",
+    4,
+    PROTOBUF_C_LABEL_OPTIONAL,
+    PROTOBUF_C_TYPE_MESSAGE,
+    0,   /* quantifier_offset */
+    offsetof(Secret__Attachment, blob),
+    &secret__blob_ref__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned secret__attachment__field_indices_by_name[] = {
+  3,   /* field[3] = blob */
   2,   /* field[2] = data */
   0,   /* field[0] = id */
   1,   /* field[1] = mime_type */
@@ -324,7 +459,7 @@ static const unsigned secret__attachment__field_indices_by_name[] = {
 static const ProtobufCIntRange secret__attachment__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 3 }
+  { 0, 4 }
 };
 const ProtobufCMessageDescriptor secret__attachment__descriptor =
 {
@@ -334,7 +469,7 @@ const ProtobufCMessageDescriptor secret__attachment__descriptor =
   "Secret__Attachment",
   "secret",
   sizeof(Secret__Attachment),
-  3,
+  4,
   secret__attachment__field_descriptors,
   secret__attachment__field_indices_by_name,
   1,  secret__attachment__number_ranges,
@@ -15,6 +15,7 @@ PROTOBUF_C__BEGIN_DECLS
 #endif
 
 
+typedef struct Secret__BlobRef Secret__BlobRef;
 typedef struct Secret__Attachment Secret__Attachment;
 typedef struct Secret__Message Secret__Message;
 typedef struct Secret__MsgEdit Secret__MsgEdit;
@@ -28,16 +29,31 @@ typedef struct Secret__Payload Secret__Payload;
 
 /* --- messages --- */
 
+struct  Secret__BlobRef
+{
+  ProtobufCMessage base;
+  ProtobufCBinaryData hash;
+  ProtobufCBinaryData key;
+  int64_t size;
+  int32_t chunk_size;
+};
+#define SECRET__BLOB_REF__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&secret__blob_ref__descriptor) \
+, {0,NULL}, {0,NULL}, 0, 0 }
+
+
 struct  Secret__Attachment
 {
   ProtobufCMessage base;
   int64_t id;
   char *mime_type;
+  protobuf_c_boolean has_data;
   ProtobufCBinaryData data;
+  Secret__BlobRef *blob;
 };
 #define SECRET__ATTACHMENT__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&secret__attachment__descriptor) \
-, 0, NULL, {0,NULL} }
+, 0, NULL, 0, {0,NULL}, NULL }
 
 
 struct  Secret__Message
@@ -126,6 +142,25 @@ struct  Secret__Payload
 , SECRET__PAYLOAD__TYPE__NOT_SET, {0} }
 
 
+/* Secret__BlobRef methods */
+void   secret__blob_ref__init
+                     (Secret__BlobRef         *message);
+size_t secret__blob_ref__get_packed_size
+                     (const Secret__BlobRef   *message);
+size_t secret__blob_ref__pack
+                     (const Secret__BlobRef   *message,
+                      uint8_t             *out);
+size_t secret__blob_ref__pack_to_buffer
+                     (const Secret__BlobRef   *message,
+                      ProtobufCBuffer     *buffer);
+Secret__BlobRef *
+       secret__blob_ref__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   secret__blob_ref__free_unpacked
+                     (Secret__BlobRef *message,
+                      ProtobufCAllocator *allocator);
 /* Secret__Attachment methods */
 void   secret__attachment__init
                      (Secret__Attachment         *message);
@@ -242,6 +277,9 @@ void   secret__payload__free_unpacked
                       ProtobufCAllocator *allocator);
 /* --- per-message closures --- */
 
+typedef void (*Secret__BlobRef_Closure)
+                 (const Secret__BlobRef *message,
+                  void *closure_data);
 typedef void (*Secret__Attachment_Closure)
                  (const Secret__Attachment *message,
                   void *closure_data);
@@ -266,6 +304,7 @@ typedef void (*Secret__Payload_Closure)
 
 /* --- descriptors --- */
 
+extern const ProtobufCMessageDescriptor secret__blob_ref__descriptor;
 extern const ProtobufCMessageDescriptor secret__attachment__descriptor;
 extern const ProtobufCMessageDescriptor secret__message__descriptor;
 extern const ProtobufCMessageDescriptor secret__msg_edit__descriptor;
@@ -277,6 +277,96 @@ void   websocket__forward__free_unpacked
   assert(message->base.descriptor == &websocket__forward__descriptor);
   protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
 }
+void   websocket__multi_forward__init
+                     (Websocket__MultiForward         *message)
+{
+  static const Websocket__MultiForward init_value = WEBSOCKET__MULTI_FORWARD__INIT;
+  *message = init_value;
+}
+size_t websocket__multi_forward__get_packed_size
+                     (const Websocket__MultiForward *message)
+{
+  assert(message->base.descriptor == &websocket__multi_forward__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t websocket__multi_forward__pack
+                     (const Websocket__MultiForward *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &websocket__multi_forward__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t websocket__multi_forward__pack_to_buffer
+                     (const Websocket__MultiForward *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &websocket__multi_forward__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+Websocket__MultiForward *
+       websocket__multi_forward__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (Websocket__MultiForward *)
+     protobuf_c_message_unpack (&websocket__multi_forward__descriptor,
+                                allocator, len, data);
+}
+void   websocket__multi_forward__free_unpacked
+                     (Websocket__MultiForward *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &websocket__multi_forward__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
+void   websocket__batch__init
+                     (Websocket__Batch         *message)
+{
+  static const Websocket__Batch init_value = WEBSOCKET__BATCH__INIT;
+  *message = init_value;
+}
+size_t websocket__batch__get_packed_size
+                     (const Websocket__Batch *message)
+{
+  assert(message->base.descriptor == &websocket__batch__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t websocket__batch__pack
+                     (const Websocket__Batch *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &websocket__batch__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t websocket__batch__pack_to_buffer
+                     (const Websocket__Batch *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &websocket__batch__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+Websocket__Batch *
+       websocket__batch__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (Websocket__Batch *)
+     protobuf_c_message_unpack (&websocket__batch__descriptor,
+                                allocator, len, data);
+}
+void   websocket__batch__free_unpacked
+                     (Websocket__Batch *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &websocket__batch__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
 void   websocket__ack__init
                      (Websocket__Ack         *message)
 {
@@ -322,6 +412,96 @@ void   websocket__ack__free_unpacked
   assert(message->base.descriptor == &websocket__ack__descriptor);
   protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
 }
+void   websocket__recipient_error__init
+                     (Websocket__RecipientError         *message)
+{
+  static const Websocket__RecipientError init_value = WEBSOCKET__RECIPIENT_ERROR__INIT;
+  *message = init_value;
+}
+size_t websocket__recipient_error__get_packed_size
+                     (const Websocket__RecipientError *message)
+{
+  assert(message->base.descriptor == &websocket__recipient_error__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t websocket__recipient_error__pack
+                     (const Websocket__RecipientError *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &websocket__recipient_error__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t websocket__recipient_error__pack_to_buffer
+                     (const Websocket__RecipientError *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &websocket__recipient_error__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+Websocket__RecipientError *
+       websocket__recipient_error__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (Websocket__RecipientError *)
+     protobuf_c_message_unpack (&websocket__recipient_error__descriptor,
+                                allocator, len, data);
+}
+void   websocket__recipient_error__free_unpacked
+                     (Websocket__RecipientError *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &websocket__recipient_error__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
+void   websocket__message_error__init
+                     (Websocket__MessageError         *message)
+{
+  static const Websocket__MessageError init_value = WEBSOCKET__MESSAGE_ERROR__INIT;
+  *message = init_value;
+}
+size_t websocket__message_error__get_packed_size
+                     (const Websocket__MessageError *message)
+{
+  assert(message->base.descriptor == &websocket__message_error__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t websocket__message_error__pack
+                     (const Websocket__MessageError *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &websocket__message_error__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t websocket__message_error__pack_to_buffer
+                     (const Websocket__MessageError *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &websocket__message_error__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+Websocket__MessageError *
+       websocket__message_error__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (Websocket__MessageError *)
+     protobuf_c_message_unpack (&websocket__message_error__descriptor,
+                                allocator, len, data);
+}
+void   websocket__message_error__free_unpacked
+                     (Websocket__MessageError *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &websocket__message_error__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
 void   websocket__low_on_keys__init
                      (Websocket__LowOnKeys         *message)
 {
@@ -764,7 +944,7 @@ const ProtobufCMessageDescriptor websocket__pqxdhinit__descriptor =
   (ProtobufCMessageInit) websocket__pqxdhinit__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor websocket__forward__field_descriptors[3] =
+static const ProtobufCFieldDescriptor websocket__forward__field_descriptors[4] =
 {
   {
     "handle",
@@ -802,8 +982,21 @@ static const ProtobufCFieldDescriptor websocket__forward__field_descriptors[3] =
     PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "body",
+    4,
+    PROTOBUF_C_LABEL_OPTIONAL,
+    PROTOBUF_C_TYPE_BYTES,
+    offsetof(Websocket__Forward, has_body),
+    offsetof(Websocket__Forward, body),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned websocket__forward__field_indices_by_name[] = {
+  3,   /* field[3] = body */
   0,   /* field[0] = handle */
   2,   /* field[2] = message */
   1,   /* field[1] = pqxdh_init */
@@ -811,7 +1004,7 @@ static const unsigned websocket__forward__field_indices_by_name[] = {
 static const ProtobufCIntRange websocket__forward__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 3 }
+  { 0, 4 }
 };
 const ProtobufCMessageDescriptor websocket__forward__descriptor =
 {
@@ -821,28 +1014,119 @@ const ProtobufCMessageDescriptor websocket__forward__descriptor =
   "Websocket__Forward",
   "websocket",
   sizeof(Websocket__Forward),
-  3,
+  4,
   websocket__forward__field_descriptors,
   websocket__forward__field_indices_by_name,
   1,  websocket__forward__number_ranges,
   (ProtobufCMessageInit) websocket__forward__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCEnumValue websocket__ack__error__enum_values_by_number[5] =
+static const ProtobufCFieldDescriptor websocket__multi_forward__field_descriptors[2] =
+{
+  {
+    "recipients",
+    1,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_MESSAGE,
+    offsetof(Websocket__MultiForward, n_recipients),
+    offsetof(Websocket__MultiForward, recipients),
+    &websocket__forward__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "body",
+    2,
+    PROTOBUF_C_LABEL_REQUIRED,
+    PROTOBUF_C_TYPE_BYTES,
+    0,   /* quantifier_offset */
+    offsetof(Websocket__MultiForward, body),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned websocket__multi_forward__field_indices_by_name[] = {
+  1,   /* field[1] = body */
+  0,   /* field[0] = recipients */
+};
+static const ProtobufCIntRange websocket__multi_forward__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 2 }
+};
+const ProtobufCMessageDescriptor websocket__multi_forward__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "websocket.MultiForward",
+  "MultiForward",
+  "Websocket__MultiForward",
+  "websocket",
+  sizeof(Websocket__MultiForward),
+  2,
+  websocket__multi_forward__field_descriptors,
+  websocket__multi_forward__field_indices_by_name,
+  1,  websocket__multi_forward__number_ranges,
+  (ProtobufCMessageInit) websocket__multi_forward__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
+static const ProtobufCFieldDescriptor websocket__batch__field_descriptors[1] =
+{
+  {
+    "forwards",
+    1,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_MESSAGE,
+    offsetof(Websocket__Batch, n_forwards),
+    offsetof(Websocket__Batch, forwards),
+    &websocket__forward__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned websocket__batch__field_indices_by_name[] = {
+  0,   /* field[0] = forwards */
+};
+static const ProtobufCIntRange websocket__batch__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 1 }
+};
+const ProtobufCMessageDescriptor websocket__batch__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "websocket.Batch",
+  "Batch",
+  "Websocket__Batch",
+  "websocket",
+  sizeof(Websocket__Batch),
+  1,
+  websocket__batch__field_descriptors,
+  websocket__batch__field_indices_by_name,
+  1,  websocket__batch__number_ranges,
+  (ProtobufCMessageInit) websocket__batch__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
+static const ProtobufCEnumValue websocket__ack__error__enum_values_by_number[6] =
 {
   { "UNAUTHENTICATED", "WEBSOCKET__ACK__ERROR__UNAUTHENTICATED", 0 },
   { "INVALID_SIGNATURE", "WEBSOCKET__ACK__ERROR__INVALID_SIGNATURE", 1 },
   { "SERVER_ERROR", "WEBSOCKET__ACK__ERROR__SERVER_ERROR", 2 },
   { "UNKNOWN_IDENTITY", "WEBSOCKET__ACK__ERROR__UNKNOWN_IDENTITY", 3 },
   { "INVALID_MESSAGE", "WEBSOCKET__ACK__ERROR__INVALID_MESSAGE", 4 },
+  { "RECIPIENT_QUEUE_FULL", "WEBSOCKET__ACK__ERROR__RECIPIENT_QUEUE_FULL", 5 },
 };
 static const ProtobufCIntRange websocket__ack__error__value_ranges[] = {
-{0, 0},{0, 5}
+{0, 0},{0, 6}
 };
-static const ProtobufCEnumValueIndex websocket__ack__error__enum_values_by_name[5] =
+static const ProtobufCEnumValueIndex websocket__ack__error__enum_values_by_name[6] =
 {
   { "INVALID_MESSAGE", 4 },
   { "INVALID_SIGNATURE", 1 },
+  { "RECIPIENT_QUEUE_FULL", 5 },
   { "SERVER_ERROR", 2 },
   { "UNAUTHENTICATED", 0 },
   { "UNKNOWN_IDENTITY", 3 },
@@ -854,15 +1138,15 @@ const ProtobufCEnumDescriptor websocket__ack__error__descriptor =
   "Error",
   "Websocket__Ack__Error",
   "websocket",
-  5,
+  6,
   websocket__ack__error__enum_values_by_number,
-  5,
+  6,
   websocket__ack__error__enum_values_by_name,
   1,
   websocket__ack__error__value_ranges,
   NULL,NULL,NULL,NULL   /* reserved[1234] */
 };
-static const ProtobufCFieldDescriptor websocket__ack__field_descriptors[2] =
+static const ProtobufCFieldDescriptor websocket__ack__field_descriptors[5] =
 {
   {
     "message_id",
@@ -888,15 +1172,54 @@ static const ProtobufCFieldDescriptor websocket__ack__field_descriptors[2] =
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "recipient_errors",
+    3,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_MESSAGE,
+    offsetof(Websocket__Ack, n_recipient_errors),
+    offsetof(Websocket__Ack, recipient_errors),
+    &websocket__recipient_error__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "last_message_id",
+    4,
+    PROTOBUF_C_LABEL_OPTIONAL,
+    PROTOBUF_C_TYPE_INT64,
+    offsetof(Websocket__Ack, has_last_message_id),
+    offsetof(Websocket__Ack, last_message_id),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "message_errors",
+    5,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_MESSAGE,
+    offsetof(Websocket__Ack, n_message_errors),
+    offsetof(Websocket__Ack, message_errors),
+    &websocket__message_error__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned websocket__ack__field_indices_by_name[] = {
   1,   /* field[1] = error */
+  3,   /* field[3] = last_message_id */
+  4,   /* field[4] = message_errors */
   0,   /* field[0] = message_id */
+  2,   /* field[2] = recipient_errors */
 };
 static const ProtobufCIntRange websocket__ack__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 2 }
+  { 0, 5 }
 };
 const ProtobufCMessageDescriptor websocket__ack__descriptor =
 {
@@ -906,13 +1229,115 @@ const ProtobufCMessageDescriptor websocket__ack__descriptor =
   "Websocket__Ack",
   "websocket",
   sizeof(Websocket__Ack),
-  2,
+  5,
   websocket__ack__field_descriptors,
   websocket__ack__field_indices_by_name,
   1,  websocket__ack__number_ranges,
   (ProtobufCMessageInit) websocket__ack__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
+static const ProtobufCFieldDescriptor websocket__recipient_error__field_descriptors[2] =
+{
+  {
+    "index",
+    1,
+    PROTOBUF_C_LABEL_REQUIRED,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(Websocket__RecipientError, index),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "error",
+    2,
+    PROTOBUF_C_LABEL_REQUIRED,
+    PROTOBUF_C_TYPE_ENUM,
+    0,   /* quantifier_offset */
+    offsetof(Websocket__RecipientError, error),
+    &websocket__ack__error__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned websocket__recipient_error__field_indices_by_name[] = {
+  1,   /* field[1] = error */
+  0,   /* field[0] = index */
+};
+static const ProtobufCIntRange websocket__recipient_error__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 2 }
+};
+const ProtobufCMessageDescriptor websocket__recipient_error__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "websocket.RecipientError",
+  "RecipientError",
+  "Websocket__RecipientError",
+  "websocket",
+  sizeof(Websocket__RecipientError),
+  2,
+  websocket__recipient_error__field_descriptors,
+  websocket__recipient_error__field_indices_by_name,
+  1,  websocket__recipient_error__number_ranges,
+  (ProtobufCMessageInit) websocket__recipient_error__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
+static const ProtobufCFieldDescriptor websocket__message_error__field_descriptors[2] =
+{
+  {
+    "message_id",
+    1,
+    PROTOBUF_C_LABEL_REQUIRED,
+    PROTOBUF_C_TYPE_INT64,
+    0,   /* quantifier_offset */
+    offsetof(Websocket__MessageError, message_id),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "error",
+    2,
+    PROTOBUF_C_LABEL_REQUIRED,
+    PROTOBUF_C_TYPE_ENUM,
+    0,   /* quantifier_offset */
+    offsetof(Websocket__MessageError, error),
+    &websocket__ack__error__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned websocket__message_error__field_indices_by_name[] = {
+  1,   /* field[1] = error */
+  0,   /* field[0] = message_id */
+};
+static const ProtobufCIntRange websocket__message_error__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 2 }
+};
+const ProtobufCMessageDescriptor websocket__message_error__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "websocket.MessageError",
+  "MessageError",
+  "Websocket__MessageError",
+  "websocket",
+  sizeof(Websocket__MessageError),
+  2,
+  websocket__message_error__field_descriptors,
+  websocket__message_error__field_indices_by_name,
+  1,  websocket__message_error__number_ranges,
+  (ProtobufCMessageInit) websocket__message_error__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
 #define websocket__low_on_keys__field_descriptors NULL
 #define websocket__low_on_keys__field_indices_by_name NULL
 #define websocket__low_on_keys__number_ranges NULL
@@ -1008,7 +1433,7 @@ const ProtobufCMessageDescriptor websocket__clientbound_message__descriptor =
   (ProtobufCMessageInit) websocket__clientbound_message__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor websocket__serverbound_message__field_descriptors[3] =
+static const ProtobufCFieldDescriptor websocket__serverbound_message__field_descriptors[5] =
 {
   {
     "id",
@@ -1046,16 +1471,42 @@ static const ProtobufCFieldDescriptor websocket__serverbound_message__field_desc
     PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "multi_forward",
+    4,
+    PROTOBUF_C_LABEL_OPTIONAL,
+    PROTOBUF_C_TYPE_MESSAGE,
+    offsetof(Websocket__ServerboundMessage, payload_case),
+    offsetof(Websocket__ServerboundMessage, multi_forward),
+    &websocket__multi_forward__descriptor,
+    NULL,
+    PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "batch",
+    5,
+    PROTOBUF_C_LABEL_OPTIONAL,
+    PROTOBUF_C_TYPE_MESSAGE,
+    offsetof(Websocket__ServerboundMessage, payload_case),
+    offsetof(Websocket__ServerboundMessage, batch),
+    &websocket__batch__descriptor,
+    NULL,
+    PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned websocket__serverbound_message__field_indices_by_name[] = {
+  4,   /* field[4] = batch */
   1,   /* field[1] = challenge_response */
   2,   /* field[2] = forward */
   0,   /* field[0] = id */
+  3,   /* field[3] = multi_forward */
 };
 static const ProtobufCIntRange websocket__serverbound_message__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 3 }
+  { 0, 5 }
 };
 const ProtobufCMessageDescriptor websocket__serverbound_message__descriptor =
 {
@@ -1065,7 +1516,7 @@ const ProtobufCMessageDescriptor websocket__serverbound_message__descriptor =
   "Websocket__ServerboundMessage",
   "websocket",
   sizeof(Websocket__ServerboundMessage),
-  3,
+  5,
   websocket__serverbound_message__field_descriptors,
   websocket__serverbound_message__field_indices_by_name,
   1,  websocket__serverbound_message__number_ranges,
@@ -21,7 +21,11 @@ typedef struct Websocket__MessageHeader Websocket__MessageHeader;
 typedef struct Websocket__EncryptedMessage Websocket__EncryptedMessage;
 typedef struct Websocket__PQXDHInit Websocket__PQXDHInit;
 typedef struct Websocket__Forward Websocket__Forward;
+typedef struct Websocket__MultiForward Websocket__MultiForward;
+typedef struct Websocket__Batch Websocket__Batch;
 typedef struct Websocket__Ack Websocket__Ack;
+typedef struct Websocket__RecipientError Websocket__RecipientError;
+typedef struct Websocket__MessageError Websocket__MessageError;
 typedef struct Websocket__LowOnKeys Websocket__LowOnKeys;
 typedef struct Websocket__ClientboundMessage Websocket__ClientboundMessage;
 typedef struct Websocket__ServerboundMessage Websocket__ServerboundMessage;
@@ -34,7 +38,8 @@ typedef enum _Websocket__Ack__Error {
   WEBSOCKET__ACK__ERROR__INVALID_SIGNATURE = 1,
   WEBSOCKET__ACK__ERROR__SERVER_ERROR = 2,
   WEBSOCKET__ACK__ERROR__UNKNOWN_IDENTITY = 3,
-  WEBSOCKET__ACK__ERROR__INVALID_MESSAGE = 4
+  WEBSOCKET__ACK__ERROR__INVALID_MESSAGE = 4,
+  WEBSOCKET__ACK__ERROR__RECIPIENT_QUEUE_FULL = 5
     PROTOBUF_C__FORCE_ENUM_TO_BE_INT_SIZE(WEBSOCKET__ACK__ERROR)
 } Websocket__Ack__Error;
 
@@ -146,10 +151,47 @@ struct  Websocket__Forward
      */
     Websocket__PQXDHInit *pqxdh_init;
   };
+  /*
+   * Shared body of a MultiForward
+   */
+  protobuf_c_boolean has_body;
+  ProtobufCBinaryData body;
 };
 #define WEBSOCKET__FORWARD__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&websocket__forward__descriptor) \
-, NULL, WEBSOCKET__FORWARD__PAYLOAD__NOT_SET, {0} }
+, NULL, WEBSOCKET__FORWARD__PAYLOAD__NOT_SET, {0}, 0, {0,NULL} }
+
+
+struct  Websocket__MultiForward
+{
+  ProtobufCMessage base;
+  /*
+   * Handle is the recipient's, body is unset
+   */
+  size_t n_recipients;
+  Websocket__Forward **recipients;
+  /*
+   * Sent once, delivered to every recipient
+   */
+  ProtobufCBinaryData body;
+};
+#define WEBSOCKET__MULTI_FORWARD__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&websocket__multi_forward__descriptor) \
+, 0,NULL, {0,NULL} }
+
+
+struct  Websocket__Batch
+{
+  ProtobufCMessage base;
+  /*
+   * The i-th one stands for message id + i
+   */
+  size_t n_forwards;
+  Websocket__Forward **forwards;
+};
+#define WEBSOCKET__BATCH__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&websocket__batch__descriptor) \
+, 0,NULL }
 
 
 struct  Websocket__Ack
@@ -158,10 +200,50 @@ struct  Websocket__Ack
   int64_t message_id;
   protobuf_c_boolean has_error;
   Websocket__Ack__Error error;
+  /*
+   * MultiForward only
+   */
+  size_t n_recipient_errors;
+  Websocket__RecipientError **recipient_errors;
+  /*
+   * Batch only, acks every id from message_id to this one
+   */
+  protobuf_c_boolean has_last_message_id;
+  int64_t last_message_id;
+  /*
+   * Batch only, the ids in that range that failed
+   */
+  size_t n_message_errors;
+  Websocket__MessageError **message_errors;
 };
 #define WEBSOCKET__ACK__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&websocket__ack__descriptor) \
-, 0, 0, WEBSOCKET__ACK__ERROR__UNAUTHENTICATED }
+, 0, 0, WEBSOCKET__ACK__ERROR__UNAUTHENTICATED, 0,NULL, 0, 0, 0,NULL }
+
+
+struct  Websocket__RecipientError
+{
+  ProtobufCMessage base;
+  /*
+   * Into MultiForward.recipients
+   */
+  uint32_t index;
+  Websocket__Ack__Error error;
+};
+#define WEBSOCKET__RECIPIENT_ERROR__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&websocket__recipient_error__descriptor) \
+, 0, WEBSOCKET__ACK__ERROR__UNAUTHENTICATED }
+
+
+struct  Websocket__MessageError
+{
+  ProtobufCMessage base;
+  int64_t message_id;
+  Websocket__Ack__Error error;
+};
+#define WEBSOCKET__MESSAGE_ERROR__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&websocket__message_error__descriptor) \
+, 0, WEBSOCKET__ACK__ERROR__UNAUTHENTICATED }
 
 
 struct  Websocket__LowOnKeys
@@ -201,7 +283,9 @@ struct  Websocket__ClientboundMessage
 typedef enum {
   WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD__NOT_SET = 0,
   WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD_CHALLENGE_RESPONSE = 2,
-  WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD_FORWARD = 3
+  WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD_FORWARD = 3,
+  WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD_MULTI_FORWARD = 4,
+  WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD_BATCH = 5
     PROTOBUF_C__FORCE_ENUM_TO_BE_INT_SIZE(WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD__CASE)
 } Websocket__ServerboundMessage__PayloadCase;
 
@@ -211,8 +295,10 @@ struct  Websocket__ServerboundMessage
   int64_t id;
   Websocket__ServerboundMessage__PayloadCase payload_case;
   union {
+    Websocket__Batch *batch;
     Websocket__ChallengeResponse *challenge_response;
     Websocket__Forward *forward;
+    Websocket__MultiForward *multi_forward;
   };
 };
 #define WEBSOCKET__SERVERBOUND_MESSAGE__INIT \
@@ -334,6 +420,44 @@ Websocket__Forward *
 void   websocket__forward__free_unpacked
                      (Websocket__Forward *message,
                       ProtobufCAllocator *allocator);
+/* Websocket__MultiForward methods */
+void   websocket__multi_forward__init
+                     (Websocket__MultiForward         *message);
+size_t websocket__multi_forward__get_packed_size
+                     (const Websocket__MultiForward   *message);
+size_t websocket__multi_forward__pack
+                     (const Websocket__MultiForward   *message,
+                      uint8_t             *out);
+size_t websocket__multi_forward__pack_to_buffer
+                     (const Websocket__MultiForward   *message,
+                      ProtobufCBuffer     *buffer);
+Websocket__MultiForward *
+       websocket__multi_forward__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   websocket__multi_forward__free_unpacked
+                     (Websocket__MultiForward *message,
+                      ProtobufCAllocator *allocator);
+/* Websocket__Batch methods */
+void   websocket__batch__init
+                     (Websocket__Batch         *message);
+size_t websocket__batch__get_packed_size
+                     (const Websocket__Batch   *message);
+size_t websocket__batch__pack
+                     (const Websocket__Batch   *message,
+                      uint8_t             *out);
+size_t websocket__batch__pack_to_buffer
+                     (const Websocket__Batch   *message,
+                      ProtobufCBuffer     *buffer);
+Websocket__Batch *
+       websocket__batch__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   websocket__batch__free_unpacked
+                     (Websocket__Batch *message,
+                      ProtobufCAllocator *allocator);
 /* Websocket__Ack methods */
 void   websocket__ack__init
                      (Websocket__Ack         *message);
@@ -353,6 +477,44 @@ Websocket__Ack *
 void   websocket__ack__free_unpacked
                      (Websocket__Ack *message,
                       ProtobufCAllocator *allocator);
+/* Websocket__RecipientError methods */
+void   websocket__recipient_error__init
+                     (Websocket__RecipientError         *message);
+size_t websocket__recipient_error__get_packed_size
+                     (const Websocket__RecipientError   *message);
+size_t websocket__recipient_error__pack
+                     (const Websocket__RecipientError   *message,
+                      uint8_t             *out);
+size_t websocket__recipient_error__pack_to_buffer
+                     (const Websocket__RecipientError   *message,
+                      ProtobufCBuffer     *buffer);
+Websocket__RecipientError *
+       websocket__recipient_error__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   websocket__recipient_error__free_unpacked
+                     (Websocket__RecipientError *message,
+                      ProtobufCAllocator *allocator);
+/* Websocket__MessageError methods */
+void   websocket__message_error__init
+                     (Websocket__MessageError         *message);
+size_t websocket__message_error__get_packed_size
+                     (const Websocket__MessageError   *message);
+size_t websocket__message_error__pack
+                     (const Websocket__MessageError   *message,
+                      uint8_t             *out);
+size_t websocket__message_error__pack_to_buffer
+                     (const Websocket__MessageError   *message,
+                      ProtobufCBuffer     *buffer);
+Websocket__MessageError *
+       websocket__message_error__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   websocket__message_error__free_unpacked
+                     (Websocket__MessageError *message,
+                      ProtobufCAllocator *allocator);
 /* Websocket__LowOnKeys methods */
 void   websocket__low_on_keys__init
                      (Websocket__LowOnKeys         *message);
@@ -430,9 +592,21 @@ typedef void (*Websocket__PQXDHInit_Closure)
 typedef void (*Websocket__Forward_Closure)
                  (const Websocket__Forward *message,
                   void *closure_data);
+typedef void (*Websocket__MultiForward_Closure)
+                 (const Websocket__MultiForward *message,
+                  void *closure_data);
+typedef void (*Websocket__Batch_Closure)
+                 (const Websocket__Batch *message,
+                  void *closure_data);
 typedef void (*Websocket__Ack_Closure)
                  (const Websocket__Ack *message,
                   void *closure_data);
+typedef void (*Websocket__RecipientError_Closure)
+                 (const Websocket__RecipientError *message,
+                  void *closure_data);
+typedef void (*Websocket__MessageError_Closure)
+                 (const Websocket__MessageError *message,
+                  void *closure_data);
 typedef void (*Websocket__LowOnKeys_Closure)
                  (const Websocket__LowOnKeys *message,
                   void *closure_data);
@@ -454,8 +628,12 @@ extern const ProtobufCMessageDescriptor websocket__message_header__descriptor;
 extern const ProtobufCMessageDescriptor websocket__encrypted_message__descriptor;
 extern const ProtobufCMessageDescriptor websocket__pqxdhinit__descriptor;
 extern const ProtobufCMessageDescriptor websocket__forward__descriptor;
+extern const ProtobufCMessageDescriptor websocket__multi_forward__descriptor;
+extern const ProtobufCMessageDescriptor websocket__batch__descriptor;
 extern const ProtobufCMessageDescriptor websocket__ack__descriptor;
 extern const ProtobufCEnumDescriptor    websocket__ack__error__descriptor;
+extern const ProtobufCMessageDescriptor websocket__recipient_error__descriptor;
+extern const ProtobufCMessageDescriptor websocket__message_error__descriptor;
 extern const ProtobufCMessageDescriptor websocket__low_on_keys__descriptor;
 extern const ProtobufCMessageDescriptor websocket__clientbound_message__descriptor;
 extern const ProtobufCMessageDescriptor websocket__serverbound_message__descriptor;
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <protobuf-c/protobuf-c.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// who asked for the memory, for the per-subsystem statistics
+enum alloc_tag {
+  ALLOC_HANDLERS,  // request handling code
+  ALLOC_PROTOBUF,  // unpacked protobuf-c messages
+  ALLOC_SQLITE,  // everything SQLite allocates, page cache included
+  ALLOC_MONGOOSE,  // connections and their iobufs
+  ALLOC_ASSETS,  // static files held in memory
+  ALLOC_TAG_COUNT,
+};
+
+struct alloc_stats {
+  _Atomic int64_t bytes;  // live, as usable size
+  _Atomic int64_t blocks;  // live
+  _Atomic uint64_t allocations;
+};
+
+extern struct alloc_stats alloc_stats[ALLOC_TAG_COUNT];
+
+// pass to protobuf-c's unpack and free_unpacked instead of NULL
+extern ProtobufCAllocator alloc_protobuf;
+
+/**
+ * Routes SQLite's allocations through this layer. Call before anything
+ * else touches SQLite.
+ */
+void alloc_init(void);
+
+/**
+ * The backend chosen with -DALLOCATOR=, "system", "jemalloc" or "mimalloc".
+ */
+const char *alloc_backend(void);
+
+const char *alloc_tag_name(enum alloc_tag tag);
+
+/**
+ * malloc and friends, counted against TAG. Memory must be freed with
+ * alloc_free and the same tag, never free(): the backend may not be the
+ * system allocator.
+ */
+void *alloc_malloc(enum alloc_tag tag, size_t size);
+void *alloc_calloc(enum alloc_tag tag, size_t n, size_t size);
+void *alloc_realloc(enum alloc_tag tag, void *ptr, size_t size);
+void alloc_free(enum alloc_tag tag, void *ptr);
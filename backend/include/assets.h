@@ -0,0 +1,33 @@
+#pragma once
+
+#include <mongoose.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ASSETS_RELOAD_DELAY_MS 250  // lets a build finish writing first
+#define ASSETS_RETRY_MS 1000  // while the directory is missing
+
+/**
+ * Loads every file under dir into memory, along with the .gz and .br files
+ * next to it as precompressed variants, and watches dir with inotify to
+ * reload it when it changes. Files named like Bun's hashed output
+ * (name-0123abcd.js) are served as immutable, everything else revalidates
+ * with its ETag.
+ * @return false if dir couldn't be loaded; requests get 404s until a
+ * reload succeeds.
+ */
+bool assets_init(const char *dir);
+void assets_close(void);
+
+/**
+ * Reloads the directory once it has settled after a change. Call from the
+ * event loop, it never blocks.
+ */
+void assets_poll(void);
+
+/**
+ * Replies to a GET or HEAD for a static file from memory, picking the
+ * best encoding the client accepts and answering If-None-Match with 304.
+ * Paths without an extension get index.html, for client-side routing.
+ */
+void assets_serve(struct mg_connection *c, struct mg_http_message *hm);
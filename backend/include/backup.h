@@ -0,0 +1,32 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <stdbool.h>
+
+#define BACKUP_PAGES_PER_STEP 64
+#define BACKUP_STEP_BUDGET_MS 5
+
+/**
+ * Starts an online backup of the directory database into path and, when
+ * sharded, of each shard next to it (see db_shard_path). With WAL, every
+ * file is copied from read transactions started together, so the set is
+ * one point in time. Each file is written to a temporary one next to it,
+ * and they are renamed over the old set only once all of them are
+ * complete; a failure before that leaves the old set alone, one during the
+ * renames can leave it mixed.
+ * @return false if a backup is already running or it could not be started.
+ */
+bool backup_start(const char *path);
+
+/**
+ * Copies pages for at most BACKUP_STEP_BUDGET_MS. Call between event loop
+ * iterations while backup_active() is true.
+ */
+void backup_step(void);
+
+bool backup_active(void);
+
+/**
+ * Abandons a running backup, e.g. on shutdown.
+ */
+void backup_abort(void);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLOBS_NAME_LEN 64  // hex sha256 of the content
+#define BLOBS_CHUNK_MAX (1 << 20)  // per upload request
+#define BLOBS_MAX_SIZE ((uint64_t)256 << 20)
+#define BLOBS_MAX_UPLOADS 64  // in progress at once
+#define BLOBS_OWNER_MAX_UPLOADS 4  // in progress at once per identity
+#define BLOBS_UPLOAD_IDLE_MS (10 * 60 * 1000)  // then the upload is dropped
+#define BLOBS_DEFAULT_TTL_S (30 * 24 * 60 * 60)
+#define BLOBS_DEFAULT_OWNER_MAX_BYTES ((uint64_t)1 << 30)  // per identity
+#define BLOBS_DEFAULT_MAX_BYTES ((uint64_t)16 << 30)  // all blobs together
+#define BLOBS_EXPIRE_INTERVAL_MS 1000
+#define BLOBS_EXPIRE_BATCH 256  // directory entries looked at per tick
+
+// seconds a blob is kept after its last upload
+extern unsigned blobs_ttl_s;
+// bytes of blobs, stored or being uploaded, that one identity may have
+extern uint64_t blobs_owner_max_bytes;
+// bytes of blobs, stored or being uploaded, kept on disk at most
+extern uint64_t blobs_max_bytes;
+
+enum blobs_status {
+  BLOBS_OK,  // chunk written, more to come
+  BLOBS_COMPLETE,  // last chunk written, the blob is readable
+  BLOBS_EXISTS,  // already stored, its expiry was pushed back
+  BLOBS_BAD_OFFSET,  // size holds where to resume from
+  BLOBS_BAD_REQUEST,
+  BLOBS_TOO_LARGE,
+  BLOBS_HASH_MISMATCH,  // the upload was dropped
+  BLOBS_LOCKED,  // someone else is uploading it
+  BLOBS_FULL,  // too many uploads in progress
+  BLOBS_BUSY,  // the owner has BLOBS_OWNER_MAX_UPLOADS in progress
+  BLOBS_OVER_QUOTA,  // the owner has too much stored already
+  BLOBS_NO_SPACE,  // blobs_max_bytes reached
+  BLOBS_ERROR,
+};
+
+/**
+ * Stores blobs as files named by their hash under dir, creating it if
+ * needed. Uploads in progress are written to <name>.part next to them.
+ * Who stored which blob is recorded in the directory database, which must
+ * be open already.
+ * @return false if dir can't be used.
+ */
+bool blobs_init(const char *dir);
+void blobs_close(void);
+
+/**
+ * Whether name is BLOBS_NAME_LEN lowercase hex digits.
+ */
+bool blobs_is_name(const char *name, size_t len);
+
+/**
+ * Appends len bytes at offset to the upload of the blob called name, which
+ * is total bytes long. The first chunk, at offset 0, starts the upload and
+ * makes owner the only one allowed to continue it. Content is hashed as it
+ * is written; once all of it is in, it must match name to be kept. The
+ * whole total is counted against the owner's quota and the global cap from
+ * the first chunk on, so an upload is either refused up front or can finish.
+ * @param[out] size bytes of the blob stored so far
+ */
+enum blobs_status blobs_write(const char *name, int64_t owner, uint64_t offset,
+                              uint64_t total, const void *data, size_t len,
+                              uint64_t *size);
+
+/**
+ * Formats the path of the stored blob called name into buf.
+ * @return false if there is no such blob.
+ */
+bool blobs_path(const char *name, char *buf, size_t len);
+
+/**
+ * Deletes blobs older than blobs_ttl_s and abandoned uploads, looking at
+ * BLOBS_EXPIRE_BATCH directory entries per call and wrapping around at the
+ * end. Meant to be run periodically from an mg_timer (arg is unused).
+ */
+void blobs_expire_tick(void *arg);
@@ -1,8 +1,120 @@
 #pragma once
 
 #include <sqlite3.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
+#define DB_READERS 4
+#define DB_MAX_SHARDS 64
+#define DB_PROFILE_STATEMENTS 256  // distinct statements, the rest is lumped
+#define DB_PROFILE_SQL_MAX 192  // normalized text kept per statement
+
+// Writer connection of the directory database (identities, tombstones).
+// Per-identity data (opks, pqopks, queue, queue_usage) lives on the shard
+// returned by db_shard(); unsharded, that is this same connection.
+// Select-only paths go through db_read_stmt/db_shard_read_stmt.
 extern sqlite3 *db;
 
-int db_init(sqlite3 **out, const char *path);
+// statements prepared once per read-only connection
+enum db_read_stmt {
+  // directory
+  DB_READ_IDENTITY_BY_HANDLE,
+  DB_READ_ID_BY_HANDLE,
+  DB_READ_HANDLE_BY_ID,
+  DB_READ_IDS_BY_HANDLES,  // bound to a JSON array of handles
+  DB_READ_BUNDLE_BY_HANDLE,
+  DB_READ_BLOB_USAGE,
+  // shards
+  DB_READ_PQOPK,
+  DB_READ_OPK,
+  DB_READ_PQOPK_COUNT,
+  DB_READ_OPK_COUNT,
+  DB_READ_QUEUE,
+  DB_READ_QUEUE_USAGE,
+  DB_READ_QUEUE_COUNT,
+  DB_READ_STMT_COUNT
+};
+
+/**
+ * Opens the directory database at path and, with shards > 1, one more file
+ * per shard next to it (see db_shard_path). The shard count is recorded in
+ * the directory and can't be changed afterwards.
+ */
+int db_init(sqlite3 **out, const char *path, int shards);
 void db_close(sqlite3 *db);
+
+int db_shard_count(void);
+
+/**
+ * Formats the file name of shard i for a database at path.
+ */
+void db_shard_path(char *buf, size_t size, const char *path, int i);
+
+/**
+ * @return the writer connection of the shard holding id's data.
+ */
+sqlite3 *db_shard(int64_t id);
+
+/**
+ * @return the writer connection of shard i, for 0 <= i < db_shard_count().
+ */
+sqlite3 *db_shard_at(int i);
+
+/**
+ * Begins a transaction on the directory and, if it is a separate database,
+ * on the shard too. db_commit commits the directory first, so an id that
+ * shard rows were written for is always burned (ids are autoincrement and
+ * never reused). A shard failure in between can leave directory rows without
+ * their shard rows, which the caller has to clean up.
+ */
+int db_begin(sqlite3 *shard);
+int db_commit(sqlite3 *shard);
+void db_rollback(sqlite3 *shard);
+
+/**
+ * Checks out a cached directory statement from one of the pooled read-only
+ * connections. Error messages are available via sqlite3_db_handle() on the
+ * statement.
+ * @return NULL if every connection has that statement checked out already.
+ */
+sqlite3_stmt *db_read_stmt(enum db_read_stmt which);
+
+/**
+ * Like db_read_stmt, for statements on the shard holding id's data.
+ */
+sqlite3_stmt *db_shard_read_stmt(enum db_read_stmt which, int64_t id);
+
+/**
+ * Resets a statement obtained from db_read_stmt or db_shard_read_stmt and
+ * returns it to the pool.
+ */
+void db_read_done(sqlite3_stmt *stmt);
+
+/**
+ * Installs cb as the sqlite3_trace_v2 callback of every connection, writers
+ * and readers alike, next to the profiler if it is running. A NULL cb
+ * removes it.
+ */
+void db_trace(unsigned mask,
+              int (*cb)(unsigned type, void *ctx, void *p, void *x),
+              void *ctx);
+
+/**
+ * Starts profiling statements on every connection. With aggregate, calls,
+ * run time and rows are summed per statement text, literals replaced by ?,
+ * for db_profile_write/db_profile_log. With slow_ms > 0, statements taking
+ * at least that long are logged as they finish.
+ */
+void db_profile_start(bool aggregate, unsigned slow_ms);
+
+/**
+ * Writes the aggregated statements as a text table, most total time first.
+ */
+void db_profile_write(FILE *f);
+
+/**
+ * Logs the aggregated statements, one info record each.
+ */
+void db_profile_log(void);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <mongoose.h>
+
+void handle_blob_request(struct mg_connection *c, struct mg_http_message *hm,
+                         struct mg_str *hash);
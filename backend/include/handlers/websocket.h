@@ -4,6 +4,16 @@
 
 #include "websocket.pb-c.h"
 
+#define WS_MULTI_FORWARD_MAX_RECIPIENTS 256
+#define WS_BATCH_MAX_FORWARDS 1024
+
+enum ws_send_status {
+  WS_SEND_DELIVERED,   // written to the recipient's open connection
+  WS_SEND_QUEUED,      // recipient offline, stored in the queue
+  WS_SEND_QUEUE_FULL,  // recipient offline and over quota, dropped
+  WS_SEND_FAILED,
+};
+
 struct ws_ctx {
   uint8_t nonce[32];  // challenge bytes
   int64_t id;
@@ -19,4 +29,20 @@ void handle_ws_challenge_response_pb(struct mg_connection *c,
 void handle_ws_authenticated(struct mg_connection *c);
 void handle_ws_forward_pb(struct mg_connection *c, Websocket__Forward *msg,
                           int64_t msg_id);
-bool ws_send_by_id(struct mg_mgr *mgr, int64_t id, const void *buf, size_t len);
+/**
+ * Sends every recipient of msg a Forward with its own payload and the shared
+ * body, after resolving all their handles in a single query. Answers with
+ * one Ack listing the recipients that could not be sent to, by index.
+ */
+void handle_ws_multi_forward_pb(struct mg_connection *c,
+                                Websocket__MultiForward *msg, int64_t msg_id);
+/**
+ * Handles each forward of msg in order as if it had come on its own, with
+ * message id msg_id plus its index. Answers with one Ack covering that whole
+ * range of ids, listing only the ones that failed.
+ */
+void handle_ws_batch_pb(struct mg_connection *c, Websocket__Batch *msg,
+                        int64_t msg_id);
+enum ws_send_status ws_send_by_id(struct mg_mgr *mgr, int64_t id,
+                                  const void *buf, size_t len);
+void ws_close_by_id(struct mg_mgr *mgr, int64_t id);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LOG_RING_SLOTS 1024  // records buffered per thread, power of two
+#define LOG_RECORD_SIZE 480  // longer messages are truncated
+#define LOG_MAX_THREADS 16
+#define LOG_RATE_BURST 10  // warnings/errors per call site per second
+#define LOG_FLUSH_INTERVAL_MS 10
+
+enum log_level {
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARN,
+  LOG_LEVEL_ERROR,
+};
+
+extern enum log_level log_level;
+
+// rate limiting state, one per call site
+struct log_site {
+  _Atomic uint64_t window;  // second the count applies to
+  _Atomic uint32_t count;
+  _Atomic uint32_t suppressed;
+};
+
+/**
+ * Logs a printf-style message tagged with the calling function and line.
+ * Extra context goes into the message as key=value fields, e.g.
+ * log_info("request conn=%lu status=%d", c->id, status).
+ */
+#define log_at(LEVEL, ...)                                             \
+  do {                                                                 \
+    static struct log_site log_site_;                                  \
+    if ((LEVEL) >= log_level)                                          \
+      log_write(&log_site_, (LEVEL), __func__, __LINE__, __VA_ARGS__); \
+  } while (0)
+
+#define log_debug(...) log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_info(...) log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error(...) log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+/**
+ * Formats a record into the calling thread's ring buffer without blocking.
+ * Records are dropped (and counted) when the ring is full, and warnings or
+ * errors beyond LOG_RATE_BURST per second from one call site are suppressed
+ * until the next second. Before log_start() records are written directly.
+ */
+void log_write(struct log_site *site, enum log_level level, const char *func,
+               int line, const char *fmt, ...)
+    __attribute__((format(printf, 5, 6)));
+
+/**
+ * Starts the background thread that writes buffered records, info and
+ * below to stdout, warnings and errors to stderr.
+ */
+bool log_start(void);
+
+/**
+ * Writes out everything still buffered and stops the background thread.
+ */
+void log_stop(void);
+
+bool log_parse_level(const char *s, enum log_level *out);
+
+uint64_t log_dropped(void);
+uint64_t log_suppressed(void);
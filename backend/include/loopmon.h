@@ -0,0 +1,36 @@
+#pragma once
+
+#include <mongoose.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LOOPMON_DEFAULT_SLOW_HANDLER_MS 100
+#define LOOPMON_MAX_FRAMES 16
+#define LOOPMON_MAX_DEPTH 8  // of nested handlers kept apart
+
+extern unsigned loopmon_slow_handler_ms;  // 0 disables the watchdog
+
+/**
+ * Starts the watchdog thread. Call from the event loop thread: when a
+ * handler runs past loopmon_slow_handler_ms the watchdog signals this
+ * thread to capture a backtrace of whatever is blocking it, which is then
+ * logged with the slow handler warning.
+ */
+bool loopmon_start(void);
+void loopmon_stop(void);
+
+/**
+ * Bracket one mg_mgr_poll call.
+ */
+void loopmon_iteration_begin(void);
+void loopmon_iteration_end(void);
+
+/**
+ * Bracket one call of an event handler. Calls may nest: a nested handler's
+ * time is taken out of the one it ran in, and only the outermost one counts
+ * towards loop busy time and the watchdog.
+ * @return the start timestamp to pass to loopmon_handler_end.
+ */
+uint64_t loopmon_handler_begin(void);
+void loopmon_handler_end(uint64_t started_at, struct mg_connection *c,
+                         int ev, void *ev_data);
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <mongoose.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// log-linear latency buckets in microseconds: 1, 2, 3, 4, then 4 buckets per
+// power of two (~25% resolution) up to 2^25 us (~33 s), plus overflow
+#define METRICS_SUB_BITS 2
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_EXPONENT 24
+#define METRICS_BUCKETS (METRICS_SUB_BUCKETS * METRICS_MAX_EXPONENT)
+
+#define METRICS_INC(FIELD) METRICS_ADD(FIELD, 1)
+#define METRICS_ADD(FIELD, N) \
+  atomic_fetch_add_explicit(&metrics.FIELD, (N), memory_order_relaxed)
+#define METRICS_SUB(FIELD, N) \
+  atomic_fetch_sub_explicit(&metrics.FIELD, (N), memory_order_relaxed)
+
+enum metrics_route {
+  METRICS_ROUTE_IDENTITY_POST,
+  METRICS_ROUTE_IDENTITY_PATCH,
+  METRICS_ROUTE_IDENTITY_DELETE,
+  METRICS_ROUTE_BUNDLE,
+  METRICS_ROUTE_BLOB_PUT,
+  METRICS_ROUTE_BLOB_GET,
+  METRICS_ROUTE_WS,
+  METRICS_ROUTE_STATIC,
+  METRICS_ROUTE_OPTIONS,
+  METRICS_ROUTE_OTHER,
+  METRICS_ROUTE_COUNT,
+};
+
+enum metrics_ws_type {
+  METRICS_WS_CHALLENGE_RESPONSE,
+  METRICS_WS_FORWARD,
+  METRICS_WS_MULTI_FORWARD,
+  METRICS_WS_BATCH,
+  METRICS_WS_INVALID,  // undecodable, wrong opcode or unknown payload
+  METRICS_WS_COUNT,
+};
+
+// event loop callbacks, see loopmon.h
+enum metrics_event {
+  METRICS_EV_ACCEPT,
+  METRICS_EV_READ,
+  METRICS_EV_WRITE,
+  METRICS_EV_CLOSE,
+  METRICS_EV_HTTP_MSG,
+  METRICS_EV_WS_OPEN,
+  METRICS_EV_WS_MSG,
+  METRICS_EV_OTHER,
+  METRICS_EV_COUNT,
+};
+
+struct metrics_histogram {
+  _Atomic uint64_t buckets[METRICS_BUCKETS + 1];  // last one is overflow
+  _Atomic uint64_t sum_ns;
+};
+
+struct metrics {
+  struct metrics_histogram http[METRICS_ROUTE_COUNT];
+  _Atomic uint64_t http_status[METRICS_ROUTE_COUNT][6];  // by status / 100
+  struct metrics_histogram ws[METRICS_WS_COUNT];
+  struct metrics_histogram sqlite;  // per statement, first step to reset
+  struct metrics_histogram xeddsa_verify;
+
+  _Atomic int64_t connections;
+  _Atomic uint64_t connections_accepted;
+  _Atomic int64_t ws_sessions;  // authenticated websockets
+  _Atomic uint64_t bytes_in, bytes_out;
+
+  _Atomic uint64_t forwards_delivered;  // written to an open connection
+  _Atomic uint64_t queue_enqueued, queue_rejected, queue_drained;
+  _Atomic uint64_t blobs_stored, blobs_expired;
+
+  struct metrics_histogram handlers[METRICS_EV_COUNT];
+  struct metrics_histogram loop_iteration;  // one mg_mgr_poll, waiting included
+  struct metrics_histogram loop_busy;  // handler time within one iteration
+  _Atomic uint64_t loop_iterations, loop_events;
+  _Atomic int64_t loop_last_events;  // handled by the latest iteration
+  _Atomic uint64_t slow_handlers;
+};
+
+extern struct metrics metrics;
+
+// required as a bearer token by /debug/pprof/profile, which is off if NULL
+extern const char *metrics_admin_token;
+
+uint64_t metrics_now_ns(void);
+
+const char *metrics_route_name(enum metrics_route route);
+const char *metrics_ws_type_name(enum metrics_ws_type type);
+const char *metrics_event_name(enum metrics_event ev);
+
+void metrics_observe(struct metrics_histogram *h, uint64_t ns);
+
+/**
+ * Starts collecting SQLite statement timings. Everything else is always
+ * counted, this adds a trace callback to every connection so it is only
+ * turned on when metrics are actually exported.
+ */
+void metrics_init(void);
+
+/**
+ * Event handler for the metrics listener. Serves /metrics in the Prometheus
+ * text format, /debug/trace as Chrome trace JSON, /debug/sql as a text
+ * table and /debug/pprof/profile?seconds=N as a pprof CPU profile.
+ */
+void handle_metrics_event(struct mg_connection *c, int ev, void *ev_data);
@@ -0,0 +1,72 @@
+#pragma once
+
+/**
+ * USDT probes under the "chat" provider, e.g.
+ *
+ *   bpftrace -e 'usdt:./build/chat_server:chat:forward_queued
+ *                { @[arg0] = count(); }'
+ *   perf buildid-cache --add ./build/chat_server && perf list sdt_chat:*
+ *
+ * Each one compiles to a single nop plus an ELF note describing where its
+ * arguments live, so a detached probe costs nothing beyond computing them:
+ * only pass values that are at hand anyway, and guard any that aren't with
+ * PROBE_ENABLED(NAME), which reads the semaphore a tracer bumps on attach.
+ * Without <sys/sdt.h> (see HAVE_SYS_SDT_H in CMakeLists.txt) they compile to
+ * nothing and PROBE_ENABLED is always false.
+ *
+ *   ws_open(conn)
+ *   ws_auth(conn, id)
+ *   ws_close(conn, id)                        id is -1 if never authenticated
+ *   ws_message(conn, type, bytes, latency_ns) type as in metrics_ws_type_name
+ *   forward_received(from_id, to_id, bytes)
+ *   forward_delivered(to_id, bytes)
+ *   forward_queued(to_id, bytes, result)      result is a queue_result
+ *   queue_drain_start(id)
+ *   queue_drain_end(id, messages, bytes, latency_ns)
+ *   bundle_served(id, bytes, has_opk, has_pqopk)
+ *   opk_exhausted(id)
+ *   sqlite_commit(rc, latency_ns)
+ *   http_request(conn, route, status, latency_ns) route as in
+ *                                             metrics_route_name
+ */
+
+// every probe, each of which needs a semaphore defined in probes.c
+#define PROBES(X)      \
+  X(ws_open)           \
+  X(ws_auth)           \
+  X(ws_close)          \
+  X(ws_message)        \
+  X(forward_received)  \
+  X(forward_delivered) \
+  X(forward_queued)    \
+  X(queue_drain_start) \
+  X(queue_drain_end)   \
+  X(bundle_served)     \
+  X(opk_exhausted)     \
+  X(sqlite_commit)     \
+  X(http_request)
+
+#ifdef HAVE_SYS_SDT_H
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PROBE_SEMAPHORE_DECLARE(NAME) \
+  extern volatile unsigned short chat_##NAME##_semaphore;
+PROBES(PROBE_SEMAPHORE_DECLARE)
+
+#define PROBE_ENABLED(NAME) __builtin_expect(chat_##NAME##_semaphore != 0, 0)
+
+#define PROBE0(NAME) DTRACE_PROBE(chat, NAME)
+#define PROBE1(NAME, A) DTRACE_PROBE1(chat, NAME, A)
+#define PROBE2(NAME, A, B) DTRACE_PROBE2(chat, NAME, A, B)
+#define PROBE3(NAME, A, B, C) DTRACE_PROBE3(chat, NAME, A, B, C)
+#define PROBE4(NAME, A, B, C, D) DTRACE_PROBE4(chat, NAME, A, B, C, D)
+#else
+#define PROBE_ENABLED(NAME) 0
+// sizeof keeps the arguments referenced without evaluating them
+#define PROBE0(NAME) ((void)0)
+#define PROBE1(NAME, A) ((void)sizeof(A))
+#define PROBE2(NAME, A, B) ((void)sizeof(A), (void)sizeof(B))
+#define PROBE3(NAME, A, B, C) (PROBE2(NAME, A, B), (void)sizeof(C))
+#define PROBE4(NAME, A, B, C, D) (PROBE3(NAME, A, B, C), (void)sizeof(D))
+#endif
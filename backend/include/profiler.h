@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define PROFILER_HZ 99  // off the 100 Hz tick so samples don't alias with it
+#define PROFILER_MAX_SECONDS 60
+#define PROFILER_MAX_SAMPLES 16384  // later ones are dropped
+#define PROFILER_MAX_FRAMES 64
+
+/**
+ * Starts sampling the stacks of whichever threads are on CPU, PROFILER_HZ
+ * times per second of process CPU time (ITIMER_PROF + SIGPROF), for the
+ * given number of seconds.
+ * @return false if a profile is already being taken or on error.
+ */
+bool profiler_start(unsigned seconds);
+
+/**
+ * Stops sampling once the duration has elapsed. Call periodically from the
+ * event loop.
+ * @return true when the profile is complete and can be written.
+ */
+bool profiler_poll(void);
+
+/**
+ * Stops sampling early and discards the profile.
+ */
+void profiler_stop(void);
+
+/**
+ * Writes the completed profile as an uncompressed pprof profile.proto and
+ * frees it. Frames are named with dladdr() where the symbol is exported,
+ * the rest carry their mapping so `pprof` can symbolize them from the
+ * binaries.
+ */
+void profiler_write_pprof(FILE *f);
@@ -0,0 +1,10 @@
+#pragma once
+
+#define PURGE_INTERVAL_MS 250
+#define PURGE_BATCH_SIZE 256
+
+/**
+ * Deletes up to PURGE_BATCH_SIZE rows belonging to tombstoned identities.
+ * Meant to be run periodically from an mg_timer (arg is unused).
+ */
+void purge_tick(void *arg);
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define QUEUE_DEFAULT_MAX_MESSAGES 10000
+#define QUEUE_DEFAULT_MAX_BYTES (64 * 1024 * 1024)
+
+extern int64_t queue_max_messages;
+extern int64_t queue_max_bytes;
+
+enum queue_result {
+  QUEUE_OK,
+  QUEUE_FULL,
+  QUEUE_ERROR,
+};
+
+// A part of a message that is queued for several recipients, stored once
+// per shard however many of them it is queued for.
+struct queue_payload {
+  const void *buf;
+  size_t len;
+  uint8_t hash[32];  // sha256 of buf, identifies the stored copy
+};
+
+/**
+ * Sums up what is queued already, for queue_depth. Call once the database
+ * is open.
+ * @return false if it couldn't be read.
+ */
+bool queue_init(void);
+
+/**
+ * Reports the messages and bytes queued for every identity together, kept
+ * up to date as they are pushed and released.
+ */
+void queue_depth(int64_t *messages, int64_t *bytes);
+
+/**
+ * Takes a deleted identity's usage counters, dropped along with its queue,
+ * out of queue_depth.
+ */
+void queue_discard(int64_t messages, int64_t bytes);
+
+/**
+ * Stores a message for an offline identity, enforcing the per-recipient
+ * message count and byte quotas.
+ * @return QUEUE_FULL if storing the message would exceed either quota.
+ */
+enum queue_result queue_push(int64_t id, const void *buf, size_t len);
+
+/**
+ * Hashes buf into a payload that can be passed to queue_push_shared.
+ * @return false if hashing failed.
+ */
+bool queue_payload_init(struct queue_payload *payload, const void *buf,
+                        size_t len);
+
+/**
+ * Like queue_push, for a message that is only complete with payload. The
+ * queued row references the stored payload, which is added on first use
+ * and deleted along with the last row referencing it. Both parts count
+ * towards the recipient's quota.
+ */
+enum queue_result queue_push_shared(int64_t id, const void *buf, size_t len,
+                                    const struct queue_payload *payload);
+
+/**
+ * Starts a batch of pushes: until queue_batch_end, the first push to each
+ * shard opens a transaction that the rest of them join, so the batch costs
+ * one commit per shard instead of one per message.
+ */
+void queue_batch_begin(void);
+
+/**
+ * Commits the transactions of the batch. A shard that fails to commit is
+ * rolled back, and queue_batch_lost tells which pushes went with it.
+ * @return false if any shard failed to commit.
+ */
+bool queue_batch_end(void);
+
+/**
+ * @return true if the last batch's pushes to id were rolled back.
+ */
+bool queue_batch_lost(int64_t id);
+
+/**
+ * Releases quota after queued messages have been delivered and deleted.
+ */
+void queue_release(int64_t id, int64_t messages, int64_t bytes);
+
+/**
+ * Drops the in-memory counters of a deleted identity.
+ */
+void queue_forget(int64_t id);
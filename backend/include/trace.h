@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+#define TRACE_MAX_SPANS 32  // per request, later ones are dropped
+#define TRACE_BUFFER_REQUESTS 1024  // kept per thread, oldest overwritten
+
+extern unsigned trace_sample_every;  // trace 1 in N requests, 0 disables
+extern uint64_t trace_slow_us;  // only keep requests taking at least this
+extern _Thread_local bool trace_sampled;
+
+/**
+ * Marks the start and end of a stage within the current request. SPAN is
+ * a uint64_t holding the start timestamp, 0 when the request isn't sampled:
+ *
+ *   uint64_t span;
+ *   TRACE_BEGIN(span);
+ *   ...
+ *   TRACE_END(span, "bundle.pack");
+ *
+ * Stages skipped by an early exit simply don't show up.
+ */
+#define TRACE_BEGIN(SPAN) ((SPAN) = trace_sampled ? trace_ticks() : 0)
+#define TRACE_END(SPAN, NAME)             \
+  do {                                    \
+    if (SPAN) trace_span((NAME), (SPAN)); \
+  } while (0)
+
+static inline uint64_t trace_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Records the time origin used to convert timestamps on export. Call once
+ * before any request is traced.
+ */
+void trace_init(void);
+
+/**
+ * Decides whether the request starting now on this thread is sampled and
+ * starts its outer span.
+ */
+void trace_request_begin(void);
+
+/**
+ * Ends the outer span of the current request, named after NAME (which must
+ * outlive the trace), and keeps it if it was slow enough.
+ */
+void trace_request_end(const char *name);
+
+void trace_span(const char *name, uint64_t begin);
+
+/**
+ * Writes the buffered requests as Chrome trace event JSON, one row per
+ * request, loadable in chrome://tracing or Perfetto.
+ */
+void trace_write_json(FILE *f);
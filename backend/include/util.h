@@ -3,6 +3,9 @@
 #include <mongoose.h>
 #include <openssl/pem.h>
 
+#define HANDLE_MIN_LENGTH 3
+#define HANDLE_MAX_LENGTH 32
+
 /**
  * Verifies a signed HTTP request
  * @param hm Pointer to the HTTP message to verify.
@@ -12,3 +15,17 @@
  * failure.
  */
 int64_t verify_request(struct mg_http_message* hm, void** id_key);
+
+/**
+ * xeddsa_verify, timed into the XEdDSA verify metrics.
+ */
+bool verify_signature(const uint8_t* pk, const uint8_t* msg, size_t msg_len,
+                      const uint8_t* sig);
+
+/**
+ * Checks a handle is HANDLE_MIN_LENGTH to HANDLE_MAX_LENGTH lowercase
+ * letters, digits and single underscores, starting with a letter and not
+ * ending with an underscore.
+ * @return 1 if it is, 0 otherwise (or if handle is NULL).
+ */
+int validate_handle(const char* handle);
@@ -0,0 +1,144 @@
+#include "alloc.h"
+
+#include <mongoose.h>
+#include <sqlite3.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#if defined(ALLOC_MIMALLOC)
+#include <mimalloc.h>
+#define BACKEND "mimalloc"
+#define backend_malloc mi_malloc
+#define backend_calloc mi_calloc
+#define backend_realloc mi_realloc
+#define backend_free mi_free
+#define backend_usable_size mi_usable_size
+#elif defined(ALLOC_JEMALLOC)
+// built without a prefix, jemalloc replaces malloc itself
+#include <jemalloc/jemalloc.h>
+#define BACKEND "jemalloc"
+#define backend_malloc malloc
+#define backend_calloc calloc
+#define backend_realloc realloc
+#define backend_free free
+#define backend_usable_size malloc_usable_size
+#else
+#include <malloc.h>
+#define BACKEND "system"
+#define backend_malloc malloc
+#define backend_calloc calloc
+#define backend_realloc realloc
+#define backend_free free
+#define backend_usable_size malloc_usable_size
+#endif
+
+struct alloc_stats alloc_stats[ALLOC_TAG_COUNT];
+
+static const char *s_tag_names[ALLOC_TAG_COUNT] = {
+    [ALLOC_HANDLERS] = "handlers",
+    [ALLOC_PROTOBUF] = "protobuf",
+    [ALLOC_SQLITE] = "sqlite",
+    [ALLOC_MONGOOSE] = "mongoose",
+    [ALLOC_ASSETS] = "assets",
+};
+
+const char *alloc_backend(void) { return BACKEND; }
+
+const char *alloc_tag_name(enum alloc_tag tag) { return s_tag_names[tag]; }
+
+static void count(enum alloc_tag tag, int64_t bytes, int64_t blocks) {
+  struct alloc_stats *s = &alloc_stats[tag];
+  atomic_fetch_add_explicit(&s->bytes, bytes, memory_order_relaxed);
+  atomic_fetch_add_explicit(&s->blocks, blocks, memory_order_relaxed);
+  if (blocks > 0)
+    atomic_fetch_add_explicit(&s->allocations, 1, memory_order_relaxed);
+}
+
+void *alloc_malloc(enum alloc_tag tag, size_t size) {
+  void *ptr = backend_malloc(size);
+  if (ptr) count(tag, backend_usable_size(ptr), 1);
+  return ptr;
+}
+
+void *alloc_calloc(enum alloc_tag tag, size_t n, size_t size) {
+  void *ptr = backend_calloc(n, size);
+  if (ptr) count(tag, backend_usable_size(ptr), 1);
+  return ptr;
+}
+
+void *alloc_realloc(enum alloc_tag tag, void *ptr, size_t size) {
+  if (!ptr) return alloc_malloc(tag, size);
+
+  size_t old_size = backend_usable_size(ptr);
+  void *grown = backend_realloc(ptr, size);
+  if (grown) count(tag, (int64_t)backend_usable_size(grown) - old_size, 0);
+  return grown;
+}
+
+void alloc_free(enum alloc_tag tag, void *ptr) {
+  if (!ptr) return;
+  count(tag, -(int64_t)backend_usable_size(ptr), -1);
+  backend_free(ptr);
+}
+
+static void *protobuf_alloc(void *data, size_t size) {
+  (void)data;
+  return alloc_malloc(ALLOC_PROTOBUF, size);
+}
+
+static void protobuf_free(void *data, void *ptr) {
+  (void)data;
+  alloc_free(ALLOC_PROTOBUF, ptr);
+}
+
+ProtobufCAllocator alloc_protobuf = {protobuf_alloc, protobuf_free, NULL};
+
+#if MG_ENABLE_CUSTOM_CALLOC
+// mongoose allocates connections and iobufs through these
+void *mg_calloc(size_t n, size_t size) {
+  return alloc_calloc(ALLOC_MONGOOSE, n, size);
+}
+
+void mg_free(void *ptr) { alloc_free(ALLOC_MONGOOSE, ptr); }
+#endif
+
+static void *sqlite_malloc(int size) {
+  return alloc_malloc(ALLOC_SQLITE, size);
+}
+
+static void sqlite_free(void *ptr) { alloc_free(ALLOC_SQLITE, ptr); }
+
+static void *sqlite_realloc(void *ptr, int size) {
+  return alloc_realloc(ALLOC_SQLITE, ptr, size);
+}
+
+static int sqlite_size(void *ptr) {
+  return ptr ? (int)backend_usable_size(ptr) : 0;
+}
+
+static int sqlite_roundup(int size) { return (size + 7) & ~7; }
+
+static int sqlite_init(void *data) {
+  (void)data;
+  return SQLITE_OK;
+}
+
+static void sqlite_shutdown(void *data) { (void)data; }
+
+void alloc_init(void) {
+  static const sqlite3_mem_methods methods = {
+      .xMalloc = sqlite_malloc,
+      .xFree = sqlite_free,
+      .xRealloc = sqlite_realloc,
+      .xSize = sqlite_size,
+      .xRoundup = sqlite_roundup,
+      .xInit = sqlite_init,
+      .xShutdown = sqlite_shutdown,
+  };
+
+  int rc;
+  if ((rc = sqlite3_config(SQLITE_CONFIG_MALLOC, &methods)) != SQLITE_OK)
+    log_error("sqlite3_config failed: %d (%s)", rc, sqlite3_errstr(rc));
+}
@@ -0,0 +1,457 @@
+#include "assets.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "log.h"
+
+#define WATCH_MASK                                                     \
+  (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+   IN_DELETE_SELF | IN_MOVE_SELF)
+
+enum asset_encoding { ENC_IDENTITY, ENC_GZIP, ENC_BROTLI, ENC_COUNT };
+
+static const char *s_encoding_names[ENC_COUNT] = {
+    [ENC_IDENTITY] = NULL,
+    [ENC_GZIP] = "gzip",
+    [ENC_BROTLI] = "br",
+};
+
+static const char *s_encoding_suffixes[ENC_COUNT] = {
+    [ENC_IDENTITY] = "",
+    [ENC_GZIP] = ".gz",
+    [ENC_BROTLI] = ".br",
+};
+
+struct asset {
+  char *path;  // from the root, with a leading slash
+  const char *mime;
+  bool immutable;
+  char etag[ENC_COUNT][40];  // quoted, one per variant
+  struct {
+    char *data;
+    size_t len;
+  } variants[ENC_COUNT];  // data is NULL where there is no such variant
+};
+
+// everything loaded from the directory, replaced as a whole on reload
+struct asset_set {
+  struct asset *items;
+  size_t n, cap;
+  size_t *slots;  // index + 1 into items, 0 is empty
+  size_t n_slots;
+  size_t bytes;
+  const struct asset *index;
+};
+
+static char *s_dir;
+static struct asset_set s_set;
+static int s_inotify = -1;
+static uint64_t s_reload_at;  // mg_millis(), 0 if no reload is pending
+
+static const struct {
+  const char *ext, *mime;
+} s_mime_types[] = {
+    {"html", "text/html; charset=utf-8"},
+    {"js", "text/javascript; charset=utf-8"},
+    {"mjs", "text/javascript; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},
+    {"json", "application/json"},
+    {"map", "application/json"},
+    {"webmanifest", "application/manifest+json"},
+    {"txt", "text/plain; charset=utf-8"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"ico", "image/x-icon"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"wasm", "application/wasm"},
+};
+
+static const char *mime_of(const char *path) {
+  const char *dot = strrchr(path, '.');
+  if (dot && !strchr(dot, '/')) {
+    for (size_t i = 0; i < sizeof s_mime_types / sizeof *s_mime_types; ++i)
+      if (strcmp(dot + 1, s_mime_types[i].ext) == 0)
+        return s_mime_types[i].mime;
+  }
+  return "application/octet-stream";
+}
+
+/**
+ * Bun names chunks and assets name-[hash].ext with an 8 character hash, so
+ * their content never changes under the same name. Only exactly 8
+ * lowercase alphanumerics with at least one digit are taken for a hash, so
+ * that names like index-fallback.html aren't cached for good; a hash that
+ * happens to be all letters just misses out.
+ */
+static bool is_hashed(const char *path) {
+  const char *name = strrchr(path, '/');
+  name = name ? name + 1 : path;
+
+  for (const char *p = strchr(name, '-'); p; p = strchr(p + 1, '-')) {
+    const char *q = p + 1;
+    bool digit = false;
+    while ((*q >= 'a' && *q <= 'z') || isdigit((unsigned char)*q))
+      digit |= isdigit((unsigned char)*q++) != 0;
+    if (q - p == 9 && digit && *q == '.') return true;
+  }
+  return false;
+}
+
+static uint64_t hash_path(const char *s, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;  // FNV-1a
+  for (size_t i = 0; i < len; ++i)
+    h = (h ^ (unsigned char)s[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+static const struct asset *find(const struct asset_set *set, const char *path,
+                                size_t len) {
+  if (!set->n_slots) return NULL;
+  for (size_t i = hash_path(path, len) & (set->n_slots - 1);;
+       i = (i + 1) & (set->n_slots - 1)) {
+    if (!set->slots[i]) return NULL;
+    const struct asset *a = &set->items[set->slots[i] - 1];
+    if (strlen(a->path) == len && memcmp(a->path, path, len) == 0) return a;
+  }
+}
+
+static bool read_file(const char *path, char **data, size_t *len) {
+  *data = NULL;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno != ENOENT)
+      log_warn("open failed path=%s: %s", path, strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) goto err;
+
+  // one spare byte so empty files still get a non-NULL buffer
+  if (!(*data = alloc_malloc(ALLOC_ASSETS, st.st_size + 1))) {
+    log_error("out of memory");
+    goto err;
+  }
+  size_t n = 0;
+  while (n < (size_t)st.st_size) {
+    ssize_t rc = read(fd, *data + n, st.st_size - n);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) {
+      log_warn("read failed path=%s: %s", path, strerror(errno));
+      goto err;
+    }
+    n += rc;
+  }
+  *len = n;
+  close(fd);
+  return true;
+err:
+  alloc_free(ALLOC_ASSETS, *data);
+  *data = NULL;
+  close(fd);
+  return false;
+}
+
+static bool has_suffix(const char *s, const char *suffix) {
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static bool add_asset(struct asset_set *set, const char *file,
+                      const char *path) {
+  if (set->n == set->cap) {
+    size_t cap = set->cap ? set->cap * 2 : 64;
+    struct asset *items =
+        alloc_realloc(ALLOC_ASSETS, set->items, cap * sizeof *items);
+    if (!items) {
+      log_error("out of memory");
+      return false;
+    }
+    set->items = items;
+    set->cap = cap;
+  }
+
+  struct asset *a = &set->items[set->n];
+  memset(a, 0, sizeof *a);
+  size_t path_len = strlen(path);
+  if (!(a->path = alloc_malloc(ALLOC_ASSETS, path_len + 1))) {
+    log_error("out of memory");
+    return false;
+  }
+  memcpy(a->path, path, path_len + 1);
+  ++set->n;
+
+  char variant[PATH_MAX];
+  for (int i = 0; i < ENC_COUNT; ++i) {
+    snprintf(variant, sizeof variant, "%s%s", file, s_encoding_suffixes[i]);
+    if (read_file(variant, &a->variants[i].data, &a->variants[i].len))
+      set->bytes += a->variants[i].len;
+  }
+  if (!a->variants[ENC_IDENTITY].data) {
+    // gone or unreadable, leave it out rather than fail the whole load
+    for (int i = 0; i < ENC_COUNT; ++i) {
+      set->bytes -= a->variants[i].data ? a->variants[i].len : 0;
+      alloc_free(ALLOC_ASSETS, a->variants[i].data);
+    }
+    alloc_free(ALLOC_ASSETS, a->path);
+    --set->n;
+    return true;
+  }
+
+  a->mime = mime_of(path);
+  a->immutable = is_hashed(path);
+
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len;
+  if (!EVP_Digest(a->variants[ENC_IDENTITY].data,
+                  a->variants[ENC_IDENTITY].len, digest, &digest_len,
+                  EVP_sha256(), NULL)) {
+    log_error("digest failed path=%s", path);
+    return false;
+  }
+  // strong validators differ between encodings of the same content
+  for (int i = 0; i < ENC_COUNT; ++i) {
+    char *p = a->etag[i];
+    *p++ = '"';
+    for (int j = 0; j < 12; ++j) p += sprintf(p, "%02x", digest[j]);
+    sprintf(p, "%s%s\"", i ? "-" : "", i ? s_encoding_names[i] : "");
+  }
+  return true;
+}
+
+static void watch(const char *dir) {
+  if (s_inotify >= 0 && inotify_add_watch(s_inotify, dir, WATCH_MASK) < 0)
+    log_warn("inotify_add_watch failed dir=%s: %s", dir, strerror(errno));
+}
+
+static bool load_dir(struct asset_set *set, const char *dir,
+                     const char *prefix) {
+  DIR *d = opendir(dir);
+  if (!d) {
+    log_warn("opendir failed dir=%s: %s", dir, strerror(errno));
+    return false;
+  }
+  watch(dir);
+
+  bool ok = true;
+  struct dirent *e;
+  while (ok && (e = readdir(d))) {
+    if (e->d_name[0] == '.') continue;
+
+    char file[PATH_MAX], path[PATH_MAX];
+    snprintf(file, sizeof file, "%s/%s", dir, e->d_name);
+    snprintf(path, sizeof path, "%s/%s", prefix, e->d_name);
+
+    // links are followed to files only, a linked directory could loop
+    struct stat st;
+    if (lstat(file, &st) != 0) continue;
+    if (S_ISLNK(st.st_mode) && (stat(file, &st) != 0 || S_ISDIR(st.st_mode)))
+      continue;
+    if (S_ISDIR(st.st_mode)) {
+      ok = load_dir(set, file, path);
+    } else if (S_ISREG(st.st_mode) && !has_suffix(path, ".gz") &&
+               !has_suffix(path, ".br")) {
+      ok = add_asset(set, file, path);
+    }
+  }
+  closedir(d);
+  return ok;
+}
+
+static bool index_set(struct asset_set *set) {
+  set->n_slots = 16;
+  while (set->n_slots < set->n * 2) set->n_slots *= 2;
+  if (!(set->slots =
+            alloc_calloc(ALLOC_ASSETS, set->n_slots, sizeof *set->slots))) {
+    log_error("out of memory");
+    return false;
+  }
+
+  for (size_t i = 0; i < set->n; ++i) {
+    const char *path = set->items[i].path;
+    size_t j = hash_path(path, strlen(path)) & (set->n_slots - 1);
+    while (set->slots[j]) j = (j + 1) & (set->n_slots - 1);
+    set->slots[j] = i + 1;
+  }
+  set->index = find(set, "/index.html", strlen("/index.html"));
+  return true;
+}
+
+static void free_set(struct asset_set *set) {
+  for (size_t i = 0; i < set->n; ++i) {
+    alloc_free(ALLOC_ASSETS, set->items[i].path);
+    for (int j = 0; j < ENC_COUNT; ++j)
+      alloc_free(ALLOC_ASSETS, set->items[i].variants[j].data);
+  }
+  alloc_free(ALLOC_ASSETS, set->items);
+  alloc_free(ALLOC_ASSETS, set->slots);
+  memset(set, 0, sizeof *set);
+}
+
+static bool reload(void) {
+  // a fresh instance drops the watches of directories that are gone
+  if (s_inotify >= 0) close(s_inotify);
+  if ((s_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+    log_warn("inotify_init1 failed: %s, changes won't be picked up",
+             strerror(errno));
+
+  struct asset_set set = {0};
+  if (!load_dir(&set, s_dir, "") || !index_set(&set)) {
+    free_set(&set);
+    return false;
+  }
+
+  free_set(&s_set);
+  s_set = set;
+  log_info("assets loaded dir=%s files=%zu bytes=%zu", s_dir, s_set.n,
+           s_set.bytes);
+  return true;
+}
+
+bool assets_init(const char *dir) {
+  size_t len = strlen(dir);
+  if (!(s_dir = alloc_malloc(ALLOC_ASSETS, len + 1))) {
+    log_error("out of memory");
+    return false;
+  }
+  memcpy(s_dir, dir, len + 1);
+
+  if (reload()) return true;
+  s_reload_at = mg_millis() + ASSETS_RETRY_MS;
+  return false;
+}
+
+void assets_close(void) {
+  if (s_inotify >= 0) close(s_inotify);
+  s_inotify = -1;
+  free_set(&s_set);
+  alloc_free(ALLOC_ASSETS, s_dir);
+  s_dir = NULL;
+}
+
+void assets_poll(void) {
+  if (!s_dir) return;
+
+  // any event at all means a reload, what changed doesn't matter
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+  while (s_inotify >= 0 && read(s_inotify, buf, sizeof buf) > 0)
+    changed = true;
+  if (changed) s_reload_at = mg_millis() + ASSETS_RELOAD_DELAY_MS;
+
+  if (!s_reload_at || mg_millis() < s_reload_at) return;
+  s_reload_at = reload() ? 0 : mg_millis() + ASSETS_RETRY_MS;
+}
+
+// whether the comma separated list of tokens in header contains token,
+// other than with q=0
+static bool has_token(const struct mg_str *header, const char *token) {
+  if (!header) return false;
+  size_t len = strlen(token);
+  const char *s = header->buf, *end = header->buf + header->len;
+  while (s < end) {
+    while (s < end && (*s == ' ' || *s == ',')) ++s;
+    const char *t = s;
+    while (s < end && *s != ',' && *s != ';' && *s != ' ') ++s;
+    bool match = (size_t)(s - t) == len && memcmp(t, token, len) == 0;
+
+    // parameters, of which only a q of zero matters
+    bool refused = false;
+    while (s < end && *s != ',') {
+      if (*s++ != ';') continue;
+      while (s < end && *s == ' ') ++s;
+      if (end - s < 2 || (*s != 'q' && *s != 'Q') || s[1] != '=') continue;
+      const char *v = s += 2;
+      while (s < end && *s != ',' && *s != ';' && *s != ' ') ++s;
+      refused = v < s && *v == '0';
+      for (const char *p = v + 1; refused && p < s; ++p)
+        refused = *p == '.' || *p == '0';
+    }
+    if (match && !refused) return true;
+  }
+  return false;
+}
+
+void assets_serve(struct mg_connection *c, struct mg_http_message *hm) {
+  bool head = mg_strcmp(hm->method, mg_str("HEAD")) == 0;
+  if (!head && mg_strcmp(hm->method, mg_str("GET")) != 0) {
+    mg_http_reply(c, 405, "Allow: GET, HEAD\r\n", "");
+    return;
+  }
+
+  struct mg_str uri = hm->uri;
+  const struct asset *a = NULL;
+  if (uri.len == 1) {
+    a = s_set.index;
+  } else if (!(a = find(&s_set, uri.buf, uri.len))) {
+    // client-side routes have no extension, missing files do
+    const char *slash = uri.buf, *p;
+    for (p = uri.buf; p < uri.buf + uri.len; ++p)
+      if (*p == '/') slash = p;
+    if (!memchr(slash, '.', uri.buf + uri.len - slash)) a = s_set.index;
+  }
+  if (!a) {
+    mg_http_reply(c, 404, "", "");
+    return;
+  }
+
+  struct mg_str *accept = mg_http_get_header(hm, "Accept-Encoding");
+  enum asset_encoding enc = ENC_IDENTITY;
+  if (a->variants[ENC_BROTLI].data && has_token(accept, "br"))
+    enc = ENC_BROTLI;
+  else if (a->variants[ENC_GZIP].data && has_token(accept, "gzip"))
+    enc = ENC_GZIP;
+  bool has_variants =
+      a->variants[ENC_GZIP].data || a->variants[ENC_BROTLI].data;
+
+  const char *cache_control =
+      a->immutable ? "public, max-age=31536000, immutable" : "no-cache";
+
+  struct mg_str *inm = mg_http_get_header(hm, "If-None-Match");
+  if (has_token(inm, a->etag[enc]) || has_token(inm, "*")) {
+    mg_printf(c,
+              "HTTP/1.1 304 Not Modified\r\n"
+              "ETag: %s\r\n"
+              "Cache-Control: %s\r\n"
+              "%s"
+              "\r\n",
+              a->etag[enc], cache_control,
+              has_variants ? "Vary: Accept-Encoding\r\n" : "");
+    c->is_resp = 0;
+    return;
+  }
+
+  mg_printf(c,
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %lu\r\n"
+            "ETag: %s\r\n"
+            "Cache-Control: %s\r\n"
+            "%s%s%s"
+            "%s"
+            "\r\n",
+            a->mime, (unsigned long)a->variants[enc].len, a->etag[enc],
+            cache_control, enc ? "Content-Encoding: " : "",
+            enc ? s_encoding_names[enc] : "", enc ? "\r\n" : "",
+            has_variants ? "Vary: Accept-Encoding\r\n" : "");
+  if (!head) mg_send(c, a->variants[enc].data, a->variants[enc].len);
+  c->is_resp = 0;
+}
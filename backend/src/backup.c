@@ -0,0 +1,236 @@
+#include "backup.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <mongoose.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "db.h"
+#include "log.h"
+
+struct backup_file {
+  sqlite3 *writer;
+  sqlite3 *snapshot;  // read-only, holding the read transaction if any
+  sqlite3 *dst;
+  char *path, *tmp_path;
+};
+
+// the directory first, then the shards when sharded
+static struct backup_file s_files[DB_MAX_SHARDS + 1];
+static int s_n_files = 0;
+static int s_current = -1;  // file being copied, -1 when idle
+static sqlite3_backup *s_backup = NULL;
+static uint64_t s_started_at = 0;
+static int s_pages = 0;
+
+static void backup_cleanup(bool remove_tmp) {
+  if (s_backup) sqlite3_backup_finish(s_backup);
+  s_backup = NULL;
+
+  for (int i = 0; i < s_n_files; ++i) {
+    struct backup_file *f = &s_files[i];
+    if (f->dst) sqlite3_close_v2(f->dst);
+    if (remove_tmp && f->tmp_path) remove(f->tmp_path);
+    // ends the read transaction holding the snapshot
+    if (f->snapshot) sqlite3_close_v2(f->snapshot);
+    free(f->path);
+    free(f->tmp_path);
+    memset(f, 0, sizeof *f);
+  }
+  s_n_files = 0;
+  s_current = -1;
+}
+
+static bool is_wal(sqlite3 *conn) {
+  sqlite3_stmt *stmt = NULL;
+  bool wal = false;
+  if (sqlite3_prepare_v2(conn, "pragma journal_mode;", -1, &stmt, NULL) ==
+          SQLITE_OK &&
+      sqlite3_step(stmt) == SQLITE_ROW) {
+    wal = sqlite3_stricmp((const char *)sqlite3_column_text(stmt, 0), "wal") ==
+          0;
+  }
+  sqlite3_finalize(stmt);
+  return wal;
+}
+
+/**
+ * Opens a read-only connection to every file and then starts a read
+ * transaction on each. Writes only happen on the event loop thread, which
+ * is running this, so the transactions all see the same point in time.
+ * Without WAL a held read transaction would block the writer, so the
+ * writers are backed up from directly instead, each file on its own.
+ */
+static bool take_snapshot(void) {
+  int rc;
+  for (int i = 0; i < s_n_files; ++i) {
+    struct backup_file *f = &s_files[i];
+    if ((rc = sqlite3_open_v2(sqlite3_db_filename(f->writer, "main"),
+                              &f->snapshot, SQLITE_OPEN_READONLY, NULL)) !=
+        SQLITE_OK) {
+      log_error("open failed: %d (%s)", rc, sqlite3_errmsg(f->snapshot));
+      return false;
+    }
+
+    if (!is_wal(f->snapshot)) {
+      log_warn("WAL unavailable, backup files are only consistent each");
+      for (int j = 0; j <= i; ++j) {
+        sqlite3_close_v2(s_files[j].snapshot);
+        s_files[j].snapshot = NULL;
+      }
+      return true;
+    }
+  }
+
+  // nothing may yield to the event loop between these
+  for (int i = 0; i < s_n_files; ++i) {
+    struct backup_file *f = &s_files[i];
+    if ((rc = sqlite3_exec(f->snapshot,
+                           "begin;select count(*) from sqlite_master;", NULL,
+                           NULL, NULL)) != SQLITE_OK) {
+      log_error("begin transaction failed: %d (%s)", rc,
+                sqlite3_errmsg(f->snapshot));
+      return false;
+    }
+  }
+  return true;
+}
+
+// starts copying s_files[s_current]
+static bool backup_open(void) {
+  struct backup_file *f = &s_files[s_current];
+  sqlite3 *src = f->snapshot ? f->snapshot : f->writer;
+  if (!(s_backup = sqlite3_backup_init(f->dst, "main", src, "main"))) {
+    log_error("backup init failed: %s", sqlite3_errmsg(f->dst));
+    return false;
+  }
+  return true;
+}
+
+bool backup_start(const char *path) {
+  if (s_current >= 0) {
+    log_warn("backup already in progress");
+    return false;
+  }
+
+  int shards = db_shard_count();
+  s_n_files = shards > 1 ? shards + 1 : 1;
+  for (int i = 0; i < s_n_files; ++i) {
+    struct backup_file *f = &s_files[i];
+    f->writer = i == 0 ? db : db_shard_at(i - 1);
+
+    char shard_path[PATH_MAX];
+    if (i > 0) db_shard_path(shard_path, sizeof shard_path, path, i - 1);
+    const char *file_path = i == 0 ? path : shard_path;
+
+    size_t len = strlen(file_path);
+    if (!(f->path = malloc(len + 1)) || !(f->tmp_path = malloc(len + 5))) {
+      log_error("out of memory");
+      goto err;
+    }
+    memcpy(f->path, file_path, len + 1);
+    snprintf(f->tmp_path, len + 5, "%s.tmp", file_path);
+  }
+
+  if (!take_snapshot()) goto err;
+
+  int rc;
+  for (int i = 0; i < s_n_files; ++i) {
+    struct backup_file *f = &s_files[i];
+    if ((rc = sqlite3_open_v2(f->tmp_path, &f->dst,
+                              SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                              NULL)) != SQLITE_OK) {
+      log_error("open failed: %d (%s)", rc, sqlite3_errmsg(f->dst));
+      goto err;
+    }
+  }
+
+  s_current = 0;
+  if (!backup_open()) goto err;
+
+  s_started_at = mg_millis();
+  s_pages = 0;
+  log_info("backup to %s started (%d files)", path, s_n_files);
+  return true;
+err:
+  backup_cleanup(true);
+  return false;
+}
+
+// renames every file into place, once all of them are complete
+static void backup_publish(void) {
+  for (int i = 0; i < s_n_files; ++i) {
+    struct backup_file *f = &s_files[i];
+    sqlite3_close_v2(f->dst);
+    f->dst = NULL;
+  }
+
+  for (int i = 0; i < s_n_files; ++i) {
+    struct backup_file *f = &s_files[i];
+    if (rename(f->tmp_path, f->path) != 0) {
+      log_error("rename failed: %s (%s)", f->tmp_path, strerror(errno));
+      // the ones before are in place already, the rest are dropped
+      backup_cleanup(true);
+      return;
+    }
+    free(f->tmp_path);
+    f->tmp_path = NULL;
+  }
+
+  log_info("backup to %s done (%d pages in %llu ms)", s_files[0].path,
+           s_pages, (unsigned long long)(mg_millis() - s_started_at));
+  backup_cleanup(false);
+}
+
+void backup_step(void) {
+  if (!s_backup) return;
+
+  // the source holds a read transaction, so the copy is of the snapshot
+  // however long it takes; without one, writes made through the source
+  // meanwhile are carried over by sqlite, so each file is still consistent
+  int rc;
+  uint64_t deadline = mg_millis() + BACKUP_STEP_BUDGET_MS;
+  do {
+    rc = sqlite3_backup_step(s_backup, BACKUP_PAGES_PER_STEP);
+  } while (rc == SQLITE_OK && mg_millis() < deadline);
+
+  struct backup_file *f = &s_files[s_current];
+  switch (rc) {
+    case SQLITE_OK:
+    case SQLITE_BUSY:
+    case SQLITE_LOCKED:
+      return;  // more to do, try again on the next step
+    case SQLITE_DONE:
+      break;
+    default: {
+      log_error("backup step failed: %d (%s)", rc, sqlite3_errmsg(f->dst));
+      backup_cleanup(true);
+      return;
+    }
+  }
+
+  s_pages += sqlite3_backup_pagecount(s_backup);
+  rc = sqlite3_backup_finish(s_backup);
+  s_backup = NULL;
+  if (rc != SQLITE_OK) {
+    log_error("backup finish failed: %d (%s)", rc, sqlite3_errmsg(f->dst));
+    backup_cleanup(true);
+    return;
+  }
+
+  if (++s_current < s_n_files) {
+    if (!backup_open()) backup_cleanup(true);
+    return;
+  }
+  backup_publish();
+}
+
+bool backup_active(void) { return s_current >= 0; }
+
+void backup_abort(void) {
+  if (s_current < 0) return;
+  backup_cleanup(true);
+}
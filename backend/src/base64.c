@@ -5,15 +5,18 @@
 #include <openssl/evp.h>
 #include <string.h>
 
+#include "alloc.h"
+#include "log.h"
+
 char *b64_decode(const char *b64, ssize_t b64_len, size_t *out_len) {
   EVP_ENCODE_CTX *ctx = EVP_ENCODE_CTX_new();
   if (!ctx) return NULL;
 
   int len, total_len = 0;
   size_t input_len = b64_len < 0 ? strlen(b64) : (size_t)b64_len;
-  char *output = malloc(input_len);
+  char *output = alloc_malloc(ALLOC_HANDLERS, input_len);
   if (!output) {
-    fprintf(stderr, "[%s:%d] out of memory\n", __func__, __LINE__);
+    log_error("out of memory");
     EVP_ENCODE_CTX_free(ctx);
     return NULL;
   }
@@ -29,13 +32,13 @@ char *b64_decode(const char *b64, ssize_t b64_len, size_t *out_len) {
   EVP_ENCODE_CTX_free(ctx);
 
   if (rc < 0) {
-    free(output);
+    alloc_free(ALLOC_HANDLERS, output);
     return NULL;
   }
 
   output[total_len] = '\0';
   if (out_len) *out_len = total_len;
 
-  char *shrunk = realloc(output, total_len + 1);
+  char *shrunk = alloc_realloc(ALLOC_HANDLERS, output, total_len + 1);
   return shrunk ? shrunk : output;
 }
@@ -0,0 +1,393 @@
+#include "blobs.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <mongoose.h>
+#include <openssl/evp.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "db.h"
+#include "log.h"
+#include "metrics.h"
+
+unsigned blobs_ttl_s = BLOBS_DEFAULT_TTL_S;
+uint64_t blobs_owner_max_bytes = BLOBS_DEFAULT_OWNER_MAX_BYTES;
+uint64_t blobs_max_bytes = BLOBS_DEFAULT_MAX_BYTES;
+
+struct upload {
+  struct upload *next;
+  char name[BLOBS_NAME_LEN + 1];
+  int64_t owner;
+  int fd;  // on <name>.part
+  uint64_t size, total;
+  EVP_MD_CTX *md;  // over the first size bytes
+  uint64_t touched_at;  // mg_millis()
+};
+
+static const char *s_dir;
+static int s_dir_fd = -1;
+static DIR *s_scan;  // where blobs_expire_tick left off
+static struct upload *s_uploads;
+static int s_upload_count;
+static uint64_t s_stored_bytes;  // in complete blobs, counted on init
+
+static void part_name(char *buf, const char *name) {
+  memcpy(buf, name, BLOBS_NAME_LEN);
+  memcpy(buf + BLOBS_NAME_LEN, ".part", sizeof ".part");
+}
+
+static struct upload **find_upload(const char *name) {
+  struct upload **p = &s_uploads;
+  while (*p && memcmp((*p)->name, name, BLOBS_NAME_LEN) != 0) p = &(*p)->next;
+  return p;
+}
+
+// unlinks p from the list and frees it, deleting the partial file unless it
+// was just renamed into place
+static void drop_upload(struct upload **p, bool unlink_part) {
+  struct upload *u = *p;
+  *p = u->next;
+  --s_upload_count;
+
+  close(u->fd);
+  if (unlink_part) {
+    char part[BLOBS_NAME_LEN + sizeof ".part"];
+    part_name(part, u->name);
+    if (unlinkat(s_dir_fd, part, 0) != 0 && errno != ENOENT)
+      log_warn("unlink failed: %s (%s)", part, strerror(errno));
+  }
+  EVP_MD_CTX_free(u->md);
+  alloc_free(ALLOC_HANDLERS, u);
+}
+
+// bytes reserved by uploads in progress, of everyone if owner is -1
+static uint64_t uploading_bytes(int64_t owner) {
+  uint64_t bytes = 0;
+  for (struct upload *u = s_uploads; u; u = u->next)
+    if (owner == -1 || u->owner == owner) bytes += u->total;
+  return bytes;
+}
+
+static int uploads_of(int64_t owner) {
+  int n = 0;
+  for (struct upload *u = s_uploads; u; u = u->next) n += u->owner == owner;
+  return n;
+}
+
+// bytes of complete blobs recorded for owner
+static bool stored_bytes(int64_t owner, uint64_t *bytes) {
+  sqlite3_stmt *stmt = db_read_stmt(DB_READ_BLOB_USAGE);
+  if (!stmt) return false;
+
+  bool ok = false;
+  int rc;
+  if ((rc = sqlite3_bind_int64(stmt, 1, owner)) != SQLITE_OK ||
+      (rc = sqlite3_step(stmt)) != SQLITE_ROW) {
+    log_error("blob usage failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt)));
+  } else {
+    *bytes = (uint64_t)sqlite3_column_int64(stmt, 0);
+    ok = true;
+  }
+  db_read_done(stmt);
+  return ok;
+}
+
+// records or forgets (owner -1) who stored the blob called name
+static void record_blob(const char *name, int64_t owner, uint64_t size) {
+  sqlite3_stmt *stmt = NULL;
+  const char *sql = owner == -1
+                        ? "delete from blobs where name=?;"
+                        : "insert or replace into blobs(name,owner,size)"
+                          "values(?,?,?);";
+
+  int rc;
+  if ((rc = sqlite3_prepare_v3(db, sql, -1, 0, &stmt, NULL)) != SQLITE_OK ||
+      (rc = sqlite3_bind_text(stmt, 1, name, BLOBS_NAME_LEN,
+                              SQLITE_STATIC)) != SQLITE_OK ||
+      (owner != -1 &&
+       ((rc = sqlite3_bind_int64(stmt, 2, owner)) != SQLITE_OK ||
+        (rc = sqlite3_bind_int64(stmt, 3, (int64_t)size)) != SQLITE_OK)) ||
+      (rc = sqlite3_step(stmt)) != SQLITE_DONE)
+    log_error("record blob failed: %d (%s)", rc, sqlite3_errmsg(db));
+  if (stmt) sqlite3_finalize(stmt);
+}
+
+bool blobs_init(const char *dir) {
+  if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+    log_error("mkdir failed: %s (%s)", dir, strerror(errno));
+    return false;
+  }
+
+  if ((s_dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+    log_error("open failed: %s (%s)", dir, strerror(errno));
+    return false;
+  }
+
+  int scan_fd = dup(s_dir_fd);
+  if (scan_fd < 0 || !(s_scan = fdopendir(scan_fd))) {
+    log_error("opendir failed: %s (%s)", dir, strerror(errno));
+    if (scan_fd >= 0) close(scan_fd);
+    close(s_dir_fd);
+    s_dir_fd = -1;
+    return false;
+  }
+
+  // the global cap counts every complete blob, including any stored before
+  // their owners were recorded
+  struct dirent *ent;
+  while ((ent = readdir(s_scan))) {
+    struct stat st;
+    if (blobs_is_name(ent->d_name, strlen(ent->d_name)) &&
+        fstatat(s_dir_fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+        S_ISREG(st.st_mode))
+      s_stored_bytes += st.st_size;
+  }
+  rewinddir(s_scan);
+  log_info("blobs: %" PRIu64 " bytes stored in %s", s_stored_bytes, dir);
+
+  s_dir = dir;
+  return true;
+}
+
+void blobs_close(void) {
+  while (s_uploads) drop_upload(&s_uploads, true);
+  if (s_scan) closedir(s_scan);
+  if (s_dir_fd >= 0) close(s_dir_fd);
+  s_scan = NULL;
+  s_dir_fd = -1;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+static enum blobs_status finish_upload(struct upload **p) {
+  struct upload *u = *p;
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  char hex[BLOBS_NAME_LEN + 1];
+
+  if (!EVP_DigestFinal_ex(u->md, digest, &digest_len) ||
+      digest_len * 2 != BLOBS_NAME_LEN) {
+    log_error("sha256 failed");
+    drop_upload(p, true);
+    return BLOBS_ERROR;
+  }
+
+  mg_hex(digest, digest_len, hex);
+  if (memcmp(hex, u->name, BLOBS_NAME_LEN) != 0) {
+    log_warn("blob hash mismatch: name=%s owner=%" PRId64, u->name, u->owner);
+    drop_upload(p, true);
+    return BLOBS_HASH_MISMATCH;
+  }
+
+  // not fsynced: the name is the hash, so a blob torn by a crash fails
+  // every client's check and gets uploaded again once it expires
+  char part[BLOBS_NAME_LEN + sizeof ".part"];
+  part_name(part, u->name);
+  if (renameat(s_dir_fd, part, s_dir_fd, u->name) != 0) {
+    log_error("rename failed: %s (%s)", part, strerror(errno));
+    drop_upload(p, true);
+    return BLOBS_ERROR;
+  }
+
+  log_info("stored blob %s size=%" PRIu64 " owner=%" PRId64, u->name, u->size,
+           u->owner);
+  METRICS_INC(blobs_stored);
+  s_stored_bytes += u->size;
+  record_blob(u->name, u->owner, u->size);
+  drop_upload(p, false);
+  return BLOBS_COMPLETE;
+}
+
+enum blobs_status blobs_write(const char *name, int64_t owner, uint64_t offset,
+                              uint64_t total, const void *data, size_t len,
+                              uint64_t *size) {
+  *size = 0;
+  if (total > BLOBS_MAX_SIZE) return BLOBS_TOO_LARGE;
+  if (offset > total || len > total - offset) return BLOBS_BAD_REQUEST;
+
+  struct stat st;
+  if (fstatat(s_dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+    // same content, so whoever sent it gets to keep it around longer
+    if (utimensat(s_dir_fd, name, NULL, 0) != 0)
+      log_warn("utimensat failed: %s (%s)", name, strerror(errno));
+    *size = st.st_size;
+    return BLOBS_EXISTS;
+  }
+
+  struct upload **p = find_upload(name);
+  struct upload *u = *p;
+
+  if (!u) {
+    if (offset != 0) return BLOBS_BAD_OFFSET;
+    if (s_upload_count >= BLOBS_MAX_UPLOADS) return BLOBS_FULL;
+
+    // one identity holding every slot would lock everyone else out
+    if (uploads_of(owner) >= BLOBS_OWNER_MAX_UPLOADS) {
+      log_warn("too many blob uploads: owner=%" PRId64, owner);
+      return BLOBS_BUSY;
+    }
+
+    uint64_t owned;
+    if (!stored_bytes(owner, &owned)) return BLOBS_ERROR;
+    if (owned + uploading_bytes(owner) + total > blobs_owner_max_bytes) {
+      log_warn("blob quota exceeded: owner=%" PRId64 " stored=%" PRIu64
+               " total=%" PRIu64,
+               owner, owned, total);
+      return BLOBS_OVER_QUOTA;
+    }
+    if (s_stored_bytes + uploading_bytes(-1) + total > blobs_max_bytes) {
+      log_warn("blob storage full: stored=%" PRIu64 " total=%" PRIu64,
+               s_stored_bytes, total);
+      return BLOBS_NO_SPACE;
+    }
+
+    if (!(u = alloc_calloc(ALLOC_HANDLERS, 1, sizeof *u))) {
+      log_error("out of memory");
+      return BLOBS_ERROR;
+    }
+
+    char part[BLOBS_NAME_LEN + sizeof ".part"];
+    part_name(part, name);
+    memcpy(u->name, name, BLOBS_NAME_LEN);
+    u->owner = owner;
+    u->total = total;
+    u->fd = openat(s_dir_fd, part, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0600);
+    if (u->fd < 0) {
+      log_error("open failed: %s (%s)", part, strerror(errno));
+      alloc_free(ALLOC_HANDLERS, u);
+      return BLOBS_ERROR;
+    }
+
+    if (!(u->md = EVP_MD_CTX_new()) ||
+        !EVP_DigestInit_ex(u->md, EVP_sha256(), NULL)) {
+      log_error("sha256 init failed");
+      EVP_MD_CTX_free(u->md);
+      close(u->fd);
+      unlinkat(s_dir_fd, part, 0);
+      alloc_free(ALLOC_HANDLERS, u);
+      return BLOBS_ERROR;
+    }
+
+    u->next = s_uploads;
+    s_uploads = u;
+    ++s_upload_count;
+    p = &s_uploads;
+  } else {
+    if (u->owner != owner) return BLOBS_LOCKED;
+    if (u->total != total) return BLOBS_BAD_REQUEST;
+    if (offset != u->size) {
+      *size = u->size;
+      return BLOBS_BAD_OFFSET;
+    }
+  }
+
+  u->touched_at = mg_millis();
+
+  if (!write_all(u->fd, data, len)) {
+    log_error("write failed: %s.part (%s)", u->name, strerror(errno));
+    drop_upload(p, true);
+    return BLOBS_ERROR;
+  }
+  if (!EVP_DigestUpdate(u->md, data, len)) {
+    log_error("sha256 update failed");
+    drop_upload(p, true);
+    return BLOBS_ERROR;
+  }
+  u->size += len;
+  *size = u->size;
+
+  return u->size == u->total ? finish_upload(p) : BLOBS_OK;
+}
+
+bool blobs_path(const char *name, char *buf, size_t len) {
+  struct stat st;
+  if (fstatat(s_dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+      !S_ISREG(st.st_mode))
+    return false;
+
+  return snprintf(buf, len, "%s/%.*s", s_dir, BLOBS_NAME_LEN, name) <
+         (int)len;
+}
+
+bool blobs_is_name(const char *name, size_t len) {
+  if (len != BLOBS_NAME_LEN) return false;
+  for (size_t i = 0; i < len; ++i)
+    if (!(name[i] >= '0' && name[i] <= '9') &&
+        !(name[i] >= 'a' && name[i] <= 'f'))
+      return false;
+  return true;
+}
+
+void blobs_expire_tick(void *arg) {
+  (void)arg;
+  if (!s_scan) return;
+
+  uint64_t now_ms = mg_millis();
+  for (struct upload **p = &s_uploads; *p;) {
+    if (now_ms - (*p)->touched_at > BLOBS_UPLOAD_IDLE_MS) {
+      log_info("dropped idle upload %s size=%" PRIu64 "/%" PRIu64,
+               (*p)->name, (*p)->size, (*p)->total);
+      drop_upload(p, true);
+    } else {
+      p = &(*p)->next;
+    }
+  }
+
+  time_t now = time(NULL);
+  for (int i = 0; i < BLOBS_EXPIRE_BATCH; ++i) {
+    struct dirent *ent = readdir(s_scan);
+    if (!ent) {
+      rewinddir(s_scan);
+      break;
+    }
+
+    // partial files left behind by a restart are only cleaned up here, the
+    // ones still being uploaded belong to the loop above
+    size_t len = strlen(ent->d_name);
+    bool part = len == BLOBS_NAME_LEN + strlen(".part") &&
+                strcmp(ent->d_name + BLOBS_NAME_LEN, ".part") == 0;
+    if (!blobs_is_name(ent->d_name, part ? BLOBS_NAME_LEN : len)) continue;
+    if (part && *find_upload(ent->d_name)) continue;
+
+    struct stat st;
+    if (fstatat(s_dir_fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+        !S_ISREG(st.st_mode))
+      continue;
+
+    time_t ttl = part ? BLOBS_UPLOAD_IDLE_MS / 1000 : (time_t)blobs_ttl_s;
+    if (now - st.st_mtime < ttl) continue;
+
+    if (unlinkat(s_dir_fd, ent->d_name, 0) != 0) {
+      log_warn("unlink failed: %s (%s)", ent->d_name, strerror(errno));
+      continue;
+    }
+    if (!part) {
+      log_info("expired blob %s", ent->d_name);
+      METRICS_INC(blobs_expired);
+      uint64_t size = (uint64_t)st.st_size;
+      s_stored_bytes -= size < s_stored_bytes ? size : s_stored_bytes;
+      record_blob(ent->d_name, -1, 0);
+    }
+  }
+}
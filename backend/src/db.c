@@ -1,10 +1,21 @@
 #include "db.h"
 
+#include <ctype.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "probes.h"
 
 // clang-format off
-static const char *s_sql =
+static const char *s_sql_directory =
   "create table if not exists identities("
     "id integer primary key autoincrement,"
     "handle text not null unique,"
@@ -20,6 +31,32 @@ static const char *s_sql =
   "create index if not exists idx_identities_id on identities(id);"
   "create index if not exists idx_identities_handle on identities(handle);"
 
+  // Deleted identities whose prekeys and queued messages haven't been purged
+  // yet. foreign_keys is deliberately left off: a cascading delete would do
+  // all of that work synchronously, see purge.c instead.
+  "create table if not exists tombstones("
+    "id integer primary key,"
+    "deleted_at integer not null default (strftime('%s','now'))"
+  ");"
+
+  "create table if not exists meta("
+    "key text primary key,"
+    "value integer not null"
+  ");"
+
+  // Who uploaded each stored blob, counted against their quota until it
+  // expires (the files themselves live in the blobs directory)
+  "create table if not exists blobs("
+    "name text primary key,"
+    "owner integer not null,"
+    "size integer not null"
+  ");"
+  "create index if not exists idx_blobs_owner on blobs(owner);";
+
+// Per-identity tables, kept in the directory when unsharded. On a separate
+// shard the foreign keys point at a table that isn't there, which is fine
+// with foreign_keys off.
+static const char *s_sql_shard =
   "create table if not exists pqopks(" // signed one-time pqkem prekeys
     "uid integer primary key autoincrement,"
     "id integer not null,"
@@ -46,35 +83,700 @@ static const char *s_sql =
     "for integer not null,"
     "msg blob not null,"
     "created_at integer not null default (strftime('%s','now')),"
+    "payload integer," // queue_payloads row completing msg, if any
+    "foreign key (for) references identities(id) on delete cascade"
+  ");"
+  "create index if not exists idx_queue_for on queue(for);"
+
+  // Bodies queued for several recipients at once, stored once and counted
+  // by the queue rows pointing at them (see db_upgrade_queue for the
+  // trigger dropping them with the last one)
+  "create table if not exists queue_payloads("
+    "id integer primary key autoincrement,"
+    "hash blob not null unique," // sha256 of data
+    "data blob not null,"
+    "refs integer not null"
+  ");"
+
+  "create table if not exists queue_usage(" // per-recipient quota counters
+    "for integer primary key,"
+    "messages integer not null default 0,"
+    "bytes integer not null default 0,"
     "foreign key (for) references identities(id) on delete cascade"
   ");";
 // clang-format on
 
+// clang-format off
+static const char *s_read_sql[DB_READ_STMT_COUNT] = {
+  [DB_READ_IDENTITY_BY_HANDLE] = "select id,ik from identities where handle=?;",
+  [DB_READ_ID_BY_HANDLE] = "select id from identities where handle=?;",
+  [DB_READ_HANDLE_BY_ID] = "select handle from identities where id=?;",
+  [DB_READ_IDS_BY_HANDLES] = "select id,handle from identities where handle in (select value from json_each(?));",
+  [DB_READ_BUNDLE_BY_HANDLE] =
+    "select "
+      "id,"
+      "ik,"
+      "spk,"
+      "spk_id,"
+      "spk_sig,"
+      "pqspk,"
+      "pqspk_id,"
+      "pqspk_sig,"
+      "notified_low_prekeys "
+    "from identities where handle=?;",
+  [DB_READ_BLOB_USAGE] = "select coalesce(sum(size),0) from blobs where owner=?;",
+  [DB_READ_PQOPK] = "select uid,bytes,id,sig from pqopks where `for`=? order by uid asc limit 1;",
+  [DB_READ_OPK] = "select uid,bytes,id from opks where `for`=? order by uid asc limit 1;",
+  [DB_READ_PQOPK_COUNT] = "select count(*) from pqopks where `for`=?;",
+  [DB_READ_OPK_COUNT] = "select count(*) from opks where `for`=?;",
+  [DB_READ_QUEUE] = "select queue.id,msg,data from queue left join queue_payloads on queue_payloads.id=payload where for=? order by created_at asc;",
+  [DB_READ_QUEUE_USAGE] = "select messages,bytes from queue_usage where for=?;",
+  [DB_READ_QUEUE_COUNT] = "select count(*),coalesce(sum(length(msg)+coalesce(length(data),0)),0) from queue left join queue_payloads on queue_payloads.id=payload where for=?;",
+};
+// clang-format on
+
+struct db_reader {
+  sqlite3 *conn;
+  sqlite3_stmt *stmts[DB_READ_STMT_COUNT];
+  bool busy[DB_READ_STMT_COUNT];
+};
+
+// a writer and its pool of read-only connections on the same file
+struct db_store {
+  sqlite3 *writer;
+  struct db_reader readers[DB_READERS];
+  size_t n_readers, next_reader;
+  pthread_mutex_t lock;
+};
+
+static struct db_store s_directory = {.lock = PTHREAD_MUTEX_INITIALIZER};
+static struct db_store *s_shards = &s_directory;
+static int s_n_shards = 1;
+
 sqlite3 *db = NULL;
 
-int db_init(sqlite3 **out, const char *path) {
+/**
+ * Opens the read-only connections. Under WAL they read the last committed
+ * state without ever waiting on the writer. Without WAL (e.g. in-memory
+ * databases) a reader would lock the writer out, so the writer's own
+ * connection is used as the only "reader" instead.
+ */
+static int db_readers_init(struct db_store *store, const char *path,
+                           bool wal) {
   int rc;
-  sqlite3 *db;
 
-  if ((rc = sqlite3_open_v2(
-           path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL)) !=
-      SQLITE_OK) {
-    fprintf(stderr, "[%s] open failed: %d (%s)\n", __func__, rc,
-            sqlite3_errmsg(db));
+  if (!wal) {
+    store->readers[0].conn = store->writer;
+    store->n_readers = 1;
+    return SQLITE_OK;
+  }
+
+  for (store->n_readers = 0; store->n_readers < DB_READERS;
+       ++store->n_readers) {
+    sqlite3 **conn = &store->readers[store->n_readers].conn;
+    if ((rc = sqlite3_open_v2(path, conn, SQLITE_OPEN_READONLY, NULL)) !=
+        SQLITE_OK) {
+      log_error("open failed: %d (%s)", rc, sqlite3_errmsg(*conn));
+      sqlite3_close_v2(*conn);
+      *conn = NULL;
+      return rc;
+    }
+  }
+
+  return SQLITE_OK;
+}
+
+static int db_store_open(struct db_store *store, const char *path,
+                         const char *sql) {
+  int rc;
+
+  if ((rc = sqlite3_open_v2(path, &store->writer,
+                            SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                            NULL)) != SQLITE_OK) {
+    log_error("open failed: %d (%s)", rc, sqlite3_errmsg(store->writer));
     return rc;
   }
 
-  if ((rc = sqlite3_exec(db, s_sql, NULL, NULL, NULL)) != SQLITE_OK) {
-    fprintf(stderr, "[%s] init failed: %d (%s)\n", __func__, rc,
-            sqlite3_errmsg(db));
+  if ((rc = sqlite3_exec(store->writer, sql, NULL, NULL, NULL)) != SQLITE_OK) {
+    log_error("init failed: %d (%s)", rc, sqlite3_errmsg(store->writer));
     return rc;
   }
 
-  *out = db;
+  sqlite3_stmt *stmt = NULL;
+  bool wal = false;
+  if (sqlite3_prepare_v2(store->writer, "pragma journal_mode=wal;", -1, &stmt,
+                         NULL) == SQLITE_OK &&
+      sqlite3_step(stmt) == SQLITE_ROW) {
+    wal = sqlite3_stricmp((const char *)sqlite3_column_text(stmt, 0), "wal") ==
+          0;
+  }
+  sqlite3_finalize(stmt);
+  if (!wal) {
+    log_warn("WAL unavailable for %s, reads will share the writer", path);
+  }
+
+  return db_readers_init(store, path, wal);
+}
+
+static void db_store_close(struct db_store *store) {
+  for (size_t i = 0; i < store->n_readers; ++i) {
+    struct db_reader *r = &store->readers[i];
+    for (size_t j = 0; j < DB_READ_STMT_COUNT; ++j) {
+      if (r->stmts[j]) sqlite3_finalize(r->stmts[j]);
+      r->stmts[j] = NULL;
+      r->busy[j] = false;
+    }
+    if (r->conn != store->writer) sqlite3_close_v2(r->conn);
+    r->conn = NULL;
+  }
+  store->n_readers = 0;
+
+  if (store->writer) sqlite3_close_v2(store->writer);
+  store->writer = NULL;
+}
+
+/**
+ * Records the shard count on first use and refuses to open the directory
+ * with a different one, since ids would map to the wrong files. Directories
+ * created before sharding existed already hold identities and count as one.
+ */
+static int db_check_shards(sqlite3 *db, int shards) {
+  sqlite3_stmt *stmt_insert = NULL, *stmt_select = NULL;
+
+  // clang-format off
+  const char *sql_insert =
+    "insert or ignore into meta(key,value) "
+      "select 'shards',case when exists(select 1 from identities) then 1 else ? end;";
+  const char *sql_select = "select value from meta where key='shards';";
+  // clang-format on
+
+  int rc;
+  if ((rc = sqlite3_prepare_v3(db, sql_insert, -1, 0, &stmt_insert, NULL)) !=
+          SQLITE_OK ||
+      (rc = sqlite3_prepare_v3(db, sql_select, -1, 0, &stmt_select, NULL)) !=
+          SQLITE_OK) {
+    log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(db));
+    goto err;
+  }
+
+  if ((rc = sqlite3_bind_int(stmt_insert, 1, shards)) != SQLITE_OK ||
+      (rc = sqlite3_step(stmt_insert)) != SQLITE_DONE ||
+      (rc = sqlite3_step(stmt_select)) != SQLITE_ROW) {
+    log_error("step failed: %d (%s)", rc, sqlite3_errmsg(db));
+    goto err;
+  }
+
+  int recorded = sqlite3_column_int(stmt_select, 0);
+  if (recorded != shards) {
+    log_error("database was created with %d shard(s), not %d", recorded,
+              shards);
+    rc = SQLITE_MISMATCH;
+    goto err;
+  }
 
+  rc = SQLITE_OK;
+err:
+  if (stmt_insert) sqlite3_finalize(stmt_insert);
+  if (stmt_select) sqlite3_finalize(stmt_select);
+  return rc;
+}
+
+/**
+ * Adds the payload column to queues created before payloads were shared,
+ * then the trigger releasing a payload whenever a row pointing at it is
+ * deleted, be it drained or purged. The trigger is created here rather
+ * than with the tables since it can't refer to a column that isn't there.
+ */
+static int db_upgrade_queue(sqlite3 *db) {
+  sqlite3_stmt *stmt = NULL;
+
+  // clang-format off
+  const char *sql_select = "select 1 from pragma_table_info('queue') where name='payload';";
+  const char *sql_alter = "alter table queue add column payload integer;";
+  const char *sql_trigger =
+    "create trigger if not exists queue_release_payload "
+    "after delete on queue when old.payload is not null begin "
+      "update queue_payloads set refs=refs-1 where id=old.payload;"
+      "delete from queue_payloads where id=old.payload and refs<=0;"
+    "end;";
+  // clang-format on
+
+  int rc;
+  if ((rc = sqlite3_prepare_v3(db, sql_select, -1, 0, &stmt, NULL)) !=
+      SQLITE_OK) {
+    log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(db));
+    goto err;
+  }
+
+  switch (rc = sqlite3_step(stmt)) {
+    case SQLITE_ROW:
+      break;
+    case SQLITE_DONE:
+      log_info("adding queue.payload to %s", sqlite3_db_filename(db, "main"));
+      if ((rc = sqlite3_exec(db, sql_alter, NULL, NULL, NULL)) != SQLITE_OK) {
+        log_error("alter failed: %d (%s)", rc, sqlite3_errmsg(db));
+        goto err;
+      }
+      break;
+    default:
+      log_error("step failed: %d (%s)", rc, sqlite3_errmsg(db));
+      goto err;
+  }
+
+  if ((rc = sqlite3_exec(db, sql_trigger, NULL, NULL, NULL)) != SQLITE_OK) {
+    log_error("trigger failed: %d (%s)", rc, sqlite3_errmsg(db));
+    goto err;
+  }
+
+  rc = SQLITE_OK;
+err:
+  if (stmt) sqlite3_finalize(stmt);
+  return rc;
+}
+
+void db_shard_path(char *buf, size_t size, const char *path, int i) {
+  snprintf(buf, size, "%s.shard%d", path, i);
+}
+
+int db_init(sqlite3 **out, const char *path, int shards) {
+  int rc;
+
+  if (shards < 1 || shards > DB_MAX_SHARDS) {
+    log_error("shard count must be between 1 and %d", DB_MAX_SHARDS);
+    return SQLITE_MISUSE;
+  }
+
+  if ((rc = db_store_open(&s_directory, path, s_sql_directory)) != SQLITE_OK ||
+      (rc = db_check_shards(s_directory.writer, shards)) != SQLITE_OK)
+    goto err;
+
+  if (shards == 1) {
+    if ((rc = sqlite3_exec(s_directory.writer, s_sql_shard, NULL, NULL,
+                           NULL)) != SQLITE_OK) {
+      log_error("init failed: %d (%s)", rc, sqlite3_errmsg(s_directory.writer));
+      goto err;
+    }
+    if ((rc = db_upgrade_queue(s_directory.writer)) != SQLITE_OK) goto err;
+  } else {
+    if (!(s_shards = calloc(shards, sizeof *s_shards))) {
+      log_error("out of memory");
+      s_shards = &s_directory;
+      rc = SQLITE_NOMEM;
+      goto err;
+    }
+    s_n_shards = shards;
+
+    char shard_path[PATH_MAX];
+    for (int i = 0; i < shards; ++i) {
+      pthread_mutex_init(&s_shards[i].lock, NULL);
+      db_shard_path(shard_path, sizeof shard_path, path, i);
+      if ((rc = db_store_open(&s_shards[i], shard_path, s_sql_shard)) !=
+              SQLITE_OK ||
+          (rc = db_upgrade_queue(s_shards[i].writer)) != SQLITE_OK)
+        goto err;
+    }
+  }
+
+  *out = s_directory.writer;
+
+  return rc;
+err:
+  db_close(s_directory.writer);
   return rc;
 }
 
 void db_close(sqlite3 *db) {
-  if (db) sqlite3_close_v2(db);
+  (void)db;
+
+  if (s_shards != &s_directory) {
+    for (int i = 0; i < s_n_shards; ++i) {
+      db_store_close(&s_shards[i]);
+      pthread_mutex_destroy(&s_shards[i].lock);
+    }
+    free(s_shards);
+    s_shards = &s_directory;
+    s_n_shards = 1;
+  }
+
+  db_store_close(&s_directory);
+}
+
+int db_shard_count(void) { return s_n_shards; }
+
+static struct db_store *db_store_of(int64_t id) {
+  // ids are handed out sequentially, mix them so neighbouring registrations
+  // don't all land on the same shard when the count has common factors
+  uint64_t x = (uint64_t)id;
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return &s_shards[x % (uint64_t)s_n_shards];
+}
+
+sqlite3 *db_shard(int64_t id) { return db_store_of(id)->writer; }
+
+sqlite3 *db_shard_at(int i) { return s_shards[i].writer; }
+
+int db_begin(sqlite3 *shard) {
+  int rc;
+  if ((rc = sqlite3_exec(db, "begin transaction;", NULL, NULL, NULL)) !=
+      SQLITE_OK) {
+    log_error("begin transaction failed: %d (%s)", rc, sqlite3_errmsg(db));
+    return rc;
+  }
+
+  if (shard != db &&
+      (rc = sqlite3_exec(shard, "begin transaction;", NULL, NULL, NULL)) !=
+          SQLITE_OK) {
+    log_error("begin transaction failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+  }
+
+  return rc;
+}
+
+int db_commit(sqlite3 *shard) {
+  uint64_t started_at = PROBE_ENABLED(sqlite_commit) ? metrics_now_ns() : 0;
+  int rc;
+  if ((rc = sqlite3_exec(db, "commit;", NULL, NULL, NULL)) != SQLITE_OK) {
+    log_error("commit failed: %d (%s)", rc, sqlite3_errmsg(db));
+    db_rollback(shard);
+    goto end;
+  }
+
+  if (shard != db &&
+      (rc = sqlite3_exec(shard, "commit;", NULL, NULL, NULL)) != SQLITE_OK) {
+    log_error("commit failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    sqlite3_exec(shard, "rollback;", NULL, NULL, NULL);
+  }
+
+end:
+  if (PROBE_ENABLED(sqlite_commit))
+    PROBE2(sqlite_commit, rc, metrics_now_ns() - started_at);
+  return rc;
+}
+
+void db_rollback(sqlite3 *shard) {
+  if (shard != db && !sqlite3_get_autocommit(shard))
+    sqlite3_exec(shard, "rollback;", NULL, NULL, NULL);
+  if (!sqlite3_get_autocommit(db))
+    sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+}
+
+static sqlite3_stmt *db_store_read_stmt(struct db_store *store,
+                                        enum db_read_stmt which) {
+  sqlite3_stmt *stmt = NULL;
+
+  pthread_mutex_lock(&store->lock);
+
+  // start at a different reader each time to spread the load
+  for (size_t n = 0; n < store->n_readers; ++n) {
+    struct db_reader *r =
+        &store->readers[(store->next_reader + n) % store->n_readers];
+    if (r->busy[which]) continue;
+
+    int rc;
+    if (!r->stmts[which] &&
+        (rc = sqlite3_prepare_v3(r->conn, s_read_sql[which], -1,
+                                 SQLITE_PREPARE_PERSISTENT, &r->stmts[which],
+                                 NULL)) != SQLITE_OK) {
+      log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(r->conn));
+      goto unlock;
+    }
+
+    r->busy[which] = true;
+    stmt = r->stmts[which];
+    goto unlock;
+  }
+  log_error("no reader available");
+
+unlock:
+  store->next_reader =
+      (store->next_reader + 1) % (store->n_readers ? store->n_readers : 1);
+  pthread_mutex_unlock(&store->lock);
+  return stmt;
+}
+
+sqlite3_stmt *db_read_stmt(enum db_read_stmt which) {
+  return db_store_read_stmt(&s_directory, which);
+}
+
+sqlite3_stmt *db_shard_read_stmt(enum db_read_stmt which, int64_t id) {
+  return db_store_read_stmt(db_store_of(id), which);
+}
+
+static bool db_store_release(struct db_store *store, sqlite3_stmt *stmt) {
+  bool found = false;
+  sqlite3 *conn = sqlite3_db_handle(stmt);
+
+  pthread_mutex_lock(&store->lock);
+  for (size_t i = 0; i < store->n_readers && !found; ++i) {
+    struct db_reader *r = &store->readers[i];
+    if (r->conn != conn) continue;
+    for (size_t j = 0; j < DB_READ_STMT_COUNT; ++j) {
+      if (r->stmts[j] == stmt) {
+        r->busy[j] = false;
+        found = true;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&store->lock);
+
+  return found;
+}
+
+void db_read_done(sqlite3_stmt *stmt) {
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+
+  if (db_store_release(&s_directory, stmt)) return;
+  for (int i = 0; i < s_n_shards; ++i)
+    if (db_store_release(&s_shards[i], stmt)) return;
+}
+
+// sqlite3_trace_v2 takes one callback per connection, db_trace_event feeds
+// both the one installed by db_trace and the profiler
+static int (*s_trace_cb)(unsigned, void *, void *, void *);
+static void *s_trace_ctx;
+static unsigned s_trace_mask;
+
+struct db_profile_entry {
+  char sql[DB_PROFILE_SQL_MAX];
+  uint64_t calls, total_ns, max_ns, rows;
+};
+
+static bool s_profile_aggregate;
+static uint64_t s_profile_slow_ns;
+static struct db_profile_entry s_profile[DB_PROFILE_STATEMENTS];
+static struct db_profile_entry s_profile_other = {.sql = "(other)"};
+static pthread_mutex_t s_profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// rows returned by the selects currently stepping on this thread, counted
+// from SQLITE_TRACE_ROW until their SQLITE_TRACE_PROFILE
+#define DB_PROFILE_ACTIVE 8
+static _Thread_local struct {
+  sqlite3_stmt *stmt;
+  uint64_t rows;
+} s_active[DB_PROFILE_ACTIVE];
+
+static void count_row(sqlite3_stmt *stmt) {
+  int free_slot = -1;
+  for (int i = 0; i < DB_PROFILE_ACTIVE; ++i) {
+    if (s_active[i].stmt == stmt) {
+      ++s_active[i].rows;
+      return;
+    }
+    if (!s_active[i].stmt && free_slot < 0) free_slot = i;
+  }
+  // more nested selects than slots, their rows go uncounted
+  if (free_slot < 0) return;
+  s_active[free_slot].stmt = stmt;
+  s_active[free_slot].rows = 1;
+}
+
+static uint64_t take_rows(sqlite3_stmt *stmt) {
+  if (!sqlite3_stmt_readonly(stmt))
+    return (uint64_t)sqlite3_changes(sqlite3_db_handle(stmt));
+
+  for (int i = 0; i < DB_PROFILE_ACTIVE; ++i) {
+    if (s_active[i].stmt == stmt) {
+      s_active[i].stmt = NULL;
+      return s_active[i].rows;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Copies sql with whitespace collapsed and string and number literals
+ * replaced by ?, so statements differing only in inlined values aggregate
+ * together.
+ */
+static void normalize_sql(char *out, size_t size, const char *sql) {
+  size_t n = 0;
+  bool space = false;
+
+  for (const char *s = sql; *s && n + 2 < size; ++s) {
+    if (isspace((unsigned char)*s)) {
+      space = n > 0;
+      continue;
+    }
+    if (space) out[n++] = ' ';
+    space = false;
+
+    char prev = n ? out[n - 1] : ' ';
+    if (*s == '\'') {
+      // '' is an escaped quote inside the literal
+      while (*++s && !(*s == '\'' && s[1] != '\''))
+        if (*s == '\'') ++s;
+      if (!*s) --s;
+      out[n++] = '?';
+    } else if (isdigit((unsigned char)*s) && !isalnum((unsigned char)prev) &&
+               prev != '_') {
+      while (isalnum((unsigned char)s[1]) || s[1] == '.') ++s;
+      out[n++] = '?';
+    } else {
+      out[n++] = *s;
+    }
+  }
+  out[n] = '\0';
+}
+
+static uint64_t hash_sql(const char *sql) {
+  uint64_t h = 0xcbf29ce484222325ULL;  // FNV-1a
+  for (; *sql; ++sql) h = (h ^ (unsigned char)*sql) * 0x100000001b3ULL;
+  return h;
+}
+
+static void profile_add(const char *sql, uint64_t ns, uint64_t rows) {
+  pthread_mutex_lock(&s_profile_lock);
+
+  struct db_profile_entry *e = &s_profile_other;
+  uint64_t h = hash_sql(sql);
+  for (size_t i = 0; i < DB_PROFILE_STATEMENTS; ++i) {
+    struct db_profile_entry *slot =
+        &s_profile[(h + i) % DB_PROFILE_STATEMENTS];
+    if (!slot->calls) {
+      snprintf(slot->sql, sizeof slot->sql, "%s", sql);
+      e = slot;
+      break;
+    }
+    if (strcmp(slot->sql, sql) == 0) {
+      e = slot;
+      break;
+    }
+  }
+
+  ++e->calls;
+  e->total_ns += ns;
+  e->rows += rows;
+  if (ns > e->max_ns) e->max_ns = ns;
+
+  pthread_mutex_unlock(&s_profile_lock);
+}
+
+static int db_trace_event(unsigned type, void *ctx, void *p, void *x) {
+  (void)ctx;
+
+  if (s_profile_aggregate || s_profile_slow_ns) {
+    if (type == SQLITE_TRACE_ROW) {
+      count_row(p);
+    } else if (type == SQLITE_TRACE_PROFILE) {
+      uint64_t ns = *(sqlite3_int64 *)x;
+      uint64_t rows = take_rows(p);
+      const char *text = sqlite3_sql(p);
+      char sql[DB_PROFILE_SQL_MAX];
+      normalize_sql(sql, sizeof sql, text ? text : "");
+
+      if (s_profile_aggregate) profile_add(sql, ns, rows);
+      if (s_profile_slow_ns && ns >= s_profile_slow_ns)
+        log_warn("slow query elapsed_ms=%.1f rows=%" PRIu64 " sql=\"%s\"",
+                 ns / 1e6, rows, sql);
+    }
+  }
+
+  if (s_trace_cb && (type & s_trace_mask)) s_trace_cb(type, s_trace_ctx, p, x);
+  return 0;
+}
+
+static void db_store_trace(struct db_store *store, unsigned mask) {
+  int (*cb)(unsigned, void *, void *, void *) = mask ? db_trace_event : NULL;
+  sqlite3_trace_v2(store->writer, mask, cb, NULL);
+  for (size_t i = 0; i < store->n_readers; ++i)
+    if (store->readers[i].conn != store->writer)
+      sqlite3_trace_v2(store->readers[i].conn, mask, cb, NULL);
+}
+
+static void db_trace_install(void) {
+  unsigned mask = s_trace_cb ? s_trace_mask : 0;
+  if (s_profile_aggregate || s_profile_slow_ns)
+    mask |= SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW;
+
+  db_store_trace(&s_directory, mask);
+  if (s_shards != &s_directory)
+    for (int i = 0; i < s_n_shards; ++i) db_store_trace(&s_shards[i], mask);
+}
+
+void db_trace(unsigned mask,
+              int (*cb)(unsigned type, void *ctx, void *p, void *x),
+              void *ctx) {
+  s_trace_cb = cb;
+  s_trace_ctx = ctx;
+  s_trace_mask = mask;
+  db_trace_install();
+}
+
+void db_profile_start(bool aggregate, unsigned slow_ms) {
+  s_profile_aggregate = aggregate;
+  s_profile_slow_ns = slow_ms * 1000000ULL;
+  db_trace_install();
+}
+
+static int by_total_desc(const void *a, const void *b) {
+  const struct db_profile_entry *x = a, *y = b;
+  return x->total_ns < y->total_ns ? 1 : x->total_ns > y->total_ns ? -1 : 0;
+}
+
+/**
+ * Copies the non-empty entries, most total time first.
+ * @return the number copied, -1 if out of memory.
+ */
+static int profile_snapshot(struct db_profile_entry **out) {
+  *out = malloc((DB_PROFILE_STATEMENTS + 1) * sizeof **out);
+  if (!*out) {
+    log_error("out of memory");
+    return -1;
+  }
+
+  int n = 0;
+  pthread_mutex_lock(&s_profile_lock);
+  for (size_t i = 0; i < DB_PROFILE_STATEMENTS; ++i)
+    if (s_profile[i].calls) (*out)[n++] = s_profile[i];
+  if (s_profile_other.calls) (*out)[n++] = s_profile_other;
+  pthread_mutex_unlock(&s_profile_lock);
+
+  qsort(*out, n, sizeof **out, by_total_desc);
+  return n;
+}
+
+void db_profile_write(FILE *f) {
+  if (!s_profile_aggregate) {
+    fprintf(f, "profiling is off, start with --profile-sql\n");
+    return;
+  }
+
+  struct db_profile_entry *entries;
+  int n = profile_snapshot(&entries);
+  if (n < 0) return;
+
+  fprintf(f, "%10s %12s %10s %10s %10s  %s\n", "calls", "total_ms", "avg_us",
+          "max_us", "rows", "sql");
+  for (int i = 0; i < n; ++i) {
+    const struct db_profile_entry *e = &entries[i];
+    fprintf(f, "%10" PRIu64 " %12.1f %10.1f %10.1f %10" PRIu64 "  %s\n",
+            e->calls, e->total_ns / 1e6, e->total_ns / 1e3 / e->calls,
+            e->max_ns / 1e3, e->rows, e->sql);
+  }
+  free(entries);
+}
+
+void db_profile_log(void) {
+  if (!s_profile_aggregate) return;
+
+  struct db_profile_entry *entries;
+  int n = profile_snapshot(&entries);
+  if (n < 0) return;
+
+  for (int i = 0; i < n; ++i) {
+    const struct db_profile_entry *e = &entries[i];
+    log_info("sql profile calls=%" PRIu64
+             " total_ms=%.1f avg_us=%.1f max_us=%.1f rows=%" PRIu64
+             " sql=\"%s\"",
+             e->calls, e->total_ns / 1e6, e->total_ns / 1e3 / e->calls,
+             e->max_ns / 1e3, e->rows, e->sql);
+  }
+  free(entries);
 }
@@ -0,0 +1,161 @@
+#include "handlers/blob.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blobs.h"
+#include "trace.h"
+#include "util.h"
+
+#ifndef NDEBUG
+#define BLOB_REPLY_HEADERS             \
+  "Access-Control-Allow-Origin: *\r\n" \
+  "Access-Control-Expose-Headers: Upload-Offset, Content-Range\r\n"
+#else
+#define BLOB_REPLY_HEADERS ""
+#endif
+
+#define ERR(CODE)         \
+  do {                    \
+    status_code = (CODE); \
+    goto err;             \
+  } while (0)
+
+// a query variable that must be there and hold a decimal number
+static bool get_u64(struct mg_http_message *hm, const char *name,
+                    uint64_t *value) {
+  char buf[24];
+  if (mg_http_get_var(&hm->query, name, buf, sizeof buf) <= 0) return false;
+  if (buf[0] < '0' || buf[0] > '9') return false;
+
+  char *end;
+  errno = 0;
+  *value = strtoull(buf, &end, 10);
+  return *end == '\0' && errno == 0;
+}
+
+/**
+ * PUT /api/blobs/<hash>?offset=N&total=T with the next chunk as the body.
+ * Replies with the bytes stored so far in Upload-Offset: 204 while more are
+ * expected, 201 once the blob is complete, 200 if it was already there, and
+ * 409 when offset isn't where the upload is at, to resume from there. A new
+ * upload that would take its owner over their quota, or the server over its
+ * cap, is refused with a 507 saying which, and one past the owner's limit of
+ * uploads in progress with a 429.
+ */
+static void handle_blob_PUT_request(struct mg_connection *c,
+                                    struct mg_http_message *hm,
+                                    const char *name) {
+  int status_code = 418;
+  uint64_t offset, total, size = 0;
+  uint64_t span;
+
+  int64_t id = verify_request(hm, NULL);
+  if (id < 0) ERR(-id);
+
+  if (!get_u64(hm, "offset", &offset) || !get_u64(hm, "total", &total))
+    ERR(400);
+  if (hm->body.len > BLOBS_CHUNK_MAX) ERR(413);
+
+  TRACE_BEGIN(span);
+  enum blobs_status status =
+      blobs_write(name, id, offset, total, hm->body.buf, hm->body.len, &size);
+  TRACE_END(span, "blob.write");
+
+  switch (status) {
+    case BLOBS_OK:
+      status_code = 204;
+      break;
+    case BLOBS_COMPLETE:
+      status_code = 201;
+      break;
+    case BLOBS_EXISTS:
+      status_code = 200;
+      break;
+    case BLOBS_BAD_OFFSET:
+      status_code = 409;
+      break;
+    case BLOBS_BAD_REQUEST:
+      ERR(400);
+    case BLOBS_TOO_LARGE:
+      ERR(413);
+    case BLOBS_HASH_MISMATCH:
+      ERR(422);
+    case BLOBS_LOCKED:
+      ERR(423);
+    case BLOBS_FULL:
+      ERR(503);
+    case BLOBS_BUSY:
+      ERR(429);
+    case BLOBS_OVER_QUOTA:
+      mg_http_reply(c, 507, BLOB_REPLY_HEADERS, "blob quota exceeded\n");
+      return;
+    case BLOBS_NO_SPACE:
+      mg_http_reply(c, 507, BLOB_REPLY_HEADERS, "blob storage full\n");
+      return;
+    default:
+      ERR(500);
+  }
+
+  char headers[256];
+  snprintf(headers, sizeof headers,
+           BLOB_REPLY_HEADERS "Upload-Offset: %" PRIu64 "\r\n", size);
+  mg_http_reply(c, status_code, headers, "");
+  return;
+
+err:
+  mg_http_reply(c, status_code, BLOB_REPLY_HEADERS, "");
+}
+
+/**
+ * GET (or HEAD) /api/blobs/<hash>, streamed from disk. Range requests get
+ * the requested bytes with a 206, so large attachments can be fetched in
+ * pieces and resumed.
+ */
+static void handle_blob_GET_request(struct mg_connection *c,
+                                    struct mg_http_message *hm,
+                                    const char *name) {
+  int status_code = 418;
+  char path[PATH_MAX];
+
+  int64_t id = verify_request(hm, NULL);
+  if (id < 0) ERR(-id);
+
+  if (!blobs_path(name, path, sizeof path)) ERR(404);
+
+  // the content never changes under a name, but it does expire
+  struct mg_http_serve_opts opts = {
+      .extra_headers = BLOB_REPLY_HEADERS
+      "Cache-Control: private, max-age=86400, immutable\r\n"
+      "X-Content-Type-Options: nosniff\r\n",
+  };
+  mg_http_serve_file(c, hm, path, &opts);
+  return;
+
+err:
+  mg_http_reply(c, status_code, BLOB_REPLY_HEADERS, "");
+}
+
+void handle_blob_request(struct mg_connection *c, struct mg_http_message *hm,
+                         struct mg_str *hash) {
+  char name[BLOBS_NAME_LEN + 1];
+  if (!blobs_is_name(hash->buf, hash->len)) {
+    mg_http_reply(c, 404, BLOB_REPLY_HEADERS, "");
+    return;
+  }
+  memcpy(name, hash->buf, BLOBS_NAME_LEN);
+  name[BLOBS_NAME_LEN] = '\0';
+
+  if (mg_strcmp(hm->method, mg_str("PUT")) == 0) {
+    handle_blob_PUT_request(c, hm, name);
+  } else if (mg_strcmp(hm->method, mg_str("GET")) == 0 ||
+             mg_strcmp(hm->method, mg_str("HEAD")) == 0) {
+    handle_blob_GET_request(c, hm, name);
+  } else {
+    mg_http_reply(c, 405, BLOB_REPLY_HEADERS, "");
+  }
+}
@@ -3,10 +3,15 @@
 #include <crypto.h>
 #include <sqlite3.h>
 
+#include "alloc.h"
 #include "db.h"
+#include "handlers/websocket.h"
+#include "log.h"
 #include "messages.pb-c.h"
 #include "mongoose.h"
 #include "protobuf-c.h"
+#include "queue.h"
+#include "trace.h"
 #include "util.h"
 
 #ifndef NDEBUG
@@ -23,77 +28,55 @@
 
 #define BUF(STRUCT) (STRUCT).data, (STRUCT).len
 
-#define HANDLE_MIN_LENGTH 3
-#define HANDLE_MAX_LENGTH 32
-
-static int validate_handle(const char *handle) {
-  if (!handle) return 0;
-
-  size_t len = strlen(handle);
-  if (len < HANDLE_MIN_LENGTH || len > HANDLE_MAX_LENGTH) return 0;
-
-  // Must start with a lowercase letter
-  if (!islower((unsigned char)handle[0])) return 0;
-
-  for (size_t i = 0; i < len; ++i) {
-    char c = handle[i];
-    // Must be lowercase letter, digit, or underscore
-    if (!islower((unsigned char)c) && !isdigit((unsigned char)c) && c != '_')
-      return 0;
-    // No consecutive underscores
-    if (c == '_' && i > 0 && handle[i - 1] == '_') return 0;
-  }
-
-  // Cannot end with underscore
-  if (handle[len - 1] == '_') return 0;
-
-  return 1;
-}
-
 static int verify_xeddsa_signature(const Messages__SignedPrekey *pb,
                                    const void *pk) {
   if (!pb || pb->sig.len != XEDDSA_SIGNATURE_LENGTH || !pk) return 0;
-  return xeddsa_verify(pk, BUF(pb->key), pb->sig.data);
+  return verify_signature(pk, BUF(pb->key), pb->sig.data);
 }
 
 static void handle_identity_POST_request(struct mg_connection *c,
                                          struct mg_http_message *hm) {
   int status_code = 418;
   Messages__Identity *pb = NULL;
+  sqlite3 *shard = db;
   sqlite3_stmt *stmt0 = NULL, *stmt1 = NULL, *stmt2 = NULL;
+  uint64_t span;
 
-  pb = messages__identity__unpack(NULL, hm->body.len, (uint8_t *)hm->body.buf);
+  TRACE_BEGIN(span);
+  pb = messages__identity__unpack(&alloc_protobuf, hm->body.len,
+                                  (uint8_t *)hm->body.buf);
   if (!pb) {
-    fprintf(stderr, "[%s:%d] invalid message\n", __func__, __LINE__);
+    log_warn("invalid message");
     ERR(400);
   }
+  TRACE_END(span, "identity.unpack");
 
   if (!validate_handle(pb->handle)) {
-    fprintf(stderr, "[%s:%d] invalid handle: %s\n", __func__, __LINE__,
-            pb->handle);
+    log_warn("invalid handle: %s", pb->handle);
     ERR(400);
   }
 
   if (pb->id_key.len != CURVE25519_PUBLIC_KEY_LENGTH ||
       pb->prekey->key.len != CURVE25519_PUBLIC_KEY_LENGTH) {
-    fprintf(stderr, "[%s:%d] invalid key\n", __func__, __LINE__);
+    log_warn("invalid key");
     ERR(400);
   }
 
+  TRACE_BEGIN(span);
   if (!verify_xeddsa_signature(pb->prekey, pb->id_key.data) ||
       !verify_xeddsa_signature(pb->pqkem_prekey, pb->id_key.data)) {
-    fprintf(stderr, "[%s:%d] invalid signature\n", __func__, __LINE__);
+    log_warn("invalid signature");
     ERR(400);
   }
 
   for (size_t i = 0; i < pb->n_one_time_pqkem_prekeys; ++i) {
     if (!verify_xeddsa_signature(pb->one_time_pqkem_prekeys[i],
                                  pb->id_key.data)) {
-      fprintf(stderr, "[%s:%d] invalid signature for PQOPK at [%zu]\n",
-              __func__, __LINE__, i);
+      log_warn("invalid signature for PQOPK at [%zu]", i);
       ERR(400);
     }
   }
+  TRACE_END(span, "identity.verify");
 
   // clang-format off
   const char *sql0 =
@@ -111,19 +94,16 @@ static void handle_identity_POST_request(struct mg_connection *c,
   const char *sql2 = "insert into opks(for,bytes,id)values(?,?,?);";
   // clang-format on
 
+  TRACE_BEGIN(span);
   int rc;
-  if ((rc = sqlite3_prepare_v3(db, sql0, -1, 0, &stmt0, NULL)) != SQLITE_OK ||
-      (rc = sqlite3_prepare_v3(db, sql1, -1, 0, &stmt1, NULL)) != SQLITE_OK ||
-      (rc = sqlite3_prepare_v3(db, sql2, -1, 0, &stmt2, NULL)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
+  if ((rc = sqlite3_prepare_v3(db, sql0, -1, 0, &stmt0, NULL)) != SQLITE_OK) {
+    log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(db));
     ERR(500);
   }
 
   if ((rc = sqlite3_exec(db, "begin transaction;", NULL, NULL, NULL)) !=
       SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] begin transaction failed: %d (%s)\n", __func__,
-            __LINE__, rc, sqlite3_errmsg(db));
+    log_error("begin transaction failed: %d (%s)", rc, sqlite3_errmsg(db));
     ERR(500);
   }
 
@@ -141,25 +121,44 @@ static void handle_identity_POST_request(struct mg_connection *c,
       (rc = sqlite3_bind_int64(stmt0, 7, pb->pqkem_prekey->id)) != SQLITE_OK ||
       (rc = sqlite3_bind_blob(stmt0, 8, BUF(pb->pqkem_prekey->sig),
                               SQLITE_STATIC)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
-    sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+    log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(db));
+    db_rollback(shard);
     ERR(500);
   }
 
   if ((rc = sqlite3_step(stmt0)) != SQLITE_DONE) {
-    fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
-    sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+    log_error("step failed: %d (%s)", rc, sqlite3_errmsg(db));
+    db_rollback(shard);
     ERR(500);
   }
 
   if (sqlite3_changes(db) == 0) {
-    sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+    db_rollback(shard);
     ERR(409);
   }
   int64_t id = sqlite3_last_insert_rowid(db);
 
+  // the prekeys go to the shard of the id just handed out
+  if (db_shard(id) != db) {
+    if ((rc = sqlite3_exec(db_shard(id), "begin transaction;", NULL, NULL,
+                           NULL)) != SQLITE_OK) {
+      log_error("begin transaction failed: %d (%s)", rc,
+                sqlite3_errmsg(db_shard(id)));
+      db_rollback(shard);
+      ERR(500);
+    }
+    shard = db_shard(id);
+  }
+
+  if ((rc = sqlite3_prepare_v3(shard, sql1, -1, 0, &stmt1, NULL)) !=
+          SQLITE_OK ||
+      (rc = sqlite3_prepare_v3(shard, sql2, -1, 0, &stmt2, NULL)) !=
+          SQLITE_OK) {
+    log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    db_rollback(shard);
+    ERR(500);
+  }
+
   for (size_t i = 0; i < pb->n_one_time_pqkem_prekeys; ++i) {
     Messages__SignedPrekey *pqopk = pb->one_time_pqkem_prekeys[i];
 
@@ -169,16 +168,14 @@ static void handle_identity_POST_request(struct mg_connection *c,
         (rc = sqlite3_bind_int64(stmt1, 3, pqopk->id)) != SQLITE_OK ||
         (rc = sqlite3_bind_blob(stmt1, 4, BUF(pqopk->sig), SQLITE_STATIC)) !=
             SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
-      sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+      log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(shard));
+      db_rollback(shard);
       ERR(500);
     }
 
     if ((rc = sqlite3_step(stmt1)) != SQLITE_DONE) {
-      fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
-      sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+      log_error("step failed: %d (%s)", rc, sqlite3_errmsg(shard));
+      db_rollback(shard);
       ERR(500);
     }
 
@@ -193,16 +190,14 @@ static void handle_identity_POST_request(struct mg_connection *c,
         (rc = sqlite3_bind_blob(stmt2, 2, BUF(opk->key), SQLITE_STATIC)) !=
             SQLITE_OK ||
         (rc = sqlite3_bind_int64(stmt2, 3, opk->id)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
-      sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+      log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(shard));
+      db_rollback(shard);
       ERR(500);
     }
 
     if ((rc = sqlite3_step(stmt2)) != SQLITE_DONE) {
-      fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
-      sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+      log_error("step failed: %d (%s)", rc, sqlite3_errmsg(shard));
+      db_rollback(shard);
       ERR(500);
     }
 
@@ -210,16 +205,24 @@ static void handle_identity_POST_request(struct mg_connection *c,
     sqlite3_clear_bindings(stmt2);
   }
 
-  if ((rc = sqlite3_exec(db, "commit;", NULL, NULL, NULL)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] commit failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
+  if (db_commit(shard) != SQLITE_OK) {
+    // the shard failed after the directory went through: drop the identity,
+    // whose id stays burned, rather than leave it without prekeys
+    sqlite3_stmt *stmt = NULL;
+    if ((rc = sqlite3_prepare_v3(db, "delete from identities where id=?;", -1,
+                                 0, &stmt, NULL)) != SQLITE_OK ||
+        (rc = sqlite3_bind_int64(stmt, 1, id)) != SQLITE_OK ||
+        (rc = sqlite3_step(stmt)) != SQLITE_DONE)
+      log_error("delete failed: %d (%s)", rc, sqlite3_errmsg(db));
+    if (stmt) sqlite3_finalize(stmt);
     ERR(500);
   }
+  TRACE_END(span, "identity.sql");
 
   status_code = 201;
 
 err:
-  if (pb) messages__identity__free_unpacked(pb, NULL);
+  if (pb) messages__identity__free_unpacked(pb, &alloc_protobuf);
   if (stmt0) sqlite3_finalize(stmt0);
   if (stmt1) sqlite3_finalize(stmt1);
   if (stmt2) sqlite3_finalize(stmt2);
@@ -233,36 +236,41 @@ static void handle_identity_PATCH_request(struct mg_connection *c,
   Messages__IdentityPatch *pb = NULL;
   sqlite3_stmt *stmt_update = NULL, *stmt_insert_pqopk = NULL,
                *stmt_insert_opk = NULL;
+  uint64_t span;
 
   int64_t id = verify_request(hm, &id_key);
   if (id < 0) ERR(-id);
+  sqlite3 *shard = db_shard(id);
 
-  pb = messages__identity_patch__unpack(NULL, hm->body.len,
+  TRACE_BEGIN(span);
+  pb = messages__identity_patch__unpack(&alloc_protobuf, hm->body.len,
                                         (uint8_t *)hm->body.buf);
   if (!pb) {
-    fprintf(stderr, "[%s:%d] invalid message\n", __func__, __LINE__);
+    log_warn("invalid message");
     ERR(400);
   }
+  TRACE_END(span, "identity.unpack");
 
   if (pb->prekey && pb->prekey->key.len != CURVE25519_PUBLIC_KEY_LENGTH) {
-    fprintf(stderr, "[%s:%d] invalid prekey\n", __func__, __LINE__);
+    log_warn("invalid prekey");
     ERR(400);
   }
 
+  TRACE_BEGIN(span);
   if ((pb->prekey && !verify_xeddsa_signature(pb->prekey, id_key)) ||
       (pb->pqkem_prekey &&
        !verify_xeddsa_signature(pb->pqkem_prekey, id_key))) {
-    fprintf(stderr, "[%s:%d] invalid signature\n", __func__, __LINE__);
+    log_warn("invalid signature");
     ERR(400);
   }
 
   for (size_t i = 0; i < pb->n_one_time_pqkem_prekeys; ++i) {
     if (!verify_xeddsa_signature(pb->one_time_pqkem_prekeys[i], id_key)) {
-      fprintf(stderr, "[%s:%d] invalid signature for PQOPK at [%zu]\n",
-              __func__, __LINE__, i);
+      log_warn("invalid signature for PQOPK at [%zu]", i);
       ERR(400);
     }
   }
+  TRACE_END(span, "identity.verify");
 
   // clang-format off
   const char *sql_update = "update identities set spk=?,spk_id=?,spk_sig=?,pqspk=?,pqspk_id=?,pqspk_sig=? where id=?;";
@@ -272,36 +280,29 @@ static void handle_identity_PATCH_request(struct mg_connection *c,
   const char *sql_insert_opk = "insert into opks(for,bytes,id)values(?,?,?);";
   // clang-format on
 
+  TRACE_BEGIN(span);
   int rc;
   if (pb->prekey && pb->pqkem_prekey) {
     if ((rc = sqlite3_prepare_v3(db, sql_update, -1, 0, &stmt_update, NULL)) !=
         SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] prepare update failed: %d (%s)\n", __func__,
-              __LINE__, rc, sqlite3_errmsg(db));
+      log_error("prepare update failed: %d (%s)", rc, sqlite3_errmsg(db));
       ERR(500);
     }
   } else if (pb->prekey) {
     if ((rc = sqlite3_prepare_v3(db, sql_update_spk_only, -1, 0, &stmt_update,
                                  NULL)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] prepare update spk failed: %d (%s)\n", __func__,
-              __LINE__, rc, sqlite3_errmsg(db));
+      log_error("prepare update spk failed: %d (%s)", rc, sqlite3_errmsg(db));
       ERR(500);
     }
   } else if (pb->pqkem_prekey) {
     if ((rc = sqlite3_prepare_v3(db, sql_update_pqspk_only, -1, 0, &stmt_update,
                                  NULL)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] prepare update pqspk failed: %d (%s)\n",
-              __func__, __LINE__, rc, sqlite3_errmsg(db));
+      log_error("prepare update pqspk failed: %d (%s)", rc, sqlite3_errmsg(db));
       ERR(500);
     }
   }
 
-  if ((rc = sqlite3_exec(db, "begin transaction;", NULL, NULL, NULL)) !=
-      SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] begin transaction failed: %d (%s)\n", __func__,
-            __LINE__, rc, sqlite3_errmsg(db));
-    ERR(500);
-  }
+  if (db_begin(shard) != SQLITE_OK) ERR(500);
 
   if (pb->prekey && pb->pqkem_prekey) {
     if ((rc = sqlite3_bind_blob(stmt_update, 1, BUF(pb->prekey->key),
@@ -317,9 +318,8 @@ static void handle_identity_PATCH_request(struct mg_connection *c,
         (rc = sqlite3_bind_blob(stmt_update, 6, BUF(pb->pqkem_prekey->sig),
                                 SQLITE_STATIC)) != SQLITE_OK ||
         (rc = sqlite3_bind_int64(stmt_update, 7, id)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] bind update failed: %d (%s)\n", __func__,
-              __LINE__, rc, sqlite3_errmsg(db));
-      sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+      log_error("bind update failed: %d (%s)", rc, sqlite3_errmsg(db));
+      db_rollback(shard);
       ERR(500);
     }
   } else if (pb->prekey) {
@@ -330,9 +330,8 @@ static void handle_identity_PATCH_request(struct mg_connection *c,
         (rc = sqlite3_bind_blob(stmt_update, 3, BUF(pb->prekey->sig),
                                 SQLITE_STATIC)) != SQLITE_OK ||
         (rc = sqlite3_bind_int64(stmt_update, 4, id)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] bind update spk failed: %d (%s)\n", __func__,
-              __LINE__, rc, sqlite3_errmsg(db));
-      sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+      log_error("bind update spk failed: %d (%s)", rc, sqlite3_errmsg(db));
+      db_rollback(shard);
       ERR(500);
     }
   } else if (pb->pqkem_prekey) {
@@ -343,28 +342,26 @@ static void handle_identity_PATCH_request(struct mg_connection *c,
         (rc = sqlite3_bind_blob(stmt_update, 3, BUF(pb->pqkem_prekey->sig),
                                 SQLITE_STATIC)) != SQLITE_OK ||
         (rc = sqlite3_bind_int64(stmt_update, 4, id)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] bind update pqspk failed: %d (%s)\n", __func__,
-              __LINE__, rc, sqlite3_errmsg(db));
-      sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+      log_error("bind update pqspk failed: %d (%s)", rc, sqlite3_errmsg(db));
+      db_rollback(shard);
       ERR(500);
     }
   }
 
   if (stmt_update) {
     if ((rc = sqlite3_step(stmt_update)) != SQLITE_DONE) {
-      fprintf(stderr, "[%s:%d] step update failed: %d (%s)\n", __func__,
-              __LINE__, rc, sqlite3_errmsg(db));
-      sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+      log_error("step update failed: %d (%s)", rc, sqlite3_errmsg(db));
+      db_rollback(shard);
       ERR(500);
     }
   }
 
   if (pb->n_one_time_pqkem_prekeys > 0) {
-    if ((rc = sqlite3_prepare_v3(db, sql_insert_pqopk, -1, 0,
+    if ((rc = sqlite3_prepare_v3(shard, sql_insert_pqopk, -1, 0,
                                  &stmt_insert_pqopk, NULL)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] prepare insert pqopk failed: %d (%s)\n",
-              __func__, __LINE__, rc, sqlite3_errmsg(db));
-      sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+      log_error("prepare insert pqopk failed: %d (%s)", rc,
+                sqlite3_errmsg(shard));
+      db_rollback(shard);
       ERR(500);
     }
 
@@ -378,16 +375,16 @@ static void handle_identity_PATCH_request(struct mg_connection *c,
               SQLITE_OK ||
           (rc = sqlite3_bind_blob(stmt_insert_pqopk, 4, BUF(pqopk->sig),
                                   SQLITE_STATIC)) != SQLITE_OK) {
-        fprintf(stderr, "[%s:%d] bind insert pqopk failed: %d (%s)\n", __func__,
-                __LINE__, rc, sqlite3_errmsg(db));
-        sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+        log_error("bind insert pqopk failed: %d (%s)", rc,
+                  sqlite3_errmsg(shard));
+        db_rollback(shard);
         ERR(500);
       }
 
       if ((rc = sqlite3_step(stmt_insert_pqopk)) != SQLITE_DONE) {
-        fprintf(stderr, "[%s:%d] step insert pqopk failed: %d (%s)\n", __func__,
-                __LINE__, rc, sqlite3_errmsg(db));
-        sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+        log_error("step insert pqopk failed: %d (%s)", rc,
+                  sqlite3_errmsg(shard));
+        db_rollback(shard);
         ERR(500);
       }
 
@@ -397,11 +394,11 @@ static void handle_identity_PATCH_request(struct mg_connection *c,
   }
 
   if (pb->n_one_time_prekeys > 0) {
-    if ((rc = sqlite3_prepare_v3(db, sql_insert_opk, -1, 0, &stmt_insert_opk,
+    if ((rc = sqlite3_prepare_v3(shard, sql_insert_opk, -1, 0, &stmt_insert_opk,
                                  NULL)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] prepare insert opk failed: %d (%s)\n", __func__,
-              __LINE__, rc, sqlite3_errmsg(db));
-      sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+      log_error("prepare insert opk failed: %d (%s)", rc,
+                sqlite3_errmsg(shard));
+      db_rollback(shard);
       ERR(500);
     }
 
@@ -412,16 +409,14 @@ static void handle_identity_PATCH_request(struct mg_connection *c,
           (rc = sqlite3_bind_blob(stmt_insert_opk, 2, BUF(opk->key),
                                   SQLITE_STATIC)) != SQLITE_OK ||
           (rc = sqlite3_bind_int64(stmt_insert_opk, 3, opk->id)) != SQLITE_OK) {
-        fprintf(stderr, "[%s:%d] bind insert opk failed: %d (%s)\n", __func__,
-                __LINE__, rc, sqlite3_errmsg(db));
-        sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+        log_error("bind insert opk failed: %d (%s)", rc, sqlite3_errmsg(shard));
+        db_rollback(shard);
         ERR(500);
       }
 
       if ((rc = sqlite3_step(stmt_insert_opk)) != SQLITE_DONE) {
-        fprintf(stderr, "[%s:%d] step insert opk failed: %d (%s)\n", __func__,
-                __LINE__, rc, sqlite3_errmsg(db));
-        sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+        log_error("step insert opk failed: %d (%s)", rc, sqlite3_errmsg(shard));
+        db_rollback(shard);
         ERR(500);
       }
 
@@ -430,11 +425,8 @@ static void handle_identity_PATCH_request(struct mg_connection *c,
     }
   }
 
-  if ((rc = sqlite3_exec(db, "commit;", NULL, NULL, NULL)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] commit failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
-    ERR(500);
-  }
+  if (db_commit(shard) != SQLITE_OK) ERR(500);
+  TRACE_END(span, "identity.sql");
 
   mg_http_reply(c, 200, NEW_IDENTITY_REPLY_HEADERS, "");
 
@@ -445,20 +437,17 @@ static void handle_identity_PATCH_request(struct mg_connection *c,
         "update identities set notified_low_prekeys=0 where id=?;";
 
     if ((rc = sqlite3_prepare_v3(db, sql, -1, 0, &stmt, NULL)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__,
-              rc, sqlite3_errmsg(db));
+      log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(db));
       goto notif_ack_err;
     }
 
     if ((rc = sqlite3_bind_int64(stmt, 1, id)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(db));
       goto notif_ack_err;
     }
 
     if ((rc = sqlite3_step(stmt)) != SQLITE_DONE) {
-      fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("step failed: %d (%s)", rc, sqlite3_errmsg(db));
       goto notif_ack_err;
     }
 
@@ -470,8 +459,8 @@ static void handle_identity_PATCH_request(struct mg_connection *c,
 err:
   mg_http_reply(c, status_code, NEW_IDENTITY_REPLY_HEADERS, "");
 cleanup:
-  if (id_key) free(id_key);
-  if (pb) messages__identity_patch__free_unpacked(pb, NULL);
+  if (id_key) alloc_free(ALLOC_HANDLERS, id_key);
+  if (pb) messages__identity_patch__free_unpacked(pb, &alloc_protobuf);
   if (stmt_update) sqlite3_finalize(stmt_update);
   if (stmt_insert_pqopk) sqlite3_finalize(stmt_insert_pqopk);
   if (stmt_insert_opk) sqlite3_finalize(stmt_insert_opk);
@@ -480,35 +469,60 @@ cleanup:
 static void handle_identity_DELETE_request(struct mg_connection *c,
                                            struct mg_http_message *hm) {
   int status_code = 418;
-  sqlite3_stmt *stmt = NULL;
+  sqlite3_stmt *stmt_tombstone = NULL, *stmt_delete = NULL;
 
   int64_t id = verify_request(hm, NULL);
   if (id < 0) ERR(-id);
 
+  // Only the identity row goes away here, which frees up the handle right
+  // away. Its prekeys and queued messages are left to purge_tick, so deleting
+  // an account with a huge backlog doesn't stall the event loop.
+  // clang-format off
+  const char *sql_tombstone = "insert or ignore into tombstones(id)values(?);";
+  const char *sql_delete = "delete from identities where id=?;";
+  // clang-format on
+
   int rc;
-  if ((rc = sqlite3_prepare_v3(db, "delete from identities where id=?;", -1, 0,
-                               &stmt, NULL)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
+  if ((rc = sqlite3_prepare_v3(db, sql_tombstone, -1, 0, &stmt_tombstone,
+                               NULL)) != SQLITE_OK ||
+      (rc = sqlite3_prepare_v3(db, sql_delete, -1, 0, &stmt_delete, NULL)) !=
+          SQLITE_OK) {
+    log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(db));
     ERR(500);
   }
 
-  if ((rc = sqlite3_bind_int64(stmt, 1, id)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
+  if ((rc = sqlite3_bind_int64(stmt_tombstone, 1, id)) != SQLITE_OK ||
+      (rc = sqlite3_bind_int64(stmt_delete, 1, id)) != SQLITE_OK) {
+    log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(db));
     ERR(500);
   }
 
-  if ((rc = sqlite3_step(stmt)) != SQLITE_DONE) {
-    fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
+  if ((rc = sqlite3_exec(db, "begin transaction;", NULL, NULL, NULL)) !=
+      SQLITE_OK) {
+    log_error("begin transaction failed: %d (%s)", rc, sqlite3_errmsg(db));
+    ERR(500);
+  }
+
+  if ((rc = sqlite3_step(stmt_tombstone)) != SQLITE_DONE ||
+      (rc = sqlite3_step(stmt_delete)) != SQLITE_DONE) {
+    log_error("step failed: %d (%s)", rc, sqlite3_errmsg(db));
+    sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
     ERR(500);
   }
 
+  if ((rc = sqlite3_exec(db, "commit;", NULL, NULL, NULL)) != SQLITE_OK) {
+    log_error("commit failed: %d (%s)", rc, sqlite3_errmsg(db));
+    ERR(500);
+  }
+
+  queue_forget(id);
+  ws_close_by_id(c->mgr, id);
+
   status_code = 200;
 
 err:
-  if (stmt) sqlite3_finalize(stmt);
+  if (stmt_tombstone) sqlite3_finalize(stmt_tombstone);
+  if (stmt_delete) sqlite3_finalize(stmt_delete);
   mg_http_reply(c, status_code, NEW_IDENTITY_REPLY_HEADERS, "");
 }
 
@@ -2,9 +2,13 @@
 
 #include <sqlite3.h>
 
+#include "alloc.h"
 #include "db.h"
 #include "handlers/websocket.h"
+#include "log.h"
 #include "messages.pb-c.h"
+#include "probes.h"
+#include "trace.h"
 #include "util.h"
 #include "websocket.pb-c.h"
 
@@ -27,6 +31,7 @@ void handle_prekey_bundle_request(struct mg_connection *c,
   sqlite3_stmt *stmt_identity = NULL, *stmt_pqopk = NULL, *stmt_opk = NULL;
   void *pb_buf = NULL;
   size_t pb_len = 0;
+  uint64_t span;
 
   if (mg_strcmp(hm->method, mg_str("GET")) != 0) ERR(405);
 
@@ -36,35 +41,14 @@ void handle_prekey_bundle_request(struct mg_connection *c,
   bool is_dry_run =
       mg_strcmp(mg_http_var(hm->query, mg_str("dryRun")), mg_str("1")) == 0;
 
-  // clang-format off
-  const char *sql_identity = 
-    "select "
-      "id,"
-      "ik,"
-      "spk,"
-      "spk_id,"
-      "spk_sig,"
-      "pqspk,"
-      "pqspk_id,"
-      "pqspk_sig,"
-      "notified_low_prekeys "
-    "from identities where handle=?;";
-  const char *sql_pqopk = "select uid,bytes,id,sig from pqopks where `for`=? order by uid asc limit 1;";
-  const char *sql_opk = "select uid,bytes,id from opks where `for`=? order by uid asc limit 1;";
-  // clang-format on
+  TRACE_BEGIN(span);
+  if (!(stmt_identity = db_read_stmt(DB_READ_BUNDLE_BY_HANDLE))) ERR(500);
 
   int rc;
-  if ((rc = sqlite3_prepare_v3(db, sql_identity, -1, 0, &stmt_identity,
-                               NULL)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
-    ERR(500);
-  }
-
   if ((rc = sqlite3_bind_text(stmt_identity, 1, handle->buf, handle->len,
                               SQLITE_STATIC)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
+    log_error("bind failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt_identity)));
     ERR(500);
   }
 
@@ -74,11 +58,12 @@ void handle_prekey_bundle_request(struct mg_connection *c,
     case SQLITE_DONE:
       ERR(404);
     default: {
-      fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("step failed: %d (%s)", rc,
+                sqlite3_errmsg(sqlite3_db_handle(stmt_identity)));
       ERR(500);
     }
   }
+  TRACE_END(span, "bundle.lookup");
 
   Messages__PQXDHKeyBundle pb = MESSAGES__PQXDHKEY_BUNDLE__INIT;
   Messages__SignedPrekey spk = MESSAGES__SIGNED_PREKEY__INIT;
@@ -88,24 +73,22 @@ void handle_prekey_bundle_request(struct mg_connection *c,
   pb.id_key.data = (uint8_t *)sqlite3_column_blob(stmt_identity, 1);
   pb.id_key.len = sqlite3_column_bytes(stmt_identity, 1);
 
+  int64_t id = sqlite3_column_int64(stmt_identity, 0);
   int64_t pqopk_id = -1, opk_id = -1;
+  sqlite3 *shard = NULL;
 
+  TRACE_BEGIN(span);
   if (!is_dry_run) {
-    int64_t id = sqlite3_column_int64(stmt_identity, 0);
-
-    if ((rc = sqlite3_prepare_v3(db, sql_pqopk, -1, 0, &stmt_pqopk, NULL)) !=
-            SQLITE_OK ||
-        (rc = sqlite3_prepare_v3(db, sql_opk, -1, 0, &stmt_opk, NULL)) !=
-            SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__,
-              rc, sqlite3_errmsg(db));
+    shard = db_shard(id);
+
+    if (!(stmt_pqopk = db_shard_read_stmt(DB_READ_PQOPK, id)) ||
+        !(stmt_opk = db_shard_read_stmt(DB_READ_OPK, id)))
       ERR(500);
-    }
 
     if ((rc = sqlite3_bind_int64(stmt_pqopk, 1, id)) != SQLITE_OK ||
         (rc = sqlite3_bind_int64(stmt_opk, 1, id)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("bind failed: %d (%s)", rc,
+                sqlite3_errmsg(sqlite3_db_handle(stmt_pqopk)));
       ERR(500);
     }
 
@@ -138,8 +121,8 @@ void handle_prekey_bundle_request(struct mg_connection *c,
         break;
       }
       default: {
-        fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__,
-                rc, sqlite3_errmsg(db));
+        log_error("step failed: %d (%s)", rc,
+                  sqlite3_errmsg(sqlite3_db_handle(stmt_pqopk)));
         ERR(500);
       }
     }
@@ -155,10 +138,11 @@ void handle_prekey_bundle_request(struct mg_connection *c,
         break;
       }
       case SQLITE_DONE:
+        PROBE1(opk_exhausted, id);
         break;
       default: {
-        fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__,
-                rc, sqlite3_errmsg(db));
+        log_error("step failed: %d (%s)", rc,
+                  sqlite3_errmsg(sqlite3_db_handle(stmt_opk)));
         ERR(500);
       }
     }
@@ -169,34 +153,30 @@ void handle_prekey_bundle_request(struct mg_connection *c,
                    *stmt_notified = NULL;
       void *buf = NULL;
 
-      const char *sql_pqopk_cnt = "select count(*) from pqopks where `for`=?;";
-      const char *sql_opk_cnt = "select count(*) from opks where `for`=?;";
       const char *sql_notified =
           "update identities set notified_low_prekeys=1 where id=?;";
 
-      if ((rc = sqlite3_prepare_v3(db, sql_pqopk_cnt, -1, 0, &stmt_pqopk_cnt,
-                                   NULL)) != SQLITE_OK ||
-          (rc = sqlite3_prepare_v3(db, sql_opk_cnt, -1, 0, &stmt_opk_cnt,
-                                   NULL)) != SQLITE_OK ||
-          (rc = sqlite3_prepare_v3(db, sql_notified, -1, 0, &stmt_notified,
+      if (!(stmt_pqopk_cnt = db_shard_read_stmt(DB_READ_PQOPK_COUNT, id)) ||
+          !(stmt_opk_cnt = db_shard_read_stmt(DB_READ_OPK_COUNT, id)))
+        goto notif_err;
+
+      if ((rc = sqlite3_prepare_v3(db, sql_notified, -1, 0, &stmt_notified,
                                    NULL)) != SQLITE_OK) {
-        fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__,
-                rc, sqlite3_errmsg(db));
+        log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(db));
         goto notif_err;
       }
 
       if ((rc = sqlite3_bind_int64(stmt_pqopk_cnt, 1, id)) != SQLITE_OK ||
           (rc = sqlite3_bind_int64(stmt_opk_cnt, 1, id)) != SQLITE_OK ||
           (rc = sqlite3_bind_int64(stmt_notified, 1, id)) != SQLITE_OK) {
-        fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__,
-                rc, sqlite3_errmsg(db));
+        log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(db));
         goto notif_err;
       }
 
       if ((rc = sqlite3_step(stmt_pqopk_cnt)) != SQLITE_ROW ||
           (rc = sqlite3_step(stmt_opk_cnt)) != SQLITE_ROW) {
-        fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__,
-                rc, sqlite3_errmsg(db));
+        log_error("step failed: %d (%s)", rc,
+                  sqlite3_errmsg(sqlite3_db_handle(stmt_pqopk_cnt)));
         goto notif_err;
       }
 
@@ -210,33 +190,40 @@ void handle_prekey_bundle_request(struct mg_connection *c,
       env.low_on_keys = &low_on_keys;
 
       size_t n = websocket__clientbound_message__get_packed_size(&env);
-      buf = malloc(n);
+      buf = alloc_malloc(ALLOC_HANDLERS, n);
       if (!buf) {
-        fprintf(stderr, "[%s:%d] out of memory\n", __func__, __LINE__);
+        log_error("out of memory");
         goto notif_err;
       }
 
       websocket__clientbound_message__pack(&env, buf);
-      if (!ws_send_by_id(c->mgr, id, buf, n)) goto notif_err;
+      switch (ws_send_by_id(c->mgr, id, buf, n)) {
+        case WS_SEND_DELIVERED:
+        case WS_SEND_QUEUED:
+          break;
+        default:
+          goto notif_err;
+      }
 
       if ((rc = sqlite3_step(stmt_notified)) != SQLITE_DONE) {
-        fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__,
-                rc, sqlite3_errmsg(db));
+        log_error("step failed: %d (%s)", rc, sqlite3_errmsg(db));
         goto notif_err;
       }
 
     notif_err:
-      if (stmt_pqopk_cnt) sqlite3_finalize(stmt_pqopk_cnt);
-      if (stmt_opk_cnt) sqlite3_finalize(stmt_opk_cnt);
+      if (stmt_pqopk_cnt) db_read_done(stmt_pqopk_cnt);
+      if (stmt_opk_cnt) db_read_done(stmt_opk_cnt);
       if (stmt_notified) sqlite3_finalize(stmt_notified);
-      if (buf) free(buf);
+      if (buf) alloc_free(ALLOC_HANDLERS, buf);
     }
   }
+  TRACE_END(span, "bundle.prekeys");
 
+  TRACE_BEGIN(span);
   pb_len = messages__pqxdhkey_bundle__get_packed_size(&pb);
-  pb_buf = malloc(pb_len);
+  pb_buf = alloc_malloc(ALLOC_HANDLERS, pb_len);
   if (!pb_buf) {
-    fprintf(stderr, "[%s:%d] out of memory\n", __func__, __LINE__);
+    log_error("out of memory");
     ERR(500);
   }
 
@@ -251,31 +238,31 @@ void handle_prekey_bundle_request(struct mg_connection *c,
             (int)pb_len);
   mg_send(c, pb_buf, pb_len);
   c->is_resp = 0;
+  TRACE_END(span, "bundle.pack");
+  PROBE4(bundle_served, id, pb_len, opk_id != -1, pqopk_id != -1);
 
-  if (stmt_identity) sqlite3_finalize(stmt_identity);
-  if (stmt_pqopk) sqlite3_finalize(stmt_pqopk);
-  if (stmt_opk) sqlite3_finalize(stmt_opk);
+  if (stmt_identity) db_read_done(stmt_identity);
+  if (stmt_pqopk) db_read_done(stmt_pqopk);
+  if (stmt_opk) db_read_done(stmt_opk);
 
+  TRACE_BEGIN(span);
   if (pqopk_id != -1) {
     sqlite3_stmt *stmt = NULL;
 
     const char *sql = "delete from pqopks where uid=?;";
 
-    if ((rc = sqlite3_prepare_v3(db, sql, -1, 0, &stmt, NULL)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__,
-              rc, sqlite3_errmsg(db));
+    if ((rc = sqlite3_prepare_v3(shard, sql, -1, 0, &stmt, NULL)) != SQLITE_OK) {
+      log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(shard));
       goto pqopk_rm_err;
     }
 
     if ((rc = sqlite3_bind_int64(stmt, 1, pqopk_id)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(shard));
       goto pqopk_rm_err;
     }
 
     if ((rc = sqlite3_step(stmt)) != SQLITE_DONE) {
-      fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("step failed: %d (%s)", rc, sqlite3_errmsg(shard));
       goto pqopk_rm_err;
     }
 
@@ -288,34 +275,32 @@ void handle_prekey_bundle_request(struct mg_connection *c,
 
     const char *sql = "delete from opks where uid=?;";
 
-    if ((rc = sqlite3_prepare_v3(db, sql, -1, 0, &stmt, NULL)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__,
-              rc, sqlite3_errmsg(db));
+    if ((rc = sqlite3_prepare_v3(shard, sql, -1, 0, &stmt, NULL)) != SQLITE_OK) {
+      log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(shard));
       goto opk_rm_err;
     }
 
     if ((rc = sqlite3_bind_int64(stmt, 1, opk_id)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(shard));
       goto opk_rm_err;
     }
 
     if ((rc = sqlite3_step(stmt)) != SQLITE_DONE) {
-      fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("step failed: %d (%s)", rc, sqlite3_errmsg(shard));
       goto opk_rm_err;
     }
 
   opk_rm_err:
     if (stmt) sqlite3_finalize(stmt);
   }
+  TRACE_END(span, "bundle.consume");
 
   goto end;
 err:
-  if (stmt_identity) sqlite3_finalize(stmt_identity);
-  if (stmt_pqopk) sqlite3_finalize(stmt_pqopk);
-  if (stmt_opk) sqlite3_finalize(stmt_opk);
+  if (stmt_identity) db_read_done(stmt_identity);
+  if (stmt_pqopk) db_read_done(stmt_pqopk);
+  if (stmt_opk) db_read_done(stmt_opk);
   mg_http_reply(c, status_code, PREKEY_BUNDLE_REPLY_HEADERS, "");
 end:
-  if (pb_buf) free(pb_buf);
+  if (pb_buf) alloc_free(ALLOC_HANDLERS, pb_buf);
 }
@@ -1,11 +1,19 @@
 #include "handlers/websocket.h"
 
 #include <crypto.h>
+#include <inttypes.h>
 #include <openssl/rand.h>
 #include <sqlite3.h>
 
+#include "alloc.h"
 #include "db.h"
+#include "log.h"
+#include "metrics.h"
 #include "mongoose.h"
+#include "probes.h"
+#include "queue.h"
+#include "trace.h"
+#include "util.h"
 #include "websocket.pb-c.h"
 
 #define SELF -1
@@ -17,22 +25,58 @@
     goto err;                                         \
   } while (0)
 
-static bool ws_send(struct mg_connection *c,
-                    const Websocket__ClientboundMessage *env, int64_t to_id) {
+// Fails a whole batch, in the one Ack that covers all of its ids
+#define BATCH_ERR(CODE)                        \
+  do {                                         \
+    ack.has_error = true;                      \
+    ack.error = WEBSOCKET__ACK__ERROR__##CODE; \
+    goto reply;                                \
+  } while (0)
+
+static struct mg_connection *find_ws_conn_by_id(struct mg_mgr *mgr,
+                                                int64_t id) {
+  for (struct mg_connection *c = mgr->conns; c; c = c->next) {
+    if (!c->is_websocket) continue;
+    struct ws_ctx *ctx = c->fn_data;
+    if (ctx && ctx->id == id) return c;
+  }
+  return NULL;
+}
+
+static enum ws_send_status ws_send(struct mg_connection *c,
+                                   const Websocket__ClientboundMessage *env,
+                                   int64_t to_id) {
+  enum ws_send_status status = WS_SEND_DELIVERED;
+  uint64_t span;
+  TRACE_BEGIN(span);
   size_t n = websocket__clientbound_message__get_packed_size(env);
-  void *buf = malloc(n);
+  void *buf = alloc_malloc(ALLOC_HANDLERS, n);
   if (!buf) {
-    fprintf(stderr, "[%s:%d] out of memory\n", __func__, __LINE__);
-    return false;
+    log_error("out of memory");
+    return WS_SEND_FAILED;
   }
   websocket__clientbound_message__pack(env, buf);
+  TRACE_END(span, "ws_send.pack");
+
+  TRACE_BEGIN(span);
   if (to_id == SELF) {
     mg_ws_send(c, buf, n, WEBSOCKET_OP_BINARY);
   } else {
-    ws_send_by_id(c->mgr, to_id, buf, n);
+    struct ws_ctx *ctx = c->fn_data;
+    PROBE3(forward_received, ctx->id, to_id, n);
+    status = ws_send_by_id(c->mgr, to_id, buf, n);
   }
-  free(buf);
-  return true;
+  TRACE_END(span, "ws_send.deliver");
+  alloc_free(ALLOC_HANDLERS, buf);
+  return status;
+}
+
+static bool ws_send_ack(struct mg_connection *c, Websocket__Ack *ack) {
+  Websocket__ClientboundMessage env = WEBSOCKET__CLIENTBOUND_MESSAGE__INIT;
+  env.payload_case = WEBSOCKET__CLIENTBOUND_MESSAGE__PAYLOAD_ACK;
+  env.ack = ack;
+
+  return ws_send(c, &env, SELF) != WS_SEND_FAILED;
 }
 
 static bool ws_ack(struct mg_connection *c, int64_t message_id,
@@ -44,11 +88,174 @@ static bool ws_ack(struct mg_connection *c, int64_t message_id,
     ack.error = error;
   }
 
-  Websocket__ClientboundMessage env = WEBSOCKET__CLIENTBOUND_MESSAGE__INIT;
-  env.payload_case = WEBSOCKET__CLIENTBOUND_MESSAGE__PAYLOAD_ACK;
-  env.ack = &ack;
+  return ws_send_ack(c, &ack);
+}
 
-  return ws_send(c, &env, SELF);
+// Queued forwards whose body is stored apart, in queue_payloads, are put
+// back together before going out
+static void ws_send_with_body(struct mg_connection *c, const void *buf,
+                              size_t len, const void *body, size_t body_len) {
+  struct ws_ctx *ctx = c->fn_data;
+  void *out = NULL;
+  Websocket__ClientboundMessage *env = websocket__clientbound_message__unpack(
+      &alloc_protobuf, len, (const uint8_t *)buf);
+  if (!env ||
+      env->payload_case != WEBSOCKET__CLIENTBOUND_MESSAGE__PAYLOAD_FORWARD) {
+    log_error("invalid queued message");
+    goto err;
+  }
+
+  env->forward->has_body = true;
+  env->forward->body.data = (uint8_t *)body;
+  env->forward->body.len = body_len;
+  size_t n = websocket__clientbound_message__get_packed_size(env);
+  if ((out = alloc_malloc(ALLOC_HANDLERS, n))) {
+    websocket__clientbound_message__pack(env, out);
+    ws_send_by_id(c->mgr, ctx->id, out, n);
+  } else {
+    log_error("out of memory");
+  }
+  // owned by sqlite, not to be freed with the rest
+  env->forward->has_body = false;
+  env->forward->body.data = NULL;
+  env->forward->body.len = 0;
+
+err:
+  if (env) websocket__clientbound_message__free_unpacked(env, &alloc_protobuf);
+  alloc_free(ALLOC_HANDLERS, out);
+}
+
+static enum ws_send_status ws_queued(int64_t id, size_t len,
+                                     enum queue_result result) {
+  PROBE3(forward_queued, id, len, result);
+  switch (result) {
+    case QUEUE_OK:
+      METRICS_INC(queue_enqueued);
+      return WS_SEND_QUEUED;
+    case QUEUE_FULL:
+      METRICS_INC(queue_rejected);
+      return WS_SEND_QUEUE_FULL;
+    default:
+      return WS_SEND_FAILED;
+  }
+}
+
+/**
+ * Like ws_send for a forward whose body goes to several recipients: an
+ * offline one gets a queue row without the body, pointing at the single
+ * stored copy of it instead.
+ */
+static enum ws_send_status ws_send_shared(struct mg_connection *c,
+                                          Websocket__ClientboundMessage *env,
+                                          int64_t to_id,
+                                          const struct queue_payload *body) {
+  if (find_ws_conn_by_id(c->mgr, to_id)) return ws_send(c, env, to_id);
+
+  Websocket__Forward *forward = env->forward;
+  forward->has_body = false;
+  size_t n = websocket__clientbound_message__get_packed_size(env);
+  void *buf = alloc_malloc(ALLOC_HANDLERS, n);
+  if (!buf) {
+    log_error("out of memory");
+    forward->has_body = true;
+    return WS_SEND_FAILED;
+  }
+  websocket__clientbound_message__pack(env, buf);
+  forward->has_body = true;
+
+  struct ws_ctx *ctx = c->fn_data;
+  PROBE3(forward_received, ctx->id, to_id, n + body->len);
+  enum ws_send_status status =
+      ws_queued(to_id, n + body->len, queue_push_shared(to_id, buf, n, body));
+  alloc_free(ALLOC_HANDLERS, buf);
+  return status;
+}
+
+// The Ack error for a forward that went out with status, NONE if it did
+static int ws_send_error(enum ws_send_status status) {
+  switch (status) {
+    case WS_SEND_DELIVERED:
+    case WS_SEND_QUEUED:
+      return NONE;
+    case WS_SEND_QUEUE_FULL:
+      return WEBSOCKET__ACK__ERROR__RECIPIENT_QUEUE_FULL;
+    default:
+      return WEBSOCKET__ACK__ERROR__SERVER_ERROR;
+  }
+}
+
+// Copies the ratchet payload of from into to, false if it carries none
+static bool ws_copy_payload(Websocket__Forward *to,
+                            const Websocket__Forward *from) {
+  to->payload_case = from->payload_case;
+  switch (to->payload_case) {
+    case WEBSOCKET__FORWARD__PAYLOAD_PQXDH_INIT:
+      to->pqxdh_init = from->pqxdh_init;
+      return true;
+    case WEBSOCKET__FORWARD__PAYLOAD_MESSAGE:
+      to->message = from->message;
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ * Resolves the handles of n forwards to identity ids with a single query,
+ * leaving -1 for those that are malformed or unknown.
+ */
+static bool ws_lookup_ids(Websocket__Forward *const *forwards, size_t n,
+                          int64_t *ids) {
+  sqlite3_stmt *stmt = NULL;
+  bool ok = false;
+
+  // handles are checked before going in, so they need no escaping
+  char *handles =
+      alloc_malloc(ALLOC_HANDLERS, 2 + n * (HANDLE_MAX_LENGTH + 3) + 1);
+  if (!handles) {
+    log_error("out of memory");
+    return false;
+  }
+
+  size_t len = 0;
+  handles[len++] = '[';
+  for (size_t i = 0; i < n; ++i) {
+    ids[i] = -1;
+    const char *handle = forwards[i]->handle;
+    if (!validate_handle(handle)) continue;
+    len += sprintf(handles + len, "%s\"%s\"", len > 1 ? "," : "", handle);
+  }
+  handles[len++] = ']';
+  handles[len] = '\0';
+
+  if (!(stmt = db_read_stmt(DB_READ_IDS_BY_HANDLES))) goto err;
+
+  int rc;
+  if ((rc = sqlite3_bind_text(stmt, 1, handles, (int)len, SQLITE_STATIC)) !=
+      SQLITE_OK) {
+    log_error("bind failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt)));
+    goto err;
+  }
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    int64_t id = sqlite3_column_int64(stmt, 0);
+    const char *handle = (const char *)sqlite3_column_text(stmt, 1);
+    // the same handle may be listed more than once
+    for (size_t i = 0; i < n; ++i)
+      if (strcmp(forwards[i]->handle, handle) == 0) ids[i] = id;
+  }
+  if (rc != SQLITE_DONE) {
+    log_error("step failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt)));
+    goto err;
+  }
+  ok = true;
+
+err:
+  if (stmt) db_read_done(stmt);
+  alloc_free(ALLOC_HANDLERS, handles);
+  return ok;
 }
 
 void handle_ws_upgrade_request(struct mg_connection *c,
@@ -59,15 +266,16 @@ void handle_ws_upgrade_request(struct mg_connection *c,
 void handle_ws_open(struct mg_connection *c, struct mg_http_message *hm) {
   (void)hm;
 
-  struct ws_ctx *ctx = malloc(sizeof(struct ws_ctx));
+  struct ws_ctx *ctx = alloc_malloc(ALLOC_HANDLERS, sizeof(struct ws_ctx));
   if (!ctx) {
-    fprintf(stderr, "[%s:%d] out of memory\n", __func__, __LINE__);
+    log_error("out of memory");
     goto err;
   }
   // freeing the ctx is taken care of by MG_EV_CLOSE handler
   c->fn_data = ctx;
 
   ctx->id = -1;
+  PROBE1(ws_open, c->id);
   if (RAND_bytes(ctx->nonce, sizeof ctx->nonce) != 1) goto err;
 
   Websocket__Challenge ch = WEBSOCKET__CHALLENGE__INIT;
@@ -78,7 +286,7 @@ void handle_ws_open(struct mg_connection *c, struct mg_http_message *hm) {
   env.payload_case = WEBSOCKET__CLIENTBOUND_MESSAGE__PAYLOAD_CHALLENGE;
   env.challenge = &ch;
 
-  if (!ws_send(c, &env, SELF)) goto err;
+  if (ws_send(c, &env, SELF) == WS_SEND_FAILED) goto err;
   return;
 err:
   c->is_closing = 1;
@@ -86,24 +294,28 @@ err:
 
 void handle_ws_message(struct mg_connection *c, struct mg_ws_message *wm) {
   Websocket__ServerboundMessage *env = NULL;
+  uint64_t started_at = metrics_now_ns(), span;
+  enum metrics_ws_type type = METRICS_WS_INVALID;
+  trace_request_begin();
 
   struct ws_ctx *ctx = c->fn_data;
   if (!ctx) {
-    fprintf(stderr, "[%s:%d] context missing\n", __func__, __LINE__);
+    log_error("context missing");
     goto err;
   }
 
   uint8_t op = wm->flags & 0x0f;
   if (op != WEBSOCKET_OP_BINARY) {
-    fprintf(stderr, "[%s:%d] invalid message opcode (flags=0x%02x op=%u)\n",
-            __func__, __LINE__, wm->flags, op);
+    log_warn("invalid message opcode (flags=0x%02x op=%u)", wm->flags, op);
     goto cleanup;
   }
 
-  env = websocket__serverbound_message__unpack(NULL, wm->data.len,
+  TRACE_BEGIN(span);
+  env = websocket__serverbound_message__unpack(&alloc_protobuf, wm->data.len,
                                                (uint8_t *)wm->data.buf);
+  TRACE_END(span, "ws.unpack");
   if (!env) {
-    fprintf(stderr, "[%s:%d] invalid message\n", __func__, __LINE__);
+    log_warn("invalid message");
     if (ctx->id == -1) goto err;
     goto cleanup;
   }
@@ -117,11 +329,21 @@ void handle_ws_message(struct mg_connection *c, struct mg_ws_message *wm) {
 
   switch (env->payload_case) {
     case WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD_CHALLENGE_RESPONSE:
+      type = METRICS_WS_CHALLENGE_RESPONSE;
       handle_ws_challenge_response_pb(c, env->challenge_response, env->id);
       break;
     case WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD_FORWARD:
+      type = METRICS_WS_FORWARD;
       handle_ws_forward_pb(c, env->forward, env->id);
       break;
+    case WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD_MULTI_FORWARD:
+      type = METRICS_WS_MULTI_FORWARD;
+      handle_ws_multi_forward_pb(c, env->multi_forward, env->id);
+      break;
+    case WEBSOCKET__SERVERBOUND_MESSAGE__PAYLOAD_BATCH:
+      type = METRICS_WS_BATCH;
+      handle_ws_batch_pb(c, env->batch, env->id);
+      break;
     default:
       break;
   }
@@ -130,38 +352,39 @@ void handle_ws_message(struct mg_connection *c, struct mg_ws_message *wm) {
 err:
   c->is_draining = 1;
 cleanup:
-  if (env) websocket__serverbound_message__free_unpacked(env, NULL);
+  if (env) websocket__serverbound_message__free_unpacked(env, &alloc_protobuf);
+  uint64_t elapsed = metrics_now_ns() - started_at;
+  metrics_observe(&metrics.ws[type], elapsed);
+  PROBE4(ws_message, c->id, metrics_ws_type_name(type), wm->data.len,
+         elapsed);
+  trace_request_end(metrics_ws_type_name(type));
 }
 
 void handle_ws_challenge_response_pb(struct mg_connection *c,
                                      Websocket__ChallengeResponse *msg,
                                      int64_t msg_id) {
   sqlite3_stmt *stmt = NULL;
+  uint64_t span;
 
   struct ws_ctx *ctx = c->fn_data;
   if (!ctx) {
-    fprintf(stderr, "[%s:%d] context missing\n", __func__, __LINE__);
+    log_error("context missing");
     goto err;
   }
 
   if (msg->signature.len != XEDDSA_SIGNATURE_LENGTH) {
-    fprintf(stderr, "[%s:%d] invalid signature\n", __func__, __LINE__);
+    log_warn("invalid signature");
     ERR(INVALID_SIGNATURE);
   }
 
-  int rc;
-  if ((rc = sqlite3_prepare_v3(db,
-                               "select id,ik from identities where handle = ?;",
-                               -1, 0, &stmt, NULL)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
-    ERR(SERVER_ERROR);
-  }
+  TRACE_BEGIN(span);
+  if (!(stmt = db_read_stmt(DB_READ_IDENTITY_BY_HANDLE))) ERR(SERVER_ERROR);
 
+  int rc;
   if ((rc = sqlite3_bind_text(stmt, 1, msg->handle, -1, SQLITE_STATIC)) !=
       SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
+    log_error("bind failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt)));
     ERR(SERVER_ERROR);
   }
 
@@ -169,12 +392,12 @@ void handle_ws_challenge_response_pb(struct mg_connection *c,
     case SQLITE_ROW:
       break;
     case SQLITE_DONE: {
-      fprintf(stderr, "[%s:%d] unknown identity\n", __func__, __LINE__);
+      log_warn("unknown identity");
       ERR(UNKNOWN_IDENTITY);
     }
     default: {
-      fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("step failed: %d (%s)", rc,
+                sqlite3_errmsg(sqlite3_db_handle(stmt)));
       ERR(SERVER_ERROR);
     }
   }
@@ -182,19 +405,25 @@ void handle_ws_challenge_response_pb(struct mg_connection *c,
   int64_t id = sqlite3_column_int64(stmt, 0);
   const void *pk_buf = sqlite3_column_blob(stmt, 1);
   int pk_len = sqlite3_column_bytes(stmt, 1);
+  TRACE_END(span, "auth.lookup");
 
   if (!pk_buf || pk_len != CURVE25519_PUBLIC_KEY_LENGTH) {
-    fprintf(stderr, "[%s:%d] invalid public key buffer\n", __func__, __LINE__);
+    log_error("invalid public key buffer");
     ERR(SERVER_ERROR);
   }
 
-  if (!xeddsa_verify(pk_buf, ctx->nonce, sizeof ctx->nonce,
-                     msg->signature.data)) {
-    fprintf(stderr, "[%s:%d] invalid signature\n", __func__, __LINE__);
+  TRACE_BEGIN(span);
+  if (!verify_signature(pk_buf, ctx->nonce, sizeof ctx->nonce,
+                        msg->signature.data)) {
+    log_warn("invalid signature");
     ERR(INVALID_SIGNATURE);
   }
+  TRACE_END(span, "auth.xeddsa");
 
   ctx->id = id;
+  METRICS_INC(ws_sessions);
+  log_info("authenticated conn=%lu id=%" PRId64, c->id, id);
+  PROBE2(ws_auth, c->id, id);
 
   ws_ack(c, msg_id, NONE);
   handle_ws_authenticated(c);
@@ -203,36 +432,36 @@ void handle_ws_challenge_response_pb(struct mg_connection *c,
 err:
   c->is_draining = 1;
 cleanup:
-  if (stmt) sqlite3_finalize(stmt);
+  if (stmt) db_read_done(stmt);
 }
 
 void handle_ws_authenticated(struct mg_connection *c) {
   sqlite3_stmt *stmt_select = NULL, *stmt_delete = NULL;
+  int64_t drained_messages = 0, drained_bytes = 0;
+  uint64_t started_at = PROBE_ENABLED(queue_drain_end) ? metrics_now_ns() : 0;
 
   struct ws_ctx *ctx = c->fn_data;
   if (!ctx || ctx->id == -1) {
-    fprintf(stderr, "[%s:%d] context invalid or missing\n", __func__, __LINE__);
+    log_error("context invalid or missing");
     goto err;
   }
 
-  // clang-format off
-  const char *sql_select = "select id,msg from queue where for=? order by created_at asc;";
   const char *sql_delete = "delete from queue where id=?;";
-  // clang-format on
+  sqlite3 *shard = db_shard(ctx->id);
+  PROBE1(queue_drain_start, ctx->id);
+
+  if (!(stmt_select = db_shard_read_stmt(DB_READ_QUEUE, ctx->id))) goto err;
 
   int rc;
-  if ((rc = sqlite3_prepare_v3(db, sql_select, -1, 0, &stmt_select, NULL)) !=
-          SQLITE_OK ||
-      (rc = sqlite3_prepare_v3(db, sql_delete, -1, 0, &stmt_delete, NULL)) !=
-          SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
+  if ((rc = sqlite3_prepare_v3(shard, sql_delete, -1, 0, &stmt_delete,
+                               NULL)) != SQLITE_OK) {
+    log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(shard));
     goto err;
   }
 
   if ((rc = sqlite3_bind_int64(stmt_select, 1, ctx->id)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
+    log_error("bind failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt_select)));
     goto err;
   }
 
@@ -240,61 +469,70 @@ void handle_ws_authenticated(struct mg_connection *c) {
     int64_t id = sqlite3_column_int64(stmt_select, 0);
     const void *msg_buf = sqlite3_column_blob(stmt_select, 1);
     int msg_len = sqlite3_column_bytes(stmt_select, 1);
+    bool has_body = sqlite3_column_type(stmt_select, 2) != SQLITE_NULL;
+    const void *body_buf = sqlite3_column_blob(stmt_select, 2);
+    int body_len = sqlite3_column_bytes(stmt_select, 2);
 
-    ws_send_by_id(c->mgr, ctx->id, msg_buf, msg_len);
+    if (has_body)
+      ws_send_with_body(c, msg_buf, msg_len, body_buf, body_len);
+    else
+      ws_send_by_id(c->mgr, ctx->id, msg_buf, msg_len);
 
     if ((rc = sqlite3_bind_int64(stmt_delete, 1, id)) != SQLITE_OK) {
-      fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(shard));
       continue;
     }
     if ((rc = sqlite3_step(stmt_delete)) != SQLITE_DONE) {
-      fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("step failed: %d (%s)", rc, sqlite3_errmsg(shard));
       continue;
     }
     sqlite3_reset(stmt_delete);
     sqlite3_clear_bindings(stmt_delete);
+
+    drained_messages += 1;
+    drained_bytes += msg_len + body_len;
   }
 
   if (rc != SQLITE_DONE) {
-    fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
+    log_error("step failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt_select)));
     goto err;
   }
 
+  if (PROBE_ENABLED(queue_drain_end))
+    PROBE4(queue_drain_end, ctx->id, drained_messages, drained_bytes,
+           metrics_now_ns() - started_at);
 err:
-  if (stmt_select) sqlite3_finalize(stmt_select);
+  if (drained_messages) {
+    queue_release(ctx->id, drained_messages, drained_bytes);
+    METRICS_ADD(queue_drained, drained_messages);
+  }
+  if (stmt_select) db_read_done(stmt_select);
   if (stmt_delete) sqlite3_finalize(stmt_delete);
 }
 
 void handle_ws_forward_pb(struct mg_connection *c, Websocket__Forward *msg,
                           int64_t msg_id) {
   sqlite3_stmt *stmt_id_by_handle = NULL, *stmt_handle_by_id = NULL;
+  uint64_t span;
 
   struct ws_ctx *ctx = c->fn_data;
   if (!ctx || ctx->id == -1) {
-    fprintf(stderr, "[%s:%d] context invalid or missing\n", __func__, __LINE__);
+    log_error("context invalid or missing");
     ERR(SERVER_ERROR);
   }
 
-  int rc;
-  if ((rc =
-           sqlite3_prepare_v3(db, "select id from identities where handle = ?;",
-                              -1, 0, &stmt_id_by_handle, NULL)) != SQLITE_OK ||
-      (rc =
-           sqlite3_prepare_v3(db, "select handle from identities where id = ?;",
-                              -1, 0, &stmt_handle_by_id, NULL)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
+  TRACE_BEGIN(span);
+  if (!(stmt_id_by_handle = db_read_stmt(DB_READ_ID_BY_HANDLE)) ||
+      !(stmt_handle_by_id = db_read_stmt(DB_READ_HANDLE_BY_ID)))
     ERR(SERVER_ERROR);
-  }
 
+  int rc;
   if ((rc = sqlite3_bind_text(stmt_id_by_handle, 1, msg->handle, -1,
                               SQLITE_STATIC)) != SQLITE_OK ||
       (rc = sqlite3_bind_int64(stmt_handle_by_id, 1, ctx->id)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
+    log_error("bind failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt_id_by_handle)));
     ERR(SERVER_ERROR);
   }
 
@@ -302,11 +540,11 @@ void handle_ws_forward_pb(struct mg_connection *c, Websocket__Forward *msg,
     case SQLITE_ROW:
       break;
     case SQLITE_DONE:
-      fprintf(stderr, "[%s:%d] unknown identity\n", __func__, __LINE__);
+      log_warn("unknown identity");
       ERR(UNKNOWN_IDENTITY);
     default:
-      fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("step failed: %d (%s)", rc,
+                sqlite3_errmsg(sqlite3_db_handle(stmt_id_by_handle)));
       ERR(SERVER_ERROR);
   }
 
@@ -314,86 +552,285 @@ void handle_ws_forward_pb(struct mg_connection *c, Websocket__Forward *msg,
     case SQLITE_ROW:
       break;
     case SQLITE_DONE:
-      fprintf(stderr, "[%s:%d] unknown identity\n", __func__, __LINE__);
+      log_warn("unknown identity");
       ERR(UNKNOWN_IDENTITY);
     default:
-      fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-              sqlite3_errmsg(db));
+      log_error("step failed: %d (%s)", rc,
+                sqlite3_errmsg(sqlite3_db_handle(stmt_handle_by_id)));
       ERR(SERVER_ERROR);
   }
 
   int64_t id = sqlite3_column_int64(stmt_id_by_handle, 0);
   char *handle = (char *)sqlite3_column_text(stmt_handle_by_id, 0);
+  TRACE_END(span, "forward.lookup");
 
   Websocket__Forward forward = WEBSOCKET__FORWARD__INIT;
   forward.handle = handle;
-  forward.payload_case = msg->payload_case;
-  switch (forward.payload_case) {
-    case WEBSOCKET__FORWARD__PAYLOAD_PQXDH_INIT:
-      forward.pqxdh_init = msg->pqxdh_init;
-      break;
-    case WEBSOCKET__FORWARD__PAYLOAD_MESSAGE:
-      forward.message = msg->message;
-      break;
-    case WEBSOCKET__FORWARD__PAYLOAD__NOT_SET:
-    case _WEBSOCKET__FORWARD__PAYLOAD__CASE_IS_INT_SIZE:
-      ERR(INVALID_MESSAGE);
-  }
+  if (!ws_copy_payload(&forward, msg)) ERR(INVALID_MESSAGE);
 
   Websocket__ClientboundMessage env = WEBSOCKET__CLIENTBOUND_MESSAGE__INIT;
   env.payload_case = WEBSOCKET__CLIENTBOUND_MESSAGE__PAYLOAD_FORWARD;
   env.forward = &forward;
 
-  ws_ack(c, msg_id, NONE);
-  ws_send(c, &env, id);
+  switch (ws_send(c, &env, id)) {
+    case WS_SEND_DELIVERED:
+    case WS_SEND_QUEUED:
+      ws_ack(c, msg_id, NONE);
+      break;
+    case WS_SEND_QUEUE_FULL:
+      ERR(RECIPIENT_QUEUE_FULL);
+    case WS_SEND_FAILED:
+      ERR(SERVER_ERROR);
+  }
+
 err:
-  if (stmt_id_by_handle) sqlite3_finalize(stmt_id_by_handle);
-  if (stmt_handle_by_id) sqlite3_finalize(stmt_handle_by_id);
+  if (stmt_id_by_handle) db_read_done(stmt_id_by_handle);
+  if (stmt_handle_by_id) db_read_done(stmt_handle_by_id);
 }
 
-static struct mg_connection *find_ws_conn_by_id(struct mg_mgr *mgr,
-                                                int64_t id) {
-  for (struct mg_connection *c = mgr->conns; c; c = c->next) {
-    if (!c->is_websocket) continue;
-    struct ws_ctx *ctx = c->fn_data;
-    if (ctx && ctx->id == id) return c;
+void handle_ws_multi_forward_pb(struct mg_connection *c,
+                                Websocket__MultiForward *msg, int64_t msg_id) {
+  sqlite3_stmt *stmt_handle_by_id = NULL;
+  int64_t *ids = NULL;
+  Websocket__RecipientError *errors = NULL, **error_ptrs = NULL;
+  uint64_t span;
+
+  struct ws_ctx *ctx = c->fn_data;
+  if (!ctx || ctx->id == -1) {
+    log_error("context invalid or missing");
+    ERR(SERVER_ERROR);
   }
-  return NULL;
+
+  size_t n = msg->n_recipients;
+  if (n == 0 || n > WS_MULTI_FORWARD_MAX_RECIPIENTS) {
+    log_warn("invalid recipient count: %zu", n);
+    ERR(INVALID_MESSAGE);
+  }
+
+  if (!(ids = alloc_malloc(ALLOC_HANDLERS, n * sizeof *ids)) ||
+      !(errors = alloc_malloc(ALLOC_HANDLERS, n * sizeof *errors)) ||
+      !(error_ptrs = alloc_malloc(ALLOC_HANDLERS, n * sizeof *error_ptrs))) {
+    log_error("out of memory");
+    ERR(SERVER_ERROR);
+  }
+
+  TRACE_BEGIN(span);
+  if (!ws_lookup_ids(msg->recipients, n, ids) ||
+      !(stmt_handle_by_id = db_read_stmt(DB_READ_HANDLE_BY_ID)))
+    ERR(SERVER_ERROR);
+
+  int rc;
+  if ((rc = sqlite3_bind_int64(stmt_handle_by_id, 1, ctx->id)) != SQLITE_OK) {
+    log_error("bind failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt_handle_by_id)));
+    ERR(SERVER_ERROR);
+  }
+
+  switch (rc = sqlite3_step(stmt_handle_by_id)) {
+    case SQLITE_ROW:
+      break;
+    case SQLITE_DONE:
+      log_warn("unknown identity");
+      ERR(UNKNOWN_IDENTITY);
+    default:
+      log_error("step failed: %d (%s)", rc,
+                sqlite3_errmsg(sqlite3_db_handle(stmt_handle_by_id)));
+      ERR(SERVER_ERROR);
+  }
+
+  char *handle = (char *)sqlite3_column_text(stmt_handle_by_id, 0);
+  TRACE_END(span, "multi_forward.lookup");
+
+  struct queue_payload body;
+  if (!queue_payload_init(&body, msg->body.data, msg->body.len))
+    ERR(SERVER_ERROR);
+
+  Websocket__Ack ack = WEBSOCKET__ACK__INIT;
+  ack.message_id = msg_id;
+  ack.recipient_errors = error_ptrs;
+
+  queue_batch_begin();
+  for (size_t i = 0; i < n; ++i) {
+    int error = NONE;
+
+    Websocket__Forward forward = WEBSOCKET__FORWARD__INIT;
+    forward.handle = handle;
+    forward.has_body = true;
+    forward.body = msg->body;
+    if (!ws_copy_payload(&forward, msg->recipients[i])) {
+      error = WEBSOCKET__ACK__ERROR__INVALID_MESSAGE;
+    } else if (ids[i] == -1) {
+      error = WEBSOCKET__ACK__ERROR__UNKNOWN_IDENTITY;
+    } else {
+      Websocket__ClientboundMessage env =
+          WEBSOCKET__CLIENTBOUND_MESSAGE__INIT;
+      env.payload_case = WEBSOCKET__CLIENTBOUND_MESSAGE__PAYLOAD_FORWARD;
+      env.forward = &forward;
+      enum ws_send_status status = ws_send_shared(c, &env, ids[i], &body);
+      error = ws_send_error(status);
+      // from here on ids only marks the recipients that were queued for
+      if (status != WS_SEND_QUEUED) ids[i] = -1;
+    }
+
+    if (error != NONE) {
+      Websocket__RecipientError *e = &errors[ack.n_recipient_errors];
+      *e = (Websocket__RecipientError)WEBSOCKET__RECIPIENT_ERROR__INIT;
+      e->index = (uint32_t)i;
+      e->error = error;
+      error_ptrs[ack.n_recipient_errors++] = e;
+    }
+  }
+
+  if (!queue_batch_end()) {
+    for (size_t i = 0; i < n; ++i) {
+      if (ids[i] == -1 || !queue_batch_lost(ids[i])) continue;
+      Websocket__RecipientError *e = &errors[ack.n_recipient_errors];
+      *e = (Websocket__RecipientError)WEBSOCKET__RECIPIENT_ERROR__INIT;
+      e->index = (uint32_t)i;
+      e->error = WEBSOCKET__ACK__ERROR__SERVER_ERROR;
+      error_ptrs[ack.n_recipient_errors++] = e;
+    }
+  }
+
+  ws_send_ack(c, &ack);
+
+err:
+  if (stmt_handle_by_id) db_read_done(stmt_handle_by_id);
+  alloc_free(ALLOC_HANDLERS, ids);
+  alloc_free(ALLOC_HANDLERS, errors);
+  alloc_free(ALLOC_HANDLERS, error_ptrs);
 }
 
-bool ws_send_by_id(struct mg_mgr *mgr, int64_t id, const void *buf,
-                   size_t len) {
-  sqlite3_stmt *stmt = NULL;
+void handle_ws_batch_pb(struct mg_connection *c, Websocket__Batch *msg,
+                        int64_t msg_id) {
+  sqlite3_stmt *stmt_handle_by_id = NULL;
+  int64_t *ids = NULL;
+  Websocket__MessageError *errors = NULL, **error_ptrs = NULL;
+  uint64_t span;
 
-  struct mg_connection *c = find_ws_conn_by_id(mgr, id);
-  if (c) {
-    mg_ws_send(c, buf, len, WEBSOCKET_OP_BINARY);
-    return true;
+  size_t n = msg->n_forwards;
+  if (n == 0 || msg_id > INT64_MAX - (int64_t)n) {
+    log_warn("invalid batch: %zu forwards from id %" PRId64, n, msg_id);
+    ERR(INVALID_MESSAGE);
   }
 
+  // from here on every reply acks the batch's whole range of ids
+  Websocket__Ack ack = WEBSOCKET__ACK__INIT;
+  ack.message_id = msg_id;
+  ack.has_last_message_id = true;
+  ack.last_message_id = msg_id + (int64_t)n - 1;
+
+  struct ws_ctx *ctx = c->fn_data;
+  if (!ctx || ctx->id == -1) {
+    log_error("context invalid or missing");
+    BATCH_ERR(SERVER_ERROR);
+  }
+
+  if (n > WS_BATCH_MAX_FORWARDS) {
+    log_warn("invalid batch size: %zu", n);
+    BATCH_ERR(INVALID_MESSAGE);
+  }
+
+  if (!(ids = alloc_malloc(ALLOC_HANDLERS, n * sizeof *ids)) ||
+      !(errors = alloc_malloc(ALLOC_HANDLERS, n * sizeof *errors)) ||
+      !(error_ptrs = alloc_malloc(ALLOC_HANDLERS, n * sizeof *error_ptrs))) {
+    log_error("out of memory");
+    BATCH_ERR(SERVER_ERROR);
+  }
+  ack.message_errors = error_ptrs;
+
+  TRACE_BEGIN(span);
+  if (!ws_lookup_ids(msg->forwards, n, ids) ||
+      !(stmt_handle_by_id = db_read_stmt(DB_READ_HANDLE_BY_ID)))
+    BATCH_ERR(SERVER_ERROR);
+
   int rc;
-  if ((rc = sqlite3_prepare_v3(db, "insert into queue (for,msg) values (?,?);",
-                               -1, 0, &stmt, NULL)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
-    goto err;
+  if ((rc = sqlite3_bind_int64(stmt_handle_by_id, 1, ctx->id)) != SQLITE_OK) {
+    log_error("bind failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt_handle_by_id)));
+    BATCH_ERR(SERVER_ERROR);
   }
 
-  if ((rc = sqlite3_bind_int64(stmt, 1, id)) != SQLITE_OK ||
-      (rc = sqlite3_bind_blob(stmt, 2, buf, len, SQLITE_STATIC)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] bind failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
-    goto err;
+  switch (rc = sqlite3_step(stmt_handle_by_id)) {
+    case SQLITE_ROW:
+      break;
+    case SQLITE_DONE:
+      log_warn("unknown identity");
+      BATCH_ERR(UNKNOWN_IDENTITY);
+    default:
+      log_error("step failed: %d (%s)", rc,
+                sqlite3_errmsg(sqlite3_db_handle(stmt_handle_by_id)));
+      BATCH_ERR(SERVER_ERROR);
   }
 
-  if ((rc = sqlite3_step(stmt)) != SQLITE_DONE) {
-    fprintf(stderr, "[%s:%d] step failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
-    goto err;
+  char *handle = (char *)sqlite3_column_text(stmt_handle_by_id, 0);
+  TRACE_END(span, "batch.lookup");
+
+  queue_batch_begin();
+  for (size_t i = 0; i < n; ++i) {
+    int error = NONE;
+
+    Websocket__Forward forward = WEBSOCKET__FORWARD__INIT;
+    forward.handle = handle;
+    if (!ws_copy_payload(&forward, msg->forwards[i])) {
+      error = WEBSOCKET__ACK__ERROR__INVALID_MESSAGE;
+    } else if (ids[i] == -1) {
+      error = WEBSOCKET__ACK__ERROR__UNKNOWN_IDENTITY;
+    } else {
+      Websocket__ClientboundMessage env =
+          WEBSOCKET__CLIENTBOUND_MESSAGE__INIT;
+      env.payload_case = WEBSOCKET__CLIENTBOUND_MESSAGE__PAYLOAD_FORWARD;
+      env.forward = &forward;
+      enum ws_send_status status = ws_send(c, &env, ids[i]);
+      error = ws_send_error(status);
+      // from here on ids only marks the forwards that were queued
+      if (status != WS_SEND_QUEUED) ids[i] = -1;
+    }
+
+    if (error != NONE) {
+      Websocket__MessageError *e = &errors[ack.n_message_errors];
+      *e = (Websocket__MessageError)WEBSOCKET__MESSAGE_ERROR__INIT;
+      e->message_id = msg_id + (int64_t)i;
+      e->error = error;
+      error_ptrs[ack.n_message_errors++] = e;
+    }
+  }
+
+  if (!queue_batch_end()) {
+    for (size_t i = 0; i < n; ++i) {
+      if (ids[i] == -1 || !queue_batch_lost(ids[i])) continue;
+      Websocket__MessageError *e = &errors[ack.n_message_errors];
+      *e = (Websocket__MessageError)WEBSOCKET__MESSAGE_ERROR__INIT;
+      e->message_id = msg_id + (int64_t)i;
+      e->error = WEBSOCKET__ACK__ERROR__SERVER_ERROR;
+      error_ptrs[ack.n_message_errors++] = e;
+    }
   }
 
-  return true;
+reply:
+  ws_send_ack(c, &ack);
+
 err:
-  if (stmt) sqlite3_finalize(stmt);
-  return false;
+  if (stmt_handle_by_id) db_read_done(stmt_handle_by_id);
+  alloc_free(ALLOC_HANDLERS, ids);
+  alloc_free(ALLOC_HANDLERS, errors);
+  alloc_free(ALLOC_HANDLERS, error_ptrs);
+}
+
+enum ws_send_status ws_send_by_id(struct mg_mgr *mgr, int64_t id,
+                                  const void *buf, size_t len) {
+  struct mg_connection *c = find_ws_conn_by_id(mgr, id);
+  if (c) {
+    mg_ws_send(c, buf, len, WEBSOCKET_OP_BINARY);
+    METRICS_INC(forwards_delivered);
+    PROBE2(forward_delivered, id, len);
+    return WS_SEND_DELIVERED;
+  }
+
+  return ws_queued(id, len, queue_push(id, buf, len));
+}
+
+void ws_close_by_id(struct mg_mgr *mgr, int64_t id) {
+  struct mg_connection *c = find_ws_conn_by_id(mgr, id);
+  if (c) c->is_draining = 1;
 }
@@ -0,0 +1,268 @@
+#include "log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_BUF_SIZE (64 * 1024)
+
+struct log_record {
+  struct timespec ts;
+  const char *func;
+  int line;
+  enum log_level level;
+  uint32_t suppressed;  // records held back at this call site before it
+  char text[LOG_RECORD_SIZE];
+};
+
+// single producer (the owning thread), single consumer (the flusher)
+struct log_ring {
+  _Atomic uint64_t head;  // next slot to write, owned by the producer
+  _Atomic uint64_t tail;  // next slot to read, owned by the flusher
+  struct log_record records[LOG_RING_SLOTS];
+};
+
+enum log_level log_level = LOG_LEVEL_INFO;
+
+static struct log_ring *_Atomic s_rings[LOG_MAX_THREADS];
+static _Atomic int s_n_rings;
+static _Thread_local struct log_ring *s_ring;
+
+static _Atomic uint64_t s_dropped, s_suppressed;
+static _Atomic bool s_running, s_stopping;
+static pthread_t s_thread;
+
+static const char *s_level_names[] = {
+    [LOG_LEVEL_DEBUG] = "DEBUG",
+    [LOG_LEVEL_INFO] = "INFO",
+    [LOG_LEVEL_WARN] = "WARN",
+    [LOG_LEVEL_ERROR] = "ERROR",
+};
+
+static size_t format_record(char *buf, size_t size,
+                            const struct log_record *r) {
+  struct tm tm;
+  gmtime_r(&r->ts.tv_sec, &tm);
+
+  int n = snprintf(buf, size,
+                   "%04d-%02d-%02dT%02d:%02d:%02d.%03ldZ %s %s:%d %s",
+                   tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+                   tm.tm_min, tm.tm_sec, r->ts.tv_nsec / 1000000,
+                   s_level_names[r->level], r->func, r->line, r->text);
+  if (n >= 0 && r->suppressed && (size_t)n < size)
+    n += snprintf(buf + n, size - n, " suppressed=%u", r->suppressed);
+  if (n < 0) return 0;
+
+  // keep room for the newline even if the record got cut short
+  size_t len = (size_t)n < size - 1 ? (size_t)n : size - 2;
+  buf[len++] = '\n';
+  return len;
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, buf, len);
+    if (n <= 0) return;  // nowhere left to report it
+    buf += n;
+    len -= n;
+  }
+}
+
+static struct log_ring *get_ring(void) {
+  if (s_ring) return s_ring;
+
+  int i = atomic_fetch_add(&s_n_rings, 1);
+  if (i >= LOG_MAX_THREADS) return NULL;
+  if (!(s_ring = calloc(1, sizeof *s_ring))) return NULL;
+  atomic_store_explicit(&s_rings[i], s_ring, memory_order_release);
+  return s_ring;
+}
+
+// counts the call against the site's per second budget, returns false if it
+// should be suppressed and otherwise how many were suppressed before it
+static bool rate_limit(struct log_site *site, uint32_t *suppressed) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  uint64_t now = ts.tv_sec;
+
+  uint64_t window = atomic_load_explicit(&site->window, memory_order_relaxed);
+  if (window != now && atomic_compare_exchange_strong(&site->window, &window,
+                                                      now)) {
+    atomic_store_explicit(&site->count, 0, memory_order_relaxed);
+    *suppressed = atomic_exchange(&site->suppressed, 0);
+  }
+
+  if (atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed) >=
+      LOG_RATE_BURST) {
+    atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s_suppressed, 1, memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+void log_write(struct log_site *site, enum log_level level, const char *func,
+               int line, const char *fmt, ...) {
+  uint32_t suppressed = 0;
+  if (level >= LOG_LEVEL_WARN && !rate_limit(site, &suppressed)) return;
+
+  struct log_record local, *r = &local;
+  struct log_ring *ring = NULL;
+  uint64_t head = 0;
+
+  if (atomic_load_explicit(&s_running, memory_order_acquire)) {
+    if (!(ring = get_ring())) {
+      atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+      return;
+    }
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= LOG_RING_SLOTS) {
+      atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+      return;
+    }
+    r = &ring->records[head & (LOG_RING_SLOTS - 1)];
+  }
+
+  clock_gettime(CLOCK_REALTIME, &r->ts);
+  r->func = func;
+  r->line = line;
+  r->level = level;
+  r->suppressed = suppressed;
+
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(r->text, sizeof r->text, fmt, ap);
+  va_end(ap);
+
+  if (ring) {
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  } else {
+    // no flusher yet (startup, or tools linking the server code)
+    char buf[LOG_RECORD_SIZE + 128];
+    size_t len = format_record(buf, sizeof buf, r);
+    write_all(level >= LOG_LEVEL_WARN ? STDERR_FILENO : STDOUT_FILENO, buf,
+              len);
+  }
+}
+
+struct log_out {
+  int fd;
+  size_t len;
+  char buf[LOG_BUF_SIZE];
+};
+
+// only touched by the flusher, and by log_stop once it has been joined
+static struct log_out s_out = {.fd = STDOUT_FILENO},
+                      s_err = {.fd = STDERR_FILENO};
+
+static void out_flush(struct log_out *out) {
+  write_all(out->fd, out->buf, out->len);
+  out->len = 0;
+}
+
+static void out_record(struct log_out *out, const struct log_record *r) {
+  if (LOG_BUF_SIZE - out->len < LOG_RECORD_SIZE + 128) out_flush(out);
+  out->len += format_record(out->buf + out->len, LOG_BUF_SIZE - out->len, r);
+}
+
+// drains every ring once, returns the number of records written
+static size_t drain(struct log_out *out, struct log_out *err) {
+  size_t written = 0;
+  int n = atomic_load(&s_n_rings);
+  for (int i = 0; i < n && i < LOG_MAX_THREADS; ++i) {
+    struct log_ring *ring =
+        atomic_load_explicit(&s_rings[i], memory_order_acquire);
+    if (!ring) continue;
+
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (; tail != head; ++tail, ++written) {
+      const struct log_record *r = &ring->records[tail & (LOG_RING_SLOTS - 1)];
+      out_record(r->level >= LOG_LEVEL_WARN ? err : out, r);
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+  }
+  return written;
+}
+
+static void *flusher(void *arg) {
+  (void)arg;
+  uint64_t reported_dropped = 0;
+
+  for (;;) {
+    bool stopping = atomic_load(&s_stopping);
+    size_t written = drain(&s_out, &s_err);
+
+    uint64_t dropped = atomic_load(&s_dropped);
+    if (dropped != reported_dropped) {
+      struct log_record r = {.func = __func__,
+                             .line = __LINE__,
+                             .level = LOG_LEVEL_WARN};
+      clock_gettime(CLOCK_REALTIME, &r.ts);
+      snprintf(r.text, sizeof r.text, "log buffer full dropped=%llu",
+               (unsigned long long)(dropped - reported_dropped));
+      out_record(&s_err, &r);
+      reported_dropped = dropped;
+    }
+
+    out_flush(&s_out);
+    out_flush(&s_err);
+
+    if (stopping) break;
+    if (!written) {
+      struct timespec ts = {0, LOG_FLUSH_INTERVAL_MS * 1000000L};
+      nanosleep(&ts, NULL);
+    }
+  }
+  return NULL;
+}
+
+bool log_start(void) {
+  int rc;
+  if ((rc = pthread_create(&s_thread, NULL, flusher, NULL)) != 0) {
+    log_error("pthread_create failed: %d (%s)", rc, strerror(rc));
+    return false;
+  }
+  atomic_store_explicit(&s_running, true, memory_order_release);
+  return true;
+}
+
+void log_stop(void) {
+  if (!atomic_load(&s_running)) return;
+  // later records go straight out, anything already in a ring is drained
+  // by the flusher's last pass
+  atomic_store(&s_running, false);
+  atomic_store(&s_stopping, true);
+  pthread_join(s_thread, NULL);
+
+  // a writer that saw s_running just before it was cleared can publish its
+  // record after that last pass
+  drain(&s_out, &s_err);
+  out_flush(&s_out);
+  out_flush(&s_err);
+}
+
+bool log_parse_level(const char *s, enum log_level *out) {
+  const char *names[] = {
+      [LOG_LEVEL_DEBUG] = "debug",
+      [LOG_LEVEL_INFO] = "info",
+      [LOG_LEVEL_WARN] = "warn",
+      [LOG_LEVEL_ERROR] = "error",
+  };
+  for (size_t i = 0; i < sizeof names / sizeof *names; ++i) {
+    if (strcmp(s, names[i]) == 0) {
+      *out = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t log_dropped(void) { return atomic_load(&s_dropped); }
+
+uint64_t log_suppressed(void) { return atomic_load(&s_suppressed); }
@@ -0,0 +1,214 @@
+#include "loopmon.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <mongoose.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "metrics.h"
+
+#define LOOPMON_SIGNAL (SIGRTMIN + 1)
+
+unsigned loopmon_slow_handler_ms = LOOPMON_DEFAULT_SLOW_HANDLER_MS;
+
+static pthread_t s_loop_thread, s_watchdog;
+static _Atomic bool s_running;
+
+// the handler currently running on the loop thread, started_at is 0 when
+// none is
+static _Atomic uint64_t s_handler_seq, s_handler_started_at;
+
+// backtrace captured by the signal handler for handler s_frames_seq
+static void *s_frames[LOOPMON_MAX_FRAMES];
+static volatile sig_atomic_t s_n_frames;
+static _Atomic uint64_t s_frames_seq;
+
+static uint64_t s_iteration_started_at, s_iteration_busy;
+static int64_t s_iteration_events;
+
+// handlers can run inside others (mg_ws_upgrade fires MG_EV_WS_OPEN from
+// the MG_EV_HTTP_MSG handler); s_nested_ns[d] is the time spent in handlers
+// nested directly in the one at depth d
+static int s_depth;
+static uint64_t s_nested_ns[LOOPMON_MAX_DEPTH];
+
+static void capture_frames(int signo) {
+  (void)signo;
+  s_n_frames = backtrace(s_frames, LOOPMON_MAX_FRAMES);
+  atomic_store(&s_frames_seq, atomic_load(&s_handler_seq));
+}
+
+static void *watchdog(void *arg) {
+  (void)arg;
+  uint64_t budget = loopmon_slow_handler_ms * 1000000ULL;
+  uint64_t signalled_seq = 0;
+
+  // check twice per budget so a capture lands within 1.5x of it
+  struct timespec interval = {budget / 2 / 1000000000ULL,
+                              budget / 2 % 1000000000ULL};
+  while (atomic_load(&s_running)) {
+    nanosleep(&interval, NULL);
+
+    // begin bumps seq before storing started_at, so an unchanged seq
+    // around the read means started_at belongs to that handler (or is 0)
+    uint64_t seq, started_at;
+    do {
+      seq = atomic_load(&s_handler_seq);
+      started_at = atomic_load(&s_handler_started_at);
+    } while (seq != atomic_load(&s_handler_seq));
+    if (!started_at || seq == signalled_seq) continue;
+    if (metrics_now_ns() - started_at < budget) continue;
+
+    signalled_seq = seq;
+    pthread_kill(s_loop_thread, LOOPMON_SIGNAL);
+  }
+  return NULL;
+}
+
+bool loopmon_start(void) {
+  if (!loopmon_slow_handler_ms) return true;
+
+  // backtrace() loads libgcc on first use, which isn't safe from a signal
+  void *warmup[1];
+  backtrace(warmup, 1);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = capture_frames;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(LOOPMON_SIGNAL, &sa, NULL) != 0) {
+    log_error("sigaction failed: %s", strerror(errno));
+    return false;
+  }
+
+  s_loop_thread = pthread_self();
+  atomic_store(&s_running, true);
+
+  int rc;
+  if ((rc = pthread_create(&s_watchdog, NULL, watchdog, NULL)) != 0) {
+    log_error("pthread_create failed: %d (%s)", rc, strerror(rc));
+    atomic_store(&s_running, false);
+    return false;
+  }
+  return true;
+}
+
+void loopmon_stop(void) {
+  if (!atomic_load(&s_running)) return;
+  atomic_store(&s_running, false);
+  pthread_join(s_watchdog, NULL);
+}
+
+void loopmon_iteration_begin(void) {
+  s_iteration_started_at = metrics_now_ns();
+  s_iteration_busy = 0;
+  s_iteration_events = 0;
+}
+
+void loopmon_iteration_end(void) {
+  metrics_observe(&metrics.loop_iteration,
+                  metrics_now_ns() - s_iteration_started_at);
+  metrics_observe(&metrics.loop_busy, s_iteration_busy);
+  METRICS_INC(loop_iterations);
+  METRICS_ADD(loop_events, s_iteration_events);
+  atomic_store_explicit(&metrics.loop_last_events, s_iteration_events,
+                        memory_order_relaxed);
+}
+
+uint64_t loopmon_handler_begin(void) {
+  uint64_t now = metrics_now_ns();
+  if (s_depth < LOOPMON_MAX_DEPTH) s_nested_ns[s_depth] = 0;
+  if (s_depth++ == 0) {
+    atomic_fetch_add(&s_handler_seq, 1);
+    atomic_store(&s_handler_started_at, now);
+  }
+  return now;
+}
+
+static enum metrics_event event_of(int ev) {
+  switch (ev) {
+    case MG_EV_ACCEPT:
+      return METRICS_EV_ACCEPT;
+    case MG_EV_READ:
+      return METRICS_EV_READ;
+    case MG_EV_WRITE:
+      return METRICS_EV_WRITE;
+    case MG_EV_CLOSE:
+      return METRICS_EV_CLOSE;
+    case MG_EV_HTTP_MSG:
+      return METRICS_EV_HTTP_MSG;
+    case MG_EV_WS_OPEN:
+      return METRICS_EV_WS_OPEN;
+    case MG_EV_WS_MSG:
+      return METRICS_EV_WS_MSG;
+    default:
+      return METRICS_EV_OTHER;
+  }
+}
+
+// "func+0x1f < caller+0x80 < ...", innermost first, skipping the frames of
+// the signal handler itself
+static void format_frames(char *buf, size_t size) {
+  size_t len = 0;
+  buf[0] = '\0';
+  for (int i = 2; i < s_n_frames && len < size; ++i) {
+    Dl_info info;
+    const char *sep = len ? " < " : "";
+    int n;
+    if (dladdr(s_frames[i], &info) && info.dli_sname) {
+      n = snprintf(buf + len, size - len, "%s%s+0x%lx", sep, info.dli_sname,
+                   (unsigned long)((char *)s_frames[i] -
+                                   (char *)info.dli_saddr));
+    } else {
+      n = snprintf(buf + len, size - len, "%s%p", sep, s_frames[i]);
+    }
+    if (n < 0) break;
+    len += n;
+  }
+}
+
+void loopmon_handler_end(uint64_t started_at, struct mg_connection *c, int ev,
+                         void *ev_data) {
+  uint64_t elapsed = metrics_now_ns() - started_at;
+  enum metrics_event event = event_of(ev);
+
+  // each handler is observed for its own time, without the ones it ran
+  --s_depth;
+  uint64_t nested = s_depth < LOOPMON_MAX_DEPTH ? s_nested_ns[s_depth] : 0;
+  metrics_observe(&metrics.handlers[event], elapsed - nested);
+  if (s_depth > 0) {
+    if (s_depth <= LOOPMON_MAX_DEPTH) s_nested_ns[s_depth - 1] += elapsed;
+    return;
+  }
+
+  // the rest only for the outermost one, which covers the nested ones
+  uint64_t seq = atomic_load(&s_handler_seq);
+  atomic_store(&s_handler_started_at, 0);
+
+  s_iteration_busy += elapsed;
+  ++s_iteration_events;
+
+  if (!loopmon_slow_handler_ms ||
+      elapsed < loopmon_slow_handler_ms * 1000000ULL)
+    return;
+
+  METRICS_INC(slow_handlers);
+
+  char stack[256] = "";
+  if (atomic_load(&s_frames_seq) == seq) format_frames(stack, sizeof stack);
+
+  struct mg_str uri = mg_str("");
+  if (ev == MG_EV_HTTP_MSG) uri = ((struct mg_http_message *)ev_data)->uri;
+
+  log_warn("slow handler event=%s conn=%lu uri=%.*s elapsed_ms=%.1f stack=%s",
+           metrics_event_name(event), c->id, (int)uri.len, uri.buf,
+           elapsed / 1e6, *stack ? stack : "-");
+}
@@ -1,17 +1,57 @@
+#include <errno.h>
+#include <limits.h>
 #include <mongoose.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 
+#include "alloc.h"
+#include "assets.h"
+#include "backup.h"
+#include "blobs.h"
 #include "db.h"
+#include "log.h"
+#include "loopmon.h"
+#include "metrics.h"
+#include "purge.h"
+#include "queue.h"
 #include "server.h"
+#include "trace.h"
 
 static const char *s_listening_addr = "http://0.0.0.0:8000";
 static const char *s_db_path = "./data.sqlite";
+static const char *s_backup_path = NULL;
+static const char *s_metrics_addr = NULL;
+static const char *s_public_dir = "./public";
+static const char *s_blobs_dir = "./blobs";
+static int s_shards = 1;
+static bool s_profile_sql = false;
+static unsigned s_slow_query_ms = 0;
 
 static int s_signo;
 inline static void signal_handler(int signo) { s_signo = signo; }
 
+static volatile sig_atomic_t s_backup_requested;
+inline static void backup_signal_handler(int signo) {
+  (void)signo;
+  s_backup_requested = 1;
+}
+
+static volatile sig_atomic_t s_profile_requested;
+inline static void profile_signal_handler(int signo) {
+  (void)signo;
+  s_profile_requested = 1;
+}
+
+// the whole of s as a whole number greater than 0
+static bool parse_positive(const char *s, long long *value) {
+  char *end;
+  errno = 0;
+  *value = s ? strtoll(s, &end, 10) : 0;
+  return s && end != s && *end == '\0' && errno == 0 && *value > 0;
+}
+
 int main(int argc, char **argv) {
   for (int i = 1; i < argc; ++i) {
     if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
@@ -21,8 +61,59 @@ int main(int argc, char **argv) {
               "Options:\n"
               "  -l, --listen ADDR    Set listening address (default: %s)\n"
               "  -d, --db PATH        Set database path (default: %s)\n"
+              "  -b, --backup PATH    Set backup path, written on SIGUSR1 "
+              "(default: <db>.bak)\n"
+              "  --public DIR         Serve static files from DIR, reloaded "
+              "on change\n"
+              "                       (default: %s)\n"
+              "  --blobs DIR          Store uploaded attachment blobs in DIR "
+              "(default: %s)\n"
+              "  --blob-ttl-days N    Delete blobs N days after their last "
+              "upload (default: %d)\n"
+              "  --blob-quota-mb N    Max MiB of blobs stored per identity "
+              "(default: %d)\n"
+              "  --blobs-max-gb N     Max GiB of blobs stored in total "
+              "(default: %d)\n"
+              "  --log-level LEVEL    debug, info, warn or error (default: "
+              "info)\n"
+              "  --metrics ADDR       Serve Prometheus metrics on a separate "
+              "listener,\n"
+              "                       e.g. http://127.0.0.1:9100 (default: "
+              "off)\n"
+              "  --admin-token TOKEN  Bearer token for /debug/pprof/profile "
+              "on the metrics\n"
+              "                       listener (default: none, profiling "
+              "off)\n"
+              "  --shards K           Split per-identity data across K "
+              "database files\n"
+              "                       (fixed once the database exists, "
+              "default: 1)\n"
+              "  --trace-sample N     Trace 1 in N requests, served as "
+              "/debug/trace on the\n"
+              "                       metrics listener (default: 0, off)\n"
+              "  --trace-slow-ms N    Only keep traces of requests slower "
+              "than N ms\n"
+              "  --profile-sql        Aggregate time and rows per SQL "
+              "statement, logged on\n"
+              "                       SIGUSR2 and served as /debug/sql on "
+              "the metrics listener\n"
+              "  --slow-query-ms N    Log SQL statements slower than N ms "
+              "(default: 0, off)\n"
+              "  --slow-handler-ms N  Log handlers blocking the event loop "
+              "longer than N ms,\n"
+              "                       with a backtrace (default: %d, 0 "
+              "disables)\n"
+              "  --queue-max-msgs N   Max queued messages per recipient "
+              "(default: %d)\n"
+              "  --queue-max-bytes N  Max queued bytes per recipient "
+              "(default: %d)\n"
               "  -h, --help           Show this help message and exit\n",
-              argv[0], s_listening_addr, s_db_path);
+              argv[0], s_listening_addr, s_db_path, s_public_dir, s_blobs_dir,
+              BLOBS_DEFAULT_TTL_S / 86400,
+              (int)(BLOBS_DEFAULT_OWNER_MAX_BYTES >> 20),
+              (int)(BLOBS_DEFAULT_MAX_BYTES >> 30),
+              LOOPMON_DEFAULT_SLOW_HANDLER_MS,
+              QUEUE_DEFAULT_MAX_MESSAGES, QUEUE_DEFAULT_MAX_BYTES);
       return EXIT_SUCCESS;
     }
   }
@@ -33,6 +124,68 @@ int main(int argc, char **argv) {
       s_listening_addr = argv[++i];
     } else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--db") == 0) {
       s_db_path = argv[++i];
+    } else if (strcmp(arg, "-b") == 0 || strcmp(arg, "--backup") == 0) {
+      s_backup_path = argv[++i];
+    } else if (strcmp(arg, "--public") == 0) {
+      s_public_dir = argv[++i];
+    } else if (strcmp(arg, "--blobs") == 0) {
+      s_blobs_dir = argv[++i];
+    } else if (strcmp(arg, "--blob-ttl-days") == 0) {
+      long long n;
+      if (!parse_positive(argv[++i], &n) || n > UINT_MAX / 86400) {
+        fprintf(stderr, "invalid value for %s: %s\n", arg, argv[i]);
+        return EXIT_FAILURE;
+      }
+      blobs_ttl_s = (unsigned)n * 86400;
+    } else if (strcmp(arg, "--blob-quota-mb") == 0) {
+      long long n;
+      if (!parse_positive(argv[++i], &n) || n > (long long)(UINT64_MAX >> 20)) {
+        fprintf(stderr, "invalid value for %s: %s\n", arg, argv[i]);
+        return EXIT_FAILURE;
+      }
+      blobs_owner_max_bytes = (uint64_t)n << 20;
+    } else if (strcmp(arg, "--blobs-max-gb") == 0) {
+      long long n;
+      if (!parse_positive(argv[++i], &n) || n > (long long)(UINT64_MAX >> 30)) {
+        fprintf(stderr, "invalid value for %s: %s\n", arg, argv[i]);
+        return EXIT_FAILURE;
+      }
+      blobs_max_bytes = (uint64_t)n << 30;
+    } else if (strcmp(arg, "--log-level") == 0) {
+      if (!log_parse_level(argv[++i], &log_level)) {
+        fprintf(stderr, "invalid log level: %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(arg, "--metrics") == 0) {
+      s_metrics_addr = argv[++i];
+    } else if (strcmp(arg, "--admin-token") == 0) {
+      metrics_admin_token = argv[++i];
+    } else if (strcmp(arg, "--shards") == 0) {
+      s_shards = atoi(argv[++i]);
+    } else if (strcmp(arg, "--trace-sample") == 0) {
+      trace_sample_every = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--trace-slow-ms") == 0) {
+      trace_slow_us = strtoull(argv[++i], NULL, 10) * 1000;
+    } else if (strcmp(arg, "--profile-sql") == 0) {
+      s_profile_sql = true;
+    } else if (strcmp(arg, "--slow-query-ms") == 0) {
+      s_slow_query_ms = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--slow-handler-ms") == 0) {
+      loopmon_slow_handler_ms = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--queue-max-msgs") == 0) {
+      long long n;
+      if (!parse_positive(argv[++i], &n)) {
+        fprintf(stderr, "invalid value for %s: %s\n", arg, argv[i]);
+        return EXIT_FAILURE;
+      }
+      queue_max_messages = n;
+    } else if (strcmp(arg, "--queue-max-bytes") == 0) {
+      long long n;
+      if (!parse_positive(argv[++i], &n)) {
+        fprintf(stderr, "invalid value for %s: %s\n", arg, argv[i]);
+        return EXIT_FAILURE;
+      }
+      queue_max_bytes = n;
     } else {
       fprintf(stderr,
               "illegal option: %s\ntry `%s --help` for more information.\n",
@@ -44,8 +197,19 @@ int main(int argc, char **argv) {
   struct mg_mgr mgr;
   struct mg_connection *conn;
 
+  alloc_init();
+
   signal(SIGINT, signal_handler);
   signal(SIGTERM, signal_handler);
+  signal(SIGUSR1, backup_signal_handler);
+  signal(SIGUSR2, profile_signal_handler);
+
+  char default_backup_path[PATH_MAX];
+  if (!s_backup_path) {
+    snprintf(default_backup_path, sizeof default_backup_path, "%s.bak",
+             s_db_path);
+    s_backup_path = default_backup_path;
+  }
 
   mg_mgr_init(&mgr);
   if ((conn = mg_http_listen(&mgr, s_listening_addr, handle_server_event,
@@ -57,17 +221,74 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
-  if (db_init(&db, s_db_path) != SQLITE_OK) {
+  if (s_metrics_addr &&
+      mg_http_listen(&mgr, s_metrics_addr, handle_metrics_event, NULL) ==
+          NULL) {
+    fprintf(stderr, "Cannot listen on %s for metrics", s_metrics_addr);
     mg_mgr_free(&mgr);
     return EXIT_FAILURE;
   }
 
+  if (db_init(&db, s_db_path, s_shards) != SQLITE_OK) {
+    mg_mgr_free(&mgr);
+    return EXIT_FAILURE;
+  }
+  if (!queue_init() || !blobs_init(s_blobs_dir)) {
+    mg_mgr_free(&mgr);
+    db_close(db);
+    return EXIT_FAILURE;
+  }
+  if (s_metrics_addr) metrics_init();
+  if (s_profile_sql || s_slow_query_ms)
+    db_profile_start(s_profile_sql, s_slow_query_ms);
+  trace_init();
+  // keeps retrying in the background, e.g. while a build is still running
+  assets_init(s_public_dir);
+
+  mg_timer_add(&mgr, PURGE_INTERVAL_MS, MG_TIMER_REPEAT, purge_tick, NULL);
+  mg_timer_add(&mgr, BLOBS_EXPIRE_INTERVAL_MS, MG_TIMER_REPEAT,
+               blobs_expire_tick, NULL);
+
+  // until here everything is logged synchronously
+  if (!log_start()) {
+    mg_mgr_free(&mgr);
+    blobs_close();
+    db_close(db);
+    return EXIT_FAILURE;
+  }
+  if (!loopmon_start()) {
+    mg_mgr_free(&mgr);
+    blobs_close();
+    db_close(db);
+    log_stop();
+    return EXIT_FAILURE;
+  }
+
   while (s_signo == 0) {
-    mg_mgr_poll(&mgr, 100);
+    // don't sleep in poll while a backup has pages left to copy
+    loopmon_iteration_begin();
+    mg_mgr_poll(&mgr, backup_active() ? 0 : 100);
+    loopmon_iteration_end();
+    assets_poll();
+
+    if (s_profile_requested) {
+      s_profile_requested = 0;
+      db_profile_log();
+    }
+    if (s_backup_requested) {
+      s_backup_requested = 0;
+      backup_start(s_backup_path);
+    }
+    backup_step();
   }
 
+  loopmon_stop();
+  assets_close();
+  backup_abort();
   mg_mgr_free(&mgr);
+  blobs_close();
   db_close(db);
+  log_stop();
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,375 @@
+#include "metrics.h"
+
+#include <inttypes.h>
+#include <mongoose.h>
+#include <openssl/crypto.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "alloc.h"
+#include "db.h"
+#include "log.h"
+#include "profiler.h"
+#include "queue.h"
+#include "trace.h"
+
+struct metrics metrics;
+
+static const char *s_route_names[METRICS_ROUTE_COUNT] = {
+    [METRICS_ROUTE_IDENTITY_POST] = "POST /api/identity",
+    [METRICS_ROUTE_IDENTITY_PATCH] = "PATCH /api/identity",
+    [METRICS_ROUTE_IDENTITY_DELETE] = "DELETE /api/identity",
+    [METRICS_ROUTE_BUNDLE] = "/api/keys/:handle/bundle",
+    [METRICS_ROUTE_BLOB_PUT] = "PUT /api/blobs/:hash",
+    [METRICS_ROUTE_BLOB_GET] = "GET /api/blobs/:hash",
+    [METRICS_ROUTE_WS] = "/api/ws",
+    [METRICS_ROUTE_STATIC] = "static",
+    [METRICS_ROUTE_OPTIONS] = "OPTIONS",
+    [METRICS_ROUTE_OTHER] = "other",
+};
+
+static const char *s_ws_type_names[METRICS_WS_COUNT] = {
+    [METRICS_WS_CHALLENGE_RESPONSE] = "challenge_response",
+    [METRICS_WS_FORWARD] = "forward",
+    [METRICS_WS_MULTI_FORWARD] = "multi_forward",
+    [METRICS_WS_BATCH] = "batch",
+    [METRICS_WS_INVALID] = "invalid",
+};
+
+static const char *s_event_names[METRICS_EV_COUNT] = {
+    [METRICS_EV_ACCEPT] = "accept",
+    [METRICS_EV_READ] = "read",
+    [METRICS_EV_WRITE] = "write",
+    [METRICS_EV_CLOSE] = "close",
+    [METRICS_EV_HTTP_MSG] = "http_msg",
+    [METRICS_EV_WS_OPEN] = "ws_open",
+    [METRICS_EV_WS_MSG] = "ws_msg",
+    [METRICS_EV_OTHER] = "other",
+};
+
+// connections of the manager being scraped, for buffer backlogs
+static struct mg_mgr *s_mgr;
+
+const char *metrics_admin_token = NULL;
+
+// the connection waiting for the CPU profile being taken, 0 if none
+static unsigned long s_profile_conn;
+
+const char *metrics_route_name(enum metrics_route route) {
+  return s_route_names[route];
+}
+
+const char *metrics_ws_type_name(enum metrics_ws_type type) {
+  return s_ws_type_names[type];
+}
+
+const char *metrics_event_name(enum metrics_event ev) {
+  return s_event_names[ev];
+}
+
+uint64_t metrics_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t bucket_of(uint64_t ns) {
+  uint64_t us = ns / 1000;
+  if (us < METRICS_SUB_BUCKETS) return us;
+
+  int e = 63 - __builtin_clzll(us);
+  if (e > METRICS_MAX_EXPONENT) return METRICS_BUCKETS;
+
+  // the bits right below the leading one pick the sub-bucket
+  size_t sub = (us >> (e - METRICS_SUB_BITS)) - METRICS_SUB_BUCKETS;
+  return METRICS_SUB_BUCKETS * (e - METRICS_SUB_BITS + 1) + sub;
+}
+
+// exclusive upper bound of a bucket, in microseconds
+static uint64_t bucket_bound(size_t i) {
+  if (i < METRICS_SUB_BUCKETS) return i + 1;
+  size_t shift = i / METRICS_SUB_BUCKETS - 1;
+  size_t sub = i % METRICS_SUB_BUCKETS;
+  return (uint64_t)(METRICS_SUB_BUCKETS + sub + 1) << shift;
+}
+
+void metrics_observe(struct metrics_histogram *h, uint64_t ns) {
+  atomic_fetch_add_explicit(&h->buckets[bucket_of(ns)], 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->sum_ns, ns, memory_order_relaxed);
+}
+
+static int sqlite_profile(unsigned type, void *ctx, void *p, void *x) {
+  (void)ctx;
+  (void)p;
+  if (type == SQLITE_TRACE_PROFILE)
+    metrics_observe(&metrics.sqlite, *(sqlite3_int64 *)x);
+  return 0;
+}
+
+void metrics_init(void) {
+  db_trace(SQLITE_TRACE_PROFILE, sqlite_profile, NULL);
+}
+
+#define LOAD(X) atomic_load_explicit(&(X), memory_order_relaxed)
+
+static void write_header(FILE *f, const char *name, const char *type,
+                         const char *help) {
+  fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void write_histogram(FILE *f, const char *name, const char *label,
+                            const char *value,
+                            const struct metrics_histogram *h) {
+  char bucket_labels[128] = "", labels[128] = "";
+  if (label) {
+    snprintf(bucket_labels, sizeof bucket_labels, "%s=\"%s\",", label, value);
+    snprintf(labels, sizeof labels, "{%s=\"%s\"}", label, value);
+  }
+
+  // buckets are bumped one by one, so take the count from them to keep the
+  // +Inf bucket and _count consistent within a scrape
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < METRICS_BUCKETS; ++i) {
+    cumulative += LOAD(h->buckets[i]);
+    fprintf(f, "%s_bucket{%sle=\"%.9g\"} %" PRIu64 "\n", name, bucket_labels,
+            bucket_bound(i) / 1e6, cumulative);
+  }
+  cumulative += LOAD(h->buckets[METRICS_BUCKETS]);
+
+  fprintf(f, "%s_bucket{%sle=\"+Inf\"} %" PRIu64 "\n", name, bucket_labels,
+          cumulative);
+  fprintf(f, "%s_sum%s %.9g\n", name, labels, LOAD(h->sum_ns) / 1e9);
+  fprintf(f, "%s_count%s %" PRIu64 "\n", name, labels, cumulative);
+}
+
+static void write_metrics(FILE *f) {
+  write_header(f, "chat_http_request_duration_seconds", "histogram",
+               "Time spent handling HTTP requests.");
+  for (int i = 0; i < METRICS_ROUTE_COUNT; ++i)
+    write_histogram(f, "chat_http_request_duration_seconds", "route",
+                    s_route_names[i], &metrics.http[i]);
+
+  write_header(f, "chat_http_responses_total", "counter",
+               "HTTP responses by status class.");
+  for (int i = 0; i < METRICS_ROUTE_COUNT; ++i) {
+    for (int j = 0; j < 6; ++j) {
+      uint64_t n = LOAD(metrics.http_status[i][j]);
+      if (!n) continue;
+      if (j) {
+        fprintf(f,
+                "chat_http_responses_total{route=\"%s\",code=\"%dxx\"} "
+                "%" PRIu64 "\n",
+                s_route_names[i], j, n);
+      } else {
+        fprintf(f,
+                "chat_http_responses_total{route=\"%s\",code=\"unknown\"} "
+                "%" PRIu64 "\n",
+                s_route_names[i], n);
+      }
+    }
+  }
+
+  write_header(f, "chat_ws_message_duration_seconds", "histogram",
+               "Time spent handling websocket messages by payload type.");
+  for (int i = 0; i < METRICS_WS_COUNT; ++i)
+    write_histogram(f, "chat_ws_message_duration_seconds", "type",
+                    s_ws_type_names[i], &metrics.ws[i]);
+
+  write_header(f, "chat_handler_duration_seconds", "histogram",
+               "Time spent in the server's event handler by event.");
+  for (int i = 0; i < METRICS_EV_COUNT; ++i)
+    write_histogram(f, "chat_handler_duration_seconds", "event",
+                    s_event_names[i], &metrics.handlers[i]);
+
+  write_header(f, "chat_loop_iteration_duration_seconds", "histogram",
+               "Wall time of one event loop iteration, waiting included.");
+  write_histogram(f, "chat_loop_iteration_duration_seconds", NULL, NULL,
+                  &metrics.loop_iteration);
+
+  write_header(f, "chat_loop_busy_duration_seconds", "histogram",
+               "Handler time per event loop iteration, i.e. how long a "
+               "newly ready event may wait.");
+  write_histogram(f, "chat_loop_busy_duration_seconds", NULL, NULL,
+                  &metrics.loop_busy);
+
+  write_header(f, "chat_sqlite_statement_duration_seconds", "histogram",
+               "SQLite statement run time, from first step to reset.");
+  write_histogram(f, "chat_sqlite_statement_duration_seconds", NULL, NULL,
+                  &metrics.sqlite);
+
+  write_header(f, "chat_xeddsa_verify_duration_seconds", "histogram",
+               "Time spent verifying XEdDSA signatures.");
+  write_histogram(f, "chat_xeddsa_verify_duration_seconds", NULL, NULL,
+                  &metrics.xeddsa_verify);
+
+  struct {
+    const char *name, *type, *help;
+    int64_t value;
+  } scalars[] = {
+      {"chat_connections", "gauge", "Open client connections.",
+       LOAD(metrics.connections)},
+      {"chat_connections_accepted_total", "counter",
+       "Client connections accepted.", LOAD(metrics.connections_accepted)},
+      {"chat_ws_sessions", "gauge", "Authenticated websocket sessions.",
+       LOAD(metrics.ws_sessions)},
+      {"chat_received_bytes_total", "counter", "Bytes read from clients.",
+       LOAD(metrics.bytes_in)},
+      {"chat_sent_bytes_total", "counter", "Bytes written to clients.",
+       LOAD(metrics.bytes_out)},
+      {"chat_forwards_delivered_total", "counter",
+       "Forwards written straight to an open connection.",
+       LOAD(metrics.forwards_delivered)},
+      {"chat_queue_enqueued_total", "counter",
+       "Forwards stored for offline recipients.", LOAD(metrics.queue_enqueued)},
+      {"chat_queue_rejected_total", "counter",
+       "Forwards dropped because the recipient queue was full.",
+       LOAD(metrics.queue_rejected)},
+      {"chat_queue_drained_total", "counter",
+       "Queued forwards delivered on reconnect.", LOAD(metrics.queue_drained)},
+      {"chat_blobs_stored_total", "counter", "Attachment blobs uploaded.",
+       LOAD(metrics.blobs_stored)},
+      {"chat_blobs_expired_total", "counter",
+       "Attachment blobs deleted after their TTL.",
+       LOAD(metrics.blobs_expired)},
+      {"chat_loop_iterations_total", "counter", "Event loop iterations.",
+       LOAD(metrics.loop_iterations)},
+      {"chat_loop_events_total", "counter",
+       "Events handled by the event loop.", LOAD(metrics.loop_events)},
+      {"chat_loop_ready_events", "gauge",
+       "Events handled by the latest event loop iteration.",
+       LOAD(metrics.loop_last_events)},
+      {"chat_slow_handlers_total", "counter",
+       "Handler calls over the --slow-handler-ms budget.",
+       LOAD(metrics.slow_handlers)},
+      {"chat_log_dropped_total", "counter",
+       "Log records dropped because the buffer was full.", log_dropped()},
+      {"chat_log_suppressed_total", "counter",
+       "Repeated warnings and errors held back by rate limiting.",
+       log_suppressed()},
+  };
+  for (size_t i = 0; i < sizeof scalars / sizeof *scalars; ++i) {
+    write_header(f, scalars[i].name, scalars[i].type, scalars[i].help);
+    fprintf(f, "%s %" PRId64 "\n", scalars[i].name, scalars[i].value);
+  }
+
+  write_header(f, "chat_allocator_info", "gauge",
+               "Allocator backend selected at build time.");
+  fprintf(f, "chat_allocator_info{allocator=\"%s\"} 1\n", alloc_backend());
+  write_header(f, "chat_alloc_bytes", "gauge",
+               "Live heap bytes by subsystem, as usable size.");
+  for (int i = 0; i < ALLOC_TAG_COUNT; ++i)
+    fprintf(f, "chat_alloc_bytes{subsystem=\"%s\"} %" PRId64 "\n",
+            alloc_tag_name(i), LOAD(alloc_stats[i].bytes));
+  write_header(f, "chat_alloc_blocks", "gauge",
+               "Live heap blocks by subsystem.");
+  for (int i = 0; i < ALLOC_TAG_COUNT; ++i)
+    fprintf(f, "chat_alloc_blocks{subsystem=\"%s\"} %" PRId64 "\n",
+            alloc_tag_name(i), LOAD(alloc_stats[i].blocks));
+  write_header(f, "chat_allocations_total", "counter",
+               "Heap allocations by subsystem.");
+  for (int i = 0; i < ALLOC_TAG_COUNT; ++i)
+    fprintf(f, "chat_allocations_total{subsystem=\"%s\"} %" PRIu64 "\n",
+            alloc_tag_name(i), LOAD(alloc_stats[i].allocations));
+
+  int64_t recv_backlog = 0, send_backlog = 0;
+  for (struct mg_connection *c = s_mgr ? s_mgr->conns : NULL; c; c = c->next) {
+    recv_backlog += c->recv.len;
+    send_backlog += c->send.len;
+  }
+  write_header(f, "chat_recv_backlog_bytes", "gauge",
+               "Bytes read from sockets but not yet handled.");
+  fprintf(f, "chat_recv_backlog_bytes %" PRId64 "\n", recv_backlog);
+  write_header(f, "chat_send_backlog_bytes", "gauge",
+               "Bytes waiting to be written to sockets.");
+  fprintf(f, "chat_send_backlog_bytes %" PRId64 "\n", send_backlog);
+
+  int64_t messages, bytes;
+  queue_depth(&messages, &bytes);
+  write_header(f, "chat_queue_messages", "gauge",
+               "Messages waiting in offline queues.");
+  fprintf(f, "chat_queue_messages %" PRId64 "\n", messages);
+  write_header(f, "chat_queue_bytes", "gauge",
+               "Bytes waiting in offline queues.");
+  fprintf(f, "chat_queue_bytes %" PRId64 "\n", bytes);
+}
+
+// renders a body into memory first so it can be sent with a length
+static void reply_with(struct mg_connection *c, const char *content_type,
+                       void (*write)(FILE *)) {
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *f = open_memstream(&buf, &len);
+  if (!f) {
+    log_error("out of memory");
+    mg_http_reply(c, 500, "", "");
+    return;
+  }
+  write(f);
+  fclose(f);
+
+  mg_printf(c,
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %d\r\n"
+            "\r\n",
+            content_type, (int)len);
+  mg_send(c, buf, len);
+  free(buf);
+}
+
+static bool is_admin(struct mg_http_message *hm) {
+  struct mg_str *auth = mg_http_get_header(hm, "Authorization");
+  if (!metrics_admin_token || !auth) return false;
+
+  size_t len = strlen(metrics_admin_token);
+  return auth->len == len + 7 && memcmp(auth->buf, "Bearer ", 7) == 0 &&
+         CRYPTO_memcmp(auth->buf + 7, metrics_admin_token, len) == 0;
+}
+
+static void handle_profile_request(struct mg_connection *c,
+                                   struct mg_http_message *hm) {
+  if (!is_admin(hm)) {
+    mg_http_reply(c, 401, "WWW-Authenticate: Bearer\r\n", "");
+    return;
+  }
+
+  char seconds[16] = "30";
+  mg_http_get_var(&hm->query, "seconds", seconds, sizeof seconds);
+  if (s_profile_conn || !profiler_start(strtoul(seconds, NULL, 10))) {
+    mg_http_reply(c, 409, "", "profile already running\n");
+    return;
+  }
+  // replied to from MG_EV_POLL once the profile is done
+  s_profile_conn = c->id;
+}
+
+void handle_metrics_event(struct mg_connection *c, int ev, void *ev_data) {
+  if (c->id == s_profile_conn) {
+    if (ev == MG_EV_POLL && profiler_poll()) {
+      reply_with(c, "application/octet-stream", profiler_write_pprof);
+      s_profile_conn = 0;
+    } else if (ev == MG_EV_CLOSE) {
+      profiler_stop();
+      s_profile_conn = 0;
+    }
+  }
+
+  if (ev != MG_EV_HTTP_MSG) return;
+  struct mg_http_message *hm = ev_data;
+
+  if (mg_strcmp(hm->uri, mg_str("/metrics")) == 0) {
+    s_mgr = c->mgr;
+    reply_with(c, "text/plain; version=0.0.4", write_metrics);
+  } else if (mg_strcmp(hm->uri, mg_str("/debug/trace")) == 0) {
+    reply_with(c, "application/json", trace_write_json);
+  } else if (mg_strcmp(hm->uri, mg_str("/debug/sql")) == 0) {
+    reply_with(c, "text/plain", db_profile_write);
+  } else if (mg_strcmp(hm->uri, mg_str("/debug/pprof/profile")) == 0) {
+    handle_profile_request(c, hm);
+  } else {
+    mg_http_reply(c, 404, "", "");
+  }
+}
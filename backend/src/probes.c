@@ -0,0 +1,11 @@
+#include "probes.h"
+
+#ifdef HAVE_SYS_SDT_H
+// where sys/sdt.h expects them, bumped by tracers attaching to the probe
+#define PROBE_SEMAPHORE_DEFINE(NAME)                            \
+  __extension__ volatile unsigned short chat_##NAME##_semaphore \
+      __attribute__((unused)) __attribute__((section(".probes")));
+PROBES(PROBE_SEMAPHORE_DEFINE)
+#else
+typedef int probes_unused;  // ISO C wants something in here
+#endif
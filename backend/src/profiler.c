@@ -0,0 +1,415 @@
+#include "profiler.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <limits.h>
+#include <link.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+
+#define PROFILER_MAX_MAPPINGS 256
+
+enum profiler_state { PROFILER_IDLE, PROFILER_RUNNING, PROFILER_DONE };
+
+struct sample {
+  _Atomic bool ready;  // set once the signal handler is done with it
+  int n;
+  void *pc[PROFILER_MAX_FRAMES];
+};
+
+static enum profiler_state s_state;
+static uint64_t s_deadline, s_started_at, s_duration, s_wall_start;
+
+static struct sample *s_samples;
+static size_t s_capacity;
+static _Atomic size_t s_n_samples;  // claimed, may run past s_capacity
+static _Atomic bool s_sampling;
+static _Atomic int s_in_handler;
+
+static void on_sigprof(int signo) {
+  (void)signo;
+  atomic_fetch_add(&s_in_handler, 1);
+  if (atomic_load(&s_sampling)) {
+    int saved_errno = errno;
+    size_t i = atomic_fetch_add(&s_n_samples, 1);
+    if (i < s_capacity) {
+      struct sample *s = &s_samples[i];
+      s->n = backtrace(s->pc, PROFILER_MAX_FRAMES);
+      atomic_store_explicit(&s->ready, true, memory_order_release);
+    }
+    errno = saved_errno;
+  }
+  atomic_fetch_sub(&s_in_handler, 1);
+}
+
+static uint64_t wall_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool profiler_start(unsigned seconds) {
+  if (s_state != PROFILER_IDLE) return false;
+
+  if (seconds < 1) seconds = 1;
+  if (seconds > PROFILER_MAX_SECONDS) seconds = PROFILER_MAX_SECONDS;
+
+  // enough for a few threads on CPU the whole time
+  s_capacity = (size_t)seconds * PROFILER_HZ * 4;
+  if (s_capacity > PROFILER_MAX_SAMPLES) s_capacity = PROFILER_MAX_SAMPLES;
+  if (!(s_samples = calloc(s_capacity, sizeof *s_samples))) {
+    log_error("out of memory");
+    return false;
+  }
+  atomic_store(&s_n_samples, 0);
+
+  // backtrace() loads libgcc on first use, which isn't safe from a signal
+  void *warmup[1];
+  backtrace(warmup, 1);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = on_sigprof;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, NULL) != 0) {
+    log_error("sigaction failed: %s", strerror(errno));
+    goto err;
+  }
+
+  atomic_store(&s_sampling, true);
+  struct itimerval timer = {{0, 1000000 / PROFILER_HZ},
+                            {0, 1000000 / PROFILER_HZ}};
+  if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+    log_error("setitimer failed: %s", strerror(errno));
+    atomic_store(&s_sampling, false);
+    goto err;
+  }
+
+  s_started_at = metrics_now_ns();
+  s_wall_start = wall_ns();
+  s_deadline = s_started_at + seconds * 1000000000ULL;
+  s_state = PROFILER_RUNNING;
+  log_info("cpu profile started seconds=%u", seconds);
+  return true;
+err:
+  free(s_samples);
+  s_samples = NULL;
+  return false;
+}
+
+static void disarm(void) {
+  struct itimerval off = {{0, 0}, {0, 0}};
+  setitimer(ITIMER_PROF, &off, NULL);
+  atomic_store(&s_sampling, false);
+  // a signal already delivered to another thread may still be writing
+  while (atomic_load(&s_in_handler)) sched_yield();
+  s_duration = metrics_now_ns() - s_started_at;
+}
+
+bool profiler_poll(void) {
+  if (s_state == PROFILER_RUNNING && metrics_now_ns() >= s_deadline) {
+    disarm();
+    s_state = PROFILER_DONE;
+  }
+  return s_state == PROFILER_DONE;
+}
+
+void profiler_stop(void) {
+  if (s_state == PROFILER_RUNNING) disarm();
+  free(s_samples);
+  s_samples = NULL;
+  s_state = PROFILER_IDLE;
+}
+
+// protobuf encoding, just what profile.proto needs
+
+struct pb {
+  uint8_t *buf;
+  size_t len, cap;
+  bool failed;
+};
+
+static void pb_put(struct pb *pb, const void *data, size_t n) {
+  if (pb->failed || !n) return;
+  if (pb->len + n > pb->cap) {
+    size_t cap = pb->cap ? pb->cap : 4096;
+    while (cap < pb->len + n) cap *= 2;
+    uint8_t *buf = realloc(pb->buf, cap);
+    if (!buf) {
+      pb->failed = true;
+      return;
+    }
+    pb->buf = buf;
+    pb->cap = cap;
+  }
+  memcpy(pb->buf + pb->len, data, n);
+  pb->len += n;
+}
+
+static void pb_varint(struct pb *pb, uint64_t v) {
+  uint8_t tmp[10];
+  size_t n = 0;
+  do {
+    tmp[n++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+    v >>= 7;
+  } while (v);
+  pb_put(pb, tmp, n);
+}
+
+static void pb_uint(struct pb *pb, int field, uint64_t v) {
+  if (!v) return;  // the default, left out like protoc does
+  pb_varint(pb, (uint64_t)field << 3);
+  pb_varint(pb, v);
+}
+
+static void pb_bytes(struct pb *pb, int field, const void *data, size_t n) {
+  pb_varint(pb, (uint64_t)field << 3 | 2);
+  pb_varint(pb, n);
+  pb_put(pb, data, n);
+}
+
+// appends SUB as field FIELD of PB and empties it for reuse
+static void pb_message(struct pb *pb, int field, struct pb *sub) {
+  if (sub->failed) pb->failed = true;
+  pb_bytes(pb, field, sub->buf, sub->len);
+  sub->len = 0;
+}
+
+// open addressing uint64 -> uint64, 0 is never a key
+struct map {
+  uint64_t *keys, *values;
+  size_t cap, len;
+};
+
+static uint64_t *map_get(struct map *m, uint64_t key, bool *found) {
+  if ((m->len + 1) * 2 > m->cap) {
+    struct map grown = {0};
+    grown.cap = m->cap ? m->cap * 2 : 1024;
+    grown.keys = calloc(grown.cap, sizeof *grown.keys);
+    grown.values = calloc(grown.cap, sizeof *grown.values);
+    if (!grown.keys || !grown.values) {
+      free(grown.keys);
+      free(grown.values);
+      return NULL;
+    }
+    for (size_t i = 0; i < m->cap; ++i) {
+      if (!m->keys[i]) continue;
+      bool unused;
+      *map_get(&grown, m->keys[i], &unused) = m->values[i];
+    }
+    free(m->keys);
+    free(m->values);
+    *m = grown;
+  }
+
+  size_t i = (key * 0x9e3779b97f4a7c15ULL) & (m->cap - 1);
+  while (m->keys[i] && m->keys[i] != key) i = (i + 1) & (m->cap - 1);
+  *found = m->keys[i] == key;
+  if (!*found) {
+    m->keys[i] = key;
+    ++m->len;
+  }
+  return &m->values[i];
+}
+
+struct mapping {
+  uint64_t start, limit, offset;
+  char *name;
+};
+
+struct mappings {
+  struct mapping items[PROFILER_MAX_MAPPINGS];
+  int n;
+};
+
+static int add_mappings(struct dl_phdr_info *info, size_t size, void *data) {
+  (void)size;
+  struct mappings *m = data;
+
+  char exe[PATH_MAX];
+  const char *name = info->dlpi_name;
+  if (!name || !*name) {
+    // the main executable comes first, without a name
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof exe - 1);
+    exe[n > 0 ? n : 0] = '\0';
+    name = exe;
+  }
+
+  for (int i = 0; i < info->dlpi_phnum && m->n < PROFILER_MAX_MAPPINGS;
+       ++i) {
+    const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+    if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X)) continue;
+    struct mapping *mp = &m->items[m->n];
+    mp->start = info->dlpi_addr + ph->p_vaddr;
+    mp->limit = mp->start + ph->p_memsz;
+    mp->offset = ph->p_offset;
+    if (!(mp->name = strdup(name))) return 1;
+    ++m->n;
+  }
+  return 0;
+}
+
+struct pprof {
+  struct pb out, strings, sub, line;
+  uint64_t n_strings;
+  struct map locations, functions;
+  struct mappings mappings;
+};
+
+static uint64_t add_string(struct pprof *p, const char *s) {
+  pb_bytes(&p->strings, 6, s, strlen(s));
+  return p->n_strings++;
+}
+
+static void add_value_type(struct pprof *p, int field, const char *type,
+                           const char *unit) {
+  pb_uint(&p->sub, 1, add_string(p, type));
+  pb_uint(&p->sub, 2, add_string(p, unit));
+  pb_message(&p->out, field, &p->sub);
+}
+
+static uint64_t function_of(struct pprof *p, uintptr_t pc) {
+  Dl_info info;
+  if (!dladdr((void *)pc, &info) || !info.dli_sname || !info.dli_saddr)
+    return 0;
+
+  bool found;
+  uint64_t *id = map_get(&p->functions, (uintptr_t)info.dli_saddr, &found);
+  if (!id) {
+    p->out.failed = true;
+    return 0;
+  }
+  if (found) return *id;
+
+  *id = p->functions.len;
+  uint64_t name = add_string(p, info.dli_sname);
+  pb_uint(&p->sub, 1, *id);
+  pb_uint(&p->sub, 2, name);
+  pb_uint(&p->sub, 3, name);
+  pb_message(&p->out, 5, &p->sub);
+  return *id;
+}
+
+static uint64_t location_of(struct pprof *p, uintptr_t pc) {
+  bool found;
+  uint64_t *id = map_get(&p->locations, pc, &found);
+  if (!id) {
+    p->out.failed = true;
+    return 0;
+  }
+  if (found) return *id;
+  *id = p->locations.len;
+  uint64_t location = *id;
+
+  uint64_t mapping = 0;
+  for (int i = 0; i < p->mappings.n; ++i) {
+    const struct mapping *mp = &p->mappings.items[i];
+    if (pc >= mp->start && pc < mp->limit) {
+      mapping = i + 1;
+      break;
+    }
+  }
+
+  // may write a function message, so before this location's fields
+  uint64_t function = function_of(p, pc);
+
+  pb_uint(&p->sub, 1, location);
+  pb_uint(&p->sub, 2, mapping);
+  pb_uint(&p->sub, 3, pc);
+  if (function) {
+    pb_uint(&p->line, 1, function);
+    pb_message(&p->sub, 4, &p->line);
+  }
+  pb_message(&p->out, 4, &p->sub);
+  return location;
+}
+
+void profiler_write_pprof(FILE *f) {
+  if (s_state != PROFILER_DONE) return;
+
+  struct pprof *p = calloc(1, sizeof *p);
+  if (!p) {
+    log_error("out of memory");
+    goto end;
+  }
+  add_string(p, "");  // index 0 is always the empty string
+
+  dl_iterate_phdr(add_mappings, &p->mappings);
+  for (int i = 0; i < p->mappings.n; ++i) {
+    const struct mapping *mp = &p->mappings.items[i];
+    pb_uint(&p->sub, 1, i + 1);
+    pb_uint(&p->sub, 2, mp->start);
+    pb_uint(&p->sub, 3, mp->limit);
+    pb_uint(&p->sub, 4, mp->offset);
+    pb_uint(&p->sub, 5, add_string(p, mp->name));
+    pb_message(&p->out, 3, &p->sub);
+  }
+
+  uint64_t period = 1000000000ULL / PROFILER_HZ;
+  add_value_type(p, 1, "samples", "count");
+  add_value_type(p, 1, "cpu", "nanoseconds");
+  add_value_type(p, 11, "cpu", "nanoseconds");
+  pb_uint(&p->out, 12, period);
+  pb_uint(&p->out, 9, s_wall_start);
+  pb_uint(&p->out, 10, s_duration);
+
+  size_t n = atomic_load(&s_n_samples), kept = 0;
+  if (n > s_capacity) n = s_capacity;
+  struct pb ids = {0}, values = {0};
+  for (size_t i = 0; i < n; ++i) {
+    struct sample *s = &s_samples[i];
+    if (!atomic_load_explicit(&s->ready, memory_order_acquire)) continue;
+
+    // frames 0 and 1 are on_sigprof and the signal trampoline
+    for (int j = 2; j < s->n; ++j) {
+      // return addresses point past the call, step back into it
+      uintptr_t pc = (uintptr_t)s->pc[j] - (j > 2);
+      pb_varint(&ids, location_of(p, pc));
+    }
+    pb_varint(&values, 1);
+    pb_varint(&values, period);
+
+    pb_message(&p->sub, 1, &ids);
+    pb_message(&p->sub, 2, &values);
+    pb_message(&p->out, 2, &p->sub);
+    ++kept;
+  }
+  free(ids.buf);
+  free(values.buf);
+
+  if (p->out.failed || p->strings.failed) {
+    log_error("out of memory");
+  } else {
+    fwrite(p->out.buf, 1, p->out.len, f);
+    fwrite(p->strings.buf, 1, p->strings.len, f);
+  }
+
+  size_t claimed = atomic_load(&s_n_samples);
+  log_info("cpu profile done samples=%zu dropped=%zu duration_ms=%.0f", kept,
+           claimed > s_capacity ? claimed - s_capacity : 0, s_duration / 1e6);
+
+  for (int i = 0; i < p->mappings.n; ++i) free(p->mappings.items[i].name);
+  free(p->locations.keys);
+  free(p->locations.values);
+  free(p->functions.keys);
+  free(p->functions.values);
+  free(p->out.buf);
+  free(p->strings.buf);
+  free(p->sub.buf);
+  free(p->line.buf);
+  free(p);
+end:
+  profiler_stop();
+}
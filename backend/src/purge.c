@@ -0,0 +1,147 @@
+#include "purge.h"
+
+#include <inttypes.h>
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "db.h"
+#include "log.h"
+#include "queue.h"
+
+// clang-format off
+static const char *s_sql_purge[] = {
+  "delete from queue where id in (select id from queue where for=?1 limit ?2);",
+  "delete from pqopks where uid in (select uid from pqopks where for=?1 limit ?2);",
+  "delete from opks where uid in (select uid from opks where for=?1 limit ?2);",
+};
+// clang-format on
+
+// runs sql bound to id, keeping the first two columns of the row it returns
+// in row if there is one
+static bool exec_for(sqlite3 *conn, const char *sql, int64_t id,
+                     int64_t *row) {
+  sqlite3_stmt *stmt = NULL;
+  bool ok = false;
+
+  int rc;
+  if ((rc = sqlite3_prepare_v3(conn, sql, -1, 0, &stmt, NULL)) != SQLITE_OK) {
+    log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(conn));
+    goto err;
+  }
+
+  if ((rc = sqlite3_bind_int64(stmt, 1, id)) != SQLITE_OK) {
+    log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(conn));
+    goto err;
+  }
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if (!row) continue;
+    row[0] = sqlite3_column_int64(stmt, 0);
+    row[1] = sqlite3_column_int64(stmt, 1);
+  }
+  if (rc != SQLITE_DONE) {
+    log_error("step failed: %d (%s)", rc, sqlite3_errmsg(conn));
+    goto err;
+  }
+
+  ok = true;
+
+err:
+  if (stmt) sqlite3_finalize(stmt);
+  return ok;
+}
+
+void purge_tick(void *arg) {
+  (void)arg;
+  sqlite3_stmt *stmt_tombstone = NULL, *stmt_purge = NULL;
+  bool in_tx = false;
+
+  int rc;
+  if ((rc = sqlite3_prepare_v3(db,
+                               "select id from tombstones order by id limit 1;",
+                               -1, 0, &stmt_tombstone, NULL)) != SQLITE_OK) {
+    log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(db));
+    goto err;
+  }
+
+  switch (rc = sqlite3_step(stmt_tombstone)) {
+    case SQLITE_ROW:
+      break;
+    case SQLITE_DONE:
+      goto err;  // nothing to purge
+    default: {
+      log_error("step failed: %d (%s)", rc, sqlite3_errmsg(db));
+      goto err;
+    }
+  }
+
+  int64_t id = sqlite3_column_int64(stmt_tombstone, 0);
+  sqlite3_reset(stmt_tombstone);  // done reading before it is deleted
+  int budget = PURGE_BATCH_SIZE;
+  sqlite3 *shard = db_shard(id);
+
+  // only the shard is written in the transaction, the tombstone goes after
+  // its commit
+  if ((rc = sqlite3_exec(shard, "begin transaction;", NULL, NULL, NULL)) !=
+      SQLITE_OK) {
+    log_error("begin transaction failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    goto err;
+  }
+  in_tx = true;
+
+  for (size_t i = 0; i < sizeof s_sql_purge / sizeof *s_sql_purge; ++i) {
+    if ((rc = sqlite3_prepare_v3(shard, s_sql_purge[i], -1, 0, &stmt_purge,
+                                 NULL)) != SQLITE_OK) {
+      log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(shard));
+      goto err;
+    }
+
+    if ((rc = sqlite3_bind_int64(stmt_purge, 1, id)) != SQLITE_OK ||
+        (rc = sqlite3_bind_int(stmt_purge, 2, budget)) != SQLITE_OK) {
+      log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(shard));
+      goto err;
+    }
+
+    if ((rc = sqlite3_step(stmt_purge)) != SQLITE_DONE) {
+      log_error("step failed: %d (%s)", rc, sqlite3_errmsg(shard));
+      goto err;
+    }
+
+    budget -= sqlite3_changes(shard);
+    sqlite3_finalize(stmt_purge);
+    stmt_purge = NULL;
+
+    if (budget <= 0) break;
+  }
+
+  // every table came up short of the budget, so nothing is left
+  int64_t usage[2] = {0, 0};
+  if (budget > 0 && !exec_for(shard,
+                              "delete from queue_usage where for=? "
+                              "returning messages,bytes;",
+                              id, usage))
+    goto err;
+
+  in_tx = false;
+  if ((rc = sqlite3_exec(shard, "commit;", NULL, NULL, NULL)) != SQLITE_OK) {
+    log_error("commit failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    sqlite3_exec(shard, "rollback;", NULL, NULL, NULL);
+    goto err;
+  }
+
+  if (budget > 0) {
+    queue_discard(usage[0], usage[1]);
+    // the shard rows are gone for good now; a crash before this leaves the
+    // tombstone behind, and the next tick finds nothing left and retires it
+    if (!exec_for(db, "delete from tombstones where id=?;", id, NULL))
+      goto err;
+    log_info("purged identity %" PRId64, id);
+  }
+
+err:
+  if (in_tx) sqlite3_exec(shard, "rollback;", NULL, NULL, NULL);
+  if (stmt_tombstone) sqlite3_finalize(stmt_tombstone);
+  if (stmt_purge) sqlite3_finalize(stmt_purge);
+}
@@ -0,0 +1,449 @@
+#include "queue.h"
+
+#include <inttypes.h>
+#include <openssl/evp.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "db.h"
+#include "log.h"
+
+#define EMPTY -1
+
+// in-memory mirror of the queue_usage table so quota checks on the enqueue
+// path don't have to touch the database
+struct queue_usage {
+  int64_t id;
+  int64_t messages;
+  int64_t bytes;
+};
+
+int64_t queue_max_messages = QUEUE_DEFAULT_MAX_MESSAGES;
+int64_t queue_max_bytes = QUEUE_DEFAULT_MAX_BYTES;
+
+static struct queue_usage *s_usage = NULL;
+static size_t s_usage_cap = 0, s_usage_len = 0;
+
+// queue_usage summed over every identity, see queue_depth
+static int64_t s_depth_messages = 0, s_depth_bytes = 0;
+
+// shards with a transaction open for the current batch, and those whose
+// batch failed to commit, see queue_batch_begin
+static bool s_batching = false;
+static sqlite3 *s_batch[DB_MAX_SHARDS], *s_lost[DB_MAX_SHARDS];
+static int s_n_batch = 0, s_n_lost = 0;
+
+static size_t usage_slot(int64_t id) {
+  uint64_t h = (uint64_t)id * 0x9e3779b97f4a7c15ull;
+  return (size_t)(h ^ (h >> 32)) & (s_usage_cap - 1);
+}
+
+static struct queue_usage *usage_find(int64_t id) {
+  if (!s_usage_cap) return NULL;
+  for (size_t i = usage_slot(id);; i = (i + 1) & (s_usage_cap - 1)) {
+    if (s_usage[i].id == id) return &s_usage[i];
+    if (s_usage[i].id == EMPTY) return NULL;
+  }
+}
+
+static struct queue_usage *usage_place(struct queue_usage entry) {
+  size_t i = usage_slot(entry.id);
+  while (s_usage[i].id != EMPTY) i = (i + 1) & (s_usage_cap - 1);
+  s_usage[i] = entry;
+  return &s_usage[i];
+}
+
+static bool usage_grow(void) {
+  size_t old_cap = s_usage_cap, cap = old_cap ? old_cap * 2 : 64;
+  struct queue_usage *old = s_usage, *usage = malloc(cap * sizeof *usage);
+  if (!usage) {
+    log_error("out of memory");
+    return false;
+  }
+  for (size_t i = 0; i < cap; ++i) usage[i].id = EMPTY;
+
+  s_usage = usage;
+  s_usage_cap = cap;
+  for (size_t i = 0; i < old_cap; ++i)
+    if (old[i].id != EMPTY) usage_place(old[i]);
+
+  free(old);
+  return true;
+}
+
+static struct queue_usage *usage_insert(struct queue_usage entry) {
+  // keep the load factor under 3/4
+  if ((s_usage_len + 1) * 4 > s_usage_cap * 3 && !usage_grow()) return NULL;
+  ++s_usage_len;
+  return usage_place(entry);
+}
+
+static void depth_add(int64_t messages, int64_t bytes) {
+  s_depth_messages += messages;
+  s_depth_bytes += bytes;
+  if (s_depth_messages < 0) s_depth_messages = 0;
+  if (s_depth_bytes < 0) s_depth_bytes = 0;
+}
+
+/**
+ * Looks up the usage counters of an identity, loading them from the database
+ * on first access. Identities queued to before the counters existed get them
+ * computed from the queue itself.
+ */
+static struct queue_usage *usage_get(int64_t id) {
+  struct queue_usage *usage = usage_find(id);
+  if (usage) return usage;
+
+  sqlite3 *shard = db_shard(id);
+  sqlite3_stmt *stmt_select = NULL, *stmt_count = NULL, *stmt_insert = NULL;
+  struct queue_usage entry = {.id = id};
+
+  // clang-format off
+  const char *sql_insert = "insert or ignore into queue_usage(for,messages,bytes)values(?,?,?);";
+  // clang-format on
+
+  if (!(stmt_select = db_shard_read_stmt(DB_READ_QUEUE_USAGE, id))) goto err;
+
+  int rc;
+  if ((rc = sqlite3_bind_int64(stmt_select, 1, id)) != SQLITE_OK) {
+    log_error("bind failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt_select)));
+    goto err;
+  }
+
+  switch (rc = sqlite3_step(stmt_select)) {
+    case SQLITE_ROW: {
+      entry.messages = sqlite3_column_int64(stmt_select, 0);
+      entry.bytes = sqlite3_column_int64(stmt_select, 1);
+      usage = usage_insert(entry);
+      goto err;
+    }
+    case SQLITE_DONE:
+      break;
+    default: {
+      log_error("step failed: %d (%s)", rc,
+                sqlite3_errmsg(sqlite3_db_handle(stmt_select)));
+      goto err;
+    }
+  }
+
+  if (!(stmt_count = db_shard_read_stmt(DB_READ_QUEUE_COUNT, id))) goto err;
+
+  if ((rc = sqlite3_prepare_v3(shard, sql_insert, -1, 0, &stmt_insert,
+                               NULL)) != SQLITE_OK) {
+    log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    goto err;
+  }
+
+  if ((rc = sqlite3_bind_int64(stmt_count, 1, id)) != SQLITE_OK) {
+    log_error("bind failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt_count)));
+    goto err;
+  }
+
+  if ((rc = sqlite3_step(stmt_count)) != SQLITE_ROW) {
+    log_error("step failed: %d (%s)", rc,
+              sqlite3_errmsg(sqlite3_db_handle(stmt_count)));
+    goto err;
+  }
+
+  entry.messages = sqlite3_column_int64(stmt_count, 0);
+  entry.bytes = sqlite3_column_int64(stmt_count, 1);
+
+  if ((rc = sqlite3_bind_int64(stmt_insert, 1, id)) != SQLITE_OK ||
+      (rc = sqlite3_bind_int64(stmt_insert, 2, entry.messages)) != SQLITE_OK ||
+      (rc = sqlite3_bind_int64(stmt_insert, 3, entry.bytes)) != SQLITE_OK) {
+    log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    goto err;
+  }
+
+  if ((rc = sqlite3_step(stmt_insert)) != SQLITE_DONE) {
+    log_error("step failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    goto err;
+  }
+
+  usage = usage_insert(entry);
+  depth_add(entry.messages, entry.bytes);
+
+err:
+  if (stmt_select) db_read_done(stmt_select);
+  if (stmt_count) db_read_done(stmt_count);
+  if (stmt_insert) sqlite3_finalize(stmt_insert);
+  return usage;
+}
+
+static bool depth_load(void) {
+  s_depth_messages = s_depth_bytes = 0;
+  for (int i = 0; i < db_shard_count(); ++i) {
+    sqlite3 *shard = db_shard_at(i);
+    sqlite3_stmt *stmt = NULL;
+    int rc;
+    if ((rc = sqlite3_prepare_v3(
+             shard,
+             "select coalesce(sum(messages), 0), coalesce(sum(bytes), 0) "
+             "from queue_usage;",
+             -1, 0, &stmt, NULL)) != SQLITE_OK) {
+      log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(shard));
+      return false;
+    }
+    if ((rc = sqlite3_step(stmt)) != SQLITE_ROW) {
+      log_error("step failed: %d (%s)", rc, sqlite3_errmsg(shard));
+      sqlite3_finalize(stmt);
+      return false;
+    }
+    depth_add(sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1));
+    sqlite3_finalize(stmt);
+  }
+  return true;
+}
+
+// drops every counter, to be read back from the database on the next push
+static void usage_clear(void) {
+  for (size_t i = 0; i < s_usage_cap; ++i) s_usage[i].id = EMPTY;
+  s_usage_len = 0;
+}
+
+void queue_forget(int64_t id) {
+  struct queue_usage *usage = usage_find(id);
+  if (!usage) return;
+
+  // backward-shift deletion, so probe sequences stay intact without tombstones
+  size_t i = usage - s_usage, j = i;
+  for (;;) {
+    j = (j + 1) & (s_usage_cap - 1);
+    if (s_usage[j].id == EMPTY) break;
+    size_t k = usage_slot(s_usage[j].id);
+    // move j into the hole at i unless its home slot k lies cyclically in (i,j]
+    if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) continue;
+    s_usage[i] = s_usage[j];
+    i = j;
+  }
+  s_usage[i].id = EMPTY;
+  --s_usage_len;
+}
+
+bool queue_payload_init(struct queue_payload *payload, const void *buf,
+                        size_t len) {
+  unsigned int hash_len = 0;
+  payload->buf = buf;
+  payload->len = len;
+  if (!EVP_Digest(buf, len, payload->hash, &hash_len, EVP_sha256(), NULL) ||
+      hash_len != sizeof payload->hash) {
+    log_error("sha256 failed");
+    return false;
+  }
+  return true;
+}
+
+enum queue_result queue_push(int64_t id, const void *buf, size_t len) {
+  return queue_push_shared(id, buf, len, NULL);
+}
+
+enum queue_result queue_push_shared(int64_t id, const void *buf, size_t len,
+                                    const struct queue_payload *payload) {
+  enum queue_result ret = QUEUE_ERROR;
+  sqlite3 *shard = db_shard(id);
+  sqlite3_stmt *stmt_payload = NULL, *stmt_queue = NULL, *stmt_usage = NULL;
+  bool in_savepoint = false;
+
+  struct queue_usage *usage = usage_get(id);
+  if (!usage) return QUEUE_ERROR;
+
+  int64_t total = (int64_t)len + (payload ? (int64_t)payload->len : 0);
+  if (usage->messages >= queue_max_messages ||
+      total > queue_max_bytes - usage->bytes) {
+    log_warn(
+        "queue full for %" PRId64 " (%" PRId64 " messages, %" PRId64 " bytes)",
+        id, usage->messages, usage->bytes);
+    return QUEUE_FULL;
+  }
+
+  // clang-format off
+  const char *sql_payload =
+    "insert into queue_payloads(hash,data,refs)values(?,?,1) "
+    "on conflict(hash) do update set refs=refs+1 "
+    "returning id;";
+  const char *sql_queue = "insert into queue(for,msg,payload)values(?,?,?);";
+  const char *sql_usage =
+    "insert into queue_usage(for,messages,bytes)values(?,1,?) "
+    "on conflict(for) do update set "
+      "messages=messages+1,"
+      "bytes=bytes+excluded.bytes;";
+  // clang-format on
+
+  int rc;
+  if ((payload && (rc = sqlite3_prepare_v3(shard, sql_payload, -1, 0,
+                                           &stmt_payload, NULL)) !=
+                      SQLITE_OK) ||
+      (rc = sqlite3_prepare_v3(shard, sql_queue, -1, 0, &stmt_queue,
+                               NULL)) != SQLITE_OK ||
+      (rc = sqlite3_prepare_v3(shard, sql_usage, -1, 0, &stmt_usage,
+                               NULL)) != SQLITE_OK) {
+    log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    goto err;
+  }
+
+  if ((payload &&
+       ((rc = sqlite3_bind_blob(stmt_payload, 1, payload->hash,
+                                sizeof payload->hash, SQLITE_STATIC)) !=
+            SQLITE_OK ||
+        (rc = sqlite3_bind_blob(stmt_payload, 2, payload->buf, payload->len,
+                                SQLITE_STATIC)) != SQLITE_OK)) ||
+      (rc = sqlite3_bind_int64(stmt_queue, 1, id)) != SQLITE_OK ||
+      (rc = sqlite3_bind_blob(stmt_queue, 2, buf, len, SQLITE_STATIC)) !=
+          SQLITE_OK ||
+      (rc = sqlite3_bind_int64(stmt_usage, 1, id)) != SQLITE_OK ||
+      (rc = sqlite3_bind_int64(stmt_usage, 2, total)) != SQLITE_OK) {
+    log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    goto err;
+  }
+
+  if (s_batching && sqlite3_get_autocommit(shard)) {
+    if ((rc = sqlite3_exec(shard, "begin transaction;", NULL, NULL, NULL)) !=
+        SQLITE_OK) {
+      log_error("begin transaction failed: %d (%s)", rc,
+                sqlite3_errmsg(shard));
+      goto err;
+    }
+    s_batch[s_n_batch++] = shard;
+  }
+
+  // a savepoint rather than a transaction so callers can batch pushes
+  if ((rc = sqlite3_exec(shard, "savepoint queue_push;", NULL, NULL, NULL)) !=
+      SQLITE_OK) {
+    log_error("savepoint failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    goto err;
+  }
+  in_savepoint = true;
+
+  if (payload) {
+    if ((rc = sqlite3_step(stmt_payload)) != SQLITE_ROW) {
+      log_error("step failed: %d (%s)", rc, sqlite3_errmsg(shard));
+      goto err;
+    }
+    int64_t payload_id = sqlite3_column_int64(stmt_payload, 0);
+    if ((rc = sqlite3_reset(stmt_payload)) != SQLITE_OK ||
+        (rc = sqlite3_bind_int64(stmt_queue, 3, payload_id)) != SQLITE_OK) {
+      log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(shard));
+      goto err;
+    }
+  }
+
+  if ((rc = sqlite3_step(stmt_queue)) != SQLITE_DONE ||
+      (rc = sqlite3_step(stmt_usage)) != SQLITE_DONE) {
+    log_error("step failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    goto err;
+  }
+
+  if ((rc = sqlite3_exec(shard, "release queue_push;", NULL, NULL, NULL)) !=
+      SQLITE_OK) {
+    log_error("release failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    goto err;
+  }
+  in_savepoint = false;
+
+  usage->messages += 1;
+  usage->bytes += total;
+  depth_add(1, total);
+  ret = QUEUE_OK;
+
+err:
+  if (in_savepoint)
+    sqlite3_exec(shard, "rollback to queue_push; release queue_push;", NULL,
+                 NULL, NULL);
+  if (stmt_payload) sqlite3_finalize(stmt_payload);
+  if (stmt_queue) sqlite3_finalize(stmt_queue);
+  if (stmt_usage) sqlite3_finalize(stmt_usage);
+  return ret;
+}
+
+bool queue_init(void) { return depth_load(); }
+
+void queue_depth(int64_t *messages, int64_t *bytes) {
+  *messages = s_depth_messages;
+  *bytes = s_depth_bytes;
+}
+
+void queue_discard(int64_t messages, int64_t bytes) {
+  depth_add(-messages, -bytes);
+}
+
+void queue_batch_begin(void) {
+  s_batching = true;
+  s_n_batch = 0;
+  s_n_lost = 0;
+}
+
+bool queue_batch_end(void) {
+  s_batching = false;
+
+  for (int i = 0; i < s_n_batch; ++i) {
+    sqlite3 *shard = s_batch[i];
+    int rc;
+    if ((rc = sqlite3_exec(shard, "commit;", NULL, NULL, NULL)) != SQLITE_OK) {
+      log_error("commit failed: %d (%s)", rc, sqlite3_errmsg(shard));
+      sqlite3_exec(shard, "rollback;", NULL, NULL, NULL);
+      s_lost[s_n_lost++] = shard;
+    }
+  }
+  s_n_batch = 0;
+
+  // the counters ran ahead of what was committed
+  if (s_n_lost) {
+    usage_clear();
+    depth_load();
+  }
+  return !s_n_lost;
+}
+
+bool queue_batch_lost(int64_t id) {
+  sqlite3 *shard = db_shard(id);
+  for (int i = 0; i < s_n_lost; ++i)
+    if (s_lost[i] == shard) return true;
+  return false;
+}
+
+void queue_release(int64_t id, int64_t messages, int64_t bytes) {
+  sqlite3 *shard = db_shard(id);
+  sqlite3_stmt *stmt = NULL;
+
+  if (messages == 0 && bytes == 0) return;
+
+  depth_add(-messages, -bytes);
+
+  struct queue_usage *usage = usage_find(id);
+  if (usage) {
+    usage->messages =
+        usage->messages > messages ? usage->messages - messages : 0;
+    usage->bytes = usage->bytes > bytes ? usage->bytes - bytes : 0;
+    // an empty queue needs no mirror, it is read back on the next push, so
+    // the map only holds recipients with something queued
+    if (usage->messages == 0) queue_forget(id);
+  }
+
+  // clang-format off
+  const char *sql = "update queue_usage set messages=max(messages-?,0),bytes=max(bytes-?,0) where for=?;";
+  // clang-format on
+
+  int rc;
+  if ((rc = sqlite3_prepare_v3(shard, sql, -1, 0, &stmt, NULL)) != SQLITE_OK) {
+    log_error("prepare failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    goto err;
+  }
+
+  if ((rc = sqlite3_bind_int64(stmt, 1, messages)) != SQLITE_OK ||
+      (rc = sqlite3_bind_int64(stmt, 2, bytes)) != SQLITE_OK ||
+      (rc = sqlite3_bind_int64(stmt, 3, id)) != SQLITE_OK) {
+    log_error("bind failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    goto err;
+  }
+
+  if ((rc = sqlite3_step(stmt)) != SQLITE_DONE) {
+    log_error("step failed: %d (%s)", rc, sqlite3_errmsg(shard));
+    goto err;
+  }
+
+err:
+  if (stmt) sqlite3_finalize(stmt);
+}
@@ -1,26 +1,81 @@
 #include "server.h"
 
+#include <inttypes.h>
 #include <mongoose.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "alloc.h"
+#include "assets.h"
+#include "handlers/blob.h"
 #include "handlers/identity.h"
 #include "handlers/prekey_bundle.h"
 #include "handlers/websocket.h"
+#include "log.h"
+#include "loopmon.h"
+#include "metrics.h"
+#include "probes.h"
+#include "trace.h"
 
-void handle_server_event(struct mg_connection *c, int ev, void *ev_data) {
+static enum metrics_route identity_route(struct mg_http_message *hm) {
+  if (mg_strcmp(hm->method, mg_str("POST")) == 0)
+    return METRICS_ROUTE_IDENTITY_POST;
+  if (mg_strcmp(hm->method, mg_str("PATCH")) == 0)
+    return METRICS_ROUTE_IDENTITY_PATCH;
+  if (mg_strcmp(hm->method, mg_str("DELETE")) == 0)
+    return METRICS_ROUTE_IDENTITY_DELETE;
+  return METRICS_ROUTE_OTHER;
+}
+
+static void finish_request(struct mg_connection *c, struct mg_http_message *hm,
+                           enum metrics_route route, uint64_t started_at,
+                           size_t send_ofs) {
+  uint64_t elapsed = metrics_now_ns() - started_at;
+  metrics_observe(&metrics.http[route], elapsed);
+  trace_request_end(metrics_route_name(route));
+
+  // every handler writes its status line right away
+  int status = 0;
+  const char *line = (const char *)c->send.buf + send_ofs;
+  if (c->send.len >= send_ofs + 12 && memcmp(line, "HTTP/1.", 7) == 0)
+    status = atoi(line + 9);
+  int class = status >= 100 && status < 600 ? status / 100 : 0;
+  METRICS_INC(http_status[route][class]);
+  if (PROBE_ENABLED(http_request))
+    PROBE4(http_request, c->id, metrics_route_name(route), status, elapsed);
+
+  log_info("%.*s %.*s%s%.*s conn=%lu status=%d latency_us=%" PRIu64,
+           (int)hm->method.len, hm->method.buf, (int)hm->uri.len, hm->uri.buf,
+           hm->query.len ? "?" : "", (int)hm->query.len, hm->query.buf, c->id,
+           status, elapsed / 1000);
+}
+
+static void dispatch(struct mg_connection *c, int ev, void *ev_data) {
   if (ev == MG_EV_WS_OPEN) {
     handle_ws_open(c, ev_data);
   } else if (ev == MG_EV_WS_MSG) {
     handle_ws_message(c, ev_data);
+  } else if (ev == MG_EV_READ) {
+    METRICS_ADD(bytes_in, *(long *)ev_data);
+  } else if (ev == MG_EV_WRITE) {
+    METRICS_ADD(bytes_out, *(long *)ev_data);
+  } else if (ev == MG_EV_ACCEPT) {
+    METRICS_INC(connections);
+    METRICS_INC(connections_accepted);
   } else if (ev == MG_EV_CLOSE) {
-    if (c->fn_data) free(c->fn_data);
+    if (c->is_accepted) METRICS_SUB(connections, 1);
+    struct ws_ctx *ctx = c->fn_data;
+    if (c->is_websocket && ctx && ctx->id != -1) METRICS_SUB(ws_sessions, 1);
+    if (c->is_websocket) PROBE2(ws_close, c->id, ctx ? ctx->id : -1);
+    if (c->fn_data) alloc_free(ALLOC_HANDLERS, c->fn_data);
   }
 
   if (ev != MG_EV_HTTP_MSG) return;
   struct mg_http_message *hm = ev_data;
 
-  printf("%.*s %.*s%c%.*s\n", (int)hm->method.len, hm->method.buf,
-         (int)hm->uri.len, hm->uri.buf, hm->query.len ? '?' : 0,
-         (int)hm->query.len, hm->query.buf);
+  uint64_t started_at = metrics_now_ns();
+  size_t send_ofs = c->send.len;
+  trace_request_begin();
 
   if (mg_strcmp(hm->method, mg_str("OPTIONS")) == 0) {
     mg_http_reply(c, 204,
@@ -31,25 +86,45 @@ void handle_server_event(struct mg_connection *c, int ev, void *ev_data) {
                   "Access-Control-Allow-Methods: *\r\n"
                   "Access-Control-Allow-Headers: *\r\n",
                   "");
+    finish_request(c, hm, METRICS_ROUTE_OPTIONS, started_at, send_ofs);
     return;
   }
 
+  enum metrics_route route;
+
   if (mg_match(hm->uri, mg_str("/api/#"), NULL)) {
     struct mg_str caps[2];
     if (mg_strcmp(hm->uri, mg_str("/api/identity")) == 0) {
+      route = identity_route(hm);
       handle_identity_request(c, hm);
     } else if (mg_strcmp(hm->uri, mg_str("/api/ws")) == 0) {
+      route = METRICS_ROUTE_WS;
       handle_ws_upgrade_request(c, hm);
     } else if (mg_match(hm->uri, mg_str("/api/keys/*/bundle"), caps)) {
+      route = METRICS_ROUTE_BUNDLE;
       handle_prekey_bundle_request(c, hm, &caps[0]);
+    } else if (mg_match(hm->uri, mg_str("/api/blobs/*"), caps)) {
+      route = mg_strcmp(hm->method, mg_str("PUT")) == 0
+                  ? METRICS_ROUTE_BLOB_PUT
+                  : METRICS_ROUTE_BLOB_GET;
+      handle_blob_request(c, hm, &caps[0]);
     } else {
+      route = METRICS_ROUTE_OTHER;
       mg_http_reply(c, 404, "", "");
     }
   } else {
-    struct mg_http_serve_opts opts = {
-        .root_dir = "./public",
-        .page404 = "./public/index.html",
-    };
-    mg_http_serve_dir(c, hm, &opts);
+    route = METRICS_ROUTE_STATIC;
+    assets_serve(c, hm);
   }
+
+  finish_request(c, hm, route, started_at, send_ofs);
+}
+
+void handle_server_event(struct mg_connection *c, int ev, void *ev_data) {
+  // every connection gets one per iteration, timing them is just noise
+  if (ev == MG_EV_POLL) return;
+
+  uint64_t started_at = loopmon_handler_begin();
+  dispatch(c, ev, ev_data);
+  loopmon_handler_end(started_at, c, ev, ev_data);
 }
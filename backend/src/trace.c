@@ -0,0 +1,151 @@
+#include "trace.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "log.h"
+
+#define TRACE_MAX_THREADS 16
+
+struct trace_event {
+  const char *name;
+  uint64_t begin, end;
+};
+
+struct trace_request {
+  uint64_t id;
+  int n_spans;
+  struct trace_event outer;
+  struct trace_event spans[TRACE_MAX_SPANS];
+};
+
+struct trace_buffer {
+  uint64_t next;  // total requests kept, the slot is next % size
+  struct trace_request requests[TRACE_BUFFER_REQUESTS];
+};
+
+unsigned trace_sample_every = 0;
+uint64_t trace_slow_us = 0;
+_Thread_local bool trace_sampled;
+
+static struct trace_buffer *_Atomic s_buffers[TRACE_MAX_THREADS];
+static _Atomic int s_n_buffers;
+static _Atomic uint64_t s_next_id;
+
+static _Thread_local struct trace_buffer *s_buffer;
+static _Thread_local struct trace_request s_current;
+static _Thread_local unsigned s_countdown;
+
+// timestamps are converted against this pair on export
+static uint64_t s_origin_ticks, s_origin_ns;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void trace_init(void) {
+  s_origin_ns = now_ns();
+  s_origin_ticks = trace_ticks();
+}
+
+static double ticks_per_ns(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t ns = now_ns() - s_origin_ns;
+  uint64_t ticks = trace_ticks() - s_origin_ticks;
+  return ns ? (double)ticks / ns : 1;
+#else
+  return 1;
+#endif
+}
+
+static struct trace_buffer *get_buffer(void) {
+  if (s_buffer) return s_buffer;
+
+  int i = atomic_fetch_add(&s_n_buffers, 1);
+  if (i >= TRACE_MAX_THREADS) return NULL;
+  if (!(s_buffer = calloc(1, sizeof *s_buffer))) {
+    log_error("out of memory");
+    return NULL;
+  }
+  atomic_store_explicit(&s_buffers[i], s_buffer, memory_order_release);
+  return s_buffer;
+}
+
+void trace_request_begin(void) {
+  trace_sampled = false;
+  if (!trace_sample_every) return;
+
+  if (s_countdown) {
+    --s_countdown;
+    return;
+  }
+  s_countdown = trace_sample_every - 1;
+
+  trace_sampled = true;
+  s_current.n_spans = 0;
+  s_current.outer.begin = trace_ticks();
+}
+
+void trace_span(const char *name, uint64_t begin) {
+  if (!trace_sampled || s_current.n_spans >= TRACE_MAX_SPANS) return;
+  s_current.spans[s_current.n_spans++] =
+      (struct trace_event){name, begin, trace_ticks()};
+}
+
+void trace_request_end(const char *name) {
+  if (!trace_sampled) return;
+  trace_sampled = false;
+
+  s_current.outer.name = name;
+  s_current.outer.end = trace_ticks();
+
+  uint64_t ticks = s_current.outer.end - s_current.outer.begin;
+  if (trace_slow_us && ticks < trace_slow_us * 1000 * ticks_per_ns()) return;
+
+  struct trace_buffer *buf = get_buffer();
+  if (!buf) return;
+
+  s_current.id = atomic_fetch_add(&s_next_id, 1);
+  buf->requests[buf->next++ % TRACE_BUFFER_REQUESTS] = s_current;
+}
+
+static void write_event(FILE *f, const struct trace_event *e, uint64_t tid,
+                        double scale, bool *first) {
+  // events from before trace_init() can't be placed, skip them
+  if (e->begin < s_origin_ticks) return;
+  fprintf(f,
+          "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%" PRIu64
+          ",\"ts\":%.3f,\"dur\":%.3f}",
+          *first ? "" : ",", e->name, tid,
+          (e->begin - s_origin_ticks) / scale, (e->end - e->begin) / scale);
+  *first = false;
+}
+
+void trace_write_json(FILE *f) {
+  // ticks per microsecond, Chrome's time unit
+  double scale = ticks_per_ns() * 1000;
+  bool first = true;
+
+  fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  int n = atomic_load(&s_n_buffers);
+  for (int i = 0; i < n && i < TRACE_MAX_THREADS; ++i) {
+    struct trace_buffer *buf =
+        atomic_load_explicit(&s_buffers[i], memory_order_acquire);
+    if (!buf) continue;
+
+    uint64_t count = buf->next < TRACE_BUFFER_REQUESTS ? buf->next
+                                                       : TRACE_BUFFER_REQUESTS;
+    for (uint64_t j = buf->next - count; j < buf->next; ++j) {
+      const struct trace_request *r =
+          &buf->requests[j % TRACE_BUFFER_REQUESTS];
+      write_event(f, &r->outer, r->id, scale, &first);
+      for (int k = 0; k < r->n_spans; ++k)
+        write_event(f, &r->spans[k], r->id, scale, &first);
+    }
+  }
+  fprintf(f, "\n]}\n");
+}
@@ -1,12 +1,17 @@
 #include "util.h"
 
 #include <crypto.h>
+#include <ctype.h>
 #include <mongoose.h>
 #include <sqlite3.h>
 #include <sys/types.h>
 
+#include "alloc.h"
 #include "base64.h"
 #include "db.h"
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
 
 #define ERR(CODE)  \
   do {             \
@@ -19,34 +24,28 @@ int64_t verify_request(struct mg_http_message *hm, void **id_key) {
   char *sig_buf = NULL;
   sqlite3_stmt *stmt = NULL;
   uint8_t *msg_buf = NULL;
+  uint64_t span;
 
   struct mg_str *id = mg_http_get_header(hm, "X-Identity");
   struct mg_str *sig_b64 = mg_http_get_header(hm, "X-Signature");
   if (!id || !sig_b64) {
-    fprintf(stderr, "[%s:%d] missing required headers\n", __func__, __LINE__);
+    log_warn("missing required headers");
     ERR(400);
   }
 
   size_t sig_len = 0;
   sig_buf = b64_decode(sig_b64->buf, sig_b64->len, &sig_len);
   if (!sig_buf || sig_len != XEDDSA_SIGNATURE_LENGTH) {
-    fprintf(stderr, "[%s:%d] invalid signature header\n", __func__, __LINE__);
+    log_warn("invalid signature header");
     ERR(400);
   }
 
-  int rc;
-  if ((rc = sqlite3_prepare_v3(
-           db, "select id, ik from identities where handle = ?;", -1, 0, &stmt,
-           NULL)) != SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] prepare failed: %d (%s)\n", __func__, __LINE__, rc,
-            sqlite3_errmsg(db));
-    ERR(500);
-  }
+  TRACE_BEGIN(span);
+  if (!(stmt = db_read_stmt(DB_READ_IDENTITY_BY_HANDLE))) ERR(500);
 
   if (sqlite3_bind_text(stmt, 1, id->buf, id->len, SQLITE_STATIC) !=
       SQLITE_OK) {
-    fprintf(stderr, "[%s:%d] bind failed: %s\n", __func__, __LINE__,
-            sqlite3_errmsg(db));
+    log_error("bind failed: %s", sqlite3_errmsg(sqlite3_db_handle(stmt)));
     ERR(500);
   }
 
@@ -54,12 +53,11 @@ int64_t verify_request(struct mg_http_message *hm, void **id_key) {
     case SQLITE_ROW:
       break;
     case SQLITE_DONE: {
-      fprintf(stderr, "[%s:%d] unknown identity\n", __func__, __LINE__);
+      log_warn("unknown identity");
       ERR(401);
     }
     default: {
-      fprintf(stderr, "[%s:%d] step failed: %s\n", __func__, __LINE__,
-              sqlite3_errmsg(db));
+      log_error("step failed: %s", sqlite3_errmsg(sqlite3_db_handle(stmt)));
       ERR(500);
     }
   }
@@ -67,12 +65,15 @@ int64_t verify_request(struct mg_http_message *hm, void **id_key) {
   ret = sqlite3_column_int64(stmt, 0);
   const void *pk_buf = sqlite3_column_blob(stmt, 1);
   int pk_len = sqlite3_column_bytes(stmt, 1);
+  TRACE_END(span, "verify.lookup");
 
   if (!pk_buf || pk_len != CURVE25519_PUBLIC_KEY_LENGTH) {
-    fprintf(stderr, "[%s:%d] invalid public key buffer\n", __func__, __LINE__);
+    log_error("invalid public key buffer");
     ERR(500);
   }
 
+  TRACE_BEGIN(span);
+
   const struct iovec iov[] = {{hm->method.buf, hm->method.len},
                               {hm->uri.buf, hm->uri.len},
                               {hm->query.buf, hm->query.len},
@@ -82,8 +83,8 @@ int64_t verify_request(struct mg_http_message *hm, void **id_key) {
     if (msg_len > SIZE_MAX - iov[i].iov_len) ERR(413);
     msg_len += iov[i].iov_len;
   }
-  if ((msg_buf = malloc(msg_len)) == NULL) {
-    fprintf(stderr, "[%s:%d] out of memory\n", __func__, __LINE__);
+  if ((msg_buf = alloc_malloc(ALLOC_HANDLERS, msg_len)) == NULL) {
+    log_error("out of memory");
     ERR(500);
   }
 
@@ -92,22 +93,56 @@ int64_t verify_request(struct mg_http_message *hm, void **id_key) {
        p += iov[i++].iov_len)
     memcpy(p, iov[i].iov_base, iov[i].iov_len);
 
-  if (!xeddsa_verify(pk_buf, msg_buf, msg_len, (const uint8_t *)sig_buf)) {
-    fprintf(stderr, "[%s:%d] invalid signature\n", __func__, __LINE__);
+  if (!verify_signature(pk_buf, msg_buf, msg_len,
+                        (const uint8_t *)sig_buf)) {
+    log_warn("invalid signature");
     ERR(401);
   }
+  TRACE_END(span, "verify.xeddsa");
 
   if (id_key) {
-    if ((*id_key = malloc(pk_len)) == NULL) {
-      fprintf(stderr, "[%s:%d] out of memory\n", __func__, __LINE__);
+    if ((*id_key = alloc_malloc(ALLOC_HANDLERS, pk_len)) == NULL) {
+      log_error("out of memory");
       ERR(500);
     }
     memcpy(*id_key, pk_buf, pk_len);
   }
 
 err:
-  if (sig_buf) free(sig_buf);
-  if (stmt) sqlite3_finalize(stmt);
-  if (msg_buf) free(msg_buf);
+  if (sig_buf) alloc_free(ALLOC_HANDLERS, sig_buf);
+  if (stmt) db_read_done(stmt);
+  if (msg_buf) alloc_free(ALLOC_HANDLERS, msg_buf);
   return ret;
 }
+
+bool verify_signature(const uint8_t *pk, const uint8_t *msg, size_t msg_len,
+                      const uint8_t *sig) {
+  uint64_t started_at = metrics_now_ns();
+  bool ok = xeddsa_verify(pk, msg, msg_len, sig);
+  metrics_observe(&metrics.xeddsa_verify, metrics_now_ns() - started_at);
+  return ok;
+}
+
+int validate_handle(const char *handle) {
+  if (!handle) return 0;
+
+  size_t len = strlen(handle);
+  if (len < HANDLE_MIN_LENGTH || len > HANDLE_MAX_LENGTH) return 0;
+
+  // Must start with a lowercase letter
+  if (!islower((unsigned char)handle[0])) return 0;
+
+  for (size_t i = 0; i < len; ++i) {
+    char c = handle[i];
+    // Must be lowercase letter, digit, or underscore
+    if (!islower((unsigned char)c) && !isdigit((unsigned char)c) && c != '_')
+      return 0;
+    // No consecutive underscores
+    if (c == '_' && i > 0 && handle[i - 1] == '_') return 0;
+  }
+
+  // Cannot end with underscore
+  if (handle[len - 1] == '_') return 0;
+
+  return 1;
+}
@@ -5,19 +5,158 @@
  * git: https://github.com/thesayyn/protoc-gen-ts */
 import * as pb_1 from "google-protobuf";
 export namespace secret {
+    export class BlobRef extends pb_1.Message {
+        #one_of_decls: number[][] = [];
+        constructor(data?: any[] | {
+            hash: Uint8Array;
+            key: Uint8Array;
+            size: number;
+            chunk_size: number;
+        }) {
+            super();
+            pb_1.Message.initialize(this, Array.isArray(data) ? data : [], 0, -1, [], this.#one_of_decls);
+            if (!Array.isArray(data) && typeof data == "object") {
+                this.hash = data.hash;
+                this.key = data.key;
+                this.size = data.size;
+                this.chunk_size = data.chunk_size;
+            }
+        }
+        get hash() {
+            return pb_1.Message.getField(this, 1) as Uint8Array;
+        }
+        set hash(value: Uint8Array) {
+            pb_1.Message.setField(this, 1, value);
+        }
+        get has_hash() {
+            return pb_1.Message.getField(this, 1) != null;
+        }
+        get key() {
+            return pb_1.Message.getField(this, 2) as Uint8Array;
+        }
+        set key(value: Uint8Array) {
+            pb_1.Message.setField(this, 2, value);
+        }
+        get has_key() {
+            return pb_1.Message.getField(this, 2) != null;
+        }
+        get size() {
+            return pb_1.Message.getField(this, 3) as number;
+        }
+        set size(value: number) {
+            pb_1.Message.setField(this, 3, value);
+        }
+        get has_size() {
+            return pb_1.Message.getField(this, 3) != null;
+        }
+        get chunk_size() {
+            return pb_1.Message.getField(this, 4) as number;
+        }
+        set chunk_size(value: number) {
+            pb_1.Message.setField(this, 4, value);
+        }
+        get has_chunk_size() {
+            return pb_1.Message.getField(this, 4) != null;
+        }
+        static fromObject(data: {
+            hash?: Uint8Array;
+            key?: Uint8Array;
+            size?: number;
+            chunk_size?: number;
+        }): BlobRef {
+            const message = new BlobRef({
+                hash: data.hash,
+                key: data.key,
+                size: data.size,
+                chunk_size: data.chunk_size
+            });
+            return message;
+        }
+        toObject() {
+            const data: {
+                hash?: Uint8Array;
+                key?: Uint8Array;
+                size?: number;
+                chunk_size?: number;
+            } = {};
+            if (this.hash != null) {
+                data.hash = this.hash;
+            }
+            if (this.key != null) {
+                data.key = this.key;
+            }
+            if (this.size != null) {
+                data.size = this.size;
+            }
+            if (this.chunk_size != null) {
+                data.chunk_size = this.chunk_size;
+            }
+            return data;
+        }
+        serialize(): Uint8Array;
+        serialize(w: pb_1.BinaryWriter): void;
+        serialize(w?: pb_1.BinaryWriter): Uint8Array | void {
+            const writer = w || new pb_1.BinaryWriter();
+            if (this.has_hash && this.hash.length)
+                writer.writeBytes(1, this.hash);
+            if (this.has_key && this.key.length)
+                writer.writeBytes(2, this.key);
+            if (this.has_size)
+                writer.writeInt64(3, this.size);
+            if (this.has_chunk_size)
+                writer.writeInt32(4, this.chunk_size);
+            if (!w)
+                return writer.getResultBuffer();
+        }
+        static deserialize(bytes: Uint8Array | pb_1.BinaryReader): BlobRef {
+            const reader = bytes instanceof pb_1.BinaryReader ? bytes : new pb_1.BinaryReader(bytes), message = new BlobRef();
+            while (reader.nextField()) {
+                if (reader.isEndGroup())
+                    break;
+                switch (reader.getFieldNumber()) {
+                    case 1:
+                        message.hash = reader.readBytes();
+                        break;
+                    case 2:
+                        message.key = reader.readBytes();
+                        break;
+                    case 3:
+                        message.size = reader.readInt64();
+                        break;
+                    case 4:
+                        message.chunk_size = reader.readInt32();
+                        break;
+                    default: reader.skipField();
+                }
+            }
+            return message;
+        }
+        serializeBinary(): Uint8Array {
+            return this.serialize();
+        }
+        static deserializeBinary(bytes: Uint8Array): BlobRef {
+            return BlobRef.deserialize(bytes);
+        }
+    }
     export class Attachment extends pb_1.Message {
         #one_of_decls: number[][] = [];
         constructor(data?: any[] | {
             id: number;
             mime_type: string;
-            data: Uint8Array;
+            data?: Uint8Array;
+            blob?: BlobRef;
         }) {
             super();
             pb_1.Message.initialize(this, Array.isArray(data) ? data : [], 0, -1, [], this.#one_of_decls);
             if (!Array.isArray(data) && typeof data == "object") {
                 this.id = data.id;
                 this.mime_type = data.mime_type;
-                this.data = data.data;
+                if ("data" in data && data.data != undefined) {
+                    this.data = data.data;
+                }
+                if ("blob" in data && data.blob != undefined) {
+                    this.blob = data.blob;
+                }
             }
         }
         get id() {
@@ -39,7 +178,7 @@ export namespace secret {
             return pb_1.Message.getField(this, 2) != null;
         }
         get data() {
-            return pb_1.Message.getField(this, 3) as Uint8Array;
+            return pb_1.Message.getFieldWithDefault(this, 3, new Uint8Array(0)) as Uint8Array;
         }
         set data(value: Uint8Array) {
             pb_1.Message.setField(this, 3, value);
@@ -47,16 +186,31 @@ export namespace secret {
         get has_data() {
             return pb_1.Message.getField(this, 3) != null;
         }
+        get blob() {
+            return pb_1.Message.getWrapperField(this, BlobRef, 4) as BlobRef;
+        }
+        set blob(value: BlobRef) {
+            pb_1.Message.setWrapperField(this, 4, value);
+        }
+        get has_blob() {
+            return pb_1.Message.getField(this, 4) != null;
+        }
         static fromObject(data: {
             id?: number;
             mime_type?: string;
             data?: Uint8Array;
+            blob?: ReturnType<typeof BlobRef.prototype.toObject>;
         }): Attachment {
             const message = new Attachment({
                 id: data.id,
-                mime_type: data.mime_type,
-                data: data.data
+                mime_type: data.mime_type
             });
+            if (data.data != null) {
+                message.data = data.data;
+            }
+            if (data.blob != null) {
+                message.blob = BlobRef.fromObject(data.blob);
+            }
             return message;
         }
         toObject() {
@@ -64,6 +218,7 @@ export namespace secret {
                 id?: number;
                 mime_type?: string;
                 data?: Uint8Array;
+                blob?: ReturnType<typeof BlobRef.prototype.toObject>;
             } = {};
             if (this.id != null) {
                 data.id = this.id;
@@ -74,6 +229,9 @@ export namespace secret {
             if (this.data != null) {
                 data.data = this.data;
             }
+            if (this.blob != null) {
+                data.blob = this.blob.toObject();
+            }
             return data;
         }
         serialize(): Uint8Array;
@@ -86,6 +244,8 @@ export namespace secret {
                 writer.writeString(2, this.mime_type);
             if (this.has_data && this.data.length)
                 writer.writeBytes(3, this.data);
+            if (this.has_blob)
+                writer.writeMessage(4, this.blob, () => this.blob.serialize(writer));
             if (!w)
                 return writer.getResultBuffer();
         }
@@ -104,6 +264,9 @@ export namespace secret {
                     case 3:
                         message.data = reader.readBytes();
                         break;
+                    case 4:
+                        reader.readMessage(message.blob, () => message.blob = BlobRef.deserialize(reader));
+                        break;
                     default: reader.skipField();
                 }
             }
@@ -538,6 +538,7 @@ export namespace websocket {
         #one_of_decls: number[][] = [[2, 3]];
         constructor(data?: any[] | ({
             handle: string;
+            body?: Uint8Array;
         } & (({
             pqxdh_init?: PQXDHInit;
             message?: never;
@@ -555,6 +556,9 @@ export namespace websocket {
                 if ("message" in data && data.message != undefined) {
                     this.message = data.message;
                 }
+                if ("body" in data && data.body != undefined) {
+                    this.body = data.body;
+                }
             }
         }
         get handle() {
@@ -584,6 +588,15 @@ export namespace websocket {
         get has_message() {
             return pb_1.Message.getField(this, 3) != null;
         }
+        get body() {
+            return pb_1.Message.getFieldWithDefault(this, 4, new Uint8Array(0)) as Uint8Array;
+        }
+        set body(value: Uint8Array) {
+            pb_1.Message.setField(this, 4, value);
+        }
+        get has_body() {
+            return pb_1.Message.getField(this, 4) != null;
+        }
         get payload() {
             const cases: {
                 [index: number]: "none" | "pqxdh_init" | "message";
@@ -598,6 +611,7 @@ export namespace websocket {
             handle?: string;
             pqxdh_init?: ReturnType<typeof PQXDHInit.prototype.toObject>;
             message?: ReturnType<typeof EncryptedMessage.prototype.toObject>;
+            body?: Uint8Array;
         }): Forward {
             const message = new Forward({
                 handle: data.handle
@@ -608,6 +622,9 @@ export namespace websocket {
             if (data.message != null) {
                 message.message = EncryptedMessage.fromObject(data.message);
             }
+            if (data.body != null) {
+                message.body = data.body;
+            }
             return message;
         }
         toObject() {
@@ -615,6 +632,7 @@ export namespace websocket {
                 handle?: string;
                 pqxdh_init?: ReturnType<typeof PQXDHInit.prototype.toObject>;
                 message?: ReturnType<typeof EncryptedMessage.prototype.toObject>;
+                body?: Uint8Array;
             } = {};
             if (this.handle != null) {
                 data.handle = this.handle;
@@ -625,6 +643,9 @@ export namespace websocket {
             if (this.message != null) {
                 data.message = this.message.toObject();
             }
+            if (this.body != null) {
+                data.body = this.body;
+            }
             return data;
         }
         serialize(): Uint8Array;
@@ -637,6 +658,8 @@ export namespace websocket {
                 writer.writeMessage(2, this.pqxdh_init, () => this.pqxdh_init.serialize(writer));
             if (this.has_message)
                 writer.writeMessage(3, this.message, () => this.message.serialize(writer));
+            if (this.has_body && this.body.length)
+                writer.writeBytes(4, this.body);
             if (!w)
                 return writer.getResultBuffer();
         }
@@ -655,6 +678,9 @@ export namespace websocket {
                     case 3:
                         reader.readMessage(message.message, () => message.message = EncryptedMessage.deserialize(reader));
                         break;
+                    case 4:
+                        message.body = reader.readBytes();
+                        break;
                     default: reader.skipField();
                 }
             }
@@ -667,19 +693,177 @@ export namespace websocket {
             return Forward.deserialize(bytes);
         }
     }
+    export class MultiForward extends pb_1.Message {
+        #one_of_decls: number[][] = [];
+        constructor(data?: any[] | {
+            recipients: Forward[];
+            body: Uint8Array;
+        }) {
+            super();
+            pb_1.Message.initialize(this, Array.isArray(data) ? data : [], 0, -1, [1], this.#one_of_decls);
+            if (!Array.isArray(data) && typeof data == "object") {
+                this.recipients = data.recipients;
+                this.body = data.body;
+            }
+        }
+        get recipients() {
+            return pb_1.Message.getRepeatedWrapperField(this, Forward, 1) as Forward[];
+        }
+        set recipients(value: Forward[]) {
+            pb_1.Message.setRepeatedWrapperField(this, 1, value);
+        }
+        get body() {
+            return pb_1.Message.getField(this, 2) as Uint8Array;
+        }
+        set body(value: Uint8Array) {
+            pb_1.Message.setField(this, 2, value);
+        }
+        get has_body() {
+            return pb_1.Message.getField(this, 2) != null;
+        }
+        static fromObject(data: {
+            recipients?: ReturnType<typeof Forward.prototype.toObject>[];
+            body?: Uint8Array;
+        }): MultiForward {
+            const message = new MultiForward({
+                recipients: data.recipients.map(item => Forward.fromObject(item)),
+                body: data.body
+            });
+            return message;
+        }
+        toObject() {
+            const data: {
+                recipients?: ReturnType<typeof Forward.prototype.toObject>[];
+                body?: Uint8Array;
+            } = {};
+            if (this.recipients != null) {
+                data.recipients = this.recipients.map((item: Forward) => item.toObject());
+            }
+            if (this.body != null) {
+                data.body = this.body;
+            }
+            return data;
+        }
+        serialize(): Uint8Array;
+        serialize(w: pb_1.BinaryWriter): void;
+        serialize(w?: pb_1.BinaryWriter): Uint8Array | void {
+            const writer = w || new pb_1.BinaryWriter();
+            if (this.recipients.length)
+                writer.writeRepeatedMessage(1, this.recipients, (item: Forward) => item.serialize(writer));
+            if (this.has_body && this.body.length)
+                writer.writeBytes(2, this.body);
+            if (!w)
+                return writer.getResultBuffer();
+        }
+        static deserialize(bytes: Uint8Array | pb_1.BinaryReader): MultiForward {
+            const reader = bytes instanceof pb_1.BinaryReader ? bytes : new pb_1.BinaryReader(bytes), message = new MultiForward();
+            while (reader.nextField()) {
+                if (reader.isEndGroup())
+                    break;
+                switch (reader.getFieldNumber()) {
+                    case 1:
+                        reader.readMessage(message.recipients, () => pb_1.Message.addToRepeatedWrapperField(message, 1, Forward.deserialize(reader), Forward));
+                        break;
+                    case 2:
+                        message.body = reader.readBytes();
+                        break;
+                    default: reader.skipField();
+                }
+            }
+            return message;
+        }
+        serializeBinary(): Uint8Array {
+            return this.serialize();
+        }
+        static deserializeBinary(bytes: Uint8Array): MultiForward {
+            return MultiForward.deserialize(bytes);
+        }
+    }
+    export class Batch extends pb_1.Message {
+        #one_of_decls: number[][] = [];
+        constructor(data?: any[] | {
+            forwards: Forward[];
+        }) {
+            super();
+            pb_1.Message.initialize(this, Array.isArray(data) ? data : [], 0, -1, [1], this.#one_of_decls);
+            if (!Array.isArray(data) && typeof data == "object") {
+                this.forwards = data.forwards;
+            }
+        }
+        get forwards() {
+            return pb_1.Message.getRepeatedWrapperField(this, Forward, 1) as Forward[];
+        }
+        set forwards(value: Forward[]) {
+            pb_1.Message.setRepeatedWrapperField(this, 1, value);
+        }
+        static fromObject(data: {
+            forwards?: ReturnType<typeof Forward.prototype.toObject>[];
+        }): Batch {
+            const message = new Batch({
+                forwards: data.forwards.map(item => Forward.fromObject(item))
+            });
+            return message;
+        }
+        toObject() {
+            const data: {
+                forwards?: ReturnType<typeof Forward.prototype.toObject>[];
+            } = {};
+            if (this.forwards != null) {
+                data.forwards = this.forwards.map((item: Forward) => item.toObject());
+            }
+            return data;
+        }
+        serialize(): Uint8Array;
+        serialize(w: pb_1.BinaryWriter): void;
+        serialize(w?: pb_1.BinaryWriter): Uint8Array | void {
+            const writer = w || new pb_1.BinaryWriter();
+            if (this.forwards.length)
+                writer.writeRepeatedMessage(1, this.forwards, (item: Forward) => item.serialize(writer));
+            if (!w)
+                return writer.getResultBuffer();
+        }
+        static deserialize(bytes: Uint8Array | pb_1.BinaryReader): Batch {
+            const reader = bytes instanceof pb_1.BinaryReader ? bytes : new pb_1.BinaryReader(bytes), message = new Batch();
+            while (reader.nextField()) {
+                if (reader.isEndGroup())
+                    break;
+                switch (reader.getFieldNumber()) {
+                    case 1:
+                        reader.readMessage(message.forwards, () => pb_1.Message.addToRepeatedWrapperField(message, 1, Forward.deserialize(reader), Forward));
+                        break;
+                    default: reader.skipField();
+                }
+            }
+            return message;
+        }
+        serializeBinary(): Uint8Array {
+            return this.serialize();
+        }
+        static deserializeBinary(bytes: Uint8Array): Batch {
+            return Batch.deserialize(bytes);
+        }
+    }
     export class Ack extends pb_1.Message {
         #one_of_decls: number[][] = [];
         constructor(data?: any[] | {
             message_id: number;
             error?: Ack.Error;
+            recipient_errors: RecipientError[];
+            last_message_id?: number;
+            message_errors: MessageError[];
         }) {
             super();
-            pb_1.Message.initialize(this, Array.isArray(data) ? data : [], 0, -1, [], this.#one_of_decls);
+            pb_1.Message.initialize(this, Array.isArray(data) ? data : [], 0, -1, [3, 5], this.#one_of_decls);
             if (!Array.isArray(data) && typeof data == "object") {
                 this.message_id = data.message_id;
                 if ("error" in data && data.error != undefined) {
                     this.error = data.error;
                 }
+                this.recipient_errors = data.recipient_errors;
+                if ("last_message_id" in data && data.last_message_id != undefined) {
+                    this.last_message_id = data.last_message_id;
+                }
+                this.message_errors = data.message_errors;
             }
         }
         get message_id() {
@@ -700,22 +884,54 @@ export namespace websocket {
         get has_error() {
             return pb_1.Message.getField(this, 2) != null;
         }
+        get recipient_errors() {
+            return pb_1.Message.getRepeatedWrapperField(this, RecipientError, 3) as RecipientError[];
+        }
+        set recipient_errors(value: RecipientError[]) {
+            pb_1.Message.setRepeatedWrapperField(this, 3, value);
+        }
+        get last_message_id() {
+            return pb_1.Message.getFieldWithDefault(this, 4, 0) as number;
+        }
+        set last_message_id(value: number) {
+            pb_1.Message.setField(this, 4, value);
+        }
+        get has_last_message_id() {
+            return pb_1.Message.getField(this, 4) != null;
+        }
+        get message_errors() {
+            return pb_1.Message.getRepeatedWrapperField(this, MessageError, 5) as MessageError[];
+        }
+        set message_errors(value: MessageError[]) {
+            pb_1.Message.setRepeatedWrapperField(this, 5, value);
+        }
         static fromObject(data: {
             message_id?: number;
             error?: Ack.Error;
+            recipient_errors?: ReturnType<typeof RecipientError.prototype.toObject>[];
+            last_message_id?: number;
+            message_errors?: ReturnType<typeof MessageError.prototype.toObject>[];
         }): Ack {
             const message = new Ack({
-                message_id: data.message_id
+                message_id: data.message_id,
+                recipient_errors: data.recipient_errors.map(item => RecipientError.fromObject(item)),
+                message_errors: data.message_errors.map(item => MessageError.fromObject(item))
             });
             if (data.error != null) {
                 message.error = data.error;
             }
+            if (data.last_message_id != null) {
+                message.last_message_id = data.last_message_id;
+            }
             return message;
         }
         toObject() {
             const data: {
                 message_id?: number;
                 error?: Ack.Error;
+                recipient_errors?: ReturnType<typeof RecipientError.prototype.toObject>[];
+                last_message_id?: number;
+                message_errors?: ReturnType<typeof MessageError.prototype.toObject>[];
             } = {};
             if (this.message_id != null) {
                 data.message_id = this.message_id;
@@ -723,6 +939,15 @@ export namespace websocket {
             if (this.error != null) {
                 data.error = this.error;
             }
+            if (this.recipient_errors != null) {
+                data.recipient_errors = this.recipient_errors.map((item: RecipientError) => item.toObject());
+            }
+            if (this.last_message_id != null) {
+                data.last_message_id = this.last_message_id;
+            }
+            if (this.message_errors != null) {
+                data.message_errors = this.message_errors.map((item: MessageError) => item.toObject());
+            }
             return data;
         }
         serialize(): Uint8Array;
@@ -733,6 +958,12 @@ export namespace websocket {
                 writer.writeInt64(1, this.message_id);
             if (this.has_error)
                 writer.writeEnum(2, this.error);
+            if (this.recipient_errors.length)
+                writer.writeRepeatedMessage(3, this.recipient_errors, (item: RecipientError) => item.serialize(writer));
+            if (this.has_last_message_id)
+                writer.writeInt64(4, this.last_message_id);
+            if (this.message_errors.length)
+                writer.writeRepeatedMessage(5, this.message_errors, (item: MessageError) => item.serialize(writer));
             if (!w)
                 return writer.getResultBuffer();
         }
@@ -748,6 +979,15 @@ export namespace websocket {
                     case 2:
                         message.error = reader.readEnum();
                         break;
+                    case 3:
+                        reader.readMessage(message.recipient_errors, () => pb_1.Message.addToRepeatedWrapperField(message, 3, RecipientError.deserialize(reader), RecipientError));
+                        break;
+                    case 4:
+                        message.last_message_id = reader.readInt64();
+                        break;
+                    case 5:
+                        reader.readMessage(message.message_errors, () => pb_1.Message.addToRepeatedWrapperField(message, 5, MessageError.deserialize(reader), MessageError));
+                        break;
                     default: reader.skipField();
                 }
             }
@@ -766,7 +1006,186 @@ export namespace websocket {
             INVALID_SIGNATURE = 1,
             SERVER_ERROR = 2,
             UNKNOWN_IDENTITY = 3,
-            INVALID_MESSAGE = 4
+            INVALID_MESSAGE = 4,
+            RECIPIENT_QUEUE_FULL = 5
+        }
+    }
+    export class RecipientError extends pb_1.Message {
+        #one_of_decls: number[][] = [];
+        constructor(data?: any[] | {
+            index: number;
+            error: Ack.Error;
+        }) {
+            super();
+            pb_1.Message.initialize(this, Array.isArray(data) ? data : [], 0, -1, [], this.#one_of_decls);
+            if (!Array.isArray(data) && typeof data == "object") {
+                this.index = data.index;
+                this.error = data.error;
+            }
+        }
+        get index() {
+            return pb_1.Message.getField(this, 1) as number;
+        }
+        set index(value: number) {
+            pb_1.Message.setField(this, 1, value);
+        }
+        get has_index() {
+            return pb_1.Message.getField(this, 1) != null;
+        }
+        get error() {
+            return pb_1.Message.getField(this, 2) as Ack.Error;
+        }
+        set error(value: Ack.Error) {
+            pb_1.Message.setField(this, 2, value);
+        }
+        get has_error() {
+            return pb_1.Message.getField(this, 2) != null;
+        }
+        static fromObject(data: {
+            index?: number;
+            error?: Ack.Error;
+        }): RecipientError {
+            const message = new RecipientError({
+                index: data.index,
+                error: data.error
+            });
+            return message;
+        }
+        toObject() {
+            const data: {
+                index?: number;
+                error?: Ack.Error;
+            } = {};
+            if (this.index != null) {
+                data.index = this.index;
+            }
+            if (this.error != null) {
+                data.error = this.error;
+            }
+            return data;
+        }
+        serialize(): Uint8Array;
+        serialize(w: pb_1.BinaryWriter): void;
+        serialize(w?: pb_1.BinaryWriter): Uint8Array | void {
+            const writer = w || new pb_1.BinaryWriter();
+            if (this.has_index)
+                writer.writeUint32(1, this.index);
+            if (this.has_error)
+                writer.writeEnum(2, this.error);
+            if (!w)
+                return writer.getResultBuffer();
+        }
+        static deserialize(bytes: Uint8Array | pb_1.BinaryReader): RecipientError {
+            const reader = bytes instanceof pb_1.BinaryReader ? bytes : new pb_1.BinaryReader(bytes), message = new RecipientError();
+            while (reader.nextField()) {
+                if (reader.isEndGroup())
+                    break;
+                switch (reader.getFieldNumber()) {
+                    case 1:
+                        message.index = reader.readUint32();
+                        break;
+                    case 2:
+                        message.error = reader.readEnum();
+                        break;
+                    default: reader.skipField();
+                }
+            }
+            return message;
+        }
+        serializeBinary(): Uint8Array {
+            return this.serialize();
+        }
+        static deserializeBinary(bytes: Uint8Array): RecipientError {
+            return RecipientError.deserialize(bytes);
+        }
+    }
+    export class MessageError extends pb_1.Message {
+        #one_of_decls: number[][] = [];
+        constructor(data?: any[] | {
+            message_id: number;
+            error: Ack.Error;
+        }) {
+            super();
+            pb_1.Message.initialize(this, Array.isArray(data) ? data : [], 0, -1, [], this.#one_of_decls);
+            if (!Array.isArray(data) && typeof data == "object") {
+                this.message_id = data.message_id;
+                this.error = data.error;
+            }
+        }
+        get message_id() {
+            return pb_1.Message.getField(this, 1) as number;
+        }
+        set message_id(value: number) {
+            pb_1.Message.setField(this, 1, value);
+        }
+        get has_message_id() {
+            return pb_1.Message.getField(this, 1) != null;
+        }
+        get error() {
+            return pb_1.Message.getField(this, 2) as Ack.Error;
+        }
+        set error(value: Ack.Error) {
+            pb_1.Message.setField(this, 2, value);
+        }
+        get has_error() {
+            return pb_1.Message.getField(this, 2) != null;
+        }
+        static fromObject(data: {
+            message_id?: number;
+            error?: Ack.Error;
+        }): MessageError {
+            const message = new MessageError({
+                message_id: data.message_id,
+                error: data.error
+            });
+            return message;
+        }
+        toObject() {
+            const data: {
+                message_id?: number;
+                error?: Ack.Error;
+            } = {};
+            if (this.message_id != null) {
+                data.message_id = this.message_id;
+            }
+            if (this.error != null) {
+                data.error = this.error;
+            }
+            return data;
+        }
+        serialize(): Uint8Array;
+        serialize(w: pb_1.BinaryWriter): void;
+        serialize(w?: pb_1.BinaryWriter): Uint8Array | void {
+            const writer = w || new pb_1.BinaryWriter();
+            if (this.has_message_id)
+                writer.writeInt64(1, this.message_id);
+            if (this.has_error)
+                writer.writeEnum(2, this.error);
+            if (!w)
+                return writer.getResultBuffer();
+        }
+        static deserialize(bytes: Uint8Array | pb_1.BinaryReader): MessageError {
+            const reader = bytes instanceof pb_1.BinaryReader ? bytes : new pb_1.BinaryReader(bytes), message = new MessageError();
+            while (reader.nextField()) {
+                if (reader.isEndGroup())
+                    break;
+                switch (reader.getFieldNumber()) {
+                    case 1:
+                        message.message_id = reader.readInt64();
+                        break;
+                    case 2:
+                        message.error = reader.readEnum();
+                        break;
+                    default: reader.skipField();
+                }
+            }
+            return message;
+        }
+        serializeBinary(): Uint8Array {
+            return this.serialize();
+        }
+        static deserializeBinary(bytes: Uint8Array): MessageError {
+            return MessageError.deserialize(bytes);
         }
     }
     export class LowOnKeys extends pb_1.Message {
@@ -985,15 +1404,29 @@ export namespace websocket {
         }
     }
     export class ServerboundMessage extends pb_1.Message {
-        #one_of_decls: number[][] = [[2, 3]];
+        #one_of_decls: number[][] = [[2, 3, 4, 5]];
         constructor(data?: any[] | ({
             id: number;
         } & (({
             challenge_response?: ChallengeResponse;
             forward?: never;
+            multi_forward?: never;
+            batch?: never;
         } | {
             challenge_response?: never;
             forward?: Forward;
+            multi_forward?: never;
+            batch?: never;
+        } | {
+            challenge_response?: never;
+            forward?: never;
+            multi_forward?: MultiForward;
+            batch?: never;
+        } | {
+            challenge_response?: never;
+            forward?: never;
+            multi_forward?: never;
+            batch?: Batch;
         })))) {
             super();
             pb_1.Message.initialize(this, Array.isArray(data) ? data : [], 0, -1, [], this.#one_of_decls);
@@ -1005,6 +1438,12 @@ export namespace websocket {
                 if ("forward" in data && data.forward != undefined) {
                     this.forward = data.forward;
                 }
+                if ("multi_forward" in data && data.multi_forward != undefined) {
+                    this.multi_forward = data.multi_forward;
+                }
+                if ("batch" in data && data.batch != undefined) {
+                    this.batch = data.batch;
+                }
             }
         }
         get id() {
@@ -1034,20 +1473,42 @@ export namespace websocket {
         get has_forward() {
             return pb_1.Message.getField(this, 3) != null;
         }
+        get multi_forward() {
+            return pb_1.Message.getWrapperField(this, MultiForward, 4) as MultiForward;
+        }
+        set multi_forward(value: MultiForward) {
+            pb_1.Message.setOneofWrapperField(this, 4, this.#one_of_decls[0], value);
+        }
+        get has_multi_forward() {
+            return pb_1.Message.getField(this, 4) != null;
+        }
+        get batch() {
+            return pb_1.Message.getWrapperField(this, Batch, 5) as Batch;
+        }
+        set batch(value: Batch) {
+            pb_1.Message.setOneofWrapperField(this, 5, this.#one_of_decls[0], value);
+        }
+        get has_batch() {
+            return pb_1.Message.getField(this, 5) != null;
+        }
         get payload() {
             const cases: {
-                [index: number]: "none" | "challenge_response" | "forward";
+                [index: number]: "none" | "challenge_response" | "forward" | "multi_forward" | "batch";
             } = {
                 0: "none",
                 2: "challenge_response",
-                3: "forward"
+                3: "forward",
+                4: "multi_forward",
+                5: "batch"
             };
-            return cases[pb_1.Message.computeOneofCase(this, [2, 3])];
+            return cases[pb_1.Message.computeOneofCase(this, [2, 3, 4, 5])];
         }
         static fromObject(data: {
             id?: number;
             challenge_response?: ReturnType<typeof ChallengeResponse.prototype.toObject>;
             forward?: ReturnType<typeof Forward.prototype.toObject>;
+            multi_forward?: ReturnType<typeof MultiForward.prototype.toObject>;
+            batch?: ReturnType<typeof Batch.prototype.toObject>;
         }): ServerboundMessage {
             const message = new ServerboundMessage({
                 id: data.id
@@ -1058,6 +1519,12 @@ export namespace websocket {
             if (data.forward != null) {
                 message.forward = Forward.fromObject(data.forward);
             }
+            if (data.multi_forward != null) {
+                message.multi_forward = MultiForward.fromObject(data.multi_forward);
+            }
+            if (data.batch != null) {
+                message.batch = Batch.fromObject(data.batch);
+            }
             return message;
         }
         toObject() {
@@ -1065,6 +1532,8 @@ export namespace websocket {
                 id?: number;
                 challenge_response?: ReturnType<typeof ChallengeResponse.prototype.toObject>;
                 forward?: ReturnType<typeof Forward.prototype.toObject>;
+                multi_forward?: ReturnType<typeof MultiForward.prototype.toObject>;
+                batch?: ReturnType<typeof Batch.prototype.toObject>;
             } = {};
             if (this.id != null) {
                 data.id = this.id;
@@ -1075,6 +1544,12 @@ export namespace websocket {
             if (this.forward != null) {
                 data.forward = this.forward.toObject();
             }
+            if (this.multi_forward != null) {
+                data.multi_forward = this.multi_forward.toObject();
+            }
+            if (this.batch != null) {
+                data.batch = this.batch.toObject();
+            }
             return data;
         }
         serialize(): Uint8Array;
@@ -1087,6 +1562,10 @@ export namespace websocket {
                 writer.writeMessage(2, this.challenge_response, () => this.challenge_response.serialize(writer));
             if (this.has_forward)
                 writer.writeMessage(3, this.forward, () => this.forward.serialize(writer));
+            if (this.has_multi_forward)
+                writer.writeMessage(4, this.multi_forward, () => this.multi_forward.serialize(writer));
+            if (this.has_batch)
+                writer.writeMessage(5, this.batch, () => this.batch.serialize(writer));
             if (!w)
                 return writer.getResultBuffer();
         }
@@ -1105,6 +1584,12 @@ export namespace websocket {
                     case 3:
                         reader.readMessage(message.forward, () => message.forward = Forward.deserialize(reader));
                         break;
+                    case 4:
+                        reader.readMessage(message.multi_forward, () => message.multi_forward = MultiForward.deserialize(reader));
+                        break;
+                    case 5:
+                        reader.readMessage(message.batch, () => message.batch = Batch.deserialize(reader));
+                        break;
                     default: reader.skipField();
                 }
             }
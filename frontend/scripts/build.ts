@@ -2,7 +2,7 @@ import tailwind from 'bun-plugin-tailwind';
 import path from 'node:path';
 
 const result = await Bun.build({
-  entrypoints: ['src/index.html', 'src/sw.ts'],
+  entrypoints: ['src/index.html', 'src/sw.ts', 'src/keygen-worker.ts', 'src/receive-worker.ts'],
   define: {
     PUBLIC_KEY: (await Bun.file(path.join(__dirname, '../..', 'public.pem')).text())
       .replace(/-----BEGIN PUBLIC KEY-----/, '')
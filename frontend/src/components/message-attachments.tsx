@@ -0,0 +1,98 @@
+import { Paperclip } from 'lucide-react';
+import { useEffect, useRef, useState } from 'react';
+import { downloadBlobPieces } from '~/lib/blobs';
+import { db, type Attachment, type Message } from '~/lib/db';
+
+interface LoadedAttachment {
+  id: number;
+  mime_type: string;
+  url: string;
+}
+
+interface MessageAttachmentsProps {
+  message: Message;
+}
+
+// Attachments stored out of band are downloaded the first time they're shown
+// and kept, so they outlive the copy on the server. They come in a piece at a
+// time, each handed over to a Blob before the next one is fetched.
+async function loadData(row: Attachment) {
+  if (row.data) return row.data;
+  if (!row.blob) return null;
+  try {
+    let data = new Blob([], { type: row.mime_type });
+    for await (const piece of downloadBlobPieces(row.blob)) {
+      data = new Blob([data, piece], { type: row.mime_type });
+    }
+    await db.attachments.where({ id: row.id, sender: row.sender, message_id: row.message_id }).modify({ data });
+    return data;
+  } catch (error) {
+    console.error('Failed to download attachment', error);
+    return null;
+  }
+}
+
+/**
+ * A message's attachments, read from the database and turned into object URLs
+ * only once the bubble scrolls into view. The URLs are revoked on unmount.
+ */
+export function MessageAttachments({ message }: MessageAttachmentsProps) {
+  const ref = useRef<HTMLDivElement>(null);
+  const [visible, setVisible] = useState(false);
+  const [attachments, setAttachments] = useState<LoadedAttachment[]>([]);
+
+  useEffect(() => {
+    const el = ref.current;
+    if (!el || visible) return;
+
+    const observer = new IntersectionObserver(entries => {
+      if (entries.some(entry => entry.isIntersecting)) setVisible(true);
+    });
+    observer.observe(el);
+    return () => observer.disconnect();
+  }, [visible]);
+
+  useEffect(() => {
+    if (!visible) return;
+
+    let cancelled = false;
+    let loaded: LoadedAttachment[] = [];
+    (async () => {
+      const rows = await db.attachments.where({ sender: message.sender, message_id: message.id }).toArray();
+      const contents = await Promise.all(rows.map(loadData));
+      if (cancelled) return;
+      loaded = rows.flatMap((row, i) => {
+        const data = contents[i];
+        if (!data) return [];
+        const url = URL.createObjectURL(new Blob([data], { type: row.mime_type }));
+        return [{ id: row.id, mime_type: row.mime_type, url }];
+      });
+      setAttachments(loaded);
+    })();
+
+    return () => {
+      cancelled = true;
+      loaded.forEach(attachment => URL.revokeObjectURL(attachment.url));
+    };
+  }, [visible, message.sender, message.id]);
+
+  return (
+    <div ref={ref} className="flex min-h-px flex-col gap-1">
+      {attachments.map(attachment =>
+        attachment.mime_type.startsWith('image/') ? (
+          <img key={attachment.id} src={attachment.url} alt="" className="max-h-80 rounded-md object-contain" />
+        ) : (
+          <a
+            key={attachment.id}
+            href={attachment.url}
+            download
+            className="flex items-center gap-1.5 text-xs underline underline-offset-2"
+          >
+            <Paperclip className="size-3" />
+            {attachment.mime_type}
+          </a>
+        )
+      )}
+    </div>
+  );
+}
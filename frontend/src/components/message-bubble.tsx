@@ -2,6 +2,7 @@ import { CornerDownLeft } from 'lucide-react';
 import Markdown from 'react-markdown';
 import type { Message } from '~/lib/db';
 import { cn } from '~/lib/utils';
+import { MessageAttachments } from '~/components/message-attachments';
 
 function formatTime(timestamp: number): string {
   const date = new Date(timestamp);
@@ -75,6 +76,7 @@ export function MessageBubble({
           )}
         >
           <div className="px-3 py-2">
+            <MessageAttachments message={message} />
             <div className={cn('prose prose-sm max-w-none', isOwn ? '' : 'prose-invert')}>
               <Markdown>{message.text}</Markdown>
             </div>
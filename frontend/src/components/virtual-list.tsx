@@ -0,0 +1,185 @@
+import {
+  useCallback,
+  useEffect,
+  useImperativeHandle,
+  useLayoutEffect,
+  useMemo,
+  useReducer,
+  useRef,
+  useState,
+  type Key,
+  type ReactNode,
+  type Ref
+} from 'react';
+import { cn } from '~/lib/utils';
+
+const OVERSCAN_PX = 600;
+const TOP_THRESHOLD_PX = 200;
+const BOTTOM_SLACK_PX = 32;
+
+export interface VirtualListHandle {
+  // false if no item has that key
+  scrollToKey(key: Key): boolean;
+}
+
+interface VirtualListProps<T> {
+  ref?: Ref<VirtualListHandle>;
+  items: T[];
+  getKey: (item: T) => Key;
+  renderItem: (item: T) => ReactNode;
+  estimateHeight: number;
+  // space below each item, part of its measured height
+  gap?: number;
+  // called when scrolled near the top, to load earlier items
+  onReachTop?: () => void;
+  className?: string;
+  innerClassName?: string;
+}
+
+// Index of the last offset <= target
+function search(offsets: number[], target: number) {
+  let lo = 0;
+  let hi = offsets.length - 1;
+  while (lo < hi) {
+    const mid = (lo + hi + 1) >> 1;
+    if (offsets[mid]! <= target) lo = mid;
+    else hi = mid - 1;
+  }
+  return lo;
+}
+
+/**
+ * A chat-style scroller that only mounts the items near the viewport. Item
+ * heights are measured as they render, starting from estimateHeight. It
+ * sticks to the bottom while the user is there, and keeps the visible items
+ * in place when items are prepended or resized above them.
+ */
+export function VirtualList<T>({
+  ref,
+  items,
+  getKey,
+  renderItem,
+  estimateHeight,
+  gap = 0,
+  onReachTop,
+  className,
+  innerClassName
+}: VirtualListProps<T>) {
+  const scrollerRef = useRef<HTMLDivElement>(null);
+  // measured heights by String(key), which is what data-key holds
+  const heights = useRef(new Map<string, number>());
+  const [, remeasured] = useReducer((n: number) => n + 1, 0);
+  const [scrollTop, setScrollTop] = useState(0);
+  const [viewportHeight, setViewportHeight] = useState(0);
+  const atBottom = useRef(true);
+  // the first visible item and where it was, to keep it in place
+  const anchor = useRef<{ key: Key; offset: number } | null>(null);
+
+  const keys = useMemo(() => items.map(getKey), [items, getKey]);
+
+  const offsets: number[] = [];
+  let total = 0;
+  for (const key of keys) {
+    offsets.push(total);
+    total += heights.current.get(String(key)) ?? estimateHeight + gap;
+  }
+
+  const start = items.length ? search(offsets, Math.max(0, scrollTop - OVERSCAN_PX)) : 0;
+  const end = items.length ? search(offsets, scrollTop + viewportHeight + OVERSCAN_PX) + 1 : 0;
+
+  const observer = useMemo(
+    () =>
+      new ResizeObserver(entries => {
+        let changed = false;
+        for (const entry of entries) {
+          const key = (entry.target as HTMLElement).dataset.key!;
+          const height = entry.borderBoxSize[0]?.blockSize ?? (entry.target as HTMLElement).offsetHeight;
+          if (heights.current.get(key) !== height) {
+            heights.current.set(key, height);
+            changed = true;
+          }
+        }
+        if (changed) remeasured();
+      }),
+    []
+  );
+
+  useEffect(() => () => observer.disconnect(), [observer]);
+
+  useEffect(() => {
+    const scroller = scrollerRef.current!;
+    const resize = new ResizeObserver(() => setViewportHeight(scroller.clientHeight));
+    resize.observe(scroller);
+    return () => resize.disconnect();
+  }, []);
+
+  const measure = useCallback(
+    (el: HTMLDivElement | null) => {
+      if (!el) return;
+      observer.observe(el);
+      return () => observer.unobserve(el);
+    },
+    [observer]
+  );
+
+  // Runs after every render: pin to the bottom, or keep the anchor still
+  useLayoutEffect(() => {
+    const scroller = scrollerRef.current!;
+    if (atBottom.current) {
+      scroller.scrollTop = scroller.scrollHeight;
+    } else if (anchor.current) {
+      const index = keys.indexOf(anchor.current.key);
+      if (index !== -1 && offsets[index] !== anchor.current.offset) {
+        scroller.scrollTop += offsets[index]! - anchor.current.offset;
+      }
+    }
+
+    const first = items.length ? search(offsets, scroller.scrollTop) : -1;
+    anchor.current = first === -1 ? null : { key: keys[first]!, offset: offsets[first]! };
+  });
+
+  const onScroll = useCallback(() => {
+    const scroller = scrollerRef.current!;
+    atBottom.current = scroller.scrollHeight - scroller.scrollTop - scroller.clientHeight < BOTTOM_SLACK_PX;
+    setScrollTop(scroller.scrollTop);
+    if (scroller.scrollTop < TOP_THRESHOLD_PX) onReachTop?.();
+  }, [onReachTop]);
+
+  const offsetsRef = useRef(offsets);
+  offsetsRef.current = offsets;
+
+  useImperativeHandle(
+    ref,
+    () => ({
+      scrollToKey(key) {
+        const index = keys.indexOf(key);
+        const scroller = scrollerRef.current;
+        if (index === -1 || !scroller) return false;
+        scroller.scrollTo({
+          top: offsetsRef.current[index]! - scroller.clientHeight / 2,
+          behavior: 'smooth'
+        });
+        return true;
+      }
+    }),
+    [keys]
+  );
+
+  return (
+    <div ref={scrollerRef} onScroll={onScroll} className={cn('overflow-y-auto', className)}>
+      <div
+        className={innerClassName}
+        style={{ paddingTop: offsets[start] ?? 0, paddingBottom: total - (offsets[end] ?? total) }}
+      >
+        {items.slice(start, end).map((item, i) => {
+          const key = keys[start + i]!;
+          return (
+            <div key={key} ref={measure} data-key={String(key)} style={{ paddingBottom: gap }}>
+              {renderItem(item)}
+            </div>
+          );
+        })}
+      </div>
+    </div>
+  );
+}
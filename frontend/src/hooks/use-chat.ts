@@ -1,23 +1,41 @@
+import { Dexie } from 'dexie';
 import { useLiveQuery } from 'dexie-react-hooks';
-import { messages as messages_proto } from 'generated/messages';
 import { secret } from 'generated/secret';
 import { websocket } from 'generated/websocket';
 import { err, ok, type Result } from 'neverthrow';
 import { useCallback, useEffect, useMemo, useRef, useState } from 'react';
 import { toast } from 'sonner';
 import { useLocation } from 'wouter';
-import { API_BASE_URL, fetchKeyBundle, patchIdentity } from '~/lib/api';
+import { API_BASE_URL, fetchKeyBundle, genOneTimePrekeys, genSignedPrekeys, patchIdentity } from '~/lib/api';
 import { randomBytes, xeddsa_sign } from '~/lib/crypto';
-import { db, type Message, type PqkemPreKey } from '~/lib/db';
-import { genCurveKeyPair, genPqkemKeyPair, recvMessage, sendMessage } from '~/lib/protocol';
-import { eq, type EnhancedOmit } from '~/lib/utils';
+import { bumpConversation, db, markConversationRead, refreshConversation, type Message } from '~/lib/db';
+import { sendMessage } from '~/lib/protocol';
+import type { ReceiveBatchResult } from '~/lib/receive';
+import { createReceivePipeline } from '~/lib/receive-pipeline';
+import { eq } from '~/lib/utils';
 
 type Identity = { handle: string; sigKey: Uint8Array };
+type Contact = { handle: string; unread: number; lastMessage: { sender: string; text: string } | null };
+
+const PAGE_SIZE = 50;
+
+// A conversation's messages in id order, optionally from a given id on
+function conversationRange(peer: string, from: Message['id'] | null = null) {
+  return db.messages
+    .where('[peer+id]')
+    .between([peer, from ?? Dexie.minKey], [peer, Dexie.maxKey], true, true);
+}
+
+// ClientboundMessage.forward, field 2 with wire type 2
+const FORWARD_TAG = (2 << 3) | 2;
+// the server takes at most this many forwards per batch
+const BATCH_MAX_FORWARDS = 1024;
 
 export function useChat() {
   const [, navigate] = useLocation();
   const wsRef = useRef<WebSocket | null>(null);
   const wsMsgIdRef = useRef(0);
+  const acksRef = useRef(new Map<number, (error: websocket.Ack.Error | null) => void>());
 
   const [status, setStatus] = useState<Result<string, string> | null>();
   const [identity, setIdentity] = useState<Identity>(null!);
@@ -38,19 +56,31 @@ export function useChat() {
       console.log('[WS] ->', pb.toObject());
       ws.send(pb.serialize());
 
-      return new Promise(resolve => {
-        ws.addEventListener('message', function cb(ev) {
-          const msg = websocket.ClientboundMessage.deserialize(ev.data);
-          if (msg.payload === 'ack' && msg.ack.message_id === id) {
-            ws.removeEventListener('message', cb);
-            resolve(msg.ack.has_error ? msg.ack.error : null);
-          }
-        });
-      });
+      return new Promise(resolve => acksRef.current.set(id, resolve));
     },
     []
   );
 
+  // Sends forwards as batches, each of which takes one id per forward and is
+  // acked as a whole, in a single frame
+  const sendBatch = useCallback((forwards: websocket.Forward[]): Promise<(websocket.Ack.Error | null)[]> => {
+    const ws = wsRef.current;
+    if (!ws) return Promise.resolve(forwards.map(() => websocket.Ack.Error.SERVER_ERROR));
+
+    const acks: Promise<websocket.Ack.Error | null>[] = [];
+    for (let start = 0; start < forwards.length; start += BATCH_MAX_FORWARDS) {
+      const batch = forwards.slice(start, start + BATCH_MAX_FORWARDS);
+      const id = wsMsgIdRef.current;
+      wsMsgIdRef.current += batch.length;
+      ws.send(new websocket.ServerboundMessage({ id, batch: new websocket.Batch({ forwards: batch }) }).serialize());
+      for (let i = 0; i < batch.length; i++) {
+        acks.push(new Promise(resolve => acksRef.current.set(id + i, resolve)));
+      }
+    }
+    console.log('[WS] ->', `${forwards.length} forwards in ${Math.ceil(forwards.length / BATCH_MAX_FORWARDS)} batches`);
+    return Promise.all(acks);
+  }, []);
+
   const getKeyBundle = useCallback(async (handle: string) => {
     const keyBundle = await fetchKeyBundle(handle);
     if (keyBundle.isErr()) return keyBundle;
@@ -60,98 +90,24 @@ export function useChat() {
     throw new Error('KEY_MISMATCH');
   }, []);
 
-  const onForwardPb = useCallback(async (pb: websocket.Forward) => {
-    const { payload, session } = await recvMessage(pb);
+  const selectedContactRef = useRef(selectedContact);
+  selectedContactRef.current = selectedContact;
 
-    console.log('[WS] <-', payload.toObject());
+  const onReceiveBatch = useCallback(
+    (result: ReceiveBatchResult) => {
+      console.log('[WS] <-', `${result.received} forwarded messages`);
 
-    switch (payload.type) {
-      case 'msg_new': {
-        const msg = payload.msg_new;
-        await db.messages.add({
-          id: msg.id,
-          peer: pb.handle,
-          sender: pb.handle,
-          text: msg.has_text ? msg.text : null,
-          reply_to: msg.has_reply_to ? msg.reply_to : null,
-          timestamp: msg.timestamp,
-          last_edited_at: null,
-          status: 'seen' // by the time you'll see the indicator, the message itself has been seen
-        });
-        await db.attachments.bulkAdd(
-          msg.attachments.map(attachment => ({
-            id: attachment.id,
-            sender: pb.handle,
-            message_id: msg.id,
-            mime_type: attachment.mime_type,
-            data: attachment.data
-          }))
-        );
-        await sendMessage(
-          pb.handle,
-          new secret.Payload({
-            receipt: new secret.Receipt({
-              [pb.handle === selectedContact && document.hasFocus() ? 'seen' : 'received']: msg.id
-            })
-          }),
-          { session }
-        ).then(send);
-        break;
-      }
-
-      case 'msg_edit': {
-        const edit = payload.msg_edit;
-        await db.messages.where({ sender: pb.handle, id: edit.id }).modify(msg => {
-          msg.text = edit.has_text ? edit.text : null;
-          msg.last_edited_at = edit.timestamp;
-        });
-        await db.attachments
-          .where({ sender: pb.handle, message_id: edit.id, id: { in: edit.attachment_ids } })
-          .delete();
-        await sendMessage(
-          pb.handle,
-          new secret.Payload({
-            receipt: new secret.Receipt({
-              [pb.handle === selectedContact && document.hasFocus() ? 'seen' : 'received']: edit.id
-            })
-          }),
-          { session }
-        ).then(send);
-        break;
-      }
-
-      case 'msg_delete': {
-        const del = payload.msg_delete;
-        await db.messages.where({ sender: pb.handle, id: del.id }).delete();
-        await db.attachments.where({ sender: pb.handle, message_id: del.id }).delete();
-        break;
-      }
-
-      case 'receipt': {
-        const receipt = payload.receipt;
-        switch (receipt.type) {
-          case 'received': {
-            await db.messages.where({ peer: pb.handle, id: receipt.received }).modify(msg => {
-              msg.status = 'delivered';
-            });
-            break;
-          }
-          case 'seen': {
-            await db.messages.where({ peer: pb.handle, id: receipt.seen }).modify(msg => {
-              msg.status = 'seen';
-            });
-            break;
-          }
-        }
-        break;
-      }
+      if (result.receipts.length) sendBatch(result.receipts.map(receipt => websocket.Forward.deserialize(receipt)));
 
-      default: {
-        toast.warning(`Received payload of unknown type: ${payload.type}`);
-        break;
+      if (result.errors.length) {
+        result.errors.forEach(error => console.error(error));
+        toast.warning(
+          result.errors.length === 1 ? result.errors[0]! : `Failed to process ${result.errors.length} messages`
+        );
       }
-    }
-  }, []);
+    },
+    [sendBatch]
+  );
 
   // Initialize WebSocket connection
   useEffect(() => {
@@ -174,7 +130,19 @@ export function useChat() {
         setStatus(ok('authenticating'));
       };
 
+      const pipeline = createReceivePipeline(
+        () => (document.hasFocus() ? selectedContactRef.current : null),
+        onReceiveBatch
+      );
+
       ws.onmessage = async ev => {
+        // forwards go to the receive pipeline undecoded; the payload is a
+        // oneof, so its tag leads the frame
+        if (new Uint8Array(ev.data)[0] === FORWARD_TAG) {
+          pipeline.push(ev.data);
+          return;
+        }
+
         const msg = websocket.ClientboundMessage.deserialize(ev.data);
         switch (msg.payload) {
           case 'challenge': {
@@ -193,117 +161,127 @@ export function useChat() {
               );
               const now = Date.now();
               if (now - lastPrekeyRotation > 1000 * 60 * 60 * 24 * 7) {
-                const prekey = genCurveKeyPair();
-                const pqkemPrekey = await genPqkemKeyPair();
-                const prekeyId = await db.prekeys.add({
-                  priv: prekey.secretKey,
-                  pub: prekey.publicKey,
-                  created_at: now
-                });
-                const pqkemPrekeyId = await db.pqkem_prekeys.add({
-                  priv: pqkemPrekey.secretKey,
-                  pub: pqkemPrekey.publicKey,
-                  one_time: false,
-                  created_at: now
-                } satisfies EnhancedOmit<PqkemPreKey, 'id'> as any);
-                await patchIdentity({
-                  prekey: new messages_proto.SignedPrekey({
-                    key: prekey.publicKey,
-                    id: prekeyId,
-                    sig: xeddsa_sign(identity.priv, prekey.publicKey, randomBytes(64))
-                  }),
-                  pqkem_prekey: new messages_proto.SignedPrekey({
-                    key: pqkemPrekey.publicKey,
-                    id: pqkemPrekeyId,
-                    sig: xeddsa_sign(identity.priv, pqkemPrekey.publicKey, randomBytes(64))
-                  })
-                });
+                await patchIdentity(await genSignedPrekeys(identity.priv, now));
               }
             }
             break;
           }
-          case 'forward': {
-            onForwardPb(msg.forward);
+          case 'ack': {
+            // a batch's ack covers a range of ids, naming only the failed ones
+            const { ack } = msg;
+            const last = ack.has_last_message_id ? ack.last_message_id : ack.message_id;
+            const errors = new Map(ack.message_errors.map(e => [e.message_id, e.error]));
+            for (let id = ack.message_id; id <= last; id++) {
+              const resolve = acksRef.current.get(id);
+              acksRef.current.delete(id);
+              resolve?.(errors.get(id) ?? (ack.has_error ? ack.error : null));
+            }
             break;
           }
           case 'low_on_keys': {
             console.log('[WS] <-', 'LowOnKeys{}');
 
-            const one_time_pqkem_prekeys = await Promise.all(
-              Array.from({ length: 100 }, async () => {
-                const keyPair = await genPqkemKeyPair();
-                const sig = xeddsa_sign(identity.priv, keyPair.publicKey, randomBytes(64));
-                const id = await db.pqkem_prekeys.add({
-                  priv: keyPair.secretKey,
-                  pub: keyPair.publicKey,
-                  one_time: true
-                });
-                return new messages_proto.SignedPrekey({
-                  key: keyPair.publicKey,
-                  id,
-                  sig
-                });
-              })
-            );
-
-            const one_time_prekeys = await Promise.all(
-              Array.from({ length: 100 }, async () => {
-                const keyPair = genCurveKeyPair();
-                const id = await db.one_time_prekeys.add({
-                  priv: keyPair.secretKey,
-                  pub: keyPair.publicKey
-                });
-                return new messages_proto.Prekey({
-                  key: keyPair.publicKey,
-                  id
-                });
-              })
-            );
-
-            await patchIdentity({
-              one_time_pqkem_prekeys,
-              one_time_prekeys
-            });
+            await patchIdentity(await genOneTimePrekeys(identity.priv));
           }
         }
       };
 
       ws.onclose = () => {};
     })();
-  }, [navigate, onForwardPb]);
+  }, [navigate, onReceiveBatch]);
 
   const contacts = useLiveQuery(async () => {
-    const messages = await db.messages.toArray();
-    const peers = Array.from(new Set(messages.map(msg => msg.peer)));
-    return Promise.all(
-      peers.map(async handle => {
-        const lastMsg = (await db.messages.where({ peer: handle }).last()) ?? null;
-        if (!lastMsg) return { handle, lastMessage: null };
-        return {
-          handle,
-          lastMessage: {
-            sender: lastMsg.sender,
-            text: lastMsg.text ?? ''
-          }
-        };
+    const conversations = await db.conversations.orderBy('last_timestamp').reverse().toArray();
+    return conversations.map(
+      (conversation): Contact => ({
+        handle: conversation.peer,
+        unread: conversation.unread,
+        lastMessage: { sender: conversation.last_sender, text: conversation.preview }
       })
     );
   });
 
+  // Re-runs when messages arrive for the open conversation, and marks it read
+  // again once the page is back in view
+  const selectedUnread = contacts?.find(c => c.handle === selectedContact)?.unread ?? 0;
+  useEffect(() => {
+    if (!selectedContact) return;
+
+    const markRead = () => {
+      if (document.visibilityState === 'visible') markConversationRead(selectedContact);
+    };
+    markRead();
+    window.addEventListener('focus', markRead);
+    document.addEventListener('visibilitychange', markRead);
+    return () => {
+      window.removeEventListener('focus', markRead);
+      document.removeEventListener('visibilitychange', markRead);
+    };
+  }, [selectedContact, selectedUnread]);
+
   const contactsList = useMemo(() => {
     const list = [...(contacts ?? [])];
     if (selectedContact && !contacts?.some(c => c.handle === selectedContact)) {
-      list.push({ handle: selectedContact, lastMessage: null });
+      list.push({ handle: selectedContact, unread: 0, lastMessage: null });
     }
     return list;
   }, [contacts, selectedContact]);
 
-  const messages = useLiveQuery(async () => {
-    if (!selectedContact) return [];
-    const messages = await db.messages.where({ peer: selectedContact }).toArray();
-    return messages.sort((a, b) => a.timestamp - b.timestamp);
+  // Only messages from cursor.id on are loaded; null means the whole
+  // conversation is
+  const [cursor, setCursor] = useState<{ peer: string; id: Message['id'] | null } | null>(null);
+
+  useEffect(() => {
+    setCursor(null);
+    if (!selectedContact) return;
+
+    let cancelled = false;
+    (async () => {
+      const oldest = await conversationRange(selectedContact)
+        .reverse()
+        .offset(PAGE_SIZE - 1)
+        .first();
+      if (!cancelled) setCursor({ peer: selectedContact, id: oldest?.id ?? null });
+    })();
+    return () => {
+      cancelled = true;
+    };
   }, [selectedContact]);
 
+  const messageWindow = useLiveQuery(async () => {
+    if (!selectedContact || cursor?.peer !== selectedContact) return undefined;
+
+    const messages = await conversationRange(selectedContact, cursor.id).toArray();
+
+    // replies can point before the window
+    const loaded = new Set(messages.map(msg => msg.id));
+    const missing = [...new Set(messages.flatMap(msg => (msg.reply_to !== null ? [msg.reply_to] : [])))].filter(
+      id => !loaded.has(id)
+    );
+    const replied = missing.length
+      ? await db.messages
+          .where('[id+peer]')
+          .anyOf(missing.map(id => [id, selectedContact]))
+          .toArray()
+      : [];
+
+    return { messages, byId: new Map([...messages, ...replied].map(msg => [msg.id, msg])) };
+  }, [selectedContact, cursor]);
+
+  const hasOlderMessages = cursor?.peer === selectedContact && cursor?.id !== null;
+
+  const loadOlderMessages = useCallback(async () => {
+    if (!cursor || cursor.id === null) return;
+
+    const oldest = await db.messages
+      .where('[peer+id]')
+      .between([cursor.peer, Dexie.minKey], [cursor.peer, cursor.id], true, false)
+      .reverse()
+      .offset(PAGE_SIZE - 1)
+      .first();
+    setCursor(current => (current === cursor ? { peer: cursor.peer, id: oldest?.id ?? null } : current));
+  }, [cursor]);
+
   const sendNewMessage = useCallback(
     async (text: string, replyTo?: Message['id']) => {
       if (!selectedContact || !text.trim()) return false;
@@ -324,7 +302,7 @@ export function useChat() {
         })
       });
 
-      await db.messages.add({
+      const message = {
         id,
         peer: selectedContact,
         sender: identity.handle,
@@ -333,6 +311,10 @@ export function useChat() {
         timestamp,
         last_edited_at: null,
         status: 'pending'
+      } satisfies Message;
+      await db.transaction('rw', db.messages, db.conversations, async () => {
+        await db.messages.add(message);
+        await bumpConversation(message, false);
       });
 
       const err = await sendMessage(selectedContact, payload, { keyBundleProvider: getKeyBundle }).then(send);
@@ -357,10 +339,13 @@ export function useChat() {
       const timestamp = Date.now();
 
       const conditions = { peer: selectedContact, sender: identity.handle, id: msg.id };
-      await db.messages.where(conditions).modify(msg => {
-        msg.text = newText.trim();
-        msg.last_edited_at = timestamp;
-        msg.status = 'pending';
+      await db.transaction('rw', db.messages, db.conversations, async () => {
+        await db.messages.where(conditions).modify(msg => {
+          msg.text = newText.trim();
+          msg.last_edited_at = timestamp;
+          msg.status = 'pending';
+        });
+        await refreshConversation(selectedContact);
       });
 
       const payload = new secret.Payload({
@@ -404,7 +389,10 @@ export function useChat() {
         return false;
       }
 
-      await db.messages.where({ peer: selectedContact, sender: identity.handle, id: msg.id }).delete();
+      await db.transaction('rw', db.messages, db.conversations, async () => {
+        await db.messages.where({ peer: selectedContact, sender: identity.handle, id: msg.id }).delete();
+        await refreshConversation(selectedContact);
+      });
 
       return true;
     },
@@ -417,7 +405,10 @@ export function useChat() {
     selectedContact,
     setSelectedContact,
     contactsList,
-    messages,
+    messages: messageWindow?.messages,
+    messagesById: messageWindow?.byId,
+    hasOlderMessages,
+    loadOlderMessages,
     sendMessage: sendNewMessage,
     editMessage,
     deleteMessage
@@ -0,0 +1,17 @@
+import { batchTransferables, genKeyBatch, type KeygenRequest, type KeygenResponse } from './lib/keygen';
+
+self.addEventListener('message', async (event: MessageEvent<KeygenRequest>) => {
+  const { id, ...job } = event.data;
+
+  let response: KeygenResponse;
+  let transfer: ArrayBuffer[] = [];
+  try {
+    const keys = await genKeyBatch(job);
+    response = { id, keys };
+    transfer = batchTransferables(keys);
+  } catch (error) {
+    response = { id, error: String(error) };
+  }
+
+  self.postMessage(response, { transfer });
+});
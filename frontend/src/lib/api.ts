@@ -2,10 +2,11 @@ import { messages } from 'generated/messages';
 import { err, ok, Result } from 'neverthrow';
 import { randomBytes, xeddsa_sign } from './crypto';
 import { db, type PqkemPreKey } from './db';
-import { genInitKeyBundle } from './protocol';
+import { genCurveKeyPair } from './keygen';
+import { genKeys } from './keygen-pool';
 import { b64Encode, type EnhancedOmit } from './utils';
 
-export const API_BASE_URL = process.env.NODE_ENV === 'development' ? 'http://localhost:8000' : window.location.origin;
+export const API_BASE_URL = process.env.NODE_ENV === 'development' ? 'http://localhost:8000' : self.location.origin;
 
 export async function fetch(url: string, { method = 'GET', ...rest }: RequestInit & { body?: Uint8Array | null } = {}) {
   const identity = await db.identity.limit(1).first();
@@ -46,60 +47,88 @@ export async function fetch(url: string, { method = 'GET', ...rest }: RequestIni
 
 type LimitedRequestInit = Omit<RequestInit, 'body' | 'method'>;
 
+const ONE_TIME_PREKEY_COUNT = 100;
+
+/**
+ * Generates, signs and stores a new prekey and PQKEM prekey off the main
+ * thread, ready to be published.
+ */
+export async function genSignedPrekeys(idKey: Uint8Array, created_at: number) {
+  const prekeys: messages.SignedPrekey[] = [];
+  const pqkemPrekeys: messages.SignedPrekey[] = [];
+
+  await Promise.all([
+    genKeys({ kind: 'curve', count: 1, signingKey: idKey }, async keys => {
+      for (const key of keys) {
+        const id = await db.prekeys.add({ priv: key.secretKey, pub: key.publicKey, created_at });
+        prekeys.push(new messages.SignedPrekey({ key: key.publicKey, id, sig: key.sig! }));
+      }
+    }),
+    genKeys({ kind: 'pqkem', count: 1, signingKey: idKey }, async keys => {
+      for (const key of keys) {
+        const id = await db.pqkem_prekeys.add({
+          priv: key.secretKey,
+          pub: key.publicKey,
+          one_time: false,
+          created_at
+        } satisfies EnhancedOmit<PqkemPreKey, 'id'> as any);
+        pqkemPrekeys.push(new messages.SignedPrekey({ key: key.publicKey, id, sig: key.sig! }));
+      }
+    })
+  ]);
+
+  return { prekey: prekeys[0]!, pqkem_prekey: pqkemPrekeys[0]! };
+}
+
+/**
+ * Generates and stores count one-time prekeys and signed one-time PQKEM
+ * prekeys off the main thread, one Dexie transaction per batch.
+ */
+export async function genOneTimePrekeys(idKey: Uint8Array, count = ONE_TIME_PREKEY_COUNT) {
+  const one_time_pqkem_prekeys: messages.SignedPrekey[] = [];
+  const one_time_prekeys: messages.Prekey[] = [];
+
+  await Promise.all([
+    genKeys({ kind: 'pqkem', count, signingKey: idKey }, async keys => {
+      const ids = await db.pqkem_prekeys.bulkAdd(
+        keys.map(
+          key =>
+            ({ priv: key.secretKey, pub: key.publicKey, one_time: true }) satisfies EnhancedOmit<
+              PqkemPreKey,
+              'id'
+            > as any
+        ),
+        { allKeys: true }
+      );
+      keys.forEach((key, i) =>
+        one_time_pqkem_prekeys.push(new messages.SignedPrekey({ key: key.publicKey, id: ids[i]!, sig: key.sig! }))
+      );
+    }),
+    genKeys({ kind: 'curve', count, signingKey: null }, async keys => {
+      const ids = await db.one_time_prekeys.bulkAdd(
+        keys.map(key => ({ priv: key.secretKey, pub: key.publicKey })),
+        { allKeys: true }
+      );
+      keys.forEach((key, i) => one_time_prekeys.push(new messages.Prekey({ key: key.publicKey, id: ids[i]! })));
+    })
+  ]);
+
+  return { one_time_pqkem_prekeys, one_time_prekeys };
+}
+
 export async function registerIdentity(handle: string) {
-  const keys = await genInitKeyBundle();
-
-  const created_at = Date.now();
-  const prekeyId = await db.prekeys.add({ priv: keys.prekey.secretKey, pub: keys.prekey.publicKey, created_at });
-  const pqkemPrekeyId = await db.pqkem_prekeys.add({
-    priv: keys.pqkemPrekey.secretKey,
-    pub: keys.pqkemPrekey.publicKey,
-    one_time: false,
-    created_at
-  } satisfies EnhancedOmit<PqkemPreKey, 'id'> as any);
-  const oneTimePqkemPrekeyIds = await db.pqkem_prekeys.bulkAdd(
-    keys.oneTimePqkemPrekeys.map(
-      pqopk =>
-        ({ priv: pqopk.secretKey, pub: pqopk.publicKey, one_time: true }) satisfies EnhancedOmit<
-          PqkemPreKey,
-          'id'
-        > as any
-    ),
-    { allKeys: true }
-  );
-  const oneTimePrekeyIds = await db.one_time_prekeys.bulkAdd(
-    keys.oneTimePrekeys.map(opk => ({ priv: opk.secretKey, pub: opk.publicKey, created_at })),
-    { allKeys: true }
-  );
+  const idKey = genCurveKeyPair();
+
+  const [signedPrekeys, oneTimePrekeys] = await Promise.all([
+    genSignedPrekeys(idKey.secretKey, Date.now()),
+    genOneTimePrekeys(idKey.secretKey)
+  ]);
 
   const pb = new messages.Identity({
     handle,
-    id_key: keys.idKey.publicKey,
-    prekey: new messages.SignedPrekey({
-      key: keys.prekey.publicKey,
-      id: prekeyId,
-      sig: xeddsa_sign(keys.idKey.secretKey, keys.prekey.publicKey, randomBytes(64))
-    }),
-    pqkem_prekey: new messages.SignedPrekey({
-      key: keys.pqkemPrekey.publicKey,
-      id: pqkemPrekeyId,
-      sig: xeddsa_sign(keys.idKey.secretKey, keys.pqkemPrekey.publicKey, randomBytes(64))
-    }),
-    one_time_pqkem_prekeys: keys.oneTimePqkemPrekeys.map(
-      (pqopk, i) =>
-        new messages.SignedPrekey({
-          key: pqopk.publicKey,
-          id: oneTimePqkemPrekeyIds[i]!,
-          sig: xeddsa_sign(keys.idKey.secretKey, pqopk.publicKey, randomBytes(64))
-        })
-    ),
-    one_time_prekeys: keys.oneTimePrekeys.map(
-      (opk, i) =>
-        new messages.Prekey({
-          key: opk.publicKey,
-          id: oneTimePrekeyIds[i]!
-        })
-    )
+    id_key: idKey.publicKey,
+    ...signedPrekeys,
+    ...oneTimePrekeys
   });
 
   const buf = pb.serialize();
@@ -110,13 +139,16 @@ export async function registerIdentity(handle: string) {
   });
 
   if (!res.ok) {
-    await db.prekeys.delete(prekeyId);
-    await db.pqkem_prekeys.bulkDelete([pqkemPrekeyId, ...oneTimePqkemPrekeyIds]);
-    await db.one_time_prekeys.bulkDelete(oneTimePrekeyIds);
+    await db.prekeys.delete(signedPrekeys.prekey.id);
+    await db.pqkem_prekeys.bulkDelete([
+      signedPrekeys.pqkem_prekey.id,
+      ...oneTimePrekeys.one_time_pqkem_prekeys.map(k => k.id)
+    ]);
+    await db.one_time_prekeys.bulkDelete(oneTimePrekeys.one_time_prekeys.map(k => k.id));
     throw new Error(res.statusText);
   }
 
-  await db.identity.add({ handle, priv: keys.idKey.secretKey, pub: keys.idKey.publicKey });
+  await db.identity.add({ handle, priv: idKey.secretKey, pub: idKey.publicKey });
 }
 
 export async function patchIdentity(
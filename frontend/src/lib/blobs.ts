@@ -0,0 +1,155 @@
+import { secret } from 'generated/secret';
+import sodium from 'libsodium-wrappers';
+import { API_BASE_URL, fetch } from './api';
+import { randomBytes } from './crypto';
+
+// plaintext per encrypted chunk, each one gets its own tag
+export const BLOB_CHUNK_SIZE = 64 * 1024;
+// the server takes at most 1 MiB per request
+const REQUEST_BYTES = 1024 * 1024;
+// smaller attachments travel inside the message itself
+export const INLINE_ATTACHMENT_MAX = 64 * 1024;
+
+const TAG_BYTES = 16; // crypto_aead_xchacha20poly1305_ietf_ABYTES
+const NONCE_BYTES = 24;
+
+export interface StoredBlobRef {
+  hash: Uint8Array;
+  key: Uint8Array;
+  size: number;
+  chunk_size: number;
+}
+
+function chunkCount(size: number, chunkSize: number) {
+  return Math.max(1, Math.ceil(size / chunkSize));
+}
+
+// Chunks are numbered by their nonce, and the last one is marked in its
+// associated data, so they can't be reordered, dropped or truncated
+function chunkNonce(index: number) {
+  const nonce = new Uint8Array(NONCE_BYTES);
+  new DataView(nonce.buffer).setBigUint64(0, BigInt(index), true);
+  return nonce;
+}
+
+function chunkAD(index: number, count: number) {
+  return Uint8Array.of(index === count - 1 ? 1 : 0);
+}
+
+function toHex(bytes: Uint8Array) {
+  return Array.from(bytes, b => b.toString(16).padStart(2, '0')).join('');
+}
+
+function blobUrl(hash: Uint8Array, query = '') {
+  return `${API_BASE_URL}/api/blobs/${toHex(hash)}${query}`;
+}
+
+async function encryptBlob(data: Uint8Array, key: Uint8Array, chunkSize: number) {
+  await sodium.ready;
+  const count = chunkCount(data.length, chunkSize);
+  const ciphertext = new Uint8Array(data.length + count * TAG_BYTES);
+  for (let i = 0; i < count; i++) {
+    const plain = data.subarray(i * chunkSize, (i + 1) * chunkSize);
+    const sealed = sodium.crypto_aead_xchacha20poly1305_ietf_encrypt(
+      plain,
+      chunkAD(i, count),
+      null,
+      chunkNonce(i),
+      key
+    );
+    ciphertext.set(sealed, i * (chunkSize + TAG_BYTES));
+  }
+  return ciphertext;
+}
+
+/**
+ * Encrypts data under a fresh key and uploads it to the blob store in
+ * requests of up to 1 MiB, resuming from wherever the server says it got to.
+ * The returned reference is all a recipient needs to fetch and decrypt it.
+ */
+export async function uploadBlob(data: Uint8Array): Promise<secret.BlobRef> {
+  const key = randomBytes(32);
+  const ciphertext = await encryptBlob(data, key, BLOB_CHUNK_SIZE);
+  const hash = new Uint8Array(await crypto.subtle.digest('SHA-256', ciphertext));
+  const total = ciphertext.length;
+
+  // whole chunks per request, so a retried request never splits one
+  const step = Math.floor(REQUEST_BYTES / (BLOB_CHUNK_SIZE + TAG_BYTES)) * (BLOB_CHUNK_SIZE + TAG_BYTES);
+  let offset = 0;
+  let conflicts = 0;
+  for (;;) {
+    const body = ciphertext.subarray(offset, offset + step);
+    const res = await fetch(blobUrl(hash, `?offset=${offset}&total=${total}`), { method: 'PUT', body });
+
+    // 201 when this was the last piece, 200 when the blob was already there
+    if (res.status === 200 || res.status === 201) break;
+    if (res.status === 204) {
+      offset += body.length;
+      continue;
+    }
+    if (res.status === 409 && conflicts++ < 3) {
+      offset = Number(res.headers.get('Upload-Offset') ?? 0);
+      continue;
+    }
+    // over the sender's quota or the server's storage cap, said in the body
+    if (res.status === 507) throw new Error(`Failed to upload attachment: ${(await res.text()).trim()}`);
+    throw new Error(`Failed to upload attachment: ${res.status}`);
+  }
+
+  return new secret.BlobRef({ hash, key, size: data.length, chunk_size: BLOB_CHUNK_SIZE });
+}
+
+/**
+ * Turns a file into an attachment, inline if it is small and uploaded to the
+ * blob store otherwise.
+ */
+export async function makeAttachment(id: number, mime_type: string, data: Uint8Array) {
+  if (data.length <= INLINE_ATTACHMENT_MAX) return new secret.Attachment({ id, mime_type, data });
+  return new secret.Attachment({ id, mime_type, blob: await uploadBlob(data) });
+}
+
+/**
+ * Fetches and decrypts bytes [start, end) of the plaintext of a blob, asking
+ * for just the encrypted chunks that cover them, one request per MiB. Each
+ * request's plaintext is yielded as soon as it is decrypted, so callers
+ * never need to hold the whole blob at once.
+ */
+export async function* downloadBlobPieces(ref: StoredBlobRef, start = 0, end = ref.size): AsyncGenerator<Uint8Array> {
+  await sodium.ready;
+  const sealedSize = ref.chunk_size + TAG_BYTES;
+  const count = chunkCount(ref.size, ref.chunk_size);
+  const first = Math.floor(start / ref.chunk_size);
+  const last = Math.max(first, Math.ceil(end / ref.chunk_size) - 1);
+  const perRequest = Math.max(1, Math.floor(REQUEST_BYTES / sealedSize));
+
+  for (let from = first; from <= last; from += perRequest) {
+    const to = Math.min(last, from + perRequest - 1);
+    const rangeEnd = Math.min((to + 1) * sealedSize, ref.size + count * TAG_BYTES) - 1;
+    const res = await fetch(blobUrl(ref.hash), { headers: { Range: `bytes=${from * sealedSize}-${rangeEnd}` } });
+    if (res.status !== 206 && res.status !== 200) throw new Error(`Failed to download attachment: ${res.status}`);
+
+    // a server that ignores Range sends the whole blob
+    let sealed = new Uint8Array(await res.arrayBuffer());
+    if (res.status === 200) sealed = sealed.subarray(from * sealedSize, rangeEnd + 1);
+
+    const plaintext = new Uint8Array((to - from + 1) * ref.chunk_size);
+    let written = 0;
+    for (let i = from; i <= to; i++) {
+      const offset = (i - from) * sealedSize;
+      const plain = sodium.crypto_aead_xchacha20poly1305_ietf_decrypt(
+        null,
+        sealed.subarray(offset, offset + sealedSize),
+        chunkAD(i, count),
+        chunkNonce(i),
+        ref.key
+      );
+      plaintext.set(plain, written);
+      written += plain.length;
+    }
+
+    // trim to [start, end) at either edge
+    const base = from * ref.chunk_size;
+    const skip = Math.max(0, start - base);
+    yield plaintext.slice(skip, Math.min(written, end - base));
+  }
+}
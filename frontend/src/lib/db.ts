@@ -1,4 +1,5 @@
 import { Dexie, type EntityTable } from 'dexie';
+import type { StoredBlobRef } from './blobs';
 
 export interface IdKey {
   for: string;
@@ -59,7 +60,18 @@ export interface Attachment {
   sender: string;
   message_id: Message['id'];
   mime_type: string;
-  data: Uint8Array;
+  // null until a blob attachment has been downloaded, into a Blob
+  data: Uint8Array | Blob | null;
+  blob?: StoredBlobRef;
+}
+
+export interface Conversation {
+  peer: string;
+  last_message_id: Message['id'];
+  last_sender: string;
+  last_timestamp: number;
+  preview: string;
+  unread: number;
 }
 
 export const db = new Dexie('theDb') as Dexie & {
@@ -72,6 +84,7 @@ export const db = new Dexie('theDb') as Dexie & {
   skipped_message_keys: EntityTable<SkippedMessageKeys, 'id'>;
   messages: EntityTable<Message>;
   attachments: EntityTable<Attachment>;
+  conversations: EntityTable<Conversation, 'peer'>;
 };
 
 db.version(1).stores({
@@ -86,6 +99,64 @@ db.version(1).stores({
   attachments: '++,&[id+sender+message_id],[sender+message_id],id,sender,message_id'
 });
 
-if (process.env.NODE_ENV === 'development') {
+const PREVIEW_LENGTH = 100;
+
+function conversationFrom(msg: Message, unread: number): Conversation {
+  return {
+    peer: msg.peer,
+    last_message_id: msg.id,
+    last_sender: msg.sender,
+    last_timestamp: msg.timestamp,
+    preview: (msg.text ?? '').slice(0, PREVIEW_LENGTH),
+    unread
+  };
+}
+
+db.version(2)
+  .stores({
+    conversations: '&peer,last_timestamp'
+  })
+  .upgrade(async tx => {
+    // messages come out in insertion order, so the last one per peer wins
+    const conversations = new Map<string, Conversation>();
+    await tx.table<Message>('messages').each(msg => conversations.set(msg.peer, conversationFrom(msg, 0)));
+    await tx.table<Conversation>('conversations').bulkPut([...conversations.values()]);
+  });
+
+// [peer+id] lets a conversation be paged by message id without touching the
+// rest of the table
+db.version(3).stores({
+  messages: '++,&[id+peer],[peer+id],[id+sender],[id+peer+sender],id,peer,sender,reply_to'
+});
+
+/**
+ * Records msg as the latest message of its conversation. Call from the
+ * transaction that adds it, with db.conversations in its scope.
+ */
+export async function bumpConversation(msg: Message, unread: boolean) {
+  const current = await db.conversations.get(msg.peer);
+  await db.conversations.put(conversationFrom(msg, (current?.unread ?? 0) + (unread ? 1 : 0)));
+}
+
+/**
+ * Rebuilds peer's summary from its last message after an edit or delete,
+ * dropping the conversation once no messages are left.
+ */
+export async function refreshConversation(peer: string) {
+  const last = await db.messages.where({ peer }).last();
+  if (!last) {
+    await db.conversations.delete(peer);
+    return;
+  }
+
+  const current = await db.conversations.get(peer);
+  await db.conversations.put(conversationFrom(last, current?.unread ?? 0));
+}
+
+export async function markConversationRead(peer: string) {
+  await db.conversations.update(peer, { unread: 0 });
+}
+
+if (process.env.NODE_ENV === 'development' && typeof window !== 'undefined') {
   (window as any).db = db;
 }
@@ -0,0 +1,96 @@
+import { genKeyBatch, type GeneratedKey, type KeygenJob, type KeygenRequest, type KeygenResponse } from './keygen';
+
+const WORKER_URL = '/keygen-worker.js';
+const BATCH_SIZE = 10;
+const POOL_SIZE = Math.max(1, Math.min(4, (navigator.hardwareConcurrency || 2) - 1));
+
+interface Task {
+  request: KeygenRequest;
+  resolve: (keys: GeneratedKey[]) => void;
+  reject: (error: Error) => void;
+}
+
+let workers: Worker[] | null = null;
+let workersUnavailable = false;
+const idle: Worker[] = [];
+const queue: Task[] = [];
+const running = new Map<Worker, Task>();
+let nextId = 0;
+
+function runLocally(task: Task) {
+  genKeyBatch(task.request).then(task.resolve, task.reject);
+}
+
+// The worker script isn't there under the dev server; finish the work here
+function abandonWorkers() {
+  workersUnavailable = true;
+  for (const worker of workers ?? []) worker.terminate();
+  workers = null;
+  idle.length = 0;
+
+  const orphaned = [...running.values(), ...queue.splice(0)];
+  running.clear();
+  orphaned.forEach(runLocally);
+}
+
+function spawnWorkers() {
+  workers = [];
+  try {
+    for (let i = 0; i < POOL_SIZE; i++) {
+      const worker = new Worker(WORKER_URL, { type: 'module', name: `keygen-${i}` });
+      worker.addEventListener('message', (event: MessageEvent<KeygenResponse>) => {
+        const task = running.get(worker);
+        if (!task || task.request.id !== event.data.id) return;
+        running.delete(worker);
+        idle.push(worker);
+
+        if ('keys' in event.data) task.resolve(event.data.keys);
+        else task.reject(new Error(event.data.error));
+        dispatch();
+      });
+      worker.addEventListener('error', event => {
+        console.error('Key generation worker failed', event.message);
+        abandonWorkers();
+      });
+      workers.push(worker);
+      idle.push(worker);
+    }
+  } catch (error) {
+    console.error('Key generation workers unavailable', error);
+    abandonWorkers();
+  }
+}
+
+function dispatch() {
+  while (idle.length && queue.length) {
+    const worker = idle.pop()!;
+    const task = queue.shift()!;
+    running.set(worker, task);
+    worker.postMessage(task.request);
+  }
+}
+
+function submit(job: KeygenJob): Promise<GeneratedKey[]> {
+  return new Promise((resolve, reject) => {
+    const task = { request: { ...job, id: nextId++ }, resolve, reject };
+    if (!workers && !workersUnavailable) spawnWorkers();
+    if (workersUnavailable) return runLocally(task);
+    queue.push(task);
+    dispatch();
+  });
+}
+
+/**
+ * Generates (and signs, if job.signingKey is set) job.count key pairs across
+ * the worker pool, handing each batch to onBatch as soon as it arrives so it
+ * can be stored while the rest are still being generated. Batches arrive in
+ * no particular order.
+ */
+export async function genKeys(job: KeygenJob, onBatch: (keys: GeneratedKey[]) => Promise<void>) {
+  const batches: Promise<void>[] = [];
+  for (let offset = 0; offset < job.count; offset += BATCH_SIZE) {
+    const count = Math.min(BATCH_SIZE, job.count - offset);
+    batches.push(submit({ ...job, count }).then(onBatch));
+  }
+  await Promise.all(batches);
+}
@@ -0,0 +1,49 @@
+import { x25519 } from '@noble/curves/ed25519.js';
+import { MlKem1024 } from 'mlkem';
+import { randomBytes, xeddsa_sign } from './crypto';
+
+export const genCurveKeyPair = x25519.keygen;
+
+const kem = new MlKem1024();
+export async function genPqkemKeyPair() {
+  const [publicKey, secretKey] = await kem.generateKeyPair();
+  return { publicKey, secretKey };
+}
+
+export interface KeygenJob {
+  kind: 'curve' | 'pqkem';
+  count: number;
+  // identity key to sign each public key with, if it is a signed prekey
+  signingKey: Uint8Array | null;
+}
+
+export interface GeneratedKey {
+  publicKey: Uint8Array;
+  secretKey: Uint8Array;
+  sig: Uint8Array | null;
+}
+
+export type KeygenRequest = KeygenJob & { id: number };
+
+export type KeygenResponse = { id: number } & ({ keys: GeneratedKey[] } | { error: string });
+
+export async function genKeyBatch({ kind, count, signingKey }: KeygenJob): Promise<GeneratedKey[]> {
+  const keys: GeneratedKey[] = [];
+  for (let i = 0; i < count; i++) {
+    const { publicKey, secretKey } = kind === 'pqkem' ? await genPqkemKeyPair() : genCurveKeyPair();
+    const sig = signingKey ? xeddsa_sign(signingKey, publicKey, randomBytes(64)) : null;
+    keys.push({ publicKey, secretKey, sig });
+  }
+  return keys;
+}
+
+// Buffers backing a batch, deduplicated since transferring one twice throws
+export function batchTransferables(keys: GeneratedKey[]): ArrayBuffer[] {
+  const buffers = new Set<ArrayBuffer>();
+  for (const { publicKey, secretKey, sig } of keys) {
+    for (const array of [publicKey, secretKey, sig]) {
+      if (array && array.buffer instanceof ArrayBuffer) buffers.add(array.buffer);
+    }
+  }
+  return Array.from(buffers);
+}
@@ -10,37 +10,14 @@ import { MlKem1024 } from 'mlkem';
 import { fetchKeyBundle } from './api';
 import { xeddsa_verify } from './crypto';
 import { db, type Session } from './db';
+import { genCurveKeyPair } from './keygen';
 import { b64Encode, concat, type ResultPromise } from './utils';
 
 const PQXDH_INFO = new TextEncoder().encode('me.averi.chat_CURVE25519_SHA-512_ML-KEM-1024');
 const KDF_RK_INFO = new TextEncoder().encode('me.averi.chat_DoubleRatchet_RootKey');
 const MAX_SKIP = 1000;
 
-export const genCurveKeyPair = x25519.keygen;
-
 const kem = new MlKem1024();
-export async function genPqkemKeyPair() {
-  const [publicKey, secretKey] = await kem.generateKeyPair();
-  return { publicKey, secretKey };
-}
-
-export async function genInitKeyBundle() {
-  const idKey = genCurveKeyPair();
-  const prekey = genCurveKeyPair();
-  const pqkemPrekey = await genPqkemKeyPair();
-  const oneTimePqkemPrekeys = await Promise.all(Array.from({ length: 100 }, genPqkemKeyPair));
-  const oneTimePrekeys = Array.from({ length: 100 }, genCurveKeyPair);
-
-  return {
-    idKey,
-    prekey,
-    pqkemPrekey,
-    oneTimePqkemPrekeys,
-    oneTimePrekeys
-  };
-}
-
-export type KeyBundle = Exclude<Awaited<ReturnType<typeof genInitKeyBundle>>, 'nextId'>;
 
 export const DH = x25519.getSharedSecret;
 
@@ -255,6 +232,19 @@ export async function sendMessage(
   }
 }
 
+// A forward with a shared body carries the key to it instead of the payload
+async function openPayload(pb: websocket.Forward, plaintext: Uint8Array) {
+  if (!pb.has_body) return secret.Payload.deserialize(plaintext);
+
+  await sodium.ready;
+  const AD = new TextEncoder().encode(pb.handle);
+  const nonce = pb.body.subarray(0, 24);
+  const sealed = pb.body.subarray(24);
+  return secret.Payload.deserialize(
+    sodium.crypto_aead_xchacha20poly1305_ietf_decrypt(null, sealed, AD, nonce, plaintext)
+  );
+}
+
 export async function recvMessage(pb: websocket.Forward) {
   const identity = await db.identity.limit(1).first();
   if (!identity) {
@@ -321,14 +311,14 @@ export async function recvMessage(pb: websocket.Forward) {
 
     await db.sessions.put(session);
 
-    return { payload: secret.Payload.deserialize(plaintext), session };
+    return { payload: await openPayload(pb, plaintext), session };
   } else if (pb.payload === 'message') {
     const session = await db.sessions.where({ peer: pb.handle }).first();
     if (!session) throw new Error('No session');
     const msg = pb.message;
     const AD = encoder.encode(pb.handle + identity.handle);
     const plaintext = await decrypt(session, msg.header, msg.ciphertext, msg.nonce, AD);
-    return { payload: secret.Payload.deserialize(plaintext), session };
+    return { payload: await openPayload(pb, plaintext), session };
   } else {
     throw new Error('unknown payload');
   }
@@ -0,0 +1,80 @@
+import { processForwardBatch, type ReceiveBatch, type ReceiveBatchResult } from './receive';
+
+const WORKER_URL = '/receive-worker.js';
+const MAX_BATCH = 256;
+
+export interface ReceivePipeline {
+  push(frame: ArrayBuffer): void;
+}
+
+/**
+ * Decrypts and stores forwarded messages in a worker, keeping the main thread
+ * free while a backlog drains. Frames queue up while a batch is in flight and
+ * go out together as the next one; onBatch is called once per batch. Falls
+ * back to the main thread if the worker can't be loaded, as under the dev
+ * server.
+ */
+export function createReceivePipeline(
+  getFocusedPeer: () => string | null,
+  onBatch: (result: ReceiveBatchResult) => void
+): ReceivePipeline {
+  let worker: Worker | null = null;
+  let inflight: { batch: ReceiveBatch; resolve: (result: ReceiveBatchResult) => void } | null = null;
+  const pending: ArrayBuffer[] = [];
+  let busy = false;
+  let scheduled = false;
+
+  try {
+    worker = new Worker(WORKER_URL, { type: 'module', name: 'receive' });
+    worker.addEventListener('message', (event: MessageEvent<ReceiveBatchResult>) => {
+      const current = inflight;
+      inflight = null;
+      current?.resolve(event.data);
+    });
+    worker.addEventListener('error', event => {
+      console.error('Receive worker failed', event.message);
+      worker?.terminate();
+      worker = null;
+
+      const current = inflight;
+      inflight = null;
+      if (current) processForwardBatch(current.batch).then(current.resolve);
+    });
+  } catch (error) {
+    console.error('Receive worker unavailable', error);
+    worker = null;
+  }
+
+  function process(batch: ReceiveBatch): Promise<ReceiveBatchResult> {
+    if (!worker) return processForwardBatch(batch);
+    return new Promise(resolve => {
+      inflight = { batch, resolve };
+      // copied rather than transferred, so it can be rerun here if the worker fails
+      worker!.postMessage(batch);
+    });
+  }
+
+  function flush() {
+    scheduled = false;
+    if (busy || !pending.length) return;
+
+    const frames = pending.splice(0, MAX_BATCH);
+    busy = true;
+    process({ frames, focusedPeer: getFocusedPeer() })
+      .then(onBatch)
+      .finally(() => {
+        busy = false;
+        flush();
+      });
+  }
+
+  return {
+    push(frame) {
+      pending.push(frame);
+      if (!busy && !scheduled) {
+        scheduled = true;
+        setTimeout(flush, 0);
+      }
+    }
+  };
+}
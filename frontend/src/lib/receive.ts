@@ -0,0 +1,203 @@
+import { secret } from 'generated/secret';
+import { websocket } from 'generated/websocket';
+import sodium from 'libsodium-wrappers';
+import { bumpConversation, db, refreshConversation, type Message } from './db';
+import { recvMessage, sendMessage } from './protocol';
+
+export interface ReceiveBatch {
+  // raw ClientboundMessage frames carrying a Forward, in arrival order
+  frames: ArrayBuffer[];
+  // the conversation the user is looking at, whose messages get 'seen' receipts
+  focusedPeer: string | null;
+}
+
+export interface ReceiveBatchResult {
+  received: number;
+  // serialized websocket.Forward receipts, ready to send in order
+  receipts: Uint8Array[];
+  errors: string[];
+}
+
+// Returns the receipt to send back for pb, if it needs one
+async function applyForward(pb: websocket.Forward, focusedPeer: string | null, result: ReceiveBatchResult) {
+  const { payload, session } = await recvMessage(pb);
+  let reply: secret.Receipt | null = null;
+
+  switch (payload.type) {
+    case 'msg_new': {
+      const msg = payload.msg_new;
+      const message = {
+        id: msg.id,
+        peer: pb.handle,
+        sender: pb.handle,
+        text: msg.has_text ? msg.text : null,
+        reply_to: msg.has_reply_to ? msg.reply_to : null,
+        timestamp: msg.timestamp,
+        last_edited_at: null,
+        status: 'seen' // by the time you'll see the indicator, the message itself has been seen
+      } satisfies Message;
+      await db.messages.add(message);
+      await bumpConversation(message, pb.handle !== focusedPeer);
+      await db.attachments.bulkAdd(
+        msg.attachments.map(attachment => ({
+          id: attachment.id,
+          sender: pb.handle,
+          message_id: msg.id,
+          mime_type: attachment.mime_type,
+          data: attachment.has_data ? attachment.data : null,
+          // fetched from the blob store when it's first shown
+          blob: attachment.has_blob
+            ? {
+                hash: attachment.blob.hash,
+                key: attachment.blob.key,
+                size: attachment.blob.size,
+                chunk_size: attachment.blob.chunk_size
+              }
+            : undefined
+        }))
+      );
+      reply = new secret.Receipt({ [pb.handle === focusedPeer ? 'seen' : 'received']: msg.id });
+      break;
+    }
+
+    case 'msg_edit': {
+      const edit = payload.msg_edit;
+      await db.messages.where({ sender: pb.handle, id: edit.id }).modify(msg => {
+        msg.text = edit.has_text ? edit.text : null;
+        msg.last_edited_at = edit.timestamp;
+      });
+      await db.attachments
+        .where({ sender: pb.handle, message_id: edit.id, id: { in: edit.attachment_ids } })
+        .delete();
+      await refreshConversation(pb.handle);
+      reply = new secret.Receipt({ [pb.handle === focusedPeer ? 'seen' : 'received']: edit.id });
+      break;
+    }
+
+    case 'msg_delete': {
+      const del = payload.msg_delete;
+      await db.messages.where({ sender: pb.handle, id: del.id }).delete();
+      await db.attachments.where({ sender: pb.handle, message_id: del.id }).delete();
+      await refreshConversation(pb.handle);
+      break;
+    }
+
+    case 'receipt': {
+      const receipt = payload.receipt;
+      switch (receipt.type) {
+        case 'received': {
+          await db.messages.where({ peer: pb.handle, id: receipt.received }).modify(msg => {
+            msg.status = 'delivered';
+          });
+          break;
+        }
+        case 'seen': {
+          await db.messages.where({ peer: pb.handle, id: receipt.seen }).modify(msg => {
+            msg.status = 'seen';
+          });
+          break;
+        }
+      }
+      break;
+    }
+
+    default: {
+      result.errors.push(`Received payload of unknown type: ${payload.type}`);
+      break;
+    }
+  }
+
+  let forward: websocket.Forward | null = null;
+  if (reply) {
+    ({ forward } = await sendMessage(pb.handle, new secret.Payload({ receipt: reply }), { session }));
+  }
+  await db.sessions.put(session);
+  return forward;
+}
+
+const RECEIVE_TABLES = [
+  db.identity,
+  db.prekeys,
+  db.pqkem_prekeys,
+  db.one_time_prekeys,
+  db.sessions,
+  db.skipped_message_keys,
+  db.messages,
+  db.attachments,
+  db.conversations
+];
+
+type Failure = { index: number; error: unknown };
+
+// Applies pbs in one transaction. If one of them throws, the whole transaction
+// is aborted and the failure says which one it was
+async function applyAll(pbs: websocket.Forward[], focusedPeer: string | null) {
+  const applied: ReceiveBatchResult = { received: 0, receipts: [], errors: [] };
+  let failure: Failure | null = null;
+
+  try {
+    await db.transaction('rw', RECEIVE_TABLES, async () => {
+      for (const [index, pb] of pbs.entries()) {
+        try {
+          const receipt = await applyForward(pb, focusedPeer, applied);
+          if (receipt) applied.receipts.push(receipt.serialize());
+          applied.received++;
+        } catch (error) {
+          failure = { index, error };
+          throw error;
+        }
+      }
+    });
+  } catch (error) {
+    // the commit itself failed, so there's no telling which frame it was:
+    // split the range and let the caller narrow it down
+    failure ??= { index: pbs.length > 1 ? Math.floor(pbs.length / 2) : 0, error };
+  }
+
+  return { applied, failure: failure as Failure | null };
+}
+
+/**
+ * Decrypts a batch of forwarded messages and applies them in arrival order,
+ * so each session's messages stay in order. Messages, attachments,
+ * conversation summaries and ratchet state are committed in one transaction
+ * for the whole batch. Safe to run in a worker.
+ *
+ * IndexedDB can't roll back part of a transaction, so when frame k throws the
+ * transaction is aborted, frames before k are replayed in a transaction of
+ * their own, and the rest carries on from k + 1. Ratchet state is only
+ * written inside the transaction, so the replay decrypts the same way. A
+ * frame that fails is reported in errors, gets no receipt, and doesn't affect
+ * the rest.
+ */
+export async function processForwardBatch({ frames, focusedPeer }: ReceiveBatch): Promise<ReceiveBatchResult> {
+  const result: ReceiveBatchResult = { received: 0, receipts: [], errors: [] };
+  const pbs = frames.map(frame => websocket.ClientboundMessage.deserialize(new Uint8Array(frame)).forward);
+
+  // anything awaited inside a transaction other than IndexedDB would let it
+  // commit early, so libsodium has to be loaded beforehand
+  await sodium.ready;
+
+  let start = 0;
+  let end = pbs.length;
+  while (start < pbs.length) {
+    const { applied, failure } = await applyAll(pbs.slice(start, end), focusedPeer);
+
+    if (!failure) {
+      result.received += applied.received;
+      result.receipts.push(...applied.receipts);
+      result.errors.push(...applied.errors);
+      start = end;
+      end = pbs.length;
+    } else if (failure.index === 0) {
+      result.errors.push(`Failed to process message from ${pbs[start]!.handle}: ${failure.error}`);
+      start++;
+      end = pbs.length;
+    } else {
+      // replay the frames before the failing one
+      end = start + failure.index;
+    }
+  }
+
+  return result;
+}
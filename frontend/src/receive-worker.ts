@@ -0,0 +1,7 @@
+import { processForwardBatch, type ReceiveBatch } from './lib/receive';
+
+// the pipeline only ever has one batch in flight, so they can't interleave
+self.addEventListener('message', async (event: MessageEvent<ReceiveBatch>) => {
+  const result = await processForwardBatch(event.data);
+  self.postMessage(result, { transfer: result.receipts.map(receipt => receipt.buffer as ArrayBuffer) });
+});
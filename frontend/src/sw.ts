@@ -1,6 +1,15 @@
 declare const PUBLIC_KEY: string;
 
+const MANIFEST_PATH = '/asset-manifest.txt';
+const CACHE_PREFIX = 'verified-';
+
+interface Manifest {
+  version: string;
+  hashes: Map<string, string>;
+}
+
 let cachedCryptoKey: CryptoKey | null = null;
+let manifest: Promise<Manifest> | null = null;
 
 async function getPublicKey(): Promise<CryptoKey> {
   if (cachedCryptoKey) return cachedCryptoKey;
@@ -18,49 +27,116 @@ async function getPublicKey(): Promise<CryptoKey> {
   return cachedCryptoKey;
 }
 
-async function verifySignature(data: ArrayBuffer, signature: ArrayBuffer): Promise<boolean> {
+async function verifySignature(data: BufferSource, signature: BufferSource): Promise<boolean> {
   const publicKey = await getPublicKey();
   return crypto.subtle.verify('RSASSA-PKCS1-v1_5', publicKey, signature, data);
 }
 
-async function fetchWithSignatureVerification(request: Request): Promise<Response> {
+async function sha256Hex(data: BufferSource): Promise<string> {
+  const digest = new Uint8Array(await crypto.subtle.digest('SHA-256', data));
+  return Array.from(digest, b => b.toString(16).padStart(2, '0')).join('');
+}
+
+/**
+ * Fetches the manifest, revalidating it with the server. Its RSA signature is
+ * only checked the first time a version is seen: the per-version cache is
+ * created once verification succeeds, so its existence marks the version as
+ * trusted and warm starts only hash the manifest.
+ */
+async function loadManifest(): Promise<Manifest> {
+  const response = await fetch(MANIFEST_PATH, { cache: 'no-cache' });
+  if (!response.ok) throw new Error(`Failed to fetch asset manifest: ${response.status}`);
+
+  const text = await response.text();
+  const newline = text.indexOf('\n');
+  if (newline === -1) throw new Error('Malformed asset manifest');
+
+  const body = new TextEncoder().encode(text.slice(newline + 1));
+  const version = await sha256Hex(body);
+  const cacheName = CACHE_PREFIX + version;
+
+  if (!(await caches.has(cacheName))) {
+    const signature = Uint8Array.from(atob(text.slice(0, newline)), c => c.charCodeAt(0));
+    if (!(await verifySignature(body, signature))) throw new Error('Invalid asset manifest signature');
+
+    await caches.open(cacheName);
+    for (const name of await caches.keys()) {
+      if (name.startsWith(CACHE_PREFIX) && name !== cacheName) await caches.delete(name);
+    }
+  }
+
+  const hashes = new Map<string, string>();
+  for (const line of text.slice(newline + 1).split('\n')) {
+    const [hash, path] = line.split('  ');
+    if (hash && path) hashes.set(path, hash);
+  }
+
+  return { version, hashes };
+}
+
+function getManifest(refresh: boolean): Promise<Manifest> {
+  if (refresh || !manifest) {
+    const pending = loadManifest();
+    manifest = pending;
+    // a newer load may have replaced this one by the time it fails
+    pending.catch(() => {
+      if (manifest === pending) manifest = null;
+    });
+  }
+  return manifest;
+}
+
+async function fetchWithHashVerification(request: Request): Promise<Response> {
   const url = new URL(request.url);
 
   if (
-    url.pathname.endsWith('.sig') ||
+    url.pathname === MANIFEST_PATH ||
     url.pathname.endsWith('.map') ||
     url.pathname.startsWith('/api/') ||
-    url.origin !== self.location.origin
+    url.origin !== self.location.origin ||
+    request.method !== 'GET'
   ) {
     return fetch(request);
   }
 
   const lastSegment = url.pathname.split('/').pop() || '';
   const hasExtension = lastSegment.includes('.');
-  const sigUrl = hasExtension ? `${request.url}.sig` : `${url.origin}/index.html.sig`;
-
-  const [assetResponse, sigResponse] = await Promise.all([fetch(request), fetch(sigUrl).catch(() => null)]);
+  const path = hasExtension ? url.pathname : '/index.html';
+
+  // navigations pick up new deployments; a path the manifest doesn't know
+  // may belong to one that happened since it was fetched
+  let current: Manifest;
+  try {
+    current = await getManifest(request.mode === 'navigate');
+    if (!current.hashes.has(path)) current = await getManifest(true);
+  } catch (error) {
+    console.error(error);
+    return new Response('Asset manifest unavailable', { status: 403 });
+  }
 
-  if (!sigResponse || !sigResponse.ok) {
-    console.error(`No signature found for ${url.pathname}`);
-    return new Response(`No signature found for ${url.pathname}`, { status: 403 });
+  const expected = current.hashes.get(path);
+  if (!expected) {
+    console.error(`${path} is not in the asset manifest`);
+    return new Response(`${path} is not in the asset manifest`, { status: 403 });
   }
 
-  const [assetData, signatureData] = await Promise.all([
-    assetResponse.clone().arrayBuffer(),
-    sigResponse.arrayBuffer()
-  ]);
+  const cache = await caches.open(CACHE_PREFIX + current.version);
+  const cached = await cache.match(path, { ignoreVary: true });
+  if (cached) return cached;
 
-  const isValid = await verifySignature(assetData, signatureData);
+  const assetResponse = await fetch(request);
+  if (!assetResponse.ok) return assetResponse;
 
-  if (!isValid) {
-    console.error(`Invalid signature for ${url.pathname}`);
-    return new Response(`Invalid signature for ${url.pathname}`, { status: 403 });
+  const actual = await sha256Hex(await assetResponse.clone().arrayBuffer());
+  if (actual !== expected) {
+    console.error(`Hash mismatch for ${url.pathname}`);
+    return new Response(`Hash mismatch for ${url.pathname}`, { status: 403 });
   }
 
+  await cache.put(path, assetResponse.clone());
   return assetResponse;
 }
 
 self.addEventListener('fetch', (event: FetchEvent) => {
-  event.respondWith(fetchWithSignatureVerification(event.request));
+  event.respondWith(fetchWithHashVerification(event.request));
 });
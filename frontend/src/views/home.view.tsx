@@ -4,10 +4,13 @@ import { MessageBubble } from '~/components/message-bubble';
 import { MessageInput, type MessageInputHandle } from '~/components/message-input';
 import NewConversationModal from '~/components/new-conversation-modal';
 import { Button } from '~/components/ui/button';
+import { VirtualList, type VirtualListHandle } from '~/components/virtual-list';
 import { useChat } from '~/hooks/use-chat';
 import type { Message } from '~/lib/db';
 import { cn } from '~/lib/utils';
 
+const getMessageKey = (msg: Message) => msg.id;
+
 // Hook to detect mobile viewport
 function useIsMobile(breakpoint = 768) {
   const [isMobile, setIsMobile] = useState(() =>
@@ -33,6 +36,9 @@ export function HomeView() {
     setSelectedContact,
     contactsList,
     messages,
+    messagesById,
+    hasOlderMessages,
+    loadOlderMessages,
     sendMessage,
     editMessage,
     deleteMessage
@@ -44,26 +50,39 @@ export function HomeView() {
   const [replyingTo, setReplyingTo] = useState<Message | null>(null);
   const [highlightedMsgId, setHighlightedMsgId] = useState<Message['id'] | null>(null);
 
-  const messagesContainerRef = useRef<HTMLDivElement>(null);
+  const messageListRef = useRef<VirtualListHandle>(null);
   const inputRef = useRef<MessageInputHandle>(null);
 
   const scrollToMessage = useCallback((targetId: Message['id']) => {
-    const container = messagesContainerRef.current;
-    if (!container) return;
-
-    const el = container.querySelector(`[data-msg-id="${targetId}"]`);
-    if (el) {
-      el.scrollIntoView({ behavior: 'smooth', block: 'center' });
+    if (messageListRef.current?.scrollToKey(targetId)) {
       setHighlightedMsgId(targetId);
       setTimeout(() => setHighlightedMsgId(null), 1500);
     }
   }, []);
 
-  const findMessageById = useCallback(
-    (id: Message['id']): Message | undefined => {
-      return messages?.find(m => m.id === id);
-    },
-    [messages]
+  const handleReply = useCallback((msg: Message) => {
+    setReplyingTo(msg);
+    inputRef.current?.focus();
+  }, []);
+
+  const onReachTop = useCallback(() => {
+    if (hasOlderMessages) loadOlderMessages();
+  }, [hasOlderMessages, loadOlderMessages]);
+
+  const renderMessage = useCallback(
+    (msg: Message) => (
+      <MessageBubble
+        message={msg}
+        isOwn={msg.sender === identity.handle}
+        isHighlighted={highlightedMsgId === msg.id}
+        repliedMessage={msg.reply_to !== null ? (messagesById?.get(msg.reply_to) ?? null) : null}
+        onReply={() => handleReply(msg)}
+        onEdit={newText => editMessage(msg, newText)}
+        onDelete={() => deleteMessage(msg)}
+        onScrollToReply={() => msg.reply_to !== null && scrollToMessage(msg.reply_to)}
+      />
+    ),
+    [identity, highlightedMsgId, messagesById, handleReply, editMessage, deleteMessage, scrollToMessage]
   );
 
   const handleStartConversation = useCallback(
@@ -96,11 +115,6 @@ export function HomeView() {
     [sendMessage]
   );
 
-  const handleReply = useCallback((msg: Message) => {
-    setReplyingTo(msg);
-    inputRef.current?.focus();
-  }, []);
-
   // Loading/error state
   if (status !== null) {
     if (!status) return null;
@@ -184,6 +198,11 @@ export function HomeView() {
                     <span className="block truncate text-sm font-medium">{contact.handle}</span>
                     <p className="text-muted-foreground truncate text-xs">{contact.lastMessage?.text}</p>
                   </div>
+                  {contact.unread > 0 && (
+                    <span className="bg-primary text-primary-foreground shrink-0 rounded-full px-1.5 text-xs font-medium">
+                      {contact.unread}
+                    </span>
+                  )}
                 </button>
               ))
             )}
@@ -211,7 +230,7 @@ export function HomeView() {
             )}
           </header>
 
-          <div ref={messagesContainerRef} className="flex-1 overflow-y-auto px-2 py-3 sm:p-4">
+          <div className="flex min-h-0 flex-1 flex-col">
             {!selectedContact ? (
               <div className="text-muted-foreground flex h-full items-center justify-center px-4 text-center text-sm">
                 Select a contact to start chatting
@@ -221,21 +240,18 @@ export function HomeView() {
                 No messages yet. Say hello!
               </div>
             ) : (
-              <div className="mx-auto max-w-2xl space-y-2 sm:space-y-3">
-                {messages?.map(msg => (
-                  <MessageBubble
-                    key={msg.id}
-                    message={msg}
-                    isOwn={msg.sender === identity.handle}
-                    isHighlighted={highlightedMsgId === msg.id}
-                    repliedMessage={msg.reply_to ? (findMessageById(msg.reply_to) ?? null) : null}
-                    onReply={() => handleReply(msg)}
-                    onEdit={newText => editMessage(msg, newText)}
-                    onDelete={() => deleteMessage(msg)}
-                    onScrollToReply={() => msg.reply_to && scrollToMessage(msg.reply_to)}
-                  />
-                ))}
-              </div>
+              <VirtualList
+                key={selectedContact}
+                ref={messageListRef}
+                items={messages ?? []}
+                getKey={getMessageKey}
+                renderItem={renderMessage}
+                estimateHeight={64}
+                gap={12}
+                onReachTop={onReachTop}
+                className="flex-1 px-2 py-3 sm:p-4"
+                innerClassName="mx-auto max-w-2xl"
+              />
             )}
           </div>
 
@@ -17,3 +17,5 @@ rm -rf "$BUILD_DIR/public"
 bun run build
 
 "$SCRIPT_DIR/sign-assets.sh"
+
+"$SCRIPT_DIR/compress-assets.sh"
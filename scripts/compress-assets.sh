@@ -0,0 +1,21 @@
+#!/bin/bash
+set -e
+
+SCRIPT_DIR="$(dirname "$0")"
+BUILD_DIR="$SCRIPT_DIR/../build"
+PUBLIC_DIR="$BUILD_DIR/public"
+
+# the server picks these up next to each file and serves them by
+# Accept-Encoding; already compressed formats gain nothing
+for file in "$PUBLIC_DIR"/*; do
+  case "$file" in
+    *.gz | *.br | *.sig | *.png | *.jpg | *.jpeg | *.gif | *.webp | *.woff | *.woff2) continue ;;
+  esac
+  [ -f "$file" ] || continue
+
+  gzip -9 -n -k -f "$file"
+  if command -v brotli > /dev/null; then
+    brotli -q 11 -k -f "$file"
+  fi
+  echo "Compressed $file"
+done
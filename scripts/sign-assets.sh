@@ -5,6 +5,7 @@ SCRIPT_DIR="$(dirname "$0")"
 PROJECT_DIR="$SCRIPT_DIR/../"
 BUILD_DIR="$SCRIPT_DIR/../build"
 PUBLIC_DIR="$BUILD_DIR/public"
+MANIFEST="$PUBLIC_DIR/asset-manifest.txt"
 
 mkdir -p "$PUBLIC_DIR"
 
@@ -13,9 +14,29 @@ if [ ! -f "$PROJECT_DIR/private.pem" ] || [ ! -f "$PROJECT_DIR/public.pem" ]; th
   "$SCRIPT_DIR/gen-sig-keys.sh"
 fi
 
+# left over from builds that signed every file
+rm -f "$PUBLIC_DIR"/*.sig
+
+# one "<sha256>  /<path>" line per asset, signed as a whole; the service
+# worker checks the signature once and then only hashes what it fetches
+body="$(mktemp)"
+trap 'rm -f "$body"' EXIT
+
 for file in "$PUBLIC_DIR"/*; do
-  if [ -f "$file" ] && [ "$(basename "$file")" != "public.pem" ] && [[ "$file" != *.map ]] && [[ "$file" != *.sig ]]; then
-    openssl dgst -sha256 -sign "$PROJECT_DIR/private.pem" -out "$file.sig" "$file"
-    echo "Signed $file"
-  fi
+  name="$(basename "$file")"
+  case "$name" in
+    public.pem | asset-manifest.txt | *.map | *.gz | *.br) continue ;;
+  esac
+  [ -f "$file" ] || continue
+
+  printf '%s  /%s\n' "$(openssl dgst -sha256 -r "$file" | cut -d' ' -f1)" "$name" >> "$body"
 done
+
+# the first line is the base64 signature of everything after it
+{
+  openssl dgst -sha256 -sign "$PROJECT_DIR/private.pem" "$body" | openssl base64 -A
+  echo
+  cat "$body"
+} > "$MANIFEST"
+
+echo "Signed $(wc -l < "$body") assets into $MANIFEST"